@@ -0,0 +1,90 @@
+/**
+ * @file UMAlignedAllocator.h
+ * aligned allocator for std containers
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <limits>
+#ifdef _MSC_VER
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+namespace burger
+{
+
+/**
+ * allocator which aligns memory to Alignment bytes.
+ * used for node arrays which are loaded by SIMD instructions.
+ */
+template <class T, std::size_t Alignment>
+class UMAlignedAllocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template <class U>
+	struct rebind { typedef UMAlignedAllocator<U, Alignment> other; };
+
+	UMAlignedAllocator() {}
+	UMAlignedAllocator(const UMAlignedAllocator&) {}
+	template <class U>
+	UMAlignedAllocator(const UMAlignedAllocator<U, Alignment>&) {}
+	~UMAlignedAllocator() {}
+
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+
+	pointer allocate(size_type n, const void* = 0)
+	{
+		if (n == 0) return NULL;
+		if (n > max_size()) throw std::bad_alloc();
+		void* p = NULL;
+#ifdef _MSC_VER
+		p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) p = NULL;
+#endif
+		if (!p) throw std::bad_alloc();
+		return static_cast<pointer>(p);
+	}
+
+	void deallocate(pointer p, size_type)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	size_type max_size() const
+	{
+		return (std::numeric_limits<size_type>::max)() / sizeof(T);
+	}
+
+	void construct(pointer p, const T& value) { new(static_cast<void*>(p)) T(value); }
+	void destroy(pointer p) { p->~T(); }
+
+	template <class U>
+	bool operator==(const UMAlignedAllocator<U, Alignment>&) const { return true; }
+	template <class U>
+	bool operator!=(const UMAlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+} // burger
@@ -79,11 +79,33 @@ bool UMBox::intersects(const UMRay& ray, UMShaderParameter& parameter) const
 			if (tmin > tmax) return false;
 		}
 	}
-	parameter.distance = tmin;
-	parameter.intersect_point = org + dir * parameter.distance;
+	UMHit hit;
+	hit.set(this, 0, tmin, 0.0, 0.0);
+	shade_hit(ray, hit, parameter);
+	return true;
+}
+
+/**
+ * ray AABB intersection without shading
+ */
+bool UMBox::intersects(const UMRay& ray, UMHit& hit) const
+{
+	UMShaderParameter parameter;
+	if (!intersects(ray, parameter)) return false;
+	if (parameter.distance >= hit.distance) return false;
+	hit.set(this, 0, parameter.distance, 0.0, 0.0);
+	return true;
+}
+
+/**
+ * set shading parameters of a hit
+ */
+void UMBox::shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& parameter) const
+{
+	parameter.distance = hit.distance;
+	parameter.intersect_point = ray.origin() + ray.direction() * hit.distance;
 	parameter.normal = normal(parameter.intersect_point);
 	parameter.color = UMVec3d(0.7, 0.7, 0.7);
-	return true;
 }
 
 /**
@@ -223,6 +245,7 @@ UMMeshPtr UMBox::convert_to_mesh() const
 	UMMaterialPtr mat = UMMaterial::default_material();
 	mat->set_polygon_count(static_cast<int>(mesh->face_list().size()));
 	mesh->mutable_material_list().push_back(mat);
+	mesh->create_material_index_list();
 	mesh->create_normals(true);
 	return mesh;
 }
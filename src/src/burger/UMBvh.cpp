@@ -9,19 +9,32 @@
  *
  */
 #include "UMBvh.h"
+#include "UMBvhQuad.h"
+#include "UMBvhOct.h"
+#include "UMBvhCompressed.h"
 #include <algorithm>
+#include <limits>
+#include <ctime>
 #include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "UMMath.h"
 #include "UMScene.h"
 #include "UMBox.h"
 #include "UMRay.h"
 #include "UMShaderParameter.h"
+#include "UMTriangle.h"
+#include "UMMesh.h"
 
 namespace burger
 {
 
-/**s
- * bvh node
+class UMBvhNode;
+typedef std::shared_ptr<UMBvhNode> UMBvhNodePtr;
+
+/**
+ * bvh node used while building
  */
 class UMBvhNode
 {
@@ -30,27 +43,26 @@ public:
 		: axis_(0),
 		start_index_(0),
 		end_index_(0),
-		flat_index_(0)
+		cost_(0.0)
 	{}
 
-	void init_as_leaf(const UMBox& box, int start_index, int end_index)
+	void init_as_leaf(const UMVec3d& minimum, const UMVec3d& maximum, int start_index, int end_index)
 	{
-		box_.set_minimum(box.minimum());
-		box_.set_maximum(box.maximum());
+		box_.set_minimum(minimum);
+		box_.set_maximum(maximum);
 		start_index_ = start_index;
 		end_index_ = end_index;
 	}
 
-	void init_as_branch(UMBvhNodePtr left, UMBvhNodePtr right, int axis)
+	void init_as_branch(const UMVec3d& minimum, const UMVec3d& maximum, UMBvhNodePtr left, UMBvhNodePtr right, int axis)
 	{
 		axis_ = axis;
 		start_index_ = 0;
 		end_index_ = 0;
 		left_ = left;
 		right_ = right;
-		box_.init();
-		box_.extend(left->box_);
-		box_.extend(right->box_);
+		box_.set_minimum(minimum);
+		box_.set_maximum(maximum);
 	}
 
 	bool is_leaf() const { return end_index_ > start_index_; }
@@ -61,8 +73,8 @@ public:
 	int axis_;
 	int start_index_;
 	int end_index_;
-	// ordered index in flatten
-	int flat_index_;
+	// SAH cost of subtree. used by treelet optimization
+	double cost_;
 };
 
 }// burger
@@ -71,6 +83,42 @@ namespace
 {
 	using namespace burger;
 
+	/// bins per axis for binned SAH
+	const int bin_count = 16;
+
+	/// primitives in a leaf at most (unless they can not be split)
+	const int max_leaf_primitive_count = 8;
+
+	/// deeper nodes are split at the object median to bound the depth
+	const int max_sah_depth = 48;
+
+	/// ranges larger than this are binned by all threads
+	const int parallel_range_threshold = 64 * 1024;
+
+	/// primitives per chunk of parallel binning
+	const int range_chunk_size = 16 * 1024;
+
+	/// subtrees smaller than this are not divided into more tasks
+	const int minimum_task_primitive_count = 1024;
+
+	/// spatial split is tried if overlap of object split children is larger than this ratio of root area
+	const double spatial_split_alpha = 1.0e-5;
+
+	/// primitives in a leaf of linear bvh at most
+	const int linear_leaf_primitive_count = 1;
+
+	/// bits of a radix sort pass
+	const int radix_bit_count = 8;
+
+	/// buckets of a radix sort pass
+	const int radix_bucket_count = 1 << radix_bit_count;
+
+	/// leaves of a treelet restructured by treelet optimization
+	const int treelet_leaf_count = 5;
+
+	/// subtrees under this depth are restructured by a thread
+	const int treelet_task_depth = 6;
+
 	/**
 	 * SAH const function
 	 * @param [in] area area of target prims' AABB
@@ -84,7 +132,7 @@ namespace
 		double area,
 		double parted_area1,
 		unsigned int parted_primitive_count1,
-		double parted_area2, 
+		double parted_area2,
 		unsigned int parted_primitive_count2)
 	{
 		double inv_area = 1.0 / area;
@@ -94,300 +142,1877 @@ namespace
 	}
 
 	/**
-	 * primitive comparator
+	 * wall clock seconds
+	 */
+	double current_seconds()
+	{
+#ifdef _OPENMP
+		return omp_get_wtime();
+#else
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+	}
+
+	/**
+	 * copyable AABB for building
+	 */
+	struct Bounds
+	{
+		Bounds() { init(); }
+
+		void init() {
+			minimum = UMVec3d(  (std::numeric_limits<double>::infinity)() );
+			maximum = UMVec3d( -(std::numeric_limits<double>::infinity)() );
+		}
+
+		void extend(const UMVec3d& p) {
+			minimum.x = std::min(minimum.x, p.x);
+			minimum.y = std::min(minimum.y, p.y);
+			minimum.z = std::min(minimum.z, p.z);
+			maximum.x = std::max(maximum.x, p.x);
+			maximum.y = std::max(maximum.y, p.y);
+			maximum.z = std::max(maximum.z, p.z);
+		}
+
+		void extend(const Bounds& b) {
+			minimum.x = std::min(minimum.x, b.minimum.x);
+			minimum.y = std::min(minimum.y, b.minimum.y);
+			minimum.z = std::min(minimum.z, b.minimum.z);
+			maximum.x = std::max(maximum.x, b.maximum.x);
+			maximum.y = std::max(maximum.y, b.maximum.y);
+			maximum.z = std::max(maximum.z, b.maximum.z);
+		}
+
+		double area() const {
+			if (minimum.x > maximum.x) return 0.0;
+			UMVec3d d = maximum - minimum;
+			return 2.0 * (d.x * d.y + d.x * d.z + d.y * d.z);
+		}
+
+		UMVec3d minimum;
+		UMVec3d maximum;
+	};
+
+	/**
+	 * precomputed primitive bounds and centroid.
+	 * the builder works on these instead of calling UMPrimitive::box().
+	 */
+	struct BuildPrimitive
+	{
+		Bounds bounds;
+		UMVec3d centroid;
+		int index;
+	};
+	typedef std::vector<BuildPrimitive> BuildPrimitiveList;
+
+	/**
+	 * a subtree which is built by a thread
+	 */
+	struct BuildTask
+	{
+		BuildTask(UMBvhNode* node_, int start_, int end_, int depth_)
+			: node(node_), start(start_), end(end_), depth(depth_) {}
+		UMBvhNode* node;
+		int start;
+		int end;
+		int depth;
+	};
+	typedef std::vector<BuildTask> BuildTaskList;
+
+	/**
+	 * task comparator
+	 */
+	struct larger_task {
+		bool operator() (const BuildTask& a, const BuildTask& b) const {
+			return (a.end - a.start) > (b.end - b.start);
+		}
+	};
+
+	/**
+	 * build context
+	 */
+	struct BuildContext
+	{
+		BuildContext(BuildPrimitiveList& primitives_, UMBvh::BuildMethod method_)
+			: primitives(primitives_),
+			method(method_),
+			tasks(NULL),
+			task_primitive_count(0)
+		{}
+		BuildPrimitiveList& primitives;
+		UMBvh::BuildMethod method;
+		// subtrees smaller than task_primitive_count are stored to tasks when tasks exists.
+		BuildTaskList* tasks;
+		int task_primitive_count;
+	};
+
+	/**
+	 * primitive comparator
+	 */
+	struct before_middle {
+		before_middle(int axis_, double middle_)
+			: axis(axis_),
+			middle(middle_)
+		{}
+		int axis;
+		double middle;
+		bool operator() (const BuildPrimitive& a) const {
+			return a.centroid[axis] < middle;
+		}
+	};
+
+	/**
+	 * primitive comparator
+	 */
+	struct before_less {
+		before_less(int axis_)
+			: axis(axis_)
+		{}
+		int axis;
+		bool operator() (const BuildPrimitive& a, const BuildPrimitive& b) const {
+			return a.centroid[axis] < b.centroid[axis];
+		}
+	};
+
+	/**
+	 * bin index of a centroid
+	 */
+	int bin_index(double centroid, double minimum, double scale)
+	{
+		int b = static_cast<int>((centroid - minimum) * scale);
+		if (b >= bin_count) { b = bin_count - 1; }
+		if (b < 0) { b = 0; }
+		return b;
+	}
+
+	/**
+	 * primitive comparator
+	 */
+	struct compare_bin {
+		compare_bin(int split, int axis_, double minimum_, double scale_)
+			: split_bin(split),
+			axis(axis_),
+			minimum(minimum_),
+			scale(scale_)
+		{ }
+		bool operator()(const BuildPrimitive& p) const {
+			return bin_index(p.centroid[axis], minimum, scale) <= split_bin;
+		}
+		int split_bin;
+		int axis;
+		double minimum;
+		double scale;
+	};
+
+	int maximum_axis(const Bounds& box) {
+		UMVec3d v = box.maximum - box.minimum;
+		if (v.x > v.y && v.x > v.z) {
+			return 0;
+		} else if (v.y > v.z){
+			return 1;
+		} else {
+			return 2;
+		}
+	}
+
+	/**
+	 * precompute bounds and centroid of all primitives
+	 */
+	void create_build_primitives(BuildPrimitiveList& dst, const UMPrimitiveList& primitives)
+	{
+		const int count = static_cast<int>(primitives.size());
+		dst.resize(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			const UMBox& box = primitives[i]->box();
+			BuildPrimitive& p = dst[i];
+			p.bounds.minimum = box.minimum();
+			p.bounds.maximum = box.maximum();
+			p.centroid = (box.minimum() + box.maximum()) * 0.5;
+			p.index = i;
+		}
+	}
+
+	/**
+	 * precompute bounds and centroid of all faces of a mesh
+	 */
+	void create_build_faces(BuildPrimitiveList& dst, const UMMesh& mesh)
+	{
+		const int count = static_cast<int>(mesh.face_list().size());
+		dst.resize(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			const UMVec3i& face = mesh.face_list()[i];
+			BuildPrimitive& p = dst[i];
+			p.bounds.init();
+			p.bounds.extend(mesh.vertex(face.x));
+			p.bounds.extend(mesh.vertex(face.y));
+			p.bounds.extend(mesh.vertex(face.z));
+			p.centroid = (p.bounds.minimum + p.bounds.maximum) * 0.5;
+			p.index = i;
+		}
+	}
+
+	/**
+	 * a bin for binned SAH
+	 */
+	struct Bin
+	{
+		Bin() : count(0) {}
+		Bounds bounds;
+		int count;
+	};
+
+	/**
+	 * bounds of primitives and their centroids in [start, end)
+	 */
+	void compute_bounds_serial(
+		Bounds& box,
+		Bounds& centroid_box,
+		const BuildPrimitiveList& primitives,
+		int start,
+		int end)
+	{
+		for (int i = start; i < end; ++i)
+		{
+			box.extend(primitives[i].bounds);
+			centroid_box.extend(primitives[i].centroid);
+		}
+	}
+
+	/**
+	 * bounds of primitives and their centroids in [start, end)
+	 */
+	void compute_bounds(
+		Bounds& box,
+		Bounds& centroid_box,
+		const BuildPrimitiveList& primitives,
+		int start,
+		int end)
+	{
+		box.init();
+		centroid_box.init();
+		const int count = end - start;
+		if (count <= parallel_range_threshold)
+		{
+			compute_bounds_serial(box, centroid_box, primitives, start, end);
+			return;
+		}
+		const int chunk_count = (count + range_chunk_size - 1) / range_chunk_size;
+#pragma omp parallel for
+		for (int c = 0; c < chunk_count; ++c)
+		{
+			const int chunk_start = start + c * range_chunk_size;
+			const int chunk_end = std::min(end, chunk_start + range_chunk_size);
+			Bounds local_box;
+			Bounds local_centroid_box;
+			compute_bounds_serial(local_box, local_centroid_box, primitives, chunk_start, chunk_end);
+#pragma omp critical
+			{
+				box.extend(local_box);
+				centroid_box.extend(local_centroid_box);
+			}
+		}
+	}
+
+	/**
+	 * fill bins of all axes by primitives in [start, end)
+	 */
+	void fill_bins_serial(
+		Bin bins[3][bin_count],
+		const BuildPrimitiveList& primitives,
+		const UMVec3d& minimum,
+		const UMVec3d& scale,
+		int start,
+		int end)
+	{
+		for (int i = start; i < end; ++i)
+		{
+			const BuildPrimitive& p = primitives[i];
+			for (int k = 0; k < 3; ++k)
+			{
+				Bin& bin = bins[k][bin_index(p.centroid[k], minimum[k], scale[k])];
+				++bin.count;
+				bin.bounds.extend(p.bounds);
+			}
+		}
+	}
+
+	/**
+	 * fill bins of all axes by primitives in [start, end)
+	 */
+	void fill_bins(
+		Bin bins[3][bin_count],
+		const BuildPrimitiveList& primitives,
+		const UMVec3d& minimum,
+		const UMVec3d& scale,
+		int start,
+		int end)
+	{
+		const int count = end - start;
+		if (count <= parallel_range_threshold)
+		{
+			fill_bins_serial(bins, primitives, minimum, scale, start, end);
+			return;
+		}
+		const int chunk_count = (count + range_chunk_size - 1) / range_chunk_size;
+#pragma omp parallel for
+		for (int c = 0; c < chunk_count; ++c)
+		{
+			const int chunk_start = start + c * range_chunk_size;
+			const int chunk_end = std::min(end, chunk_start + range_chunk_size);
+			Bin local_bins[3][bin_count];
+			fill_bins_serial(local_bins, primitives, minimum, scale, chunk_start, chunk_end);
+#pragma omp critical
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					for (int b = 0; b < bin_count; ++b)
+					{
+						bins[k][b].count += local_bins[k][b].count;
+						bins[k][b].bounds.extend(local_bins[k][b].bounds);
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * find middle split
+	 * @retval false if a leaf should be created
+	 */
+	bool find_middle_split(
+		BuildContext& context,
+		const Bounds& centroid_box,
+		int start,
+		int end,
+		int& axis,
+		int& middle_index)
+	{
+		BuildPrimitiveList& primitives = context.primitives;
+		axis = maximum_axis(centroid_box);
+		if ((end - start) <= 4 || centroid_box.maximum[axis] == centroid_box.minimum[axis])
+		{
+			return false;
+		}
+
+		const double middle = (centroid_box.minimum[axis] + centroid_box.maximum[axis]) * 0.5;
+		BuildPrimitiveList::iterator it = std::partition(
+			primitives.begin() + start,
+			primitives.begin() + end,
+			before_middle(axis, middle));
+		middle_index = static_cast<int>(std::distance(primitives.begin(), it));
+		if (middle_index == start || middle_index == end) {
+			// split equal counts
+			middle_index = (start + end) / 2;
+			std::nth_element(
+				primitives.begin() + start,
+				primitives.begin() + middle_index,
+				primitives.begin() + end,
+				before_less(axis));
+		}
+		return true;
+	}
+
+	/**
+	 * best object split found by binned SAH
+	 */
+	struct ObjectSplit
+	{
+		ObjectSplit() : cost((std::numeric_limits<double>::max)()), axis(-1), split_bin(0) {}
+		double cost;
+		int axis;
+		int split_bin;
+		Bounds left_bounds;
+		Bounds right_bounds;
+	};
+
+	/**
+	 * find binned SAH object split over all axes
+	 * @param [out] split best split. split.axis is -1 if not found
+	 */
+	void find_object_split(
+		ObjectSplit& split,
+		const BuildPrimitiveList& primitives,
+		const Bounds& box,
+		const Bounds& centroid_box,
+		const UMVec3d& scale,
+		int start,
+		int end)
+	{
+		const UMVec3d& minimum = centroid_box.minimum;
+
+		// fill bins of all axes in one pass
+		Bin bins[3][bin_count];
+		fill_bins(bins, primitives, minimum, scale, start, end);
+
+		const double area = box.area();
+		for (int k = 0; k < 3; ++k)
+		{
+			if (scale[k] == 0.0) continue;
+
+			// sweep from right
+			Bounds right_bounds[bin_count];
+			int right_count[bin_count];
+			{
+				Bounds right_box;
+				int right = 0;
+				for (int b = bin_count - 1; b > 0; --b)
+				{
+					right_box.extend(bins[k][b].bounds);
+					right += bins[k][b].count;
+					right_bounds[b] = right_box;
+					right_count[b] = right;
+				}
+			}
+
+			// sweep from left and evaluate split after each bin
+			Bounds left_box;
+			int left = 0;
+			for (int b = 0; b < bin_count - 1; ++b)
+			{
+				left_box.extend(bins[k][b].bounds);
+				left += bins[k][b].count;
+				if (left == 0 || right_count[b + 1] == 0) continue;
+				const double cost = sah(
+					area,
+					left_box.area(), left,
+					right_bounds[b + 1].area(), right_count[b + 1]);
+				if (cost < split.cost)
+				{
+					split.cost = cost;
+					split.axis = k;
+					split.split_bin = b;
+					split.left_bounds = left_box;
+					split.right_bounds = right_bounds[b + 1];
+				}
+			}
+		}
+	}
+
+	/**
+	 * bin scale of centroid box
+	 */
+	UMVec3d centroid_bin_scale(const Bounds& centroid_box)
+	{
+		UMVec3d scale;
+		for (int k = 0; k < 3; ++k)
+		{
+			const double extent = centroid_box.maximum[k] - centroid_box.minimum[k];
+			scale[k] = extent > 0.0 ? (bin_count / extent) : 0.0;
+		}
+		return scale;
+	}
+
+	/**
+	 * find binned SAH split over all axes
+	 * @retval false if a leaf should be created
+	 */
+	bool find_sah_split(
+		BuildContext& context,
+		const Bounds& box,
+		const Bounds& centroid_box,
+		int start,
+		int end,
+		int depth,
+		int& axis,
+		int& middle_index)
+	{
+		BuildPrimitiveList& primitives = context.primitives;
+		const int count = end - start;
+		if (count == 1) return false;
+
+		axis = maximum_axis(centroid_box);
+		if (centroid_box.maximum[axis] == centroid_box.minimum[axis])
+		{
+			// all centroids are same point
+			if (count <= max_leaf_primitive_count) return false;
+			middle_index = (start + end) / 2;
+			return true;
+		}
+
+		if (depth >= max_sah_depth)
+		{
+			// object median
+			middle_index = (start + end) / 2;
+			std::nth_element(
+				primitives.begin() + start,
+				primitives.begin() + middle_index,
+				primitives.begin() + end,
+				before_less(axis));
+			return true;
+		}
+
+		const UMVec3d scale = centroid_bin_scale(centroid_box);
+		ObjectSplit split;
+		find_object_split(split, primitives, box, centroid_box, scale, start, end);
+
+		if (split.axis < 0)
+		{
+			if (count <= max_leaf_primitive_count) return false;
+			middle_index = (start + end) / 2;
+			return true;
+		}
+
+		// leaf is cheaper than split
+		if (count <= max_leaf_primitive_count && split.cost >= count)
+		{
+			return false;
+		}
+
+		axis = split.axis;
+		BuildPrimitiveList::iterator it = std::partition(
+			primitives.begin() + start,
+			primitives.begin() + end,
+			compare_bin(split.split_bin, axis, centroid_box.minimum[axis], scale[axis]));
+		middle_index = static_cast<int>(std::distance(primitives.begin(), it));
+		if (middle_index <= start || middle_index >= end)
+		{
+			middle_index = (start + end) / 2;
+		}
+		return true;
+	}
+
+	/**
+	 * build node of [start, end) recursively
+	 * @param [in,out] context build context
+	 * @param [out] node target node
+	 * @param [in] start start index
+	 * @param [in] end end index
+	 * @param [in] depth depth of node
+	 */
+	void build_recursive(
+		BuildContext& context,
+		UMBvhNode& node,
+		int start,
+		int end,
+		int depth)
+	{
+		// leave it to a thread
+		if (context.tasks && (end - start) <= context.task_primitive_count)
+		{
+			context.tasks->push_back(BuildTask(&node, start, end, depth));
+			return;
+		}
+
+		Bounds box;
+		Bounds centroid_box;
+		compute_bounds(box, centroid_box, context.primitives, start, end);
+
+		int axis = 0;
+		int middle_index = 0;
+		bool is_branch = false;
+		if (context.method == UMBvh::eMiddleSplit)
+		{
+			is_branch = find_middle_split(context, centroid_box, start, end, axis, middle_index);
+		}
+		else
+		{
+			is_branch = find_sah_split(context, box, centroid_box, start, end, depth, axis, middle_index);
+		}
+
+		// create leaf
+		if (!is_branch)
+		{
+			node.init_as_leaf(box.minimum, box.maximum, start, end);
+			return;
+		}
+
+		// create branch
+		UMBvhNodePtr left(std::make_shared<UMBvhNode>());
+		UMBvhNodePtr right(std::make_shared<UMBvhNode>());
+		node.init_as_branch(box.minimum, box.maximum, left, right, axis);
+		build_recursive(context, *left, start, middle_index, depth + 1);
+		build_recursive(context, *right, middle_index, end, depth + 1);
+	}
+
+	/**
+	 * build tree. upper levels are built serially, then subtrees are built in parallel.
+	 */
+	void build_tree(BuildContext& context, UMBvhNode& root)
+	{
+		const int primitive_count = static_cast<int>(context.primitives.size());
+		int thread_count = 1;
+#ifdef _OPENMP
+		thread_count = omp_get_max_threads();
+#endif
+		BuildTaskList tasks;
+		if (thread_count > 1)
+		{
+			context.tasks = &tasks;
+			context.task_primitive_count = std::max(
+				minimum_task_primitive_count,
+				primitive_count / (thread_count * 8));
+		}
+		build_recursive(context, root, 0, primitive_count, 0);
+		context.tasks = NULL;
+
+		// larger subtree first
+		std::sort(tasks.begin(), tasks.end(), larger_task());
+		const int task_count = static_cast<int>(tasks.size());
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int i = 0; i < task_count; ++i)
+		{
+			const BuildTask& task = tasks[i];
+			build_recursive(context, *task.node, task.start, task.end, task.depth);
+		}
+	}
+
+	/**
+	 * triangle vertices to clip references by split planes.
+	 * references of other primitives are clipped as boxes.
+	 */
+	struct ClipTriangle
+	{
+		ClipTriangle() : is_triangle(false) {}
+		UMVec3d vertex[3];
+		bool is_triangle;
+	};
+	typedef std::vector<ClipTriangle> ClipTriangleList;
+
+	/**
+	 * collect vertices of triangle primitives
+	 */
+	void create_clip_triangles(ClipTriangleList& dst, const UMPrimitiveList& primitives)
+	{
+		const int count = static_cast<int>(primitives.size());
+		dst.resize(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			const UMTriangle* triangle = dynamic_cast<const UMTriangle*>(primitives[i].get());
+			if (!triangle) continue;
+			const UMMeshPtr mesh = triangle->mesh();
+			const UMVec3i& index = triangle->vertex_index();
+			ClipTriangle& clip = dst[i];
+			clip.vertex[0] = mesh->vertex(index.x);
+			clip.vertex[1] = mesh->vertex(index.y);
+			clip.vertex[2] = mesh->vertex(index.z);
+			clip.is_triangle = true;
+		}
+	}
+
+	/**
+	 * collect vertices of all faces of a mesh
+	 */
+	void create_clip_faces(ClipTriangleList& dst, const UMMesh& mesh)
+	{
+		const int count = static_cast<int>(mesh.face_list().size());
+		dst.resize(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			const UMVec3i& face = mesh.face_list()[i];
+			ClipTriangle& clip = dst[i];
+			clip.vertex[0] = mesh.vertex(face.x);
+			clip.vertex[1] = mesh.vertex(face.y);
+			clip.vertex[2] = mesh.vertex(face.z);
+			clip.is_triangle = true;
+		}
+	}
+
+	/**
+	 * is bounds empty or not
+	 */
+	bool is_empty(const Bounds& bounds)
+	{
+		return bounds.minimum.x > bounds.maximum.x
+			|| bounds.minimum.y > bounds.maximum.y
+			|| bounds.minimum.z > bounds.maximum.z;
+	}
+
+	/**
+	 * surface area of intersection of two bounds
+	 */
+	double overlap_area(const Bounds& a, const Bounds& b)
+	{
+		UMVec3d d;
+		for (int k = 0; k < 3; ++k)
+		{
+			d[k] = std::min(a.maximum[k], b.maximum[k]) - std::max(a.minimum[k], b.minimum[k]);
+			if (d[k] < 0.0) return 0.0;
+		}
+		return 2.0 * (d.x * d.y + d.x * d.z + d.y * d.z);
+	}
+
+	/**
+	 * bounds of a reference inside the slab [lower, upper] of an axis
+	 * @param [in] reference a reference which may be clipped already
+	 * @param [in] triangle vertices of the referred primitive
+	 */
+	Bounds clip_reference(
+		const BuildPrimitive& reference,
+		const ClipTriangle& triangle,
+		int axis,
+		double lower,
+		double upper)
+	{
+		Bounds bounds;
+		if (triangle.is_triangle)
+		{
+			const double planes[] = { lower, upper };
+			for (int i = 0; i < 3; ++i)
+			{
+				const UMVec3d& a = triangle.vertex[i];
+				const UMVec3d& b = triangle.vertex[(i + 1) % 3];
+				if (a[axis] >= lower && a[axis] <= upper)
+				{
+					bounds.extend(a);
+				}
+				// edge crosses the planes
+				for (int p = 0; p < 2; ++p)
+				{
+					const double plane = planes[p];
+					if ((a[axis] < plane && plane < b[axis]) || (b[axis] < plane && plane < a[axis]))
+					{
+						UMVec3d point = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+						point[axis] = plane;
+						bounds.extend(point);
+					}
+				}
+			}
+		}
+		else
+		{
+			bounds = reference.bounds;
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			bounds.minimum[k] = std::max(bounds.minimum[k], reference.bounds.minimum[k]);
+			bounds.maximum[k] = std::min(bounds.maximum[k], reference.bounds.maximum[k]);
+		}
+		bounds.minimum[axis] = std::max(bounds.minimum[axis], lower);
+		bounds.maximum[axis] = std::min(bounds.maximum[axis], upper);
+		return bounds;
+	}
+
+	/**
+	 * reference with clipped bounds
+	 */
+	BuildPrimitive clipped_reference(const BuildPrimitive& reference, const Bounds& bounds)
+	{
+		BuildPrimitive clipped;
+		clipped.bounds = bounds;
+		clipped.centroid = (bounds.minimum + bounds.maximum) * 0.5;
+		clipped.index = reference.index;
+		return clipped;
+	}
+
+	/**
+	 * a bin for spatial split.
+	 * references are chopped into bins which they overlap.
+	 */
+	struct SpatialBin
+	{
+		SpatialBin() : entry(0), exit(0) {}
+		Bounds bounds;
+		int entry;
+		int exit;
+	};
+
+	/**
+	 * best spatial split
+	 */
+	struct SpatialSplit
+	{
+		SpatialSplit() : cost((std::numeric_limits<double>::max)()), axis(-1), position(0.0) {}
+		double cost;
+		int axis;
+		double position;
+	};
+
+	/**
+	 * find binned SAH spatial split over all axes
+	 * @param [out] split best split. split.axis is -1 if not found
+	 */
+	void find_spatial_split(
+		SpatialSplit& split,
+		const BuildPrimitiveList& references,
+		const ClipTriangleList& triangles,
+		const Bounds& box)
+	{
+		const double area = box.area();
+		const int count = static_cast<int>(references.size());
+		for (int k = 0; k < 3; ++k)
+		{
+			const double extent = box.maximum[k] - box.minimum[k];
+			if (extent <= 0.0) continue;
+			const double width = extent / bin_count;
+			const double scale = bin_count / extent;
+
+			SpatialBin bins[bin_count];
+			for (int i = 0; i < count; ++i)
+			{
+				const BuildPrimitive& reference = references[i];
+				const int first = bin_index(reference.bounds.minimum[k], box.minimum[k], scale);
+				const int last = bin_index(reference.bounds.maximum[k], box.minimum[k], scale);
+				++bins[first].entry;
+				++bins[last].exit;
+				if (first == last)
+				{
+					bins[first].bounds.extend(reference.bounds);
+					continue;
+				}
+				for (int b = first; b <= last; ++b)
+				{
+					const double lower = (b == first) ? reference.bounds.minimum[k] : (box.minimum[k] + b * width);
+					const double upper = (b == last) ? reference.bounds.maximum[k] : (box.minimum[k] + (b + 1) * width);
+					bins[b].bounds.extend(clip_reference(reference, triangles[reference.index], k, lower, upper));
+				}
+			}
+
+			// sweep from right
+			double right_area[bin_count];
+			int right_count[bin_count];
+			{
+				Bounds right_box;
+				int right = 0;
+				for (int b = bin_count - 1; b > 0; --b)
+				{
+					right_box.extend(bins[b].bounds);
+					right += bins[b].exit;
+					right_area[b] = right_box.area();
+					right_count[b] = right;
+				}
+			}
+
+			// sweep from left and evaluate split after each bin
+			Bounds left_box;
+			int left = 0;
+			for (int b = 0; b < bin_count - 1; ++b)
+			{
+				left_box.extend(bins[b].bounds);
+				left += bins[b].entry;
+				if (left == 0 || right_count[b + 1] == 0) continue;
+				const double cost = sah(
+					area,
+					left_box.area(), left,
+					right_area[b + 1], right_count[b + 1]);
+				if (cost < split.cost)
+				{
+					split.cost = cost;
+					split.axis = k;
+					split.position = box.minimum[k] + (b + 1) * width;
+				}
+			}
+		}
+	}
+
+	/**
+	 * split references by a plane.
+	 * references over the plane are duplicated, or moved to one side if it is cheaper.
+	 * @param [in,out] budget count of references which can be duplicated
+	 */
+	void split_references(
+		BuildPrimitiveList& left,
+		BuildPrimitiveList& right,
+		const BuildPrimitiveList& references,
+		const ClipTriangleList& triangles,
+		int axis,
+		double position,
+		int& budget)
+	{
+		Bounds left_bounds;
+		Bounds right_bounds;
+		std::vector<int> straddling;
+		const int count = static_cast<int>(references.size());
+		for (int i = 0; i < count; ++i)
+		{
+			const BuildPrimitive& reference = references[i];
+			if (reference.bounds.maximum[axis] <= position)
+			{
+				left.push_back(reference);
+				left_bounds.extend(reference.bounds);
+			}
+			else if (reference.bounds.minimum[axis] >= position)
+			{
+				right.push_back(reference);
+				right_bounds.extend(reference.bounds);
+			}
+			else
+			{
+				straddling.push_back(i);
+			}
+		}
+
+		const int straddling_count = static_cast<int>(straddling.size());
+		for (int i = 0; i < straddling_count; ++i)
+		{
+			const BuildPrimitive& reference = references[straddling[i]];
+			const ClipTriangle& triangle = triangles[reference.index];
+			const Bounds left_part = clip_reference(reference, triangle, axis, reference.bounds.minimum[axis], position);
+			const Bounds right_part = clip_reference(reference, triangle, axis, position, reference.bounds.maximum[axis]);
+
+			// compare costs of splitting and unsplitting
+			const double left_count = static_cast<double>(left.size());
+			const double right_count = static_cast<double>(right.size());
+			Bounds left_split(left_bounds);
+			left_split.extend(left_part);
+			Bounds right_split(right_bounds);
+			right_split.extend(right_part);
+			Bounds left_union(left_bounds);
+			left_union.extend(reference.bounds);
+			Bounds right_union(right_bounds);
+			right_union.extend(reference.bounds);
+			const double split_cost = left_split.area() * (left_count + 1) + right_split.area() * (right_count + 1);
+			const double left_cost = left_union.area() * (left_count + 1) + right_bounds.area() * right_count;
+			const double right_cost = left_bounds.area() * left_count + right_union.area() * (right_count + 1);
+
+			const bool can_split = budget > 0 && !is_empty(left_part) && !is_empty(right_part);
+			if (can_split && split_cost < std::min(left_cost, right_cost))
+			{
+				left.push_back(clipped_reference(reference, left_part));
+				right.push_back(clipped_reference(reference, right_part));
+				left_bounds = left_split;
+				right_bounds = right_split;
+				--budget;
+			}
+			else if (left_cost <= right_cost)
+			{
+				left.push_back(reference);
+				left_bounds = left_union;
+			}
+			else
+			{
+				right.push_back(reference);
+				right_bounds = right_union;
+			}
+		}
+	}
+
+	/**
+	 * a subtree which is built by a thread with spatial splits
+	 */
+	struct SpatialTask
+	{
+		UMBvhNode* node;
+		BuildPrimitiveList references;
+		BuildPrimitiveList leaf_references;
+		int budget;
+		int depth;
+	};
+	typedef std::shared_ptr<SpatialTask> SpatialTaskPtr;
+	typedef std::vector<SpatialTaskPtr> SpatialTaskList;
+
+	/**
+	 * spatial split build context
+	 */
+	struct SpatialContext
+	{
+		SpatialContext(const ClipTriangleList& triangles_, double root_area_)
+			: triangles(triangles_),
+			root_area(root_area_),
+			tasks(NULL),
+			task_primitive_count(0)
+		{}
+		const ClipTriangleList& triangles;
+		double root_area;
+		// subtrees smaller than task_primitive_count are stored to tasks when tasks exists.
+		SpatialTaskList* tasks;
+		int task_primitive_count;
+	};
+
+	/**
+	 * split references by the best object split, or at the object median
+	 */
+	void split_objects(
+		BuildPrimitiveList& left,
+		BuildPrimitiveList& right,
+		BuildPrimitiveList& references,
+		const ObjectSplit& split,
+		const Bounds& centroid_box,
+		const UMVec3d& scale,
+		int& axis)
+	{
+		BuildPrimitiveList::iterator middle = references.begin() + references.size() / 2;
+		if (split.axis >= 0)
+		{
+			axis = split.axis;
+			BuildPrimitiveList::iterator it = std::partition(
+				references.begin(),
+				references.end(),
+				compare_bin(split.split_bin, axis, centroid_box.minimum[axis], scale[axis]));
+			if (it != references.begin() && it != references.end())
+			{
+				middle = it;
+			}
+		}
+		else
+		{
+			axis = maximum_axis(centroid_box);
+			std::nth_element(references.begin(), middle, references.end(), before_less(axis));
+		}
+		left.assign(references.begin(), middle);
+		right.assign(middle, references.end());
+	}
+
+	/**
+	 * build node of references recursively with spatial splits
+	 * @param [in,out] context build context
+	 * @param [out] node target node
+	 * @param [in,out] references references of node. released after split.
+	 * @param [in] budget count of references which can be duplicated in this subtree
+	 * @param [in] depth depth of node
+	 * @param [out] leaf_references references of leaves are appended to this
+	 */
+	void build_spatial_recursive(
+		SpatialContext& context,
+		UMBvhNode& node,
+		BuildPrimitiveList& references,
+		int budget,
+		int depth,
+		BuildPrimitiveList& leaf_references)
+	{
+		const int count = static_cast<int>(references.size());
+
+		// leave it to a thread
+		if (context.tasks && count <= context.task_primitive_count)
+		{
+			SpatialTaskPtr task(std::make_shared<SpatialTask>());
+			task->node = &node;
+			task->references.swap(references);
+			task->budget = budget;
+			task->depth = depth;
+			context.tasks->push_back(task);
+			return;
+		}
+
+		Bounds box;
+		Bounds centroid_box;
+		compute_bounds(box, centroid_box, references, 0, count);
+
+		bool is_branch = false;
+		ObjectSplit object_split;
+		SpatialSplit spatial_split;
+		UMVec3d scale(0.0);
+		if (count > 1 && depth < max_sah_depth)
+		{
+			scale = centroid_bin_scale(centroid_box);
+			find_object_split(object_split, references, box, centroid_box, scale, 0, count);
+
+			// spatial split is tried only if children of object split overlap enough
+			if (budget > 0 && (object_split.axis < 0
+				|| overlap_area(object_split.left_bounds, object_split.right_bounds) > spatial_split_alpha * context.root_area))
+			{
+				find_spatial_split(spatial_split, references, context.triangles, box);
+			}
+			const double cost = std::min(object_split.cost, spatial_split.cost);
+			if (object_split.axis < 0 && spatial_split.axis < 0)
+			{
+				is_branch = count > max_leaf_primitive_count;
+			}
+			else
+			{
+				// leaf is cheaper than split
+				is_branch = count > max_leaf_primitive_count || cost < count;
+			}
+		}
+		else if (count > max_leaf_primitive_count)
+		{
+			// object median
+			scale = centroid_bin_scale(centroid_box);
+			is_branch = true;
+		}
+
+		// create leaf
+		if (!is_branch)
+		{
+			const int start = static_cast<int>(leaf_references.size());
+			leaf_references.insert(leaf_references.end(), references.begin(), references.end());
+			node.init_as_leaf(box.minimum, box.maximum, start, start + count);
+			BuildPrimitiveList().swap(references);
+			return;
+		}
+
+		int axis = 0;
+		BuildPrimitiveList left;
+		BuildPrimitiveList right;
+		if (spatial_split.axis >= 0 && spatial_split.cost < object_split.cost)
+		{
+			axis = spatial_split.axis;
+			split_references(left, right, references, context.triangles, axis, spatial_split.position, budget);
+		}
+		if (left.empty() || right.empty())
+		{
+			left.clear();
+			right.clear();
+			split_objects(left, right, references, object_split, centroid_box, scale, axis);
+		}
+		BuildPrimitiveList().swap(references);
+
+		// remaining budget is shared by children
+		const int left_budget = static_cast<int>(
+			static_cast<double>(budget) * left.size() / (left.size() + right.size()));
+		const int right_budget = budget - left_budget;
+
+		// create branch
+		UMBvhNodePtr left_node(std::make_shared<UMBvhNode>());
+		UMBvhNodePtr right_node(std::make_shared<UMBvhNode>());
+		node.init_as_branch(box.minimum, box.maximum, left_node, right_node, axis);
+		build_spatial_recursive(context, *left_node, left, left_budget, depth + 1, leaf_references);
+		build_spatial_recursive(context, *right_node, right, right_budget, depth + 1, leaf_references);
+	}
+
+	/**
+	 * shift leaf ranges of subtree
+	 */
+	void offset_leaves(UMBvhNode& node, int offset)
+	{
+		if (node.is_leaf())
+		{
+			node.start_index_ += offset;
+			node.end_index_ += offset;
+			return;
+		}
+		offset_leaves(*node.left_, offset);
+		offset_leaves(*node.right_, offset);
+	}
+
+	/**
+	 * larger spatial task first
+	 */
+	struct larger_spatial_task {
+		bool operator() (const SpatialTaskPtr& a, const SpatialTaskPtr& b) const {
+			return a->references.size() > b->references.size();
+		}
+	};
+
+	/**
+	 * build tree with spatial splits. upper levels are built serially, then subtrees are built in parallel.
+	 * @param [in] triangles vertices of primitives
+	 * @param [out] root root node
+	 * @param [in,out] references references of all primitives. released after build.
+	 * @param [in] budget count of references which can be duplicated
+	 * @param [out] leaf_references references ordered by leaves
+	 */
+	void build_spatial_tree(
+		const ClipTriangleList& triangles,
+		UMBvhNode& root,
+		BuildPrimitiveList& references,
+		int budget,
+		BuildPrimitiveList& leaf_references)
+	{
+		const int primitive_count = static_cast<int>(references.size());
+		Bounds box;
+		Bounds centroid_box;
+		compute_bounds(box, centroid_box, references, 0, primitive_count);
+		SpatialContext context(triangles, box.area());
+
+		int thread_count = 1;
+#ifdef _OPENMP
+		thread_count = omp_get_max_threads();
+#endif
+		SpatialTaskList tasks;
+		if (thread_count > 1)
+		{
+			context.tasks = &tasks;
+			context.task_primitive_count = std::max(
+				minimum_task_primitive_count,
+				primitive_count / (thread_count * 8));
+		}
+		leaf_references.reserve(primitive_count + budget);
+		build_spatial_recursive(context, root, references, budget, 0, leaf_references);
+		context.tasks = NULL;
+
+		std::sort(tasks.begin(), tasks.end(), larger_spatial_task());
+		const int task_count = static_cast<int>(tasks.size());
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int i = 0; i < task_count; ++i)
+		{
+			SpatialTask& task = *tasks[i];
+			build_spatial_recursive(context, *task.node, task.references, task.budget, task.depth, task.leaf_references);
+		}
+
+		// append leaves of subtrees
+		for (int i = 0; i < task_count; ++i)
+		{
+			SpatialTask& task = *tasks[i];
+			offset_leaves(*task.node, static_cast<int>(leaf_references.size()));
+			leaf_references.insert(leaf_references.end(), task.leaf_references.begin(), task.leaf_references.end());
+		}
+	}
+
+	/**
+	 * morton code of a primitive centroid
+	 */
+	typedef unsigned long long MortonCode;
+
+	/**
+	 * sort key of linear bvh
+	 */
+	struct MortonPrimitive
+	{
+		MortonCode code;
+		int index;
+	};
+	typedef std::vector<MortonPrimitive> MortonPrimitiveList;
+
+	/**
+	 * spread 10 bits to every 3rd bit of 30 bits
+	 */
+	MortonCode expand_bits_30(MortonCode v)
+	{
+		v &= 0x3ff;
+		v = (v | (v << 16)) & 0x30000ffull;
+		v = (v | (v << 8)) & 0x300f00full;
+		v = (v | (v << 4)) & 0x30c30c3ull;
+		v = (v | (v << 2)) & 0x9249249ull;
+		return v;
+	}
+
+	/**
+	 * spread 21 bits to every 3rd bit of 63 bits
+	 */
+	MortonCode expand_bits_63(MortonCode v)
+	{
+		v &= 0x1fffff;
+		v = (v | (v << 32)) & 0x1f00000000ffffull;
+		v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+		v = (v | (v << 8)) & 0x100f00f00f00f00full;
+		v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+		v = (v | (v << 2)) & 0x1249249249249249ull;
+		return v;
+	}
+
+	/**
+	 * compute morton codes of primitive centroids
+	 * @param [in] bit_count 30 or 63
+	 */
+	void create_morton_codes(
+		MortonPrimitiveList& dst,
+		const BuildPrimitiveList& primitives,
+		const Bounds& centroid_box,
+		int bit_count)
+	{
+		const int count = static_cast<int>(primitives.size());
+		const int axis_bit_count = bit_count / 3;
+		const double cell_count = static_cast<double>(1 << axis_bit_count);
+		UMVec3d scale;
+		for (int k = 0; k < 3; ++k)
+		{
+			const double extent = centroid_box.maximum[k] - centroid_box.minimum[k];
+			scale[k] = extent > 0.0 ? (cell_count / extent) : 0.0;
+		}
+		dst.resize(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			MortonCode cell[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				const double position = (primitives[i].centroid[k] - centroid_box.minimum[k]) * scale[k];
+				cell[k] = static_cast<MortonCode>(std::min(std::max(position, 0.0), cell_count - 1.0));
+			}
+			if (bit_count == 30)
+			{
+				dst[i].code = (expand_bits_30(cell[0]) << 2) | (expand_bits_30(cell[1]) << 1) | expand_bits_30(cell[2]);
+			}
+			else
+			{
+				dst[i].code = (expand_bits_63(cell[0]) << 2) | (expand_bits_63(cell[1]) << 1) | expand_bits_63(cell[2]);
+			}
+			dst[i].index = i;
+		}
+	}
+
+	/**
+	 * stable LSD radix sort of morton codes. each chunk is counted and scattered by a thread.
+	 * @param [in] bit_count sorted lower bits of codes
+	 */
+	void radix_sort(MortonPrimitiveList& values, int bit_count)
+	{
+		const int count = static_cast<int>(values.size());
+		const int chunk_count = std::max(1, (count + range_chunk_size - 1) / range_chunk_size);
+		MortonPrimitiveList temp(count);
+		std::vector<int> offsets(chunk_count * radix_bucket_count);
+		for (int shift = 0; shift < bit_count; shift += radix_bit_count)
+		{
+			std::fill(offsets.begin(), offsets.end(), 0);
+#pragma omp parallel for if (count > parallel_range_threshold)
+			for (int c = 0; c < chunk_count; ++c)
+			{
+				int* histogram = &offsets[c * radix_bucket_count];
+				const int chunk_end = std::min(count, (c + 1) * range_chunk_size);
+				for (int i = c * range_chunk_size; i < chunk_end; ++i)
+				{
+					++histogram[(values[i].code >> shift) & (radix_bucket_count - 1)];
+				}
+			}
+
+			// exclusive prefix sum in bucket major order keeps the sort stable
+			int sum = 0;
+			for (int b = 0; b < radix_bucket_count; ++b)
+			{
+				for (int c = 0; c < chunk_count; ++c)
+				{
+					const int bucket = offsets[c * radix_bucket_count + b];
+					offsets[c * radix_bucket_count + b] = sum;
+					sum += bucket;
+				}
+			}
+
+#pragma omp parallel for if (count > parallel_range_threshold)
+			for (int c = 0; c < chunk_count; ++c)
+			{
+				int* offset = &offsets[c * radix_bucket_count];
+				const int chunk_end = std::min(count, (c + 1) * range_chunk_size);
+				for (int i = c * range_chunk_size; i < chunk_end; ++i)
+				{
+					temp[offset[(values[i].code >> shift) & (radix_bucket_count - 1)]++] = values[i];
+				}
+			}
+			values.swap(temp);
+		}
+	}
+
+	/**
+	 * emit node of sorted [start, end) recursively.
+	 * ranges are split where the highest different bit of codes changes.
+	 * bounds are computed later.
+	 * @param [in] bit highest bit which may differ in the range
+	 */
+	void emit_linear_recursive(
+		const MortonPrimitiveList& codes,
+		UMBvhNode& node,
+		int start,
+		int end,
+		int bit)
+	{
+		if (end - start <= linear_leaf_primitive_count)
+		{
+			node.start_index_ = start;
+			node.end_index_ = end;
+			return;
+		}
+
+		int middle = (start + end) / 2;
+		int axis = 0;
+		for (; bit >= 0; --bit)
+		{
+			const MortonCode mask = 1ull << bit;
+			if ((codes[start].code & mask) == (codes[end - 1].code & mask)) continue;
+			// find first code which has the bit
+			int low = start;
+			int high = end - 1;
+			while (low + 1 < high)
+			{
+				const int center = (low + high) / 2;
+				if (codes[center].code & mask)
+				{
+					high = center;
+				}
+				else
+				{
+					low = center;
+				}
+			}
+			middle = high;
+			// x, y, z bits are interleaved from higher bit
+			axis = 2 - (bit % 3);
+			break;
+		}
+
+		UMBvhNodePtr left(std::make_shared<UMBvhNode>());
+		UMBvhNodePtr right(std::make_shared<UMBvhNode>());
+		node.left_ = left;
+		node.right_ = right;
+		node.axis_ = axis;
+		emit_linear_recursive(codes, *left, start, middle, bit - 1);
+		emit_linear_recursive(codes, *right, middle, end, bit - 1);
+	}
+
+	/**
+	 * compute bounds and SAH cost of subtree
+	 */
+	void compute_node_bounds(UMBvhNode& node, const BuildPrimitiveList& primitives)
+	{
+		Bounds bounds;
+		if (node.is_leaf())
+		{
+			for (int i = node.start_index_; i < node.end_index_; ++i)
+			{
+				bounds.extend(primitives[i].bounds);
+			}
+			node.cost_ = bounds.area() * (node.end_index_ - node.start_index_);
+		}
+		else
+		{
+			compute_node_bounds(*node.left_, primitives);
+			compute_node_bounds(*node.right_, primitives);
+			bounds.minimum = node.left_->box_.minimum();
+			bounds.maximum = node.left_->box_.maximum();
+			bounds.extend(node.right_->box_.maximum());
+			bounds.extend(node.right_->box_.minimum());
+			node.cost_ = 0.2 * bounds.area() + node.left_->cost_ + node.right_->cost_;
+		}
+		node.box_.set_minimum(bounds.minimum);
+		node.box_.set_maximum(bounds.maximum);
+	}
+
+	/**
+	 * bounds of node
+	 */
+	Bounds node_bounds(const UMBvhNode& node)
+	{
+		Bounds bounds;
+		bounds.minimum = node.box_.minimum();
+		bounds.maximum = node.box_.maximum();
+		return bounds;
+	}
+
+	/**
+	 * treelet of up to treelet_leaf_count leaves
+	 */
+	struct Treelet
+	{
+		UMBvhNodePtr leaves[treelet_leaf_count];
+		UMBvhNodePtr internals[treelet_leaf_count - 1];
+		int leaf_count;
+		int internal_count;
+		Bounds bounds[1 << treelet_leaf_count];
+		double cost[1 << treelet_leaf_count];
+		int partition[1 << treelet_leaf_count];
+	};
+
+	/**
+	 * set children of treelet node by optimal partition of leaf set
+	 */
+	void assign_treelet(Treelet& treelet, UMBvhNode& node, int set)
+	{
+		const int left_set = treelet.partition[set];
+		const int right_set = set ^ left_set;
+		const int sets[] = { left_set, right_set };
+		UMBvhNodePtr children[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			if ((sets[i] & (sets[i] - 1)) == 0)
+			{
+				// single leaf
+				int leaf = 0;
+				while (!(sets[i] & (1 << leaf))) ++leaf;
+				children[i] = treelet.leaves[leaf];
+			}
+			else
+			{
+				children[i] = treelet.internals[treelet.internal_count++];
+				assign_treelet(treelet, *children[i], sets[i]);
+			}
+		}
+		node.left_ = children[0];
+		node.right_ = children[1];
+		const Bounds& bounds = treelet.bounds[set];
+		node.box_.set_minimum(bounds.minimum);
+		node.box_.set_maximum(bounds.maximum);
+		node.cost_ = treelet.cost[set];
+		// split axis is the axis where children are most apart
+		const UMVec3d d = (node_bounds(*children[1]).minimum + node_bounds(*children[1]).maximum)
+			- (node_bounds(*children[0]).minimum + node_bounds(*children[0]).maximum);
+		const UMVec3d abs_d(std::abs(d.x), std::abs(d.y), std::abs(d.z));
+		node.axis_ = (abs_d.x > abs_d.y && abs_d.x > abs_d.z) ? 0 : (abs_d.y > abs_d.z ? 1 : 2);
+	}
+
+	/**
+	 * restructure treelet under root to minimize SAH cost
+	 */
+	void restructure_treelet(UMBvhNode& root, Treelet& treelet)
+	{
+		// open the largest branch until treelet_leaf_count leaves
+		treelet.leaves[0] = root.left_;
+		treelet.leaves[1] = root.right_;
+		treelet.leaf_count = 2;
+		treelet.internal_count = 0;
+		while (treelet.leaf_count < treelet_leaf_count)
+		{
+			int largest = -1;
+			double largest_area = -1.0;
+			for (int i = 0; i < treelet.leaf_count; ++i)
+			{
+				if (treelet.leaves[i]->is_leaf()) continue;
+				const double area = treelet.leaves[i]->box_.area();
+				if (area > largest_area)
+				{
+					largest_area = area;
+					largest = i;
+				}
+			}
+			if (largest < 0) break;
+			UMBvhNodePtr opened = treelet.leaves[largest];
+			treelet.internals[treelet.internal_count++] = opened;
+			treelet.leaves[largest] = opened->left_;
+			treelet.leaves[treelet.leaf_count++] = opened->right_;
+		}
+		if (treelet.leaf_count < 4) return;
+
+		// optimal costs of all leaf subsets. subsets of a set are smaller than the set.
+		const int full_set = (1 << treelet.leaf_count) - 1;
+		for (int set = 1; set <= full_set; ++set)
+		{
+			Bounds& bounds = treelet.bounds[set];
+			bounds.init();
+			for (int i = 0; i < treelet.leaf_count; ++i)
+			{
+				if (set & (1 << i))
+				{
+					bounds.extend(node_bounds(*treelet.leaves[i]));
+				}
+			}
+			if ((set & (set - 1)) == 0)
+			{
+				int leaf = 0;
+				while (!(set & (1 << leaf))) ++leaf;
+				treelet.cost[set] = treelet.leaves[leaf]->cost_;
+				continue;
+			}
+			// partitions including the lowest leaf to skip mirrored ones
+			const int lowest = set & (-set);
+			double best_cost = (std::numeric_limits<double>::max)();
+			int best_partition = 0;
+			for (int part = (set - 1) & set; part > 0; part = (part - 1) & set)
+			{
+				if (!(part & lowest)) continue;
+				const double cost = treelet.cost[part] + treelet.cost[set ^ part];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_partition = part;
+				}
+			}
+			treelet.cost[set] = 0.2 * bounds.area() + best_cost;
+			treelet.partition[set] = best_partition;
+		}
+		if (treelet.cost[full_set] >= root.cost_) return;
+
+		// reuse internal nodes of treelet
+		treelet.internal_count = 0;
+		assign_treelet(treelet, root, full_set);
+	}
+
+	/**
+	 * restructure treelets bottom-up
+	 * @param [in] depth depth of node
+	 * @param [in] max_depth nodes deeper than this are not restructured
+	 */
+	void optimize_treelets(UMBvhNode& node, Treelet& treelet, int depth, int max_depth)
+	{
+		if (node.is_leaf() || depth > max_depth) return;
+		optimize_treelets(*node.left_, treelet, depth + 1, max_depth);
+		optimize_treelets(*node.right_, treelet, depth + 1, max_depth);
+		restructure_treelet(node, treelet);
+	}
+
+	/**
+	 * collect nodes of a depth
+	 */
+	void collect_nodes(std::vector<UMBvhNode*>& dst, UMBvhNode& node, int depth, int target_depth)
+	{
+		if (depth == target_depth)
+		{
+			dst.push_back(&node);
+			return;
+		}
+		if (node.is_leaf()) return;
+		collect_nodes(dst, *node.left_, depth + 1, target_depth);
+		collect_nodes(dst, *node.right_, depth + 1, target_depth);
+	}
+
+	/**
+	 * restructure treelets bottom-up.
+	 * subtrees under the top levels are restructured in parallel.
+	 */
+	void optimize_treelets(UMBvhNode& root)
+	{
+		std::vector<UMBvhNode*> subtrees;
+		collect_nodes(subtrees, root, 0, treelet_task_depth);
+		const int subtree_count = static_cast<int>(subtrees.size());
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int i = 0; i < subtree_count; ++i)
+		{
+			Treelet treelet;
+			optimize_treelets(*subtrees[i], treelet, 0, (std::numeric_limits<int>::max)());
+		}
+		Treelet treelet;
+		optimize_treelets(root, treelet, 0, treelet_task_depth - 1);
+	}
+
+	/**
+	 * build linear bvh. primitives are sorted by morton codes of centroids.
+	 * @param [in,out] primitives primitives. reordered by morton codes.
+	 * @param [out] root root node
+	 * @param [in] optimize restructure treelets by SAH or not
+	 */
+	void build_linear_tree(BuildPrimitiveList& primitives, UMBvhNode& root, bool optimize)
+	{
+		const int count = static_cast<int>(primitives.size());
+		Bounds box;
+		Bounds centroid_box;
+		compute_bounds(box, centroid_box, primitives, 0, count);
+
+		// 10 bits per axis are enough for scenes less than a million primitives
+		const int bit_count = count < (1 << 20) ? 30 : 63;
+		MortonPrimitiveList codes;
+		create_morton_codes(codes, primitives, centroid_box, bit_count);
+		radix_sort(codes, bit_count);
+
+		BuildPrimitiveList sorted(count);
+#pragma omp parallel for if (count > parallel_range_threshold)
+		for (int i = 0; i < count; ++i)
+		{
+			sorted[i] = primitives[codes[i].index];
+		}
+		primitives.swap(sorted);
+
+		emit_linear_recursive(codes, root, 0, count, bit_count - 1);
+		compute_node_bounds(root, primitives);
+		if (optimize)
+		{
+			optimize_treelets(root);
+		}
+	}
+
+	/**
+	 * count nodes of tree
+	 * @param [in] root recursive root
+	 */
+	unsigned int count_nodes(const UMBvhNode& root)
+	{
+		if (root.is_leaf()) return 1;
+		return 1 + count_nodes(*root.left_) + count_nodes(*root.right_);
+	}
+
+	/**
+	 * surface area of a flattened node
+	 */
+	double node_area(const UMBvhFlatNode& node)
+	{
+		const double dx = static_cast<double>(node.maximum[0]) - node.minimum[0];
+		const double dy = static_cast<double>(node.maximum[1]) - node.minimum[1];
+		const double dz = static_cast<double>(node.maximum[2]) - node.minimum[2];
+		if (dx < 0.0 || dy < 0.0 || dz < 0.0) return 0.0;
+		return 2.0 * (dx * dy + dx * dz + dy * dz);
+	}
+
+	/**
+	 * SAH cost and depth of flattened tree
+	 * @param [in] node_list flattened nodes
+	 * @param [out] max_depth max depth
+	 * @retval SAH cost of root
 	 */
-	struct before_middle {
-		before_middle(int axis_, double middle_)
-			: axis(axis_),
-			middle(middle_)
-		{}
-		int axis;
-		double middle;
-		bool operator() (const UMPrimitivePtr a) const {
-			return a->box().center()[axis] < middle;
+	double evaluate_tree(const UMBvhFlatNodeList& node_list, int& max_depth)
+	{
+		max_depth = 0;
+		if (node_list.empty()) return 0.0;
+		const double root_area = node_area(node_list[0]);
+		const double inv_root_area = root_area > 0.0 ? 1.0 / root_area : 0.0;
+
+		double cost = 0.0;
+		std::vector<std::pair<int, int> > stack;
+		stack.push_back(std::make_pair(0, 0));
+		while (!stack.empty())
+		{
+			const int index = stack.back().first;
+			const int depth = stack.back().second;
+			stack.pop_back();
+			const UMBvhFlatNode& node = node_list[index];
+			max_depth = std::max(max_depth, depth);
+			const double probability = node_area(node) * inv_root_area;
+			if (node.is_leaf())
+			{
+				cost += probability * node.primitive_count;
+			}
+			else
+			{
+				cost += 0.2 * probability;
+				stack.push_back(std::make_pair(index + 1, depth + 1));
+				stack.push_back(std::make_pair(node.offset, depth + 1));
+			}
 		}
-	};
+		return cost;
+	}
 
 	/**
-	 * primitive comparator
+	 * round toward negative infinity
 	 */
-	struct before_less {
-		before_less(int axis_)
-			: axis(axis_)
-		{}
-		int axis;
-		bool operator() (const UMPrimitivePtr a, const UMPrimitivePtr b) const {
-			return a->box().center()[axis] < b->box().center()[axis];
+	float round_down(double value)
+	{
+		float f = static_cast<float>(value);
+		if (static_cast<double>(f) > value)
+		{
+			f -= std::abs(f) * std::numeric_limits<float>::epsilon() + (std::numeric_limits<float>::min)();
 		}
-	};
-	
-	struct compare_bucket {
-		compare_bucket(int split, int num, int axis_, const UMBox &b)
-			: centroid(b),
-			split_bucket(split),
-			bucket_count(num),
-			axis(axis_)
-		{ }
-		bool operator()(const UMPrimitivePtr p) const;
-
-		int split_bucket;
-		int bucket_count;
-		int axis;
-		const UMBox &centroid;
-	};
-
-	bool compare_bucket::operator()(const UMPrimitivePtr p) const {
-		int b = static_cast<int>(bucket_count * (
-			(p->box().center()[axis] - centroid.minimum()[axis]) /
-			(centroid.maximum()[axis] - centroid.minimum()[axis])
-			));
-
-		if (b == bucket_count)  { b = bucket_count-1; }
-		assert(b >= 0 && b < bucket_count);
-		return b <= split_bucket;
+		return f;
 	}
 
-	struct compare_point {
-		compare_point(int axis_) : axis(axis_) {}
-		bool operator()(const UMPrimitivePtr a, const UMPrimitivePtr b) const {
-			return a->box().center()[axis] < b->box().center()[axis];
+	/**
+	 * round toward positive infinity
+	 */
+	float round_up(double value)
+	{
+		float f = static_cast<float>(value);
+		if (static_cast<double>(f) < value)
+		{
+			f += std::abs(f) * std::numeric_limits<float>::epsilon() + (std::numeric_limits<float>::min)();
 		}
-		int axis;
-	};
+		return f;
+	}
 
-	int maximum_axis(const UMBox& box) { 
-		UMVec3d v =box.maximum() - box.minimum();
-		if (v.x > v.y && v.x > v.z) {
-			return 0;
-		} else if (v.y > v.z){
-			return 1;
-		} else {
-			return 2;
+	/**
+	 * set bounds rounded outward to float
+	 */
+	void set_bounds(UMBvhFlatNode& node, const UMVec3d& minimum, const UMVec3d& maximum)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			node.minimum[k] = round_down(minimum[k]);
+			node.maximum[k] = round_up(maximum[k]);
 		}
 	}
 
 	/**
-	 *
-	 * @param [out] ordered_primitives
-	 * @param [in] scene
-	 * @param [in] start
-	 * @param [in] end
+	 * flatten tree to node list in depth first order
+	 * @param [out] dst_node_list destination node list
+	 * @param [in] root recursive root
+	 * @param [in,out] offset current index
 	 */
-	UMBvhNodePtr build_middle_split(
-		unsigned int& total_node_count,
-		UMPrimitiveList& ordered_primitives, 
-		UMScene& scene, 
-		int start, 
-		int end,
-		int& depth)
+	void flatten(UMBvhFlatNodeList& dst_node_list, const UMBvhNode& root, int& offset)
 	{
-		UMPrimitiveList& primitives = scene.mutable_primitive_list();
-		const int count = end - start;
-		
-		++total_node_count;
-
-		UMBox box_centroid;
-		for (int i = start; i < end; ++i)
+		UMBvhFlatNode& node = dst_node_list.at(offset);
+		++offset;
+		set_bounds(node, root.box_.minimum(), root.box_.maximum());
+		if (root.is_leaf())
 		{
-			UMPrimitivePtr primitive = primitives.at(i);
-			box_centroid.extend(primitive->box().center());
+			node.offset = root.start_index_;
+			node.primitive_count = root.end_index_ - root.start_index_;
+			node.axis = 0;
+			return;
 		}
+		node.primitive_count = 0;
+		node.axis = root.axis_;
+		flatten(dst_node_list, *root.left_, offset);
+		node.offset = offset;
+		flatten(dst_node_list, *root.right_, offset);
+	}
 
-		const int axis = maximum_axis(box_centroid);
-		
-		UMBvhNodePtr node(std::make_shared<UMBvhNode>());
+	/**
+	 * recompute bounds of flattened nodes keeping the topology
+	 * @param [in,out] node_list flattened nodes
+	 * @param [in] primitives primitives referred by leaves
+	 * @param [in] update_primitives update primitive boxes before use or not
+	 */
+	void refit_nodes(UMBvhFlatNodeList& node_list, const UMPrimitiveList& primitives, bool update_primitives)
+	{
+		const int node_count = static_cast<int>(node_list.size());
 
-		// create leaf
-		if (depth == 0 || count <= 4 || box_centroid.maximum()[axis] == box_centroid.minimum()[axis])
+		// leaves
+#pragma omp parallel for if (node_count > parallel_range_threshold)
+		for (int i = 0; i < node_count; ++i)
 		{
-			const int start_index = static_cast<int>(ordered_primitives.size());
-			UMBox box_all;
-			for (int i = start; i < end; ++i)
+			UMBvhFlatNode& node = node_list[i];
+			if (!node.is_leaf()) continue;
+			Bounds bounds;
+			const int end = node.offset + node.primitive_count;
+			for (int k = node.offset; k < end; ++k)
 			{
-				UMPrimitivePtr primitive = primitives.at(i);
-				box_all.extend(primitive->box());
-				ordered_primitives.push_back(primitive);
+				if (update_primitives) primitives[k]->update_box();
+				const UMBox& box = primitives[k]->box();
+				bounds.extend(box.minimum());
+				bounds.extend(box.maximum());
 			}
-			node->init_as_leaf(box_all, start_index, start_index + count);
-			return node;
+			set_bounds(node, bounds.minimum, bounds.maximum);
 		}
 
-		// create branch
-		UMVec3d centroid = box_centroid.center();
-		UMPrimitiveList::iterator middle = std::partition(
-			primitives.begin() + start, 
-			primitives.begin() + end, 
-			before_middle(axis, centroid[axis]));
-		int middle_index = static_cast<int>(std::distance(primitives.begin(), middle));
-		if (middle_index == start || middle_index == end) {
-			// split equal counts
-			middle_index = (start + end) / 2;
-			std::nth_element(
-				primitives.begin() + start,
-				primitives.begin() + middle_index,
-				primitives.begin() + end,
-				before_less(axis));
+		// branches. children are always after their parent.
+		for (int i = node_count - 1; i >= 0; --i)
+		{
+			UMBvhFlatNode& node = node_list[i];
+			if (node.is_leaf()) continue;
+			const UMBvhFlatNode& left = node_list[i + 1];
+			const UMBvhFlatNode& right = node_list[node.offset];
+			for (int k = 0; k < 3; ++k)
+			{
+				node.minimum[k] = std::min(left.minimum[k], right.minimum[k]);
+				node.maximum[k] = std::max(left.maximum[k], right.maximum[k]);
+			}
 		}
-
-		--depth;
-		node->init_as_branch(
-			build_middle_split(total_node_count, ordered_primitives, scene, start, middle_index, depth),
-			build_middle_split(total_node_count, ordered_primitives, scene, middle_index, end, depth),
-			axis);
-
-		return node;
 	}
-	
+
 	/**
-	 *
-	 * @param [out] ordered_primitives
-	 * @param [in] scene
-	 * @param [in] start
-	 * @param [in] end
-	 */
-	UMBvhNodePtr build_sah(
-		unsigned int& total_node_count,
-		UMPrimitiveList& ordered_primitives, 
-		UMScene& scene, 
-		int start, 
-		int end,
-		int& depth)
+	 * recompute bounds of flattened nodes from faces of an updated mesh
+	 * @param [in,out] node_list flattened nodes
+	 * @param [in] mesh mesh
+	 * @param [in] face_order face indices referred by leaves
+	 */
+	void refit_mesh_nodes(UMBvhFlatNodeList& node_list, const UMMesh& mesh, const std::vector<int>& face_order)
 	{
-		UMPrimitiveList& primitives = scene.mutable_primitive_list();
-		const int count = end - start;
-		
-		++total_node_count;
-		
-		UMBox box_all;
-		UMBox box_centroid;
-		for (int i = start; i < end; ++i)
+		const int node_count = static_cast<int>(node_list.size());
+
+		// leaves
+#pragma omp parallel for if (node_count > parallel_range_threshold)
+		for (int i = 0; i < node_count; ++i)
 		{
-			UMPrimitivePtr primitive = primitives.at(i);
-			box_all.extend(primitive->box());
-			box_centroid.extend(primitive->box().center());
-		}
-		const int axis = maximum_axis(box_centroid);
-		
-		UMBvhNodePtr node(std::make_shared<UMBvhNode>());
-		
-		// create leaf
-		if (depth == 0 || box_centroid.maximum()[axis] == box_centroid.minimum()[axis])
-		{
-			const int start_index = static_cast<int>(ordered_primitives.size());
-			for (int i = start; i < end; ++i)
-			{
-				UMPrimitivePtr primitive = primitives.at(i);
-				ordered_primitives.push_back(primitive);
-			}
-			node->init_as_leaf(box_all, start_index, start_index + count);
-			return node;
-		}
-		
-		// Partition primitives into two sets and build children
-		int middle_index = (start + end) / 2;
-		{
-			// Allocate _BucketInfo_ for SAH partition buckets
-			const int buckets_count = 12;
-			struct BucketInfo {
-				BucketInfo() { count = 0; }
-				int count;
-				UMBox bounds;
-			};
-			BucketInfo buckets[buckets_count];
-			
-			// Initialize _BucketInfo_ for SAH partition buckets
-			for (int i = start; i < end; ++i)
-			{
-				int b = static_cast<int>(buckets_count * 
-					((primitives.at(i)->box().center()[axis] - box_centroid.minimum()[axis]) /
-					(box_centroid.maximum()[axis] - box_centroid.minimum()[axis])));
-				if (b == buckets_count) { 
-					b = buckets_count-1;
-				}
-				assert(b >= 0 && b < buckets_count);
-				buckets[b].count++;
-				buckets[b].bounds.extend(primitives[i]->box());
-			}
-			
-			// Compute costs for splitting after each bucket
-			double cost[buckets_count-1];
-			for (int i = 0; i < buckets_count-1; ++i) {
-				UMBox b0;
-				UMBox b1;
-				int count0 = 0;
-				int count1 = 0;
-				for (int k = 0; k <= i; ++k) {
-					b0.extend(buckets[k].bounds);
-					count0 += buckets[k].count;
-				}
-				for (int k = i+1; k < buckets_count; ++k) {
-					b1.extend(buckets[k].bounds);
-					count1 += buckets[k].count;
-				}
-				cost[i] = sah(
-					box_all.area(),
-					b0.area(), count0,
-					b1.area(), count1);
-			}
-			
-			// Find bucket to split at that minimizes SAH metric
-			double min_cost = cost[0];
-			unsigned int min_cost_split = 0;
-			for (int i = 1; i < buckets_count-1; ++i) {
-				if (cost[i] < min_cost) {
-					min_cost = cost[i];
-					min_cost_split = i;
-				}
-			}
-			
-			// Either create leaf or split primitives at selected SAH bucket
-			if (count > 255 || min_cost < count) {
-				UMPrimitiveList::iterator middle = std::partition(
-					primitives.begin() + start, 
-					primitives.begin() + end, 
-					compare_bucket(min_cost_split, buckets_count, axis, box_centroid));
-				middle_index = static_cast<int>(std::distance(primitives.begin(), middle));
-				if (middle_index <= start || middle_index >= end)
-				{
-					middle_index = (start + end) / 2;
-				}
-			}
-			else
+			UMBvhFlatNode& node = node_list[i];
+			if (!node.is_leaf()) continue;
+			Bounds bounds;
+			const int end = node.offset + node.primitive_count;
+			for (int k = node.offset; k < end; ++k)
 			{
-				// create leaf
-				int start_index = static_cast<int>(ordered_primitives.size());
-				for (int i = start; i < end; ++i) {
-					UMPrimitivePtr primitive = primitives.at(i);
-					ordered_primitives.push_back(primitive);
-				}
-				node->init_as_leaf(box_all, start_index, start_index + count);
-				return node;
+				const UMVec3i& face = mesh.face_list()[face_order[k]];
+				bounds.extend(mesh.vertex(face.x));
+				bounds.extend(mesh.vertex(face.y));
+				bounds.extend(mesh.vertex(face.z));
 			}
+			set_bounds(node, bounds.minimum, bounds.maximum);
 		}
 
-		--depth;
-		node->init_as_branch(
-			build_sah(total_node_count, ordered_primitives, scene, start, middle_index, depth),
-			build_sah(total_node_count, ordered_primitives, scene, middle_index, end, depth),
-			axis);
-
-		return node;
+		// branches. children are always after their parent.
+		for (int i = node_count - 1; i >= 0; --i)
+		{
+			UMBvhFlatNode& node = node_list[i];
+			if (node.is_leaf()) continue;
+			const UMBvhFlatNode& left = node_list[i + 1];
+			const UMBvhFlatNode& right = node_list[node.offset];
+			for (int k = 0; k < 3; ++k)
+			{
+				node.minimum[k] = std::min(left.minimum[k], right.minimum[k]);
+				node.maximum[k] = std::max(left.maximum[k], right.maximum[k]);
+			}
+		}
 	}
 
 	/**
-	 * @param [out] dst_node_list destination node list
-	 * @param [in] root recursive root
-	 * @param [in] offset current index
+	 * build bvh node tree by a build method
+	 * @param [in,out] build_primitives primitives. replaced by references in leaf order.
+	 * @param [in] triangles vertices to clip references. used by eSpatialSplit
+	 * @param [in] method build method
+	 * @param [in] budget max count of duplicated references by eSpatialSplit
+	 * @param [in] treelet_optimization restructure treelets of eLinear or not
+	 * @retval root node
 	 */
-	void flatten(UMBvhNodeList& dst_node_list, UMBvhNodePtr root, unsigned int& offset)
+	UMBvhNodePtr build_node_tree(
+		BuildPrimitiveList& build_primitives,
+		const ClipTriangleList& triangles,
+		UMBvh::BuildMethod method,
+		int budget,
+		bool treelet_optimization)
 	{
-		if (!root) return;
-		root->flat_index_ = offset;
-		dst_node_list.at(root->flat_index_) = root;
-		++offset;
-
-		flatten(dst_node_list, root->left_, offset);
-		flatten(dst_node_list, root->right_, offset);
+		UMBvhNodePtr root(std::make_shared<UMBvhNode>());
+		if (method == UMBvh::eSpatialSplit)
+		{
+			BuildPrimitiveList leaf_references;
+			build_spatial_tree(triangles, *root, build_primitives, budget, leaf_references);
+			build_primitives.swap(leaf_references);
+		}
+		else if (method == UMBvh::eLinear)
+		{
+			build_linear_tree(build_primitives, *root, treelet_optimization);
+		}
+		else
+		{
+			BuildContext context(build_primitives, method);
+			build_tree(context, *root);
+		}
+		return root;
 	}
 
 } // anonymouse namespace
@@ -397,31 +2022,32 @@ namespace burger
 
 
 static bool intersect_box(
-	const UMBox& bounds, 
+	const UMBvhFlatNode& node,
 	const UMRay& ray,
-	const UMVec3d& inv_dir, 
+	const UMVec3d& inv_dir,
 	const UMVec3i& dir_is_negative,
 	double closest_distance)
 {
+	const float* bounds[] = { node.minimum, node.maximum };
 	double interval_min = ray.tmin();
 	double interval_max = closest_distance;
 
 	// intersection of x and y slabs
-	double txmin =  (bounds[  dir_is_negative[0]].x - ray.origin().x) * inv_dir.x;
-	double txmax =  (bounds[1-dir_is_negative[0]].x - ray.origin().x) * inv_dir.x;
+	double txmin =  (bounds[  dir_is_negative[0]][0] - ray.origin().x) * inv_dir.x;
+	double txmax =  (bounds[1-dir_is_negative[0]][0] - ray.origin().x) * inv_dir.x;
 	if (txmin > interval_min) interval_min = txmin;
 	if (txmax < interval_max) interval_max = txmax;
 	if (interval_min > interval_max) return false;
 	
-	double tymin = (bounds[  dir_is_negative[1]].y - ray.origin().y) * inv_dir.y;
-	double tymax = (bounds[1-dir_is_negative[1]].y - ray.origin().y) * inv_dir.y;
+	double tymin = (bounds[  dir_is_negative[1]][1] - ray.origin().y) * inv_dir.y;
+	double tymax = (bounds[1-dir_is_negative[1]][1] - ray.origin().y) * inv_dir.y;
 	if (tymin > interval_min) interval_min = tymin;
 	if (tymax < interval_max) interval_max = tymax;
 	if (interval_min > interval_max) return false;
 
 	// intersection against z slab
-	double tzmin = (bounds[  dir_is_negative[2]].z - ray.origin().z) * inv_dir.z;
-	double tzmax = (bounds[1-dir_is_negative[2]].z - ray.origin().z) * inv_dir.z;;
+	double tzmin = (bounds[  dir_is_negative[2]][2] - ray.origin().z) * inv_dir.z;
+	double tzmax = (bounds[1-dir_is_negative[2]][2] - ray.origin().z) * inv_dir.z;
 	if (tzmin > interval_min) interval_min = tzmin;
 	if (tzmax < interval_max) interval_max = tzmax;
 	return (interval_min <= interval_max) ;
@@ -441,37 +2067,292 @@ bool UMBvh::build(UMScenePtr scene)
  */
 bool UMBvh::build(UMScene& scene)
 {
+	// unbounded primitives are tested by the scene, not by the bvh
 	UMPrimitiveList& primitives = scene.mutable_primitive_list();
+	UMPrimitiveList& unbounded_primitives = scene.mutable_unbounded_primitive_list();
+	const size_t unbounded_count = unbounded_primitives.size();
+	UMPrimitiveList bounded_primitives;
+	bounded_primitives.reserve(primitives.size());
+	for (UMPrimitiveList::const_iterator it = primitives.begin(); it != primitives.end(); ++it)
+	{
+		if ((*it)->is_bounded())
+		{
+			bounded_primitives.push_back(*it);
+		}
+		else
+		{
+			unbounded_primitives.push_back(*it);
+		}
+	}
+	if (bounded_primitives.empty())
+	{
+		build(bounded_primitives);
+		primitives.clear();
+		return true;
+	}
+	if (!build(bounded_primitives))
+	{
+		unbounded_primitives.resize(unbounded_count);
+		return false;
+	}
+
+	primitives.clear();
+	primitives.push_back(self_ptr());
+	return true;
+}
+
+/**
+ * clear built tree
+ */
+void UMBvh::clear()
+{
+	node_list_.clear();
+	ordered_primitives_.clear();
+	primitive_order_.clear();
+	source_primitives_.clear();
+	mesh_.reset();
+	is_cache_loaded_ = false;
+	quad_.reset();
+	oct_.reset();
+	compressed8_.reset();
+	compressed16_.reset();
+	box_.init();
+	sah_cost_ = 0.0;
+	built_sah_cost_ = 0.0;
+	depth_ = 0;
+}
+
+/**
+ * flatten node tree to node list. the node tree is released after this.
+ */
+void UMBvh::set_tree(const UMBvhNode& root)
+{
+	node_list_.resize(count_nodes(root));
+	int offset = 0;
+	flatten(node_list_, root, offset);
+	box_.set_minimum(root.box_.minimum());
+	box_.set_maximum(root.box_.maximum());
+
+	sah_cost_ = evaluate_tree(node_list_, depth_);
+	built_sah_cost_ = sah_cost_;
+}
+
+/**
+ * build bvh from primitives
+ */
+bool UMBvh::build(const UMPrimitiveList& primitives)
+{
+	const double start_time = current_seconds();
 	const int primitive_count = static_cast<int>(primitives.size());
 	
-	ordered_primitives_.reserve(primitive_count);
-	unsigned int total_node_count = 0;
+	clear();
+	if (primitive_count == 0)
+	{
+		build_time_ = current_seconds() - start_time;
+		return false;
+	}
 
-	int max_depth = (std::numeric_limits<int>::max)();
+	// precompute bounds and centroids
+	BuildPrimitiveList build_primitives;
+	create_build_primitives(build_primitives, primitives);
 
 	// create bvh node tree
-	UMBvhNodePtr root = build_middle_split(
-	//UMBvhNodePtr root = build_sah(
-		total_node_count,
-		ordered_primitives_, 
-		scene, 
-		0, 
-		primitive_count,
-		max_depth);
+	ClipTriangleList triangles;
+	if (build_method_ == eSpatialSplit)
+	{
+		create_clip_triangles(triangles, primitives);
+	}
+	const int budget = static_cast<int>(primitive_count * spatial_split_budget_);
+	UMBvhNodePtr root = build_node_tree(build_primitives, triangles, build_method_, budget, treelet_optimization_);
+
+	// leaves refer to ranges of build_primitives
+	const int reference_count = static_cast<int>(build_primitives.size());
+	ordered_primitives_.resize(reference_count);
+	primitive_order_.resize(reference_count);
+	for (int i = 0; i < reference_count; ++i)
+	{
+		primitive_order_[i] = build_primitives[i].index;
+		ordered_primitives_[i] = primitives[build_primitives[i].index];
+	}
+	if (reference_count > primitive_count)
+	{
+		source_primitives_ = primitives;
+	}
 
-	int depth = (std::numeric_limits<int>::max)() - max_depth;
+	set_tree(*root);
+	leaves_.build(ordered_primitives_, leaf_precision_);
+	create_wide_nodes();
 
-	primitives.clear();
-	primitives.push_back(self_ptr());
+	build_time_ = current_seconds() - start_time;
+	return true;
+}
 
-	// flatten to list
-	node_list_.resize(total_node_count);
-	unsigned int offset = 0;
-	flatten(node_list_, root, offset);
+/**
+ * build bvh from faces of a mesh
+ */
+bool UMBvh::build(UMMeshPtr mesh)
+{
+	const double start_time = current_seconds();
+	
+	clear();
+	const int face_count = mesh ? static_cast<int>(mesh->face_list().size()) : 0;
+	if (face_count == 0)
+	{
+		build_time_ = current_seconds() - start_time;
+		return false;
+	}
+	mesh_ = mesh;
+
+	// precompute bounds and centroids
+	BuildPrimitiveList build_primitives;
+	create_build_faces(build_primitives, *mesh_);
+
+	// create bvh node tree
+	ClipTriangleList triangles;
+	if (build_method_ == eSpatialSplit)
+	{
+		create_clip_faces(triangles, *mesh_);
+	}
+	const int budget = static_cast<int>(face_count * spatial_split_budget_);
+	UMBvhNodePtr root = build_node_tree(build_primitives, triangles, build_method_, budget, treelet_optimization_);
+
+	// leaves refer to faces by index
+	const int reference_count = static_cast<int>(build_primitives.size());
+	primitive_order_.resize(reference_count);
+	for (int i = 0; i < reference_count; ++i)
+	{
+		primitive_order_[i] = build_primitives[i].index;
+	}
+
+	set_tree(*root);
+	leaves_.build(mesh_, primitive_order_, leaf_precision_);
+	create_wide_nodes();
+
+	build_time_ = current_seconds() - start_time;
+	return true;
+}
+
+/**
+ * refit bvh to updated primitives
+ */
+bool UMBvh::refit()
+{
+	if (node_list_.empty()) return false;
+	const double start_time = current_seconds();
+
+	if (mesh_)
+	{
+		refit_mesh_nodes(node_list_, *mesh_, primitive_order_);
+	}
+	else if (source_primitives_.empty())
+	{
+		refit_nodes(node_list_, ordered_primitives_, true);
+	}
+	else
+	{
+		// references are duplicated. update each primitive once.
+		const int primitive_count = static_cast<int>(source_primitives_.size());
+#pragma omp parallel for if (primitive_count > parallel_range_threshold)
+		for (int i = 0; i < primitive_count; ++i)
+		{
+			source_primitives_[i]->update_box();
+		}
+		refit_nodes(node_list_, ordered_primitives_, false);
+	}
+
+	int depth = 0;
+	sah_cost_ = evaluate_tree(node_list_, depth);
+	if (built_sah_cost_ > 0.0 && sah_cost_ > built_sah_cost_ * rebuild_threshold_)
+	{
+		// the tree is too degraded. rebuild it.
+		bool result = false;
+		if (mesh_)
+		{
+			const UMMeshPtr mesh(mesh_);
+			result = build(mesh);
+		}
+		else
+		{
+			const UMPrimitiveList primitives(source_primitives_.empty() ? ordered_primitives_ : source_primitives_);
+			result = build(primitives);
+		}
+		refit_time_ = current_seconds() - start_time;
+		return result;
+	}
 
+	const UMBvhFlatNode& root = node_list_[0];
+	box_.set_minimum(UMVec3d(root.minimum[0], root.minimum[1], root.minimum[2]));
+	box_.set_maximum(UMVec3d(root.maximum[0], root.maximum[1], root.maximum[2]));
+	leaves_.refit(ordered_primitives_);
+	if (quad_) quad_->refit(node_list_);
+	if (oct_) oct_->refit(node_list_, leaves_);
+	if (compressed8_) compressed8_->refit(node_list_);
+	if (compressed16_) compressed16_->refit(node_list_);
+
+	refit_time_ = current_seconds() - start_time;
 	return true;
 }
 
+/**
+ * create wide nodes from binary nodes by node layout
+ */
+void UMBvh::create_wide_nodes()
+{
+	quad_.reset();
+	oct_.reset();
+	compressed8_.reset();
+	compressed16_.reset();
+	if (node_layout_ == eCompressedNode)
+	{
+		compressed8_ = std::make_shared<UMBvhCompressed8>();
+		if (compressed8_->build(node_list_)) return;
+		// leaves are too large to be compressed
+		compressed8_.reset();
+	}
+	else if (node_layout_ == eCompressedNode16)
+	{
+		compressed16_ = std::make_shared<UMBvhCompressed16>();
+		if (compressed16_->build(node_list_)) return;
+		// leaves are too large to be compressed
+		compressed16_.reset();
+	}
+	if (node_layout_ == eOctNode && UMBvhOct::is_supported())
+	{
+		oct_ = std::make_shared<UMBvhOct>();
+		oct_->build(node_list_, leaves_);
+	}
+	else if (node_layout_ != eBinaryNode)
+	{
+		quad_ = std::make_shared<UMBvhQuad>();
+		quad_->build(node_list_);
+	}
+}
+
+/**
+ * copy build settings
+ */
+void UMBvh::set_build_settings(const UMBvh& bvh)
+{
+	build_method_ = bvh.build_method_;
+	node_layout_ = bvh.node_layout_;
+	leaf_precision_ = bvh.leaf_precision_;
+	spatial_split_budget_ = bvh.spatial_split_budget_;
+	treelet_optimization_ = bvh.treelet_optimization_;
+	rebuild_threshold_ = bvh.rebuild_threshold_;
+}
+
+/**
+ * get byte size of nodes used by traversal
+ */
+size_t UMBvh::node_memory_size() const
+{
+	if (oct_) return oct_->node_count() * sizeof(UMBvhOctNode);
+	if (quad_) return quad_->node_count() * sizeof(UMBvhQuadNode);
+	if (compressed8_) return compressed8_->node_count() * sizeof(UMBvhCompressed8::Node);
+	if (compressed16_) return compressed16_->node_count() * sizeof(UMBvhCompressed16::Node);
+	return node_list_.size() * sizeof(UMBvhFlatNode);
+}
+
 /**
  * (for debug) get box list
  */
@@ -482,8 +2363,10 @@ UMPrimitiveList UMBvh::create_box_list() const
 	box_list.resize(box_count);
 	for (int i = 0; i < box_count; ++i)
 	{
-		const UMBox& box = node_list_.at(i)->box_;
-		UMBoxPtr newbox(new UMBox(box.minimum(), box.maximum()));
+		const UMBvhFlatNode& node = node_list_.at(i);
+		UMBoxPtr newbox(new UMBox(
+			UMVec3d(node.minimum[0], node.minimum[1], node.minimum[2]),
+			UMVec3d(node.maximum[0], node.maximum[1], node.maximum[2])));
 		box_list.at(i) = newbox;
 	}
 	return box_list;
@@ -493,47 +2376,77 @@ UMPrimitiveList UMBvh::create_box_list() const
  * ray intersection
  */
 bool UMBvh::intersects(const UMRay& ray, UMShaderParameter& param) const
+{
+	UMHit hit;
+	if (!intersects(ray, hit)) return false;
+	hit.shade(ray, param);
+	return true;
+}
+
+/**
+ * ray intersection without shading
+ */
+bool UMBvh::intersects(const UMRay& ray, UMHit& hit) const
 {
 	if (node_list_.empty()) return false;
-	
+	bool found = false;
+	if (oct_) found = oct_->intersects(ray, ordered_primitives_, leaves_, hit);
+	else if (quad_) found = quad_->intersects(ray, ordered_primitives_, leaves_, hit);
+	else if (compressed8_) found = compressed8_->intersects(ray, ordered_primitives_, leaves_, hit);
+	else if (compressed16_) found = compressed16_->intersects(ray, ordered_primitives_, leaves_, hit);
+	else found = intersects_binary(ray, hit, NULL);
+	// triangles of leaves are shaded by this
+	if (found && !hit.primitive) hit.primitive = this;
+	return found;
+}
+
+/**
+ * set shading parameters of a triangle hit
+ */
+void UMBvh::shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const
+{
+	leaves_.shade(ray, ordered_primitives_, hit, param);
+}
+
+/**
+ * ray intersection counting traversal steps
+ */
+bool UMBvh::intersects(const UMRay& ray, UMShaderParameter& param, UMBvhTraversalCount& count) const
+{
+	if (node_list_.empty()) return false;
+	UMHit hit;
+	if (!intersects_binary(ray, hit, &count)) return false;
+	if (!hit.primitive) hit.primitive = this;
+	hit.shade(ray, param);
+	return true;
+}
+
+/**
+ * ray intersection by binary nodes
+ */
+bool UMBvh::intersects_binary(const UMRay& ray, UMHit& hit, UMBvhTraversalCount* count) const
+{
 	UMVec3d inv_dir(1.0 / ray.direction().x, 1.0 / ray.direction().y, 1.0 / ray.direction().z);
 	UMVec3i dir_is_negative(inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0);
+	const UMBvhLeafRay leaf_ray(ray, leaves_.precision());
 	
-	double closest_distance = (std::numeric_limits<double>::max)();
-	UMShaderParameter parameter;
-	
-	int box_intersect_count = 0;
-	int triangle_intersect_count = 0;
-
-	bool hit = false;
+	bool found = false;
 	unsigned int branch_stack[1024];
 	unsigned int branch_stack_index = 0;
 
-	unsigned int primitive_count = static_cast<unsigned int>(ordered_primitives_.size());
-
-	int count = 0;
 	for (unsigned int i = 0; ; )
 	{
-		const UMBvhNodePtr& node = node_list_[i];
-		//if (node->box_.intersects(ray))
-		if (intersect_box(node->box_, ray, inv_dir, dir_is_negative, closest_distance))
+		const UMBvhFlatNode& node = node_list_[i];
+		if (count) ++count->node_test_count;
+		if (intersect_box(node, ray, inv_dir, dir_is_negative, hit.distance))
 		{
-			++box_intersect_count;
-			if (node->is_leaf())
+			if (node.is_leaf())
 			{
-				for (int k = node->start_index_; k < node->end_index_; ++k)
+				const int end = node.offset + node.primitive_count;
+				if (count) count->primitive_test_count += node.primitive_count;
+				if (leaves_.intersects(leaf_ray, ordered_primitives_, node.offset, end, hit))
 				{
-					if (ordered_primitives_[k]->intersects(ray, parameter))
-					{
-						++triangle_intersect_count;
-						if (parameter.distance < closest_distance)
-						{
-							++count;
-							closest_distance = parameter.distance;
-							param = parameter;
-							hit = true;
-						}
-					}
+					found = true;
 				}
 				// not hit. branch stack is empty.
 				if (branch_stack_index == 0) break;
@@ -543,17 +2456,17 @@ bool UMBvh::intersects(const UMRay& ray, UMShaderParameter& param) const
 			// is branch
 			else
 			{
-				if (dir_is_negative[node->axis_])
+				if (dir_is_negative[node.axis])
 				{
 					// push left branch index
 					branch_stack[branch_stack_index++] = i + 1;
 					// go to right
-					i = node->right_->flat_index_;
+					i = node.offset;
 				}
 				else
 				{
 					// push right branch index
-					branch_stack[branch_stack_index++] = node->right_->flat_index_;
+					branch_stack[branch_stack_index++] = node.offset;
 					// go to left
 					++i;
 				}
@@ -567,7 +2480,7 @@ bool UMBvh::intersects(const UMRay& ray, UMShaderParameter& param) const
 			i = branch_stack[--branch_stack_index];
 		}
 	}
-	return hit;
+	return found;
 }
 
 /**
@@ -576,27 +2489,29 @@ bool UMBvh::intersects(const UMRay& ray, UMShaderParameter& param) const
 bool UMBvh::intersects(const UMRay& ray) const
 {
 	if (node_list_.empty()) return false;
+	if (oct_) return oct_->intersects(ray, ordered_primitives_, leaves_);
+	if (quad_) return quad_->intersects(ray, ordered_primitives_, leaves_);
+	if (compressed8_) return compressed8_->intersects(ray, ordered_primitives_, leaves_);
+	if (compressed16_) return compressed16_->intersects(ray, ordered_primitives_, leaves_);
 	
 	UMVec3d inv_dir(1.0 / ray.direction().x, 1.0 / ray.direction().y, 1.0 / ray.direction().z);
 	UMVec3i dir_is_negative(inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0);
+	const UMBvhLeafRay leaf_ray(ray, leaves_.precision());
 	
 	bool hit = false;
 	unsigned int branch_stack[1024];
 	unsigned int branch_stack_index = 0;
 	for (unsigned int i = 0; ; )
 	{
-		const UMBvhNodePtr& node = node_list_[i];
-		//if (node->box_.intersects(ray))
-		if (intersect_box(node->box_, ray, inv_dir, dir_is_negative, ray.tmax()))
+		const UMBvhFlatNode& node = node_list_[i];
+		if (intersect_box(node, ray, inv_dir, dir_is_negative, ray.tmax()))
 		{
-			if (node->is_leaf())
+			if (node.is_leaf())
 			{
-				for (int k = node->start_index_; k < node->end_index_; ++k)
+				const int end = node.offset + node.primitive_count;
+				if (leaves_.intersects(leaf_ray, ordered_primitives_, node.offset, end))
 				{
-					if (ordered_primitives_[k]->intersects(ray))
-					{
-						return true;
-					}
+					return true;
 				}
 				// not hit. branch stack is empty.
 				if (branch_stack_index == 0) break;
@@ -606,17 +2521,17 @@ bool UMBvh::intersects(const UMRay& ray) const
 			// is branch
 			else
 			{
-				if (dir_is_negative[node->axis_])
+				if (dir_is_negative[node.axis])
 				{
 					// push left branch index
 					branch_stack[branch_stack_index++] = i + 1;
 					// go to right
-					i = node->right_->flat_index_;
+					i = node.offset;
 				}
 				else
 				{
 					// push right branch index
-					branch_stack[branch_stack_index++] = node->right_->flat_index_;
+					branch_stack[branch_stack_index++] = node.offset;
 					// go to left
 					++i;
 				}
@@ -638,12 +2553,7 @@ bool UMBvh::intersects(const UMRay& ray) const
  */
 const UMBox& UMBvh::box() const
 {
-	if (!node_list_.empty())
-	{
-		return (*node_list_.begin())->box_;
-	}
-	static UMBox empty;
-	return empty;
+	return box_;
 }
 
 } // burger
@@ -16,6 +16,10 @@
 #include "UMMacro.h"
 #include "UMMath.h"
 #include "UMPrimitive.h"
+#include "UMBox.h"
+#include "UMAlignedAllocator.h"
+#include "UMBvhLeaves.h"
+#include "UMMesh.h"
 
 namespace burger
 {
@@ -27,9 +31,54 @@ typedef std::weak_ptr<UMBvh> UMBvhWeakPtr;
 class UMScene;
 typedef std::shared_ptr<UMScene> UMScenePtr;
 
+class UMBvhQuad;
+typedef std::shared_ptr<UMBvhQuad> UMBvhQuadPtr;
+
+class UMBvhOct;
+typedef std::shared_ptr<UMBvhOct> UMBvhOctPtr;
+
 class UMBvhNode;
-typedef std::shared_ptr<UMBvhNode> UMBvhNodePtr;
-typedef std::vector<UMBvhNodePtr> UMBvhNodeList;
+
+template <class T> class UMBvhCompressed;
+typedef std::shared_ptr<UMBvhCompressed<unsigned char> > UMBvhCompressed8Ptr;
+typedef std::shared_ptr<UMBvhCompressed<unsigned short> > UMBvhCompressed16Ptr;
+
+/**
+ * flattened bvh node.
+ * 32 bytes. bounds are rounded outward to float.
+ * the first child of a branch is the next node.
+ */
+struct UMBvhFlatNode
+{
+	/**
+	 * is leaf or not
+	 */
+	bool is_leaf() const { return primitive_count > 0; }
+
+	/// minimum of AABB
+	float minimum[3];
+	/// leaf: first index of ordered primitives. branch: index of second child
+	int offset;
+	/// maximum of AABB
+	float maximum[3];
+	/// primitive count of leaf. 0 for branch
+	unsigned int primitive_count : 30;
+	/// split axis of branch
+	unsigned int axis : 2;
+};
+typedef std::vector<UMBvhFlatNode, UMAlignedAllocator<UMBvhFlatNode, 32> > UMBvhFlatNodeList;
+
+/**
+ * counts of tests in a traversal
+ */
+struct UMBvhTraversalCount
+{
+	UMBvhTraversalCount() : node_test_count(0), primitive_test_count(0) {}
+	/// ray box tests
+	unsigned int node_test_count;
+	/// ray primitive tests
+	unsigned int primitive_test_count;
+};
 
 /**
  * a bounding volume hierarchy using SAH(surface area heuristic)
@@ -39,6 +88,27 @@ class UMBvh : public UMPrimitive
 	DISALLOW_COPY_AND_ASSIGN(UMBvh);
 
 public:
+	
+	/**
+	 * build methods
+	 */
+	enum BuildMethod {
+		eMiddleSplit,
+		eBinnedSAH,
+		eSpatialSplit, // binned SAH with spatial splits duplicating references (SBVH)
+		eLinear // morton code order (LBVH). fast build
+	};
+
+	/**
+	 * node layouts used by traversal
+	 */
+	enum NodeLayout {
+		eBinaryNode,
+		eQuadNode,
+		eOctNode, // falls back to eQuadNode without AVX. not yet faster than eQuadNode, see NodeLayoutBenchmark
+		eCompressedNode, // 4-wide with 8bit quantized child bounds. falls back to eQuadNode if a leaf is too large
+		eCompressedNode16 // 4-wide with 16bit quantized child bounds. same fallback as eCompressedNode
+	};
 
 	static UMBvhPtr create() { 
 		UMBvhPtr instance = UMBvhPtr(new UMBvh);
@@ -56,12 +126,260 @@ public:
 	bool build(UMScenePtr scene);
 	
 	/**
-	 * build bvh from scene
+	 * build bvh from scene.
+	 * primitive list of the scene is replaced by this bvh.
+	 * unbounded primitives are moved to unbounded primitive list of the scene.
 	 * @param [in,out] scene scene
 	 * @retval success or fail
 	 */
 	bool build(UMScene& scene);
 
+	/**
+	 * build bvh from primitives.
+	 * the primitive list is not changed.
+	 * @param [in] primitives primitives
+	 * @retval success or fail
+	 */
+	bool build(const UMPrimitiveList& primitives);
+
+	/**
+	 * build bvh from primitives using a cache file.
+	 * loads the cache if it has the key, else builds and writes the cache.
+	 * @param [in] primitives primitives in the same order as the cache was written
+	 * @param [in] path cache file path
+	 * @param [in] key hash of contents of primitives. build settings are added to this.
+	 * @retval success or fail
+	 */
+	bool build(const UMPrimitiveList& primitives, const std::string& path, unsigned long long key);
+
+	/**
+	 * build bvh from faces of a mesh.
+	 * faces are referred by index, no primitive is created per face.
+	 * @param [in] mesh mesh
+	 * @retval success or fail
+	 */
+	bool build(UMMeshPtr mesh);
+
+	/**
+	 * build bvh from faces of a mesh using a cache file.
+	 * the cache is compatible with the one built from triangles of the faces in face order.
+	 * @param [in] mesh mesh
+	 * @param [in] path cache file path
+	 * @param [in] key hash of contents of the mesh. build settings are added to this.
+	 * @retval success or fail
+	 */
+	bool build(UMMeshPtr mesh, const std::string& path, unsigned long long key);
+
+	/**
+	 * write nodes and primitive order to a cache file
+	 * @param [in] path cache file path
+	 * @param [in] key hash of contents of primitives
+	 * @retval success or fail
+	 */
+	bool save_cache(const std::string& path, unsigned long long key) const;
+
+	/**
+	 * read nodes and primitive order from a cache file.
+	 * fails if the key or the build settings differ.
+	 * @param [in] primitives primitives in the same order as the cache was written
+	 * @param [in] path cache file path
+	 * @param [in] key hash of contents of primitives
+	 * @retval success or fail
+	 */
+	bool load_cache(const UMPrimitiveList& primitives, const std::string& path, unsigned long long key);
+
+	/**
+	 * read nodes and face order from a cache file.
+	 * fails if the key or the build settings differ.
+	 * @param [in] mesh mesh
+	 * @param [in] path cache file path
+	 * @param [in] key hash of contents of the mesh
+	 * @retval success or fail
+	 */
+	bool load_cache(UMMeshPtr mesh, const std::string& path, unsigned long long key);
+
+	/**
+	 * 64bit FNV-1a hash for cache keys
+	 * @param [in] data data
+	 * @param [in] size byte size of data
+	 * @param [in] seed previous hash to be continued
+	 */
+	static unsigned long long hash(const void* data, size_t size, unsigned long long seed);
+
+	/**
+	 * 64bit FNV-1a hash for cache keys
+	 * @param [in] data data
+	 * @param [in] size byte size of data
+	 */
+	static unsigned long long hash(const void* data, size_t size);
+	
+	/**
+	 * refit node bounds to updated primitives keeping the topology.
+	 * calls update_box() of all primitives, then updates nodes bottom-up.
+	 * rebuilds the tree if SAH cost exceeds rebuild_threshold() times the cost at build.
+	 * @retval success or fail
+	 */
+	bool refit();
+
+	/**
+	 * get build method
+	 */
+	BuildMethod build_method() const { return build_method_; }
+
+	/**
+	 * set build method
+	 * @param [in] method build method used by next build
+	 */
+	void set_build_method(BuildMethod method) { build_method_ = method; }
+
+	/**
+	 * get spatial split budget
+	 */
+	double spatial_split_budget() const { return spatial_split_budget_; }
+
+	/**
+	 * set spatial split budget
+	 * @param [in] budget max ratio of duplicated references to primitives by eSpatialSplit
+	 */
+	void set_spatial_split_budget(double budget) { spatial_split_budget_ = budget; }
+
+	/**
+	 * get treelet optimization
+	 */
+	bool treelet_optimization() const { return treelet_optimization_; }
+
+	/**
+	 * set treelet optimization
+	 * @param [in] optimization restructure treelets of eLinear by SAH or not
+	 */
+	void set_treelet_optimization(bool optimization) { treelet_optimization_ = optimization; }
+
+	/**
+	 * get node layout
+	 */
+	NodeLayout node_layout() const { return node_layout_; }
+
+	/**
+	 * set node layout
+	 * @param [in] layout node layout used by next build
+	 */
+	void set_node_layout(NodeLayout layout) { node_layout_ = layout; }
+
+	/**
+	 * get leaf precision
+	 */
+	UMBvhLeafPrecision leaf_precision() const { return leaf_precision_; }
+
+	/**
+	 * set leaf precision
+	 * @param [in] precision precision of triangles stored in leaves by next build
+	 */
+	void set_leaf_precision(UMBvhLeafPrecision precision) { leaf_precision_ = precision; }
+
+	/**
+	 * get 4-wide bvh. exists if node layout is eQuadNode
+	 */
+	UMBvhQuadPtr quad() const { return quad_; }
+
+	/**
+	 * get 8-wide bvh. exists if node layout is eOctNode and AVX is supported
+	 */
+	UMBvhOctPtr oct() const { return oct_; }
+
+	/**
+	 * get 8bit compressed bvh. exists if node layout is eCompressedNode
+	 */
+	UMBvhCompressed8Ptr compressed8() const { return compressed8_; }
+
+	/**
+	 * get 16bit compressed bvh. exists if node layout is eCompressedNode16
+	 */
+	UMBvhCompressed16Ptr compressed16() const { return compressed16_; }
+
+	/**
+	 * get byte size of nodes used by traversal
+	 */
+	size_t node_memory_size() const;
+
+	/**
+	 * get rebuild threshold
+	 */
+	double rebuild_threshold() const { return rebuild_threshold_; }
+
+	/**
+	 * set rebuild threshold
+	 * @param [in] threshold refit rebuilds if SAH cost grows more than this ratio
+	 */
+	void set_rebuild_threshold(double threshold) { rebuild_threshold_ = threshold; }
+
+	/**
+	 * copy build settings
+	 * @param [in] bvh bvh of which method, layout, leaf precision, split and refit settings are used by next build
+	 */
+	void set_build_settings(const UMBvh& bvh);
+
+	/**
+	 * get seconds spent by last build
+	 */
+	double build_time() const { return build_time_; }
+
+	/**
+	 * get bvh was loaded from a cache file or not by last build
+	 */
+	bool is_cache_loaded() const { return is_cache_loaded_; }
+
+	/**
+	 * get seconds spent by last refit
+	 */
+	double refit_time() const { return refit_time_; }
+
+	/**
+	 * get SAH cost of the current tree
+	 */
+	double sah_cost() const { return sah_cost_; }
+
+	/**
+	 * get SAH cost of the tree right after last build
+	 */
+	double built_sah_cost() const { return built_sah_cost_; }
+
+	/**
+	 * get node count
+	 */
+	unsigned int node_count() const { return static_cast<unsigned int>(node_list_.size()); }
+
+	/**
+	 * get node list
+	 */
+	const UMBvhFlatNodeList& node_list() const { return node_list_; }
+
+	/**
+	 * get primitives ordered by leaves.
+	 * a primitive may be referred by several leaves if built by eSpatialSplit.
+	 * empty if built from a mesh.
+	 */
+	const UMPrimitiveList& ordered_primitives() const { return ordered_primitives_; }
+
+	/**
+	 * get index of built primitives or mesh faces of each leaf reference
+	 */
+	const std::vector<int>& primitive_order() const { return primitive_order_; }
+
+	/**
+	 * get mesh of which faces are referred by index. null if built from primitives
+	 */
+	UMMeshPtr mesh() const { return mesh_; }
+
+	/**
+	 * get precomputed leaf primitives in the order of ordered primitives
+	 */
+	const UMBvhLeaves& leaves() const { return leaves_; }
+
+	/**
+	 * get depth of the tree
+	 */
+	int depth() const { return depth_; }
+
 	/**
 	 * (for debug) create box list
 	 */
@@ -73,12 +391,45 @@ public:
 	 * @param [in,out] param shading parameters
 	 */
 	virtual bool intersects(const UMRay& ray, UMShaderParameter& param) const;
+
+	/**
+	 * ray intersection counting traversal steps.
+	 * always traverses binary nodes.
+	 * @param [in] ray a ray
+	 * @param [in,out] param shading parameters
+	 * @param [in,out] count counts are added to this
+	 */
+	bool intersects(const UMRay& ray, UMShaderParameter& param, UMBvhTraversalCount& count) const;
 	
 	/**
 	 * ray intersection
 	 * @param [in] ray a ray
 	 */
 	virtual bool intersects(const UMRay& ray) const;
+
+	/**
+	 * ray intersection without shading.
+	 * triangles of leaves are shaded by this, other primitives shade their own hits.
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const;
+
+	/**
+	 * set shading parameters of a triangle hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const;
+
+	/**
+	 * ray packet intersection.
+	 * coherent rays traverse binary nodes together, culling nodes missed by the whole packet.
+	 * diverged rays are traced one by one.
+	 * @param [in,out] packet rays and the closest hits found so far
+	 */
+	virtual void intersects(UMRayPacket& packet) const;
 	
 	/**
 	 * get box
@@ -88,13 +439,58 @@ public:
 	/**
 	 * update AABB
 	 */
-	virtual void update_box() {}
+	virtual void update_box() { refit(); }
 
 private:
-	UMBvh() {}
+	UMBvh() :
+		build_method_(eBinnedSAH),
+		node_layout_(eBinaryNode),
+		leaf_precision_(eDoubleLeaf),
+		spatial_split_budget_(0.3),
+		treelet_optimization_(true),
+		rebuild_threshold_(1.5),
+		build_time_(0.0),
+		refit_time_(0.0),
+		is_cache_loaded_(false),
+		sah_cost_(0.0),
+		built_sah_cost_(0.0),
+		depth_(0)
+	{}
 
-	UMBvhNodeList node_list_;
+	UMBvhFlatNodeList node_list_;
 	UMPrimitiveList ordered_primitives_;
+	// index of built primitives of each ordered primitive
+	std::vector<int> primitive_order_;
+	// primitives before references are duplicated. empty if not duplicated
+	UMPrimitiveList source_primitives_;
+	// mesh of which faces are referred by primitive_order_. null if built from primitives
+	UMMeshPtr mesh_;
+	UMBvhLeaves leaves_;
+	UMBox box_;
+	UMBvhQuadPtr quad_;
+	UMBvhOctPtr oct_;
+	UMBvhCompressed8Ptr compressed8_;
+	UMBvhCompressed16Ptr compressed16_;
+
+	BuildMethod build_method_;
+	NodeLayout node_layout_;
+	UMBvhLeafPrecision leaf_precision_;
+	double spatial_split_budget_;
+	bool treelet_optimization_;
+	double rebuild_threshold_;
+	double build_time_;
+	double refit_time_;
+	bool is_cache_loaded_;
+	double sah_cost_;
+	double built_sah_cost_;
+	int depth_;
+
+	void clear();
+	void set_tree(const UMBvhNode& root);
+	void create_wide_nodes();
+	unsigned long long cache_key(unsigned long long key) const;
+	bool read_cache(const std::string& path, unsigned long long key, int primitive_count);
+	bool intersects_binary(const UMRay& ray, UMHit& hit, UMBvhTraversalCount* count) const;
 
 	UMBvhPtr self_ptr() { return self_ptr_.lock(); }
 	UMBvhWeakPtr self_ptr_;
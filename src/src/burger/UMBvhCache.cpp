@@ -0,0 +1,330 @@
+/**
+ * @file UMBvhCache.cpp
+ * bounding volume hierarchy cache file
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvh.h"
+#include "UMBvhQuad.h"
+#include "UMBvhOct.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+	using namespace burger;
+
+	const unsigned long long fnv_offset_basis = 14695981039346656037ULL;
+	const unsigned long long fnv_prime = 1099511628211ULL;
+
+	/// increment when layout of the file or UMBvhFlatNode changes
+	const unsigned int cache_version = 1;
+
+	/**
+	 * head of cache file.
+	 * followed by nodes and indices of primitives ordered by leaves.
+	 */
+	struct CacheHeader
+	{
+		/// "UMBV"
+		char magic[4];
+		unsigned int version;
+		/// key of primitives and build settings
+		unsigned long long key;
+		int primitive_count;
+		int reference_count;
+		int node_count;
+		int depth;
+		double sah_cost;
+		double built_sah_cost;
+	};
+
+	double current_seconds()
+	{
+#ifdef _OPENMP
+		return omp_get_wtime();
+#else
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+	}
+
+	/**
+	 * id of this process
+	 */
+	int process_id()
+	{
+#ifdef _WIN32
+		return ::_getpid();
+#else
+		return static_cast<int>(::getpid());
+#endif
+	}
+
+	/**
+	 * temporary file path unique to the process and the writer,
+	 * so processes which miss the cache at the same time do not write the same file
+	 */
+	std::string temporary_path(const std::string& path, const void* writer)
+	{
+		std::stringstream temporary;
+		temporary << path << "." << process_id() << "." << writer << ".tmp";
+		return temporary.str();
+	}
+
+	/**
+	 * closes a file at the end of scope
+	 */
+	class ScopedFile
+	{
+		DISALLOW_COPY_AND_ASSIGN(ScopedFile);
+	public:
+		explicit ScopedFile(FILE* file) : file_(file) {}
+
+		~ScopedFile()
+		{
+			if (file_) std::fclose(file_);
+		}
+
+		FILE* get() const { return file_; }
+
+	private:
+		FILE* file_;
+	};
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * 64bit FNV-1a hash
+ */
+unsigned long long UMBvh::hash(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	unsigned long long hash = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= fnv_prime;
+	}
+	return hash;
+}
+
+/**
+ * 64bit FNV-1a hash
+ */
+unsigned long long UMBvh::hash(const void* data, size_t size)
+{
+	return hash(data, size, fnv_offset_basis);
+}
+
+/**
+ * add build settings to the key of primitives
+ */
+unsigned long long UMBvh::cache_key(unsigned long long key) const
+{
+	const int method = static_cast<int>(build_method_);
+	const int treelet = treelet_optimization_ ? 1 : 0;
+	const int precision = static_cast<int>(leaf_precision_);
+	key = hash(&cache_version, sizeof(cache_version), key);
+	key = hash(&method, sizeof(method), key);
+	key = hash(&spatial_split_budget_, sizeof(spatial_split_budget_), key);
+	key = hash(&treelet, sizeof(treelet), key);
+	key = hash(&precision, sizeof(precision), key);
+	return key;
+}
+
+/**
+ * build bvh from primitives using a cache file
+ */
+bool UMBvh::build(const UMPrimitiveList& primitives, const std::string& path, unsigned long long key)
+{
+	if (load_cache(primitives, path, key)) return true;
+	if (!build(primitives)) return false;
+	save_cache(path, key);
+	return true;
+}
+
+/**
+ * build bvh from faces of a mesh using a cache file
+ */
+bool UMBvh::build(UMMeshPtr mesh, const std::string& path, unsigned long long key)
+{
+	if (load_cache(mesh, path, key)) return true;
+	if (!build(mesh)) return false;
+	save_cache(path, key);
+	return true;
+}
+
+/**
+ * write cache file
+ */
+bool UMBvh::save_cache(const std::string& path, unsigned long long key) const
+{
+	if (node_list_.empty()) return false;
+	if (!mesh_ && primitive_order_.size() != ordered_primitives_.size()) return false;
+	int primitive_count = static_cast<int>(source_primitives_.empty() ? ordered_primitives_.size() : source_primitives_.size());
+	if (mesh_)
+	{
+		primitive_count = static_cast<int>(mesh_->face_list().size());
+	}
+
+	CacheHeader header;
+	std::memcpy(header.magic, "UMBV", 4);
+	header.version = cache_version;
+	header.key = cache_key(key);
+	header.primitive_count = primitive_count;
+	header.reference_count = static_cast<int>(primitive_order_.size());
+	header.node_count = static_cast<int>(node_list_.size());
+	header.depth = depth_;
+	header.sah_cost = sah_cost_;
+	header.built_sah_cost = built_sah_cost_;
+
+	// write to a temporary file and rename, so readers never see a partial file
+	const std::string temporary = temporary_path(path, this);
+	FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file) return false;
+	bool result = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	result = result && std::fwrite(&node_list_[0], sizeof(UMBvhFlatNode), node_list_.size(), file) == node_list_.size();
+	result = result && std::fwrite(&primitive_order_[0], sizeof(int), primitive_order_.size(), file) == primitive_order_.size();
+	result = (std::fclose(file) == 0) && result;
+	if (result)
+	{
+#ifdef _WIN32
+		// rename does not replace an existing file on windows
+		std::remove(path.c_str());
+#endif
+		result = std::rename(temporary.c_str(), path.c_str()) == 0;
+	}
+	if (!result)
+	{
+		std::remove(temporary.c_str());
+	}
+	return result;
+}
+
+/**
+ * read nodes and primitive order from a cache file
+ */
+bool UMBvh::read_cache(const std::string& path, unsigned long long key, int primitive_count)
+{
+	if (primitive_count == 0) return false;
+
+	ScopedFile file(std::fopen(path.c_str(), "rb"));
+	if (!file.get()) return false;
+
+	CacheHeader header;
+	if (std::fread(&header, sizeof(header), 1, file.get()) != 1) return false;
+	if (std::memcmp(header.magic, "UMBV", 4) != 0) return false;
+	if (header.version != cache_version) return false;
+	if (header.key != cache_key(key)) return false;
+	if (header.primitive_count != primitive_count) return false;
+	if (header.node_count <= 0 || header.reference_count < primitive_count) return false;
+	// check the file size before allocating lists of the header sizes
+	const long long file_size = static_cast<long long>(sizeof(CacheHeader))
+		+ static_cast<long long>(sizeof(UMBvhFlatNode)) * header.node_count
+		+ static_cast<long long>(sizeof(int)) * header.reference_count;
+	if (std::fseek(file.get(), 0, SEEK_END) != 0) return false;
+	if (static_cast<long long>(std::ftell(file.get())) != file_size) return false;
+	if (std::fseek(file.get(), sizeof(CacheHeader), SEEK_SET) != 0) return false;
+
+	UMBvhFlatNodeList node_list(header.node_count);
+	std::vector<int> primitive_order(header.reference_count);
+	if (std::fread(&node_list[0], sizeof(UMBvhFlatNode), node_list.size(), file.get()) != node_list.size()) return false;
+	if (std::fread(&primitive_order[0], sizeof(int), primitive_order.size(), file.get()) != primitive_order.size()) return false;
+
+	for (int i = 0; i < header.reference_count; ++i)
+	{
+		if (primitive_order[i] < 0 || primitive_order[i] >= primitive_count) return false;
+	}
+
+	// nodes must refer inside of the file
+	for (int i = 0; i < header.node_count; ++i)
+	{
+		const UMBvhFlatNode& node = node_list[i];
+		if (node.is_leaf())
+		{
+			if (node.offset < 0 || node.offset + static_cast<int>(node.primitive_count) > header.reference_count) return false;
+		}
+		else if (node.offset <= i + 1 || node.offset >= header.node_count)
+		{
+			return false;
+		}
+	}
+
+	clear();
+	node_list_.swap(node_list);
+	primitive_order_.swap(primitive_order);
+
+	const UMBvhFlatNode& root = node_list_[0];
+	box_.set_minimum(UMVec3d(root.minimum[0], root.minimum[1], root.minimum[2]));
+	box_.set_maximum(UMVec3d(root.maximum[0], root.maximum[1], root.maximum[2]));
+	depth_ = header.depth;
+	sah_cost_ = header.sah_cost;
+	built_sah_cost_ = header.built_sah_cost;
+	return true;
+}
+
+/**
+ * read cache file
+ */
+bool UMBvh::load_cache(const UMPrimitiveList& primitives, const std::string& path, unsigned long long key)
+{
+	const double start_time = current_seconds();
+	const int primitive_count = static_cast<int>(primitives.size());
+	if (!read_cache(path, key, primitive_count)) return false;
+
+	const int reference_count = static_cast<int>(primitive_order_.size());
+	ordered_primitives_.resize(reference_count);
+	for (int i = 0; i < reference_count; ++i)
+	{
+		ordered_primitives_[i] = primitives[primitive_order_[i]];
+	}
+	if (reference_count > primitive_count)
+	{
+		source_primitives_ = primitives;
+	}
+	leaves_.build(ordered_primitives_, leaf_precision_);
+	create_wide_nodes();
+	is_cache_loaded_ = true;
+
+	build_time_ = current_seconds() - start_time;
+	return true;
+}
+
+/**
+ * read cache file for faces of a mesh
+ */
+bool UMBvh::load_cache(UMMeshPtr mesh, const std::string& path, unsigned long long key)
+{
+	const double start_time = current_seconds();
+	if (!mesh) return false;
+	const int face_count = static_cast<int>(mesh->face_list().size());
+	if (!read_cache(path, key, face_count)) return false;
+
+	mesh_ = mesh;
+	leaves_.build(mesh_, primitive_order_, leaf_precision_);
+	create_wide_nodes();
+	is_cache_loaded_ = true;
+
+	build_time_ = current_seconds() - start_time;
+	return true;
+}
+
+} // burger
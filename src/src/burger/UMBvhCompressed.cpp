@@ -0,0 +1,507 @@
+/**
+ * @file UMBvhCompressed.cpp
+ * 4-wide bounding volume hierarchy with quantized bounds
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvhCompressed.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include "UMRay.h"
+#include "UMShaderParameter.h"
+
+namespace
+{
+	using namespace burger;
+
+	/// max traversal stack size
+	const int max_stack_size = 512;
+
+	/// enlarges far distance of float slab test to cover rounding errors
+	const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+	/// exponent range of normalized float
+	const int min_exponent = -126;
+	const int max_exponent = 127;
+
+	/// max primitive count of a leaf child
+	const unsigned int max_leaf_primitive_count = 255;
+
+	/**
+	 * error bound of a float slab distance.
+	 * covers rounding of the ray origin and of the products.
+	 * @param [in] origin ray origin
+	 * @param [in] bounds_abs_max max absolute value of bounds
+	 * @param [in] inv_dir inverted ray direction
+	 */
+	float slab_error(double origin, double bounds_abs_max, float inv_dir)
+	{
+		const double origin_error = std::abs(static_cast<double>(static_cast<float>(origin)) - origin);
+		const double product_error = 4.0 * std::numeric_limits<float>::epsilon() * (std::abs(origin) + bounds_abs_max);
+		return static_cast<float>((origin_error + product_error) * std::abs(inv_dir));
+	}
+
+	/**
+	 * surface area of a binary node
+	 */
+	float node_area(const UMBvhFlatNode& node)
+	{
+		const float dx = node.maximum[0] - node.minimum[0];
+		const float dy = node.maximum[1] - node.minimum[1];
+		const float dz = node.maximum[2] - node.minimum[2];
+		return 2.0f * (dx * dy + dx * dz + dy * dz);
+	}
+
+	/**
+	 * quantization step 2^exponent as float bits
+	 */
+	__m128 step_from_exponent(int exponent)
+	{
+		return _mm_castsi128_ps(_mm_set1_epi32((exponent + 127) << 23));
+	}
+
+	/**
+	 * load 4 quantized 8bit values as float
+	 */
+	__m128 load_quantized(const unsigned char* quantized)
+	{
+		int bits;
+		std::memcpy(&bits, quantized, sizeof(bits));
+		const __m128i zero = _mm_setzero_si128();
+		__m128i values = _mm_cvtsi32_si128(bits);
+		values = _mm_unpacklo_epi8(values, zero);
+		values = _mm_unpacklo_epi16(values, zero);
+		return _mm_cvtepi32_ps(values);
+	}
+
+	/**
+	 * load 4 quantized 16bit values as float
+	 */
+	__m128 load_quantized(const unsigned short* quantized)
+	{
+		__m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantized));
+		values = _mm_unpacklo_epi16(values, _mm_setzero_si128());
+		return _mm_cvtepi32_ps(values);
+	}
+
+	/**
+	 * traversal stack entry
+	 */
+	struct StackEntry
+	{
+		int child;
+		int primitive_count;
+		float distance;
+	};
+
+	/**
+	 * ray data for SSE box tests
+	 */
+	struct CompressedRay
+	{
+		CompressedRay(const UMRay& ray, const UMVec3d& bounds_abs_max)
+		{
+			const UMVec3d& origin = ray.origin();
+			const UMVec3d& direction = ray.direction();
+			for (int k = 0; k < 3; ++k)
+			{
+				const float inv_dir = static_cast<float>(1.0 / direction[k]);
+				const float origin_x_inv_dir = static_cast<float>(origin[k]) * inv_dir;
+				const float pad = slab_error(origin[k], bounds_abs_max[k], inv_dir);
+				// near distance is decreased and far distance is increased by pad
+				origin_x_inv_dir_near[k] = _mm_set1_ps(origin_x_inv_dir + pad);
+				origin_x_inv_dir_far[k] = _mm_set1_ps(origin_x_inv_dir - pad);
+				this->inv_dir[k] = _mm_set1_ps(inv_dir);
+				is_negative[k] = inv_dir < 0.0f ? 1 : 0;
+			}
+			tmin = _mm_set1_ps(static_cast<float>(ray.tmin()));
+		}
+		__m128 origin_x_inv_dir_near[3];
+		__m128 origin_x_inv_dir_far[3];
+		__m128 inv_dir[3];
+		__m128 tmin;
+		int is_negative[3];
+	};
+
+	/**
+	 * decode and test 4 child boxes
+	 * @param [out] distance near distance of each child
+	 * @retval hit mask
+	 */
+	template <class T>
+	int intersect_compressed(
+		const UMBvhCompressedNode<T>& node,
+		const CompressedRay& ray,
+		float closest_distance,
+		float distance[4])
+	{
+		__m128 interval_min = ray.tmin;
+		__m128 interval_max = _mm_set1_ps(closest_distance * far_scale);
+		for (int k = 0; k < 3; ++k)
+		{
+			const __m128 origin = _mm_set1_ps(node.origin[k]);
+			const __m128 step = step_from_exponent(node.exponent[k]);
+			const __m128 minimum = _mm_add_ps(origin, _mm_mul_ps(load_quantized(node.minimum[k]), step));
+			const __m128 maximum = _mm_add_ps(origin, _mm_mul_ps(load_quantized(node.maximum[k]), step));
+			const __m128 near_plane = ray.is_negative[k] ? maximum : minimum;
+			const __m128 far_plane = ray.is_negative[k] ? minimum : maximum;
+			const __m128 tnear = _mm_sub_ps(_mm_mul_ps(near_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_near[k]);
+			const __m128 tfar = _mm_sub_ps(_mm_mul_ps(far_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_far[k]);
+			// NaN is ignored because max/min return the second operand
+			interval_min = _mm_max_ps(tnear, interval_min);
+			interval_max = _mm_min_ps(_mm_mul_ps(tfar, _mm_set1_ps(far_scale)), interval_max);
+		}
+		_mm_storeu_ps(distance, interval_min);
+		return _mm_movemask_ps(_mm_cmple_ps(interval_min, interval_max));
+	}
+
+	/**
+	 * decoded bound in double. exact, so comparing it to a float bound
+	 * tells the side of the float rounded decode too.
+	 */
+	double decode_bound(float origin, int exponent, unsigned int quantized)
+	{
+		return static_cast<double>(origin) + std::ldexp(static_cast<double>(quantized), exponent);
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * build from binary bvh nodes
+ */
+template <class T>
+bool UMBvhCompressed<T>::build(const UMBvhFlatNodeList& binary_node_list)
+{
+	node_list_.clear();
+	source_list_.clear();
+	bounds_abs_max_ = UMVec3d(0.0);
+	if (binary_node_list.empty()) return false;
+
+	const int binary_node_count = static_cast<int>(binary_node_list.size());
+	for (int i = 0; i < binary_node_count; ++i)
+	{
+		if (binary_node_list[i].primitive_count > max_leaf_primitive_count) return false;
+	}
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	if (root.is_leaf())
+	{
+		const int source[4] = { 0, -1, -1, -1 };
+		Node node;
+		quantize(node, binary_node_list, source);
+		node.child[0] = root.offset;
+		node.primitive_count[0] = static_cast<unsigned char>(root.primitive_count);
+		node_list_.push_back(node);
+		source_list_.assign(source, source + 4);
+		return true;
+	}
+	node_list_.reserve(binary_node_list.size() / 2 + 1);
+	collapse(binary_node_list, 0);
+	return true;
+}
+
+/**
+ * collapse binary branch to a compressed node
+ * @retval index of created node
+ */
+template <class T>
+int UMBvhCompressed<T>::collapse(const UMBvhFlatNodeList& binary_node_list, int binary_index)
+{
+	const int index = static_cast<int>(node_list_.size());
+	node_list_.push_back(Node());
+	source_list_.resize(source_list_.size() + 4, -1);
+
+	// open the largest branch child until 4 children
+	int children[4] = { -1, -1, -1, -1 };
+	int child_count = 2;
+	children[0] = binary_index + 1;
+	children[1] = binary_node_list[binary_index].offset;
+	while (child_count < 4)
+	{
+		int largest = -1;
+		float largest_area = -1.0f;
+		for (int i = 0; i < child_count; ++i)
+		{
+			const UMBvhFlatNode& child = binary_node_list[children[i]];
+			if (child.is_leaf()) continue;
+			const float area = node_area(child);
+			if (area > largest_area)
+			{
+				largest_area = area;
+				largest = i;
+			}
+		}
+		if (largest < 0) break;
+		const int opened = children[largest];
+		children[largest] = opened + 1;
+		children[child_count++] = binary_node_list[opened].offset;
+	}
+
+	quantize(node_list_[index], binary_node_list, children);
+	for (int i = 0; i < child_count; ++i)
+	{
+		const UMBvhFlatNode& child = binary_node_list[children[i]];
+		source_list_[index * 4 + i] = children[i];
+		if (child.is_leaf())
+		{
+			node_list_[index].child[i] = child.offset;
+			node_list_[index].primitive_count[i] = static_cast<unsigned char>(child.primitive_count);
+		}
+		else
+		{
+			// node_list_ may be reallocated in collapse
+			const int child_index = collapse(binary_node_list, children[i]);
+			node_list_[index].child[i] = child_index;
+		}
+	}
+	return index;
+}
+
+/**
+ * quantize child bounds of a node outward.
+ * children are set empty. leaf and branch indices are set by the caller.
+ * @param [out] node target node
+ * @param [in] binary_node_list flattened binary bvh
+ * @param [in] source binary node index of each child slot. -1 for empty
+ */
+template <class T>
+void UMBvhCompressed<T>::quantize(Node& node, const UMBvhFlatNodeList& binary_node_list, const int source[4])
+{
+	const unsigned int limit = (std::numeric_limits<T>::max)();
+	std::memset(&node, 0, sizeof(node));
+	for (int i = 0; i < 4; ++i)
+	{
+		node.child[i] = -1;
+	}
+
+	for (int k = 0; k < 3; ++k)
+	{
+		// node box is union of children
+		float lower = (std::numeric_limits<float>::max)();
+		float upper = -(std::numeric_limits<float>::max)();
+		for (int i = 0; i < 4; ++i)
+		{
+			if (source[i] < 0) continue;
+			lower = std::min(lower, binary_node_list[source[i]].minimum[k]);
+			upper = std::max(upper, binary_node_list[source[i]].maximum[k]);
+		}
+		node.origin[k] = lower;
+
+		// smallest step which covers the node box
+		const double extent = static_cast<double>(upper) - static_cast<double>(lower);
+		int exponent = min_exponent;
+		if (extent > 0.0)
+		{
+			int fraction_exponent = 0;
+			std::frexp(extent / limit, &fraction_exponent);
+			exponent = std::max(min_exponent, std::min(max_exponent, fraction_exponent));
+		}
+		while (exponent > min_exponent && decode_bound(lower, exponent - 1, limit) >= upper)
+		{
+			--exponent;
+		}
+		while (exponent < max_exponent && decode_bound(lower, exponent, limit) < upper)
+		{
+			++exponent;
+		}
+		node.exponent[k] = static_cast<signed char>(exponent);
+
+		const double step = std::ldexp(1.0, exponent);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (source[i] < 0)
+			{
+				// empty box
+				node.minimum[k][i] = static_cast<T>(limit);
+				node.maximum[k][i] = 0;
+				continue;
+			}
+			const UMBvhFlatNode& child = binary_node_list[source[i]];
+			const double minimum = std::floor((static_cast<double>(child.minimum[k]) - lower) / step);
+			const double maximum = std::ceil((static_cast<double>(child.maximum[k]) - lower) / step);
+			unsigned int quantized_minimum = static_cast<unsigned int>(std::max(0.0, std::min(static_cast<double>(limit), minimum)));
+			unsigned int quantized_maximum = static_cast<unsigned int>(std::max(0.0, std::min(static_cast<double>(limit), maximum)));
+			while (quantized_minimum > 0 && decode_bound(lower, exponent, quantized_minimum) > child.minimum[k])
+			{
+				--quantized_minimum;
+			}
+			while (quantized_maximum < limit && decode_bound(lower, exponent, quantized_maximum) < child.maximum[k])
+			{
+				++quantized_maximum;
+			}
+			node.minimum[k][i] = static_cast<T>(quantized_minimum);
+			node.maximum[k][i] = static_cast<T>(quantized_maximum);
+		}
+	}
+}
+
+/**
+ * requantize bounds from refitted binary bvh nodes
+ */
+template <class T>
+void UMBvhCompressed<T>::refit(const UMBvhFlatNodeList& binary_node_list)
+{
+	if (node_list_.empty() || binary_node_list.empty()) return;
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	const int node_count = static_cast<int>(node_list_.size());
+#pragma omp parallel for if (node_count > 4096)
+	for (int i = 0; i < node_count; ++i)
+	{
+		Node& node = node_list_[i];
+		int child[4];
+		unsigned char primitive_count[4];
+		std::memcpy(child, node.child, sizeof(child));
+		std::memcpy(primitive_count, node.primitive_count, sizeof(primitive_count));
+		quantize(node, binary_node_list, &source_list_[i * 4]);
+		std::memcpy(node.child, child, sizeof(child));
+		std::memcpy(node.primitive_count, primitive_count, sizeof(primitive_count));
+	}
+}
+
+/**
+ * get child box decoded from quantized bounds
+ */
+template <class T>
+void UMBvhCompressed<T>::decode(const Node& node, int slot, UMVec3d& minimum, UMVec3d& maximum)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		const float step = std::ldexp(1.0f, node.exponent[k]);
+		minimum[k] = node.origin[k] + static_cast<float>(node.minimum[k][slot]) * step;
+		maximum[k] = node.origin[k] + static_cast<float>(node.maximum[k][slot]) * step;
+	}
+}
+
+/**
+ * ray intersection
+ */
+template <class T>
+bool UMBvhCompressed<T>::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const
+{
+	if (node_list_.empty()) return false;
+
+	const CompressedRay compressed_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	float closest_distance_f = static_cast<float>(
+		std::min(hit.distance, static_cast<double>((std::numeric_limits<float>::max)())));
+	bool found = false;
+
+	StackEntry stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index].child = 0;
+	stack[stack_index].primitive_count = 0;
+	stack[stack_index].distance = 0.0f;
+	++stack_index;
+
+	while (stack_index > 0)
+	{
+		const StackEntry entry = stack[--stack_index];
+		if (entry.distance > closest_distance_f) continue;
+
+		// leaf
+		if (entry.primitive_count > 0)
+		{
+			const int end = entry.child + entry.primitive_count;
+			if (leaves.intersects(leaf_ray, ordered_primitives, entry.child, end, hit))
+			{
+				closest_distance_f = static_cast<float>(hit.distance);
+				found = true;
+			}
+			continue;
+		}
+
+		// branch
+		const Node& node = node_list_[entry.child];
+		float distance[4];
+		const int mask = intersect_compressed(node, compressed_ray, closest_distance_f, distance);
+		if (mask == 0) continue;
+
+		// sort hit children far to near, then push. near child is popped first.
+		int order[4];
+		int hit_count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			int k = hit_count++;
+			while (k > 0 && distance[order[k - 1]] < distance[i])
+			{
+				order[k] = order[k - 1];
+				--k;
+			}
+			order[k] = i;
+		}
+		for (int i = 0; i < hit_count; ++i)
+		{
+			StackEntry& pushed = stack[stack_index++];
+			pushed.child = node.child[order[i]];
+			pushed.primitive_count = node.primitive_count[order[i]];
+			pushed.distance = distance[order[i]];
+		}
+	}
+	return found;
+}
+
+/**
+ * ray intersection
+ */
+template <class T>
+bool UMBvhCompressed<T>::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const
+{
+	if (node_list_.empty()) return false;
+
+	const CompressedRay compressed_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	const float tmax = static_cast<float>(ray.tmax());
+
+	int stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index++] = 0;
+
+	while (stack_index > 0)
+	{
+		const Node& node = node_list_[stack[--stack_index]];
+		float distance[4];
+		const int mask = intersect_compressed(node, compressed_ray, tmax, distance);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			if (node.primitive_count[i] > 0)
+			{
+				const int end = node.child[i] + node.primitive_count[i];
+				if (leaves.intersects(leaf_ray, ordered_primitives, node.child[i], end))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				stack[stack_index++] = node.child[i];
+			}
+		}
+	}
+	return false;
+}
+
+template class UMBvhCompressed<unsigned char>;
+template class UMBvhCompressed<unsigned short>;
+
+} // burger
@@ -0,0 +1,133 @@
+/**
+ * @file UMBvhCompressed.h
+ * 4-wide bounding volume hierarchy with quantized bounds
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "UMMacro.h"
+#include "UMPrimitive.h"
+#include "UMAlignedAllocator.h"
+#include "UMBvh.h"
+
+namespace burger
+{
+
+template <class T> class UMBvhCompressed;
+typedef UMBvhCompressed<unsigned char> UMBvhCompressed8;
+typedef UMBvhCompressed<unsigned short> UMBvhCompressed16;
+typedef std::shared_ptr<UMBvhCompressed8> UMBvhCompressed8Ptr;
+typedef std::shared_ptr<UMBvhCompressed16> UMBvhCompressed16Ptr;
+
+class UMRay;
+class UMShaderParameter;
+
+/**
+ * 4-wide bvh node with child bounds quantized relative to the node.
+ * child bound is origin + quantized * 2^exponent, rounded outward.
+ * 64 bytes for 8bit, 96 bytes for 16bit. UMBvhQuadNode is 128 bytes.
+ */
+template <class T>
+struct UMBvhCompressedNode
+{
+	/// minimum of the node box
+	float origin[3];
+	/// exponent of quantization step. [axis]
+	signed char exponent[3];
+	unsigned char padding0;
+	/// quantized minimum of child AABBs. [axis][child]
+	T minimum[3][4];
+	/// quantized maximum of child AABBs. [axis][child]
+	T maximum[3][4];
+	/// leaf: first index of ordered primitives. branch: node index. -1: empty
+	int child[4];
+	/// primitive count of leaf child. 0 for branch child
+	unsigned char primitive_count[4];
+	unsigned char padding1[sizeof(T) == 1 ? 4 : 12];
+};
+
+/**
+ * 4-wide bvh with quantized child bounds, collapsed from a binary bvh.
+ * uses less memory than UMBvhQuad at the cost of decoding bounds in traversal.
+ * shares ordered primitives with the binary bvh.
+ */
+template <class T>
+class UMBvhCompressed
+{
+	DISALLOW_COPY_AND_ASSIGN(UMBvhCompressed);
+
+public:
+	typedef UMBvhCompressedNode<T> Node;
+	typedef std::vector<Node, UMAlignedAllocator<Node, 64> > NodeList;
+
+	UMBvhCompressed() : bounds_abs_max_(0.0) {}
+
+	~UMBvhCompressed() {}
+
+	/**
+	 * build from binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh
+	 * @retval success or fail. fails if a leaf has more than 255 primitives
+	 */
+	bool build(const UMBvhFlatNodeList& binary_node_list);
+
+	/**
+	 * requantize bounds from refitted binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh which has the same topology as built
+	 */
+	void refit(const UMBvhFlatNodeList& binary_node_list);
+
+	/**
+	 * get node count
+	 */
+	unsigned int node_count() const { return static_cast<unsigned int>(node_list_.size()); }
+
+	/**
+	 * get node list
+	 */
+	const NodeList& node_list() const { return node_list_; }
+
+	/**
+	 * get child box decoded from quantized bounds
+	 * @param [in] node a node
+	 * @param [in] slot child slot
+	 * @param [out] minimum minimum of child box
+	 * @param [out] maximum maximum of child box
+	 */
+	static void decode(const Node& node, int slot, UMVec3d& minimum, UMVec3d& maximum);
+
+	/**
+	 * ray intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 * @param [in,out] hit the closest hit found so far. triangles of leaves are set without primitive
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const;
+
+	/**
+	 * ray intersection
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const;
+
+private:
+	int collapse(const UMBvhFlatNodeList& binary_node_list, int binary_index);
+	void quantize(Node& node, const UMBvhFlatNodeList& binary_node_list, const int source[4]);
+
+	NodeList node_list_;
+	// binary node index of each child slot. -1 for empty
+	std::vector<int> source_list_;
+	UMVec3d bounds_abs_max_;
+};
+
+} // burger
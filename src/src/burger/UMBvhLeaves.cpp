@@ -0,0 +1,230 @@
+/**
+ * @file UMBvhLeaves.cpp
+ * precomputed leaf primitives of bounding volume hierarchy
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvhLeaves.h"
+#include "UMTriangle.h"
+#include "UMMesh.h"
+
+namespace
+{
+	using namespace burger;
+
+	// leaf count to precompute in parallel
+	const int parallel_leaf_threshold = 4096;
+
+	/**
+	 * store vertices of a triangle
+	 */
+	template <class T>
+	void set_triangle(UMBvhLeafTriangle<T>& dst, const UMMesh& mesh, const UMVec3i& vertex_index, int face_index)
+	{
+		const UMVec3d a = mesh.vertex(vertex_index.x);
+		const UMVec3d b = mesh.vertex(vertex_index.y);
+		const UMVec3d c = mesh.vertex(vertex_index.z);
+		dst.a = UMVector3<T>(static_cast<T>(a.x), static_cast<T>(a.y), static_cast<T>(a.z));
+		dst.b = UMVector3<T>(static_cast<T>(b.x), static_cast<T>(b.y), static_cast<T>(b.z));
+		dst.c = UMVector3<T>(static_cast<T>(c.x), static_cast<T>(c.y), static_cast<T>(c.z));
+		dst.is_triangle = 1;
+		dst.face_index = face_index;
+	}
+
+	/**
+	 * store vertices of a triangle primitive
+	 */
+	template <class T>
+	void set_triangle(UMBvhLeafTriangle<T>& dst, const UMTriangle& triangle)
+	{
+		set_triangle(dst, *triangle.mesh(), triangle.vertex_index(), -1);
+	}
+
+	/**
+	 * a primitive which is tested by itself
+	 */
+	template <class T>
+	void set_other(UMBvhLeafTriangle<T>& dst)
+	{
+		dst.a = dst.b = dst.c = UMVector3<T>(0);
+		dst.is_triangle = 0;
+		dst.face_index = -1;
+	}
+
+	/**
+	 * precompute triangles from ordered primitives
+	 */
+	template <class List>
+	void build_triangles(List& triangle_list, const UMPrimitiveList& ordered_primitives)
+	{
+		const int primitive_count = static_cast<int>(ordered_primitives.size());
+		triangle_list.resize(primitive_count);
+#pragma omp parallel for if (primitive_count > parallel_leaf_threshold)
+		for (int i = 0; i < primitive_count; ++i)
+		{
+			const UMTriangle* triangle = dynamic_cast<const UMTriangle*>(ordered_primitives[i].get());
+			if (triangle)
+			{
+				set_triangle(triangle_list[i], *triangle);
+			}
+			else
+			{
+				set_other(triangle_list[i]);
+			}
+		}
+	}
+
+	/**
+	 * recompute triangles from updated primitives
+	 */
+	template <class List>
+	void refit_triangles(List& triangle_list, const UMPrimitiveList& ordered_primitives)
+	{
+		// triangles were checked by dynamic_cast on build
+		const int primitive_count = static_cast<int>(triangle_list.size());
+#pragma omp parallel for if (primitive_count > parallel_leaf_threshold)
+		for (int i = 0; i < primitive_count; ++i)
+		{
+			if (!triangle_list[i].is_triangle) continue;
+			const UMTriangle* triangle = static_cast<const UMTriangle*>(ordered_primitives[i].get());
+			set_triangle(triangle_list[i], *triangle);
+		}
+	}
+
+	/**
+	 * precompute triangles from faces of a mesh
+	 */
+	template <class List>
+	void build_mesh_triangles(List& triangle_list, const UMMesh& mesh, const std::vector<int>& face_order)
+	{
+		const int reference_count = static_cast<int>(face_order.size());
+		triangle_list.resize(reference_count);
+#pragma omp parallel for if (reference_count > parallel_leaf_threshold)
+		for (int i = 0; i < reference_count; ++i)
+		{
+			const int face_index = face_order[i];
+			set_triangle(triangle_list[i], mesh, mesh.face_list()[face_index], face_index);
+		}
+	}
+
+	/**
+	 * recompute triangles from the updated mesh
+	 */
+	template <class List>
+	void refit_mesh_triangles(List& triangle_list, const UMMesh& mesh)
+	{
+		const int reference_count = static_cast<int>(triangle_list.size());
+#pragma omp parallel for if (reference_count > parallel_leaf_threshold)
+		for (int i = 0; i < reference_count; ++i)
+		{
+			const int face_index = triangle_list[i].face_index;
+			set_triangle(triangle_list[i], mesh, mesh.face_list()[face_index], face_index);
+		}
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * precompute triangles from ordered primitives
+ */
+void UMBvhLeaves::build(const UMPrimitiveList& ordered_primitives, UMBvhLeafPrecision precision)
+{
+	precision_ = precision;
+	mesh_.reset();
+	if (precision_ == eFloatLeaf)
+	{
+		UMBvhTriangleList().swap(triangle_list_);
+		build_triangles(float_triangle_list_, ordered_primitives);
+	}
+	else
+	{
+		UMBvhTrianglefList().swap(float_triangle_list_);
+		build_triangles(triangle_list_, ordered_primitives);
+	}
+}
+
+/**
+ * precompute triangles from faces of a mesh
+ */
+void UMBvhLeaves::build(UMMeshPtr mesh, const std::vector<int>& face_order, UMBvhLeafPrecision precision)
+{
+	precision_ = precision;
+	mesh_ = mesh;
+	if (precision_ == eFloatLeaf)
+	{
+		UMBvhTriangleList().swap(triangle_list_);
+		build_mesh_triangles(float_triangle_list_, *mesh_, face_order);
+	}
+	else
+	{
+		UMBvhTrianglefList().swap(float_triangle_list_);
+		build_mesh_triangles(triangle_list_, *mesh_, face_order);
+	}
+}
+
+/**
+ * recompute triangles from updated primitives or the updated mesh
+ */
+void UMBvhLeaves::refit(const UMPrimitiveList& ordered_primitives)
+{
+	if (mesh_)
+	{
+		if (precision_ == eFloatLeaf)
+		{
+			refit_mesh_triangles(float_triangle_list_, *mesh_);
+		}
+		else
+		{
+			refit_mesh_triangles(triangle_list_, *mesh_);
+		}
+	}
+	else if (precision_ == eFloatLeaf)
+	{
+		refit_triangles(float_triangle_list_, ordered_primitives);
+	}
+	else
+	{
+		refit_triangles(triangle_list_, ordered_primitives);
+	}
+}
+
+/**
+ * set shading parameters of a triangle hit found in leaves
+ */
+void UMBvhLeaves::shade(
+	const UMRay& ray,
+	const UMPrimitiveList& ordered_primitives,
+	const UMHit& hit,
+	UMShaderParameter& param) const
+{
+	UMShaderParameter parameter;
+	// v
+	parameter.uvw.y = hit.u;
+	// w
+	parameter.uvw.z = hit.v;
+	// u
+	parameter.uvw.x = 1.0 - parameter.uvw.y - parameter.uvw.z;
+	parameter.distance = hit.distance;
+	parameter.intersect_point = ray.origin() + ray.direction() * hit.distance;
+
+	if (mesh_)
+	{
+		const int face_index = this->face_index(hit.index);
+		UMTriangle::interpolate(*mesh_, mesh_->face_list()[face_index], face_index, parameter);
+	}
+	else
+	{
+		const UMTriangle* triangle = static_cast<const UMTriangle*>(ordered_primitives[hit.index].get());
+		triangle->interpolate(parameter);
+	}
+	param = parameter;
+}
+
+} // burger
@@ -0,0 +1,334 @@
+/**
+ * @file UMBvhLeaves.h
+ * precomputed leaf primitives of bounding volume hierarchy
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cfloat>
+#include "UMMacro.h"
+#include "UMVector.h"
+#include "UMPrimitive.h"
+#include "UMAlignedAllocator.h"
+#include "UMRay.h"
+#include "UMShaderParameter.h"
+#include "UMRayTriangle.h"
+#include "UMMesh.h"
+
+namespace burger
+{
+
+class UMBvhLeaves;
+typedef std::shared_ptr<UMBvhLeaves> UMBvhLeavesPtr;
+
+/**
+ * precision of triangles stored in leaves
+ */
+enum UMBvhLeafPrecision
+{
+	eDoubleLeaf,
+	eFloatLeaf // half memory. hits differ from UMTriangle within float precision
+};
+
+/**
+ * a triangle stored in leaf order
+ * @param T float or double
+ */
+template <class T>
+struct UMBvhLeafTriangle
+{
+	/// first vertex
+	UMVector3<T> a;
+	/// second vertex
+	UMVector3<T> b;
+	/// third vertex
+	UMVector3<T> c;
+	/// is UMTriangle or not. other primitives are tested by themselves.
+	int is_triangle;
+	/// face index of the mesh if built from a mesh. -1 otherwise
+	int face_index;
+};
+typedef UMBvhLeafTriangle<double> UMBvhTriangle;
+typedef UMBvhLeafTriangle<float> UMBvhTrianglef;
+typedef std::vector<UMBvhTriangle, UMAlignedAllocator<UMBvhTriangle, 32> > UMBvhTriangleList;
+typedef std::vector<UMBvhTrianglef, UMAlignedAllocator<UMBvhTrianglef, 32> > UMBvhTrianglefList;
+
+/**
+ * a ray precomputed once per traversal for leaf tests
+ */
+struct UMBvhLeafRay
+{
+	UMBvhLeafRay() : ray(NULL) {}
+
+	UMBvhLeafRay(const UMRay& src, UMBvhLeafPrecision precision) { init(src, precision); }
+
+	/**
+	 * precompute the watertight ray of the precision only
+	 * @param [in] src source ray
+	 * @param [in] precision precision of leaves tested by this ray
+	 */
+	void init(const UMRay& src, UMBvhLeafPrecision precision)
+	{
+		ray = &src;
+		if (precision == eFloatLeaf)
+		{
+			float_ray.init(src);
+		}
+		else
+		{
+			double_ray.init(src);
+		}
+	}
+
+	/// source ray. tmin and tmax are read from this
+	const UMRay* ray;
+	/// valid if leaves are eDoubleLeaf
+	UMWatertightRay<double> double_ray;
+	/// valid if leaves are eFloatLeaf
+	UMWatertightRay<float> float_ray;
+};
+
+/**
+ * leaf primitives of bvh stored contiguously in leaf order.
+ * triangles are tested without virtual calls nor mesh lookups,
+ * by the same watertight test as UMTriangle in double or float precision.
+ */
+class UMBvhLeaves
+{
+	DISALLOW_COPY_AND_ASSIGN(UMBvhLeaves);
+
+public:
+	UMBvhLeaves() : precision_(eDoubleLeaf) {}
+
+	~UMBvhLeaves() {}
+
+	/**
+	 * precompute triangles from ordered primitives
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] precision precision of stored triangles
+	 */
+	void build(const UMPrimitiveList& ordered_primitives, UMBvhLeafPrecision precision);
+
+	/**
+	 * precompute triangles from faces of a mesh.
+	 * no primitive is referred, ordered primitives passed to other methods may be empty.
+	 * @param [in] mesh source mesh
+	 * @param [in] face_order face indices in leaf order
+	 * @param [in] precision precision of stored triangles
+	 */
+	void build(UMMeshPtr mesh, const std::vector<int>& face_order, UMBvhLeafPrecision precision);
+
+	/**
+	 * recompute triangles from updated primitives or the updated mesh
+	 * @param [in] ordered_primitives primitives which are same as built
+	 */
+	void refit(const UMPrimitiveList& ordered_primitives);
+
+	/**
+	 * get source mesh. null if built from primitives
+	 */
+	UMMeshPtr mesh() const { return mesh_; }
+
+	/**
+	 * get precision of stored triangles
+	 */
+	UMBvhLeafPrecision precision() const { return precision_; }
+
+	/**
+	 * get triangle list. empty if precision is eFloatLeaf
+	 */
+	const UMBvhTriangleList& triangle_list() const { return triangle_list_; }
+
+	/**
+	 * get float triangle list. empty if precision is eDoubleLeaf
+	 */
+	const UMBvhTrianglefList& float_triangle_list() const { return float_triangle_list_; }
+
+	/**
+	 * is the ordered primitive at the index a triangle or not
+	 */
+	bool is_triangle(int index) const
+	{
+		if (precision_ == eFloatLeaf) return float_triangle_list_[index].is_triangle != 0;
+		return triangle_list_[index].is_triangle != 0;
+	}
+
+	/**
+	 * get face index of the triangle at the index. -1 if not built from a mesh
+	 */
+	int face_index(int index) const
+	{
+		if (precision_ == eFloatLeaf) return float_triangle_list_[index].face_index;
+		return triangle_list_[index].face_index;
+	}
+
+	/**
+	 * get vertices of the triangle at the index as stored
+	 * @param [in] index index of ordered primitives
+	 * @param [out] a first vertex
+	 * @param [out] b second vertex
+	 * @param [out] c third vertex
+	 */
+	void triangle(int index, UMVec3d& a, UMVec3d& b, UMVec3d& c) const
+	{
+		if (precision_ == eFloatLeaf)
+		{
+			const UMBvhTrianglef& triangle = float_triangle_list_[index];
+			a = UMVec3d(triangle.a.x, triangle.a.y, triangle.a.z);
+			b = UMVec3d(triangle.b.x, triangle.b.y, triangle.b.z);
+			c = UMVec3d(triangle.c.x, triangle.c.y, triangle.c.z);
+			return;
+		}
+		const UMBvhTriangle& triangle = triangle_list_[index];
+		a = triangle.a;
+		b = triangle.b;
+		c = triangle.c;
+	}
+
+	/**
+	 * get byte size of stored triangles
+	 */
+	size_t memory_size() const
+	{
+		return triangle_list_.size() * sizeof(UMBvhTriangle)
+			+ float_triangle_list_.size() * sizeof(UMBvhTrianglef);
+	}
+
+	/**
+	 * closest ray intersection of a leaf without shading.
+	 * a triangle hit is set with null primitive and its index of ordered primitives,
+	 * the bvh sets itself as the primitive. it is shaded by shade().
+	 * other primitives set their own hits.
+	 * @param [in] ray a ray precomputed by UMBvhLeafRay
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] start first index of ordered primitives
+	 * @param [in] end last index + 1 of ordered primitives
+	 * @param [in,out] hit the closest hit found so far
+	 * @retval closer hit is found or not
+	 */
+	bool intersects(
+		const UMBvhLeafRay& ray,
+		const UMPrimitiveList& ordered_primitives,
+		int start,
+		int end,
+		UMHit& hit) const
+	{
+		if (precision_ == eFloatLeaf)
+		{
+			return intersects(float_triangle_list_, ray.float_ray, *ray.ray, ordered_primitives, start, end, hit);
+		}
+		return intersects(triangle_list_, ray.double_ray, *ray.ray, ordered_primitives, start, end, hit);
+	}
+
+	/**
+	 * any ray intersection of a leaf
+	 * @param [in] ray a ray precomputed by UMBvhLeafRay
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] start first index of ordered primitives
+	 * @param [in] end last index + 1 of ordered primitives
+	 */
+	bool intersects(
+		const UMBvhLeafRay& ray,
+		const UMPrimitiveList& ordered_primitives,
+		int start,
+		int end) const
+	{
+		if (precision_ == eFloatLeaf)
+		{
+			return intersects(float_triangle_list_, ray.float_ray, *ray.ray, ordered_primitives, start, end);
+		}
+		return intersects(triangle_list_, ray.double_ray, *ray.ray, ordered_primitives, start, end);
+	}
+
+	/**
+	 * set shading parameters of a triangle hit found in leaves
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] hit a triangle hit
+	 * @param [out] param shading parameters
+	 */
+	void shade(
+		const UMRay& ray,
+		const UMPrimitiveList& ordered_primitives,
+		const UMHit& hit,
+		UMShaderParameter& param) const;
+
+private:
+	UMBvhLeafPrecision precision_;
+	UMMeshPtr mesh_;
+	UMBvhTriangleList triangle_list_;
+	UMBvhTrianglefList float_triangle_list_;
+
+	template <class T, class List>
+	static bool intersects(
+		const List& triangle_list,
+		const UMWatertightRay<T>& watertight_ray,
+		const UMRay& ray,
+		const UMPrimitiveList& ordered_primitives,
+		int start,
+		int end,
+		UMHit& hit)
+	{
+		bool found = false;
+		for (int k = start; k < end; ++k)
+		{
+			const UMBvhLeafTriangle<T>& triangle = triangle_list[k];
+			if (!triangle.is_triangle)
+			{
+				if (ordered_primitives[k]->intersects(ray, hit))
+				{
+					found = true;
+				}
+				continue;
+			}
+
+			double distance = 0.0;
+			double v = 0.0;
+			double w = 0.0;
+			if (!um_intersect_triangle(watertight_ray, triangle.a, triangle.b, triangle.c,
+				ray.tmin(), ray.tmax(), distance, v, w)) continue;
+			if (distance >= hit.distance) continue;
+
+			hit.set(NULL, k, distance, v, w);
+			found = true;
+		}
+		return found;
+	}
+
+	template <class T, class List>
+	static bool intersects(
+		const List& triangle_list,
+		const UMWatertightRay<T>& watertight_ray,
+		const UMRay& ray,
+		const UMPrimitiveList& ordered_primitives,
+		int start,
+		int end)
+	{
+		for (int k = start; k < end; ++k)
+		{
+			const UMBvhLeafTriangle<T>& triangle = triangle_list[k];
+			if (!triangle.is_triangle)
+			{
+				if (ordered_primitives[k]->intersects(ray)) return true;
+				continue;
+			}
+
+			double distance = 0.0;
+			double v = 0.0;
+			double w = 0.0;
+			if (um_intersect_triangle(watertight_ray, triangle.a, triangle.b, triangle.c,
+				ray.tmin(), ray.tmax(), distance, v, w)) return true;
+		}
+		return false;
+	}
+};
+
+} // burger
@@ -0,0 +1,380 @@
+/**
+ * @file UMBvhOct.cpp
+ * 8-wide bounding volume hierarchy for AVX
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvhOct.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	using namespace burger;
+
+	/// error bound of the float triangle filter in units of float epsilon
+	const float triangle_error_factor = 64.0f;
+
+	/**
+	 * surface area of a binary node
+	 */
+	float node_area(const UMBvhFlatNode& node)
+	{
+		const float dx = node.maximum[0] - node.minimum[0];
+		const float dy = node.maximum[1] - node.minimum[1];
+		const float dz = node.maximum[2] - node.minimum[2];
+		return 2.0f * (dx * dy + dx * dz + dy * dz);
+	}
+
+	/**
+	 * set child slot of an oct node
+	 */
+	void set_child(UMBvhOctNode& node, int slot, const UMBvhFlatNode& src, int child, int primitive_count)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			node.minimum[k][slot] = src.minimum[k];
+			node.maximum[k][slot] = src.maximum[k];
+		}
+		node.child[slot] = child;
+		node.primitive_count[slot] = primitive_count;
+	}
+
+	/**
+	 * set child slot of an oct node empty
+	 */
+	void set_empty_child(UMBvhOctNode& node, int slot)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			node.minimum[k][slot] =  (std::numeric_limits<float>::infinity)();
+			node.maximum[k][slot] = -(std::numeric_limits<float>::infinity)();
+		}
+		node.child[slot] = -1;
+		node.primitive_count[slot] = 0;
+	}
+
+	/**
+	 * sum of absolute components
+	 */
+	double abs_sum(const UMVec3d& v)
+	{
+		return std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+	}
+
+	/**
+	 * set a triangle to a lane
+	 */
+	void set_triangle(UMBvhOctTriangles& triangles, int lane, const UMBvhLeaves& leaves, int primitive_index)
+	{
+		UMVec3d a;
+		UMVec3d b;
+		UMVec3d c;
+		leaves.triangle(primitive_index, a, b, c);
+		const UMVec3d ab = b - a;
+		const UMVec3d ac = c - a;
+		const UMVec3d n = ab.cross(ac);
+		for (int k = 0; k < 3; ++k)
+		{
+			triangles.a[k][lane] = static_cast<float>(a[k]);
+			triangles.ab[k][lane] = static_cast<float>(ab[k]);
+			triangles.ac[k][lane] = static_cast<float>(ac[k]);
+			triangles.n[k][lane] = static_cast<float>(n[k]);
+		}
+		// barycentric values are products of an edge and distance to the first vertex.
+		// their float errors are bounded by these.
+		const double edge = std::max(abs_sum(ab), std::max(abs_sum(ac), abs_sum(c - b)));
+		const double epsilon = triangle_error_factor * std::numeric_limits<float>::epsilon();
+		triangles.error_scale[lane] = static_cast<float>(epsilon * edge);
+		triangles.error_bias[lane] = static_cast<float>(epsilon * edge * (edge + abs_sum(a)));
+	}
+
+	/**
+	 * set an empty lane
+	 */
+	void set_empty_lane(UMBvhOctTriangles& triangles, int lane)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			triangles.a[k][lane] = 0.0f;
+			triangles.ab[k][lane] = 0.0f;
+			triangles.ac[k][lane] = 0.0f;
+			triangles.n[k][lane] = 0.0f;
+		}
+		triangles.error_scale[lane] = 0.0f;
+		triangles.error_bias[lane] = 0.0f;
+		triangles.primitive_index[lane] = -1;
+	}
+
+	/**
+	 * set a float triangle to a lane
+	 */
+	void set_triangle(UMBvhOctFloatTriangles& triangles, int lane, const UMBvhLeaves& leaves, int primitive_index)
+	{
+		const UMBvhTrianglef& triangle = leaves.float_triangle_list()[primitive_index];
+		for (int k = 0; k < 3; ++k)
+		{
+			triangles.vertex[0][k][lane] = triangle.a[k];
+			triangles.vertex[1][k][lane] = triangle.b[k];
+			triangles.vertex[2][k][lane] = triangle.c[k];
+		}
+	}
+
+	/**
+	 * set an empty lane of float triangles
+	 */
+	void set_empty_lane(UMBvhOctFloatTriangles& triangles, int lane)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				triangles.vertex[i][k][lane] = 0.0f;
+			}
+		}
+		triangles.primitive_index[lane] = -1;
+	}
+
+	/**
+	 * create triangle packets of a leaf
+	 * @retval index of first packet
+	 */
+	template <class Triangles, class List>
+	int create_packets(List& triangles_list, const UMBvhFlatNode& binary_leaf, const UMBvhLeaves& leaves)
+	{
+		const int first = static_cast<int>(triangles_list.size());
+		const int start = binary_leaf.offset;
+		const int end = binary_leaf.offset + binary_leaf.primitive_count;
+		for (int packet_start = start; packet_start < end; packet_start += 8)
+		{
+			Triangles triangles;
+			triangles.valid_mask = 0;
+			triangles.triangle_mask = 0;
+			for (int lane = 0; lane < 8; ++lane)
+			{
+				const int primitive_index = packet_start + lane;
+				if (primitive_index >= end)
+				{
+					set_empty_lane(triangles, lane);
+					continue;
+				}
+				triangles.valid_mask |= (1 << lane);
+				if (leaves.is_triangle(primitive_index))
+				{
+					set_triangle(triangles, lane, leaves, primitive_index);
+					triangles.triangle_mask |= (1 << lane);
+				}
+				else
+				{
+					set_empty_lane(triangles, lane);
+				}
+				triangles.primitive_index[lane] = primitive_index;
+			}
+			triangles_list.push_back(triangles);
+		}
+		return first;
+	}
+
+	/**
+	 * refit triangle packets to refitted leaves
+	 */
+	template <class List>
+	void refit_packets(List& triangles_list, const UMBvhLeaves& leaves)
+	{
+		const int packet_count = static_cast<int>(triangles_list.size());
+#pragma omp parallel for if (packet_count > 4096)
+		for (int i = 0; i < packet_count; ++i)
+		{
+			for (int lane = 0; lane < 8; ++lane)
+			{
+				if (!(triangles_list[i].triangle_mask & (1 << lane))) continue;
+				set_triangle(triangles_list[i], lane, leaves, triangles_list[i].primitive_index[lane]);
+			}
+		}
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * the cpu and os support AVX or not
+ */
+bool UMBvhOct::is_supported()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx) return false;
+	// os saves ymm registers
+	return (_xgetbv(0) & 6) == 6;
+#elif defined(__GNUC__)
+	return __builtin_cpu_supports("avx") != 0;
+#else
+	return false;
+#endif
+}
+
+/**
+ * build from binary bvh nodes
+ */
+bool UMBvhOct::build(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves)
+{
+	node_list_.clear();
+	source_list_.clear();
+	triangles_list_.clear();
+	float_triangles_list_.clear();
+	if (binary_node_list.empty()) return false;
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	if (root.is_leaf())
+	{
+		UMBvhOctNode node;
+		set_child(node, 0, root, create_leaf(root, leaves), root.primitive_count);
+		for (int i = 1; i < 8; ++i)
+		{
+			set_empty_child(node, i);
+		}
+		node_list_.push_back(node);
+		source_list_.assign(8, -1);
+		source_list_[0] = 0;
+		return true;
+	}
+	node_list_.reserve(binary_node_list.size() / 4 + 1);
+	if (leaves.precision() == eFloatLeaf)
+	{
+		float_triangles_list_.reserve(binary_node_list.size() / 2 + 1);
+	}
+	else
+	{
+		triangles_list_.reserve(binary_node_list.size() / 2 + 1);
+	}
+	collapse(binary_node_list, leaves, 0);
+	return true;
+}
+
+/**
+ * refit bounds and triangles to refitted binary bvh nodes
+ */
+void UMBvhOct::refit(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves)
+{
+	if (node_list_.empty() || binary_node_list.empty()) return;
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	const int node_count = static_cast<int>(node_list_.size());
+#pragma omp parallel for if (node_count > 4096)
+	for (int i = 0; i < node_count; ++i)
+	{
+		UMBvhOctNode& node = node_list_[i];
+		for (int slot = 0; slot < 8; ++slot)
+		{
+			const int source = source_list_[i * 8 + slot];
+			if (source < 0) continue;
+			const UMBvhFlatNode& src = binary_node_list[source];
+			for (int k = 0; k < 3; ++k)
+			{
+				node.minimum[k][slot] = src.minimum[k];
+				node.maximum[k][slot] = src.maximum[k];
+			}
+		}
+	}
+
+	// leaves are refitted before this
+	refit_packets(triangles_list_, leaves);
+	refit_packets(float_triangles_list_, leaves);
+}
+
+/**
+ * collapse binary branch to an oct node
+ * @retval index of created node
+ */
+int UMBvhOct::collapse(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves, int binary_index)
+{
+	const int index = static_cast<int>(node_list_.size());
+	node_list_.push_back(UMBvhOctNode());
+	source_list_.resize(source_list_.size() + 8, -1);
+
+	// open the largest branch child until 8 children
+	int children[8];
+	int child_count = 2;
+	children[0] = binary_index + 1;
+	children[1] = binary_node_list[binary_index].offset;
+	while (child_count < 8)
+	{
+		int largest = -1;
+		float largest_area = -1.0f;
+		for (int i = 0; i < child_count; ++i)
+		{
+			const UMBvhFlatNode& child = binary_node_list[children[i]];
+			if (child.is_leaf()) continue;
+			const float area = node_area(child);
+			if (area > largest_area)
+			{
+				largest_area = area;
+				largest = i;
+			}
+		}
+		if (largest < 0) break;
+		const int opened = children[largest];
+		children[largest] = opened + 1;
+		children[child_count++] = binary_node_list[opened].offset;
+	}
+
+	for (int i = 0; i < 8; ++i)
+	{
+		if (i >= child_count)
+		{
+			set_empty_child(node_list_[index], i);
+			continue;
+		}
+		const UMBvhFlatNode& child = binary_node_list[children[i]];
+		source_list_[index * 8 + i] = children[i];
+		if (child.is_leaf())
+		{
+			const int leaf_index = create_leaf(child, leaves);
+			set_child(node_list_[index], i, child, leaf_index, child.primitive_count);
+		}
+		else
+		{
+			// node_list_ may be reallocated in collapse
+			const int child_index = collapse(binary_node_list, leaves, children[i]);
+			set_child(node_list_[index], i, child, child_index, 0);
+		}
+	}
+	return index;
+}
+
+/**
+ * create triangle packets of a leaf
+ * @retval index of first packet
+ */
+int UMBvhOct::create_leaf(const UMBvhFlatNode& binary_leaf, const UMBvhLeaves& leaves)
+{
+	if (leaves.precision() == eFloatLeaf)
+	{
+		return create_packets<UMBvhOctFloatTriangles>(float_triangles_list_, binary_leaf, leaves);
+	}
+	return create_packets<UMBvhOctTriangles>(triangles_list_, binary_leaf, leaves);
+}
+
+} // burger
@@ -0,0 +1,180 @@
+/**
+ * @file UMBvhOct.h
+ * 8-wide bounding volume hierarchy for AVX
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "UMMacro.h"
+#include "UMPrimitive.h"
+#include "UMAlignedAllocator.h"
+#include "UMBvh.h"
+
+namespace burger
+{
+
+class UMBvhOct;
+typedef std::shared_ptr<UMBvhOct> UMBvhOctPtr;
+
+class UMRay;
+class UMShaderParameter;
+
+/**
+ * 8-wide bvh node.
+ * bounds of 8 children are stored as SoA for AVX.
+ */
+struct UMBvhOctNode
+{
+	/// minimum of child AABBs. [axis][child]
+	float minimum[3][8];
+	/// maximum of child AABBs. [axis][child]
+	float maximum[3][8];
+	/// leaf: first index of triangle packets. branch: node index. -1: empty
+	int child[8];
+	/// primitive count of leaf child. 0 for branch child
+	int primitive_count[8];
+};
+typedef std::vector<UMBvhOctNode, UMAlignedAllocator<UMBvhOctNode, 32> > UMBvhOctNodeList;
+
+/**
+ * up to 8 leaf primitives of eDoubleLeaf stored as SoA for AVX.
+ * triangles are filtered by a conservative float test,
+ * then confirmed by the watertight test of UMBvhLeaves.
+ */
+struct UMBvhOctTriangles
+{
+	/// first vertex. [axis][lane]
+	float a[3][8];
+	/// second vertex - first vertex
+	float ab[3][8];
+	/// third vertex - first vertex
+	float ac[3][8];
+	/// not normalized normal. ab x ac
+	float n[3][8];
+	/// error bound factor multiplied by distance to the first vertex
+	float error_scale[8];
+	/// error bound bias
+	float error_bias[8];
+	/// index of ordered primitives. -1 for empty lane
+	int primitive_index[8];
+	/// lanes which have a primitive
+	int valid_mask;
+	/// lanes which have a triangle. other primitives are always tested.
+	int triangle_mask;
+	int padding[6];
+};
+typedef std::vector<UMBvhOctTriangles, UMAlignedAllocator<UMBvhOctTriangles, 32> > UMBvhOctTrianglesList;
+
+/**
+ * up to 8 leaf primitives of eFloatLeaf stored as SoA for AVX.
+ * triangles are tested by the float watertight test of all lanes at once,
+ * which gives the same result as UMBvhLeaves. only the closest lane is tested again to set the hit.
+ */
+struct UMBvhOctFloatTriangles
+{
+	/// vertices same as float leaves. [vertex][axis][lane]
+	float vertex[3][3][8];
+	/// index of ordered primitives. -1 for empty lane
+	int primitive_index[8];
+	/// lanes which have a primitive
+	int valid_mask;
+	/// lanes which have a triangle. other primitives are tested by themselves.
+	int triangle_mask;
+	int padding[6];
+};
+typedef std::vector<UMBvhOctFloatTriangles, UMAlignedAllocator<UMBvhOctFloatTriangles, 32> > UMBvhOctFloatTrianglesList;
+
+/**
+ * 8-wide bvh collapsed from a binary bvh.
+ * shares ordered primitives with the binary bvh.
+ * traversal is in UMBvhOctAvx.cpp, where only the traversal functions use AVX.
+ */
+class UMBvhOct
+{
+	DISALLOW_COPY_AND_ASSIGN(UMBvhOct);
+
+public:
+	UMBvhOct()
+	{
+		bounds_abs_max_[0] = bounds_abs_max_[1] = bounds_abs_max_[2] = 0.0f;
+	}
+
+	~UMBvhOct() {}
+
+	/**
+	 * the cpu and os support AVX or not
+	 */
+	static bool is_supported();
+
+	/**
+	 * build from binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh
+	 * @param [in] leaves precomputed leaf primitives. triangles are read from this
+	 * @retval success or fail
+	 */
+	bool build(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves);
+
+	/**
+	 * refit bounds and triangles to refitted binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh which has the same topology as built
+	 * @param [in] leaves refitted leaf primitives
+	 */
+	void refit(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves);
+
+	/**
+	 * get node count
+	 */
+	unsigned int node_count() const { return static_cast<unsigned int>(node_list_.size()); }
+
+	/**
+	 * get node list
+	 */
+	const UMBvhOctNodeList& node_list() const { return node_list_; }
+
+	/**
+	 * get leaf triangle packets. empty if leaves are eFloatLeaf
+	 */
+	const UMBvhOctTrianglesList& triangles_list() const { return triangles_list_; }
+
+	/**
+	 * get float leaf triangle packets. empty if leaves are eDoubleLeaf
+	 */
+	const UMBvhOctFloatTrianglesList& float_triangles_list() const { return float_triangles_list_; }
+
+	/**
+	 * ray intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 * @param [in,out] hit the closest hit found so far. triangles of leaves are set without primitive
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const;
+
+	/**
+	 * ray intersection
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const;
+
+private:
+	int collapse(const UMBvhFlatNodeList& binary_node_list, const UMBvhLeaves& leaves, int binary_index);
+	int create_leaf(const UMBvhFlatNode& binary_leaf, const UMBvhLeaves& leaves);
+
+	UMBvhOctNodeList node_list_;
+	UMBvhOctTrianglesList triangles_list_;
+	UMBvhOctFloatTrianglesList float_triangles_list_;
+	// binary node index of each child slot. -1 for empty
+	std::vector<int> source_list_;
+	float bounds_abs_max_[3];
+};
+
+} // burger
@@ -0,0 +1,530 @@
+/**
+ * @file UMBvhOctAvx.cpp
+ * 8-wide bounding volume hierarchy traversal.
+ * only the functions marked UM_TARGET_AVX use AVX, and they are called only if UMBvhOct::is_supported().
+ * the file is compiled with the project flags, so inline functions of shared headers
+ * which are not inlined into them are compiled without AVX.
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvhOct.h"
+#include <algorithm>
+#include <limits>
+#include <immintrin.h>
+#include "UMRay.h"
+#include "UMShaderParameter.h"
+
+#if defined(__GNUC__)
+#define UM_TARGET_AVX __attribute__((target("avx")))
+#else
+// msvc emits AVX intrinsics without /arch:AVX
+#define UM_TARGET_AVX
+#endif
+
+namespace
+{
+	using namespace burger;
+
+	/// max traversal stack size
+	const int max_stack_size = 1024;
+
+	/// enlarges far distance of float slab test to cover rounding errors
+	const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+	/**
+	 * traversal stack entry
+	 */
+	struct StackEntry
+	{
+		int child;
+		int primitive_count;
+		float distance;
+	};
+
+	/**
+	 * absolute value of 8 floats
+	 */
+	UM_TARGET_AVX inline __m256 abs_ps(__m256 v)
+	{
+		return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+	}
+
+	/**
+	 * ray data for AVX tests
+	 */
+	struct OctRay
+	{
+		UM_TARGET_AVX OctRay(const UMRay& ray, const float bounds_abs_max[3])
+		{
+			float origin_abs_sum_f = 0.0f;
+			for (int k = 0; k < 3; ++k)
+			{
+				const double origin_d = ray.origin()[k];
+				const float origin_f = static_cast<float>(origin_d);
+				const float direction_f = static_cast<float>(ray.direction()[k]);
+				const float inv_dir_f = static_cast<float>(1.0 / ray.direction()[k]);
+				const float abs_inv_dir_f = inv_dir_f < 0.0f ? -inv_dir_f : inv_dir_f;
+				const float abs_origin_f = origin_f < 0.0f ? -origin_f : origin_f;
+				// error bound of slab distances by rounding of the origin and of the products
+				const double origin_error = static_cast<double>(origin_f) - origin_d;
+				const float pad = static_cast<float>(
+					((origin_error < 0.0 ? -origin_error : origin_error)
+					+ 4.0 * std::numeric_limits<float>::epsilon() * (abs_origin_f + bounds_abs_max[k]))
+					* abs_inv_dir_f);
+				origin[k] = _mm256_set1_ps(origin_f);
+				direction[k] = _mm256_set1_ps(direction_f);
+				inv_dir[k] = _mm256_set1_ps(inv_dir_f);
+				// near distance is decreased and far distance is increased by pad
+				origin_x_inv_dir_near[k] = _mm256_set1_ps(origin_f * inv_dir_f + pad);
+				origin_x_inv_dir_far[k] = _mm256_set1_ps(origin_f * inv_dir_f - pad);
+				is_negative[k] = inv_dir_f < 0.0f ? 1 : 0;
+				origin_abs_sum_f += abs_origin_f;
+			}
+			origin_abs_sum = _mm256_set1_ps(origin_abs_sum_f);
+			tmin = _mm256_set1_ps(static_cast<float>(ray.tmin()));
+		}
+		__m256 origin[3];
+		__m256 direction[3];
+		__m256 inv_dir[3];
+		__m256 origin_x_inv_dir_near[3];
+		__m256 origin_x_inv_dir_far[3];
+		__m256 origin_abs_sum;
+		__m256 tmin;
+		int is_negative[3];
+	};
+
+	/**
+	 * test 8 child boxes
+	 * @param [out] distance near distance of each child
+	 * @retval hit mask
+	 */
+	UM_TARGET_AVX inline int intersect_oct(
+		const UMBvhOctNode& node,
+		const OctRay& ray,
+		float closest_distance,
+		float distance[8])
+	{
+		__m256 interval_min = ray.tmin;
+		__m256 interval_max = _mm256_set1_ps(closest_distance * far_scale);
+		const __m256 scale = _mm256_set1_ps(far_scale);
+		for (int k = 0; k < 3; ++k)
+		{
+			const __m256 near_plane = _mm256_load_ps(ray.is_negative[k] ? node.maximum[k] : node.minimum[k]);
+			const __m256 far_plane = _mm256_load_ps(ray.is_negative[k] ? node.minimum[k] : node.maximum[k]);
+			const __m256 tnear = _mm256_sub_ps(_mm256_mul_ps(near_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_near[k]);
+			const __m256 tfar = _mm256_sub_ps(_mm256_mul_ps(far_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_far[k]);
+			// NaN is ignored because max/min return the second operand
+			interval_min = _mm256_max_ps(tnear, interval_min);
+			interval_max = _mm256_min_ps(_mm256_mul_ps(tfar, scale), interval_max);
+		}
+		_mm256_storeu_ps(distance, interval_min);
+		return _mm256_movemask_ps(_mm256_cmp_ps(interval_min, interval_max, _CMP_LE_OQ));
+	}
+
+	/**
+	 * conservative float test of 8 triangles of eDoubleLeaf.
+	 * follows UMTriangle::intersects, accepting lanes within the error bound.
+	 * @retval candidate mask
+	 */
+	UM_TARGET_AVX inline int filter_triangles(const UMBvhOctTriangles& triangles, const OctRay& ray)
+	{
+		const __m256 aox = _mm256_sub_ps(ray.origin[0], _mm256_load_ps(triangles.a[0]));
+		const __m256 aoy = _mm256_sub_ps(ray.origin[1], _mm256_load_ps(triangles.a[1]));
+		const __m256 aoz = _mm256_sub_ps(ray.origin[2], _mm256_load_ps(triangles.a[2]));
+		const __m256& dx = ray.direction[0];
+		const __m256& dy = ray.direction[1];
+		const __m256& dz = ray.direction[2];
+
+		// d = -dir . n
+		const __m256 d = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(
+			_mm256_mul_ps(dx, _mm256_load_ps(triangles.n[0])), _mm256_add_ps(
+			_mm256_mul_ps(dy, _mm256_load_ps(triangles.n[1])),
+			_mm256_mul_ps(dz, _mm256_load_ps(triangles.n[2])))));
+
+		// e = -dir x ao
+		const __m256 ex = _mm256_sub_ps(_mm256_mul_ps(aoy, dz), _mm256_mul_ps(aoz, dy));
+		const __m256 ey = _mm256_sub_ps(_mm256_mul_ps(aoz, dx), _mm256_mul_ps(aox, dz));
+		const __m256 ez = _mm256_sub_ps(_mm256_mul_ps(aox, dy), _mm256_mul_ps(aoy, dx));
+
+		// v = ac . e, w = -ab . e
+		const __m256 v = _mm256_add_ps(
+			_mm256_mul_ps(_mm256_load_ps(triangles.ac[0]), ex), _mm256_add_ps(
+			_mm256_mul_ps(_mm256_load_ps(triangles.ac[1]), ey),
+			_mm256_mul_ps(_mm256_load_ps(triangles.ac[2]), ez)));
+		const __m256 w = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(
+			_mm256_mul_ps(_mm256_load_ps(triangles.ab[0]), ex), _mm256_add_ps(
+			_mm256_mul_ps(_mm256_load_ps(triangles.ab[1]), ey),
+			_mm256_mul_ps(_mm256_load_ps(triangles.ab[2]), ez))));
+
+		// error bound
+		const __m256 ao_abs_sum = _mm256_add_ps(abs_ps(aox), _mm256_add_ps(abs_ps(aoy), abs_ps(aoz)));
+		const __m256 tolerance = _mm256_add_ps(
+			_mm256_mul_ps(_mm256_load_ps(triangles.error_scale), _mm256_add_ps(ao_abs_sum, ray.origin_abs_sum)),
+			_mm256_load_ps(triangles.error_bias));
+		const __m256 negative_tolerance = _mm256_sub_ps(_mm256_setzero_ps(), tolerance);
+
+		__m256 mask = _mm256_cmp_ps(d, negative_tolerance, _CMP_GE_OQ);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, negative_tolerance, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(w, negative_tolerance, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(
+			_mm256_add_ps(v, w),
+			_mm256_add_ps(d, _mm256_add_ps(tolerance, tolerance)),
+			_CMP_LE_OQ));
+
+		const int hit_mask = _mm256_movemask_ps(mask) & triangles.triangle_mask;
+		const int other_mask = triangles.valid_mask & ~triangles.triangle_mask;
+		return hit_mask | other_mask;
+	}
+
+	/**
+	 * float watertight ray for AVX tests
+	 */
+	struct WatertightOctRay
+	{
+		UM_TARGET_AVX explicit WatertightOctRay(const UMWatertightRay<float>& ray)
+			: kx(ray.kx), ky(ray.ky), kz(ray.kz)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				origin[k] = _mm256_set1_ps(ray.origin[k]);
+			}
+			sx = _mm256_set1_ps(ray.sx);
+			sy = _mm256_set1_ps(ray.sy);
+			sz = _mm256_set1_ps(ray.sz);
+		}
+		__m256 origin[3];
+		__m256 sx;
+		__m256 sy;
+		__m256 sz;
+		int kx;
+		int ky;
+		int kz;
+	};
+
+	/**
+	 * float watertight test of 8 triangles.
+	 * follows um_intersect_triangle in the same operation order,
+	 * so accepted lanes and distances are the same as UMBvhLeaves.
+	 * @param [out] hit_mask lanes accepted before the distance range test
+	 * @param [out] distance hit distance of each lane
+	 * @retval false if lanes must be tested by UMBvhLeaves
+	 */
+	UM_TARGET_AVX inline bool intersect_triangles(
+		const UMBvhOctFloatTriangles& triangles,
+		const WatertightOctRay& ray,
+		int& hit_mask,
+		double distance[8])
+	{
+		// other primitives are tested by themselves
+		if (triangles.triangle_mask != triangles.valid_mask) return false;
+
+		const __m256 oax = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[0][ray.kx]), ray.origin[ray.kx]);
+		const __m256 oay = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[0][ray.ky]), ray.origin[ray.ky]);
+		const __m256 oaz = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[0][ray.kz]), ray.origin[ray.kz]);
+		const __m256 obx = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[1][ray.kx]), ray.origin[ray.kx]);
+		const __m256 oby = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[1][ray.ky]), ray.origin[ray.ky]);
+		const __m256 obz = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[1][ray.kz]), ray.origin[ray.kz]);
+		const __m256 ocx = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[2][ray.kx]), ray.origin[ray.kx]);
+		const __m256 ocy = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[2][ray.ky]), ray.origin[ray.ky]);
+		const __m256 ocz = _mm256_sub_ps(_mm256_load_ps(triangles.vertex[2][ray.kz]), ray.origin[ray.kz]);
+
+		// shear and scale vertices
+		const __m256 ax = _mm256_sub_ps(oax, _mm256_mul_ps(ray.sx, oaz));
+		const __m256 ay = _mm256_sub_ps(oay, _mm256_mul_ps(ray.sy, oaz));
+		const __m256 bx = _mm256_sub_ps(obx, _mm256_mul_ps(ray.sx, obz));
+		const __m256 by = _mm256_sub_ps(oby, _mm256_mul_ps(ray.sy, obz));
+		const __m256 cx = _mm256_sub_ps(ocx, _mm256_mul_ps(ray.sx, ocz));
+		const __m256 cy = _mm256_sub_ps(ocy, _mm256_mul_ps(ray.sy, ocz));
+
+		// edge functions. zero edges are computed again in double by UMBvhLeaves
+		const __m256 eu = _mm256_sub_ps(_mm256_mul_ps(cx, by), _mm256_mul_ps(cy, bx));
+		const __m256 ev = _mm256_sub_ps(_mm256_mul_ps(ax, cy), _mm256_mul_ps(ay, cx));
+		const __m256 ew = _mm256_sub_ps(_mm256_mul_ps(bx, ay), _mm256_mul_ps(by, ax));
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 on_edge = _mm256_or_ps(_mm256_cmp_ps(eu, zero, _CMP_EQ_OQ),
+			_mm256_or_ps(_mm256_cmp_ps(ev, zero, _CMP_EQ_OQ), _mm256_cmp_ps(ew, zero, _CMP_EQ_OQ)));
+		if (_mm256_movemask_ps(on_edge) & triangles.triangle_mask) return false;
+
+		// outside or back face
+		__m256 reject = _mm256_or_ps(_mm256_cmp_ps(eu, zero, _CMP_LT_OQ),
+			_mm256_or_ps(_mm256_cmp_ps(ev, zero, _CMP_LT_OQ), _mm256_cmp_ps(ew, zero, _CMP_LT_OQ)));
+		const __m256 det = _mm256_add_ps(_mm256_add_ps(eu, ev), ew);
+		reject = _mm256_or_ps(reject, _mm256_cmp_ps(det, zero, _CMP_EQ_OQ));
+
+		const __m256 az = _mm256_mul_ps(ray.sz, oaz);
+		const __m256 bz = _mm256_mul_ps(ray.sz, obz);
+		const __m256 cz = _mm256_mul_ps(ray.sz, ocz);
+		const __m256 t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(eu, az), _mm256_mul_ps(ev, bz)), _mm256_mul_ps(ew, cz));
+		reject = _mm256_or_ps(reject, _mm256_cmp_ps(t, zero, _CMP_LT_OQ));
+		hit_mask = ~_mm256_movemask_ps(reject) & triangles.triangle_mask;
+		if (hit_mask == 0) return true;
+
+		// distance in double
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d inv_det_low = _mm256_div_pd(one, _mm256_cvtps_pd(_mm256_castps256_ps128(det)));
+		const __m256d inv_det_high = _mm256_div_pd(one, _mm256_cvtps_pd(_mm256_extractf128_ps(det, 1)));
+		_mm256_storeu_pd(distance, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(t)), inv_det_low));
+		_mm256_storeu_pd(distance + 4, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(t, 1)), inv_det_high));
+		return true;
+	}
+
+	/**
+	 * closest intersection of a float packet.
+	 * only the closest lane is tested again by UMBvhLeaves to set the hit.
+	 */
+	UM_TARGET_AVX inline bool intersects_packet(
+		const UMBvhOctFloatTriangles& triangles,
+		const WatertightOctRay& watertight_ray,
+		const UMBvhLeafRay& leaf_ray,
+		const UMPrimitiveList& ordered_primitives,
+		const UMBvhLeaves& leaves,
+		UMHit& hit)
+	{
+		int mask = 0;
+		double distance[8];
+		if (!intersect_triangles(triangles, watertight_ray, mask, distance))
+		{
+			bool found = false;
+			for (int lane = 0; lane < 8; ++lane)
+			{
+				if (!(triangles.valid_mask & (1 << lane))) continue;
+				const int k = triangles.primitive_index[lane];
+				if (leaves.intersects(leaf_ray, ordered_primitives, k, k + 1, hit))
+				{
+					found = true;
+				}
+			}
+			return found;
+		}
+
+		// same order of tests as UMBvhLeaves
+		const double tmin = leaf_ray.ray->tmin();
+		const double tmax = leaf_ray.ray->tmax();
+		double closest_distance = hit.distance;
+		int closest_lane = -1;
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+			if (distance[lane] < tmin) continue;
+			if (distance[lane] > tmax) continue;
+			if (distance[lane] >= closest_distance) continue;
+			closest_distance = distance[lane];
+			closest_lane = lane;
+		}
+		if (closest_lane < 0) return false;
+		const int k = triangles.primitive_index[closest_lane];
+		return leaves.intersects(leaf_ray, ordered_primitives, k, k + 1, hit);
+	}
+
+	/**
+	 * any intersection of a float packet
+	 */
+	UM_TARGET_AVX inline bool intersects_packet(
+		const UMBvhOctFloatTriangles& triangles,
+		const WatertightOctRay& watertight_ray,
+		const UMBvhLeafRay& leaf_ray,
+		const UMPrimitiveList& ordered_primitives,
+		const UMBvhLeaves& leaves)
+	{
+		int mask = 0;
+		double distance[8];
+		if (!intersect_triangles(triangles, watertight_ray, mask, distance))
+		{
+			for (int lane = 0; lane < 8; ++lane)
+			{
+				if (!(triangles.valid_mask & (1 << lane))) continue;
+				const int k = triangles.primitive_index[lane];
+				if (leaves.intersects(leaf_ray, ordered_primitives, k, k + 1)) return true;
+			}
+			return false;
+		}
+
+		const double tmin = leaf_ray.ray->tmin();
+		const double tmax = leaf_ray.ray->tmax();
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+			if (distance[lane] < tmin) continue;
+			if (distance[lane] > tmax) continue;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * closest intersection of a double packet.
+	 * candidates of the conservative filter are tested by UMBvhLeaves.
+	 */
+	UM_TARGET_AVX inline bool intersects_packet(
+		const UMBvhOctTriangles& triangles,
+		const OctRay& oct_ray,
+		const UMBvhLeafRay& leaf_ray,
+		const UMPrimitiveList& ordered_primitives,
+		const UMBvhLeaves& leaves,
+		UMHit& hit)
+	{
+		bool found = false;
+		int mask = filter_triangles(triangles, oct_ray);
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+			const int k = triangles.primitive_index[lane];
+			if (leaves.intersects(leaf_ray, ordered_primitives, k, k + 1, hit))
+			{
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	/**
+	 * any intersection of a double packet
+	 */
+	UM_TARGET_AVX inline bool intersects_packet(
+		const UMBvhOctTriangles& triangles,
+		const OctRay& oct_ray,
+		const UMBvhLeafRay& leaf_ray,
+		const UMPrimitiveList& ordered_primitives,
+		const UMBvhLeaves& leaves)
+	{
+		int mask = filter_triangles(triangles, oct_ray);
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+			const int k = triangles.primitive_index[lane];
+			if (leaves.intersects(leaf_ray, ordered_primitives, k, k + 1)) return true;
+		}
+		return false;
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * ray intersection
+ */
+UM_TARGET_AVX bool UMBvhOct::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const
+{
+	if (node_list_.empty()) return false;
+
+	const OctRay oct_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	const WatertightOctRay watertight_ray(leaf_ray.float_ray);
+	const bool is_float_leaf = (leaves.precision() == eFloatLeaf);
+	float closest_distance_f = static_cast<float>(
+		std::min(hit.distance, static_cast<double>((std::numeric_limits<float>::max)())));
+	bool found = false;
+
+	StackEntry stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index].child = 0;
+	stack[stack_index].primitive_count = 0;
+	stack[stack_index].distance = 0.0f;
+	++stack_index;
+
+	while (stack_index > 0)
+	{
+		const StackEntry entry = stack[--stack_index];
+		if (entry.distance > closest_distance_f) continue;
+
+		// leaf
+		if (entry.primitive_count > 0)
+		{
+			const int packet_end = entry.child + (entry.primitive_count + 7) / 8;
+			for (int p = entry.child; p < packet_end; ++p)
+			{
+				const bool packet_found = is_float_leaf
+					? intersects_packet(float_triangles_list_[p], watertight_ray, leaf_ray, ordered_primitives, leaves, hit)
+					: intersects_packet(triangles_list_[p], oct_ray, leaf_ray, ordered_primitives, leaves, hit);
+				if (packet_found)
+				{
+					closest_distance_f = static_cast<float>(hit.distance);
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// branch
+		const UMBvhOctNode& node = node_list_[entry.child];
+		float distance[8];
+		const int mask = intersect_oct(node, oct_ray, closest_distance_f, distance);
+		if (mask == 0) continue;
+
+		// sort hit children far to near, then push. near child is popped first.
+		int order[8];
+		int hit_count = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			int k = hit_count++;
+			while (k > 0 && distance[order[k - 1]] < distance[i])
+			{
+				order[k] = order[k - 1];
+				--k;
+			}
+			order[k] = i;
+		}
+		for (int i = 0; i < hit_count; ++i)
+		{
+			StackEntry& pushed = stack[stack_index++];
+			pushed.child = node.child[order[i]];
+			pushed.primitive_count = node.primitive_count[order[i]];
+			pushed.distance = distance[order[i]];
+		}
+	}
+	return found;
+}
+
+/**
+ * ray intersection
+ */
+UM_TARGET_AVX bool UMBvhOct::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const
+{
+	if (node_list_.empty()) return false;
+
+	const OctRay oct_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	const WatertightOctRay watertight_ray(leaf_ray.float_ray);
+	const bool is_float_leaf = (leaves.precision() == eFloatLeaf);
+	const float tmax = static_cast<float>(ray.tmax());
+
+	int stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index++] = 0;
+
+	while (stack_index > 0)
+	{
+		const UMBvhOctNode& node = node_list_[stack[--stack_index]];
+		float distance[8];
+		const int mask = intersect_oct(node, oct_ray, tmax, distance);
+		for (int i = 0; i < 8; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			if (node.primitive_count[i] > 0)
+			{
+				const int packet_end = node.child[i] + (node.primitive_count[i] + 7) / 8;
+				for (int p = node.child[i]; p < packet_end; ++p)
+				{
+					const bool packet_found = is_float_leaf
+						? intersects_packet(float_triangles_list_[p], watertight_ray, leaf_ray, ordered_primitives, leaves)
+						: intersects_packet(triangles_list_[p], oct_ray, leaf_ray, ordered_primitives, leaves);
+					if (packet_found) return true;
+				}
+			}
+			else
+			{
+				stack[stack_index++] = node.child[i];
+			}
+		}
+	}
+	return false;
+}
+
+} // burger
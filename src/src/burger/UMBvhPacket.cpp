@@ -0,0 +1,398 @@
+/**
+ * @file UMBvhPacket.cpp
+ * ray packet traversal of bounding volume hierarchy
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvh.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMShaderParameter.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+namespace
+{
+	using namespace burger;
+
+	const int max_packet_ray_count = UMRayPacket::max_ray_count;
+
+	/// cosine of max angle between a ray and mean direction of a coherent packet
+	const double coherent_cosine = 0.9;
+
+	/**
+	 * active rays of a packet in structure of arrays
+	 */
+	struct PacketRays
+	{
+		/// ray count
+		int count;
+		/// index in the packet
+		int index[max_packet_ray_count];
+		double origin[3][max_packet_ray_count];
+		double inv_dir[3][max_packet_ray_count];
+		int dir_is_negative[3][max_packet_ray_count];
+		double tmin[max_packet_ray_count];
+		/// tmax or distance of the closest hit found so far
+		double tmax[max_packet_ray_count];
+		/// shadow ray is occluded
+		bool done[max_packet_ray_count];
+
+		/// interval of all rays. an axis is not used if directions have different signs
+		bool is_interval_axis[3];
+		double origin_min[3];
+		double origin_max[3];
+		double inv_dir_min[3];
+		double inv_dir_max[3];
+		double tmin_min;
+		double tmax_max;
+	};
+
+	/**
+	 * set active rays of the packet
+	 */
+	void set_packet_rays(PacketRays& rays, const UMRayPacket& packet)
+	{
+		rays.count = 0;
+		for (int i = 0; i < packet.ray_count(); ++i)
+		{
+			if (!packet.is_active(i)) continue;
+			if (packet.is_shadow() && packet.is_hit(i)) continue;
+			const UMRay& ray = packet.ray(i);
+			const int r = rays.count++;
+			rays.index[r] = i;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				rays.origin[axis][r] = ray.origin()[axis];
+				rays.inv_dir[axis][r] = 1.0 / ray.direction()[axis];
+				rays.dir_is_negative[axis][r] = rays.inv_dir[axis][r] < 0 ? 1 : 0;
+			}
+			rays.tmin[r] = ray.tmin();
+			rays.tmax[r] = packet.closest_distance(i);
+			rays.done[r] = false;
+		}
+		if (rays.count == 0) return;
+
+		rays.tmin_min = *std::min_element(rays.tmin, rays.tmin + rays.count);
+		rays.tmax_max = *std::max_element(rays.tmax, rays.tmax + rays.count);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const double* origin = rays.origin[axis];
+			const double* inv_dir = rays.inv_dir[axis];
+			rays.origin_min[axis] = *std::min_element(origin, origin + rays.count);
+			rays.origin_max[axis] = *std::max_element(origin, origin + rays.count);
+			rays.inv_dir_min[axis] = *std::min_element(inv_dir, inv_dir + rays.count);
+			rays.inv_dir_max[axis] = *std::max_element(inv_dir, inv_dir + rays.count);
+			// interval of an axis is valid only if all rays go to the same side with finite inv_dir
+			rays.is_interval_axis[axis] =
+				(rays.inv_dir_min[axis] > 0 || rays.inv_dir_max[axis] < 0) &&
+				std::fabs(rays.inv_dir_min[axis]) <= DBL_MAX &&
+				std::fabs(rays.inv_dir_max[axis]) <= DBL_MAX;
+		}
+	}
+
+	/**
+	 * rays go to similar directions or not.
+	 * traversing a packet of diverged rays visits the union of their nodes,
+	 * so such packets are traced ray by ray.
+	 */
+	bool is_coherent(const UMRayPacket& packet, const PacketRays& rays)
+	{
+		if (!rays.is_interval_axis[0] || !rays.is_interval_axis[1] || !rays.is_interval_axis[2]) return false;
+		UMVec3d mean(0);
+		for (int r = 0; r < rays.count; ++r)
+		{
+			mean += packet.ray(rays.index[r]).direction().normalized();
+		}
+		mean = mean.normalized();
+		for (int r = 0; r < rays.count; ++r)
+		{
+			if (packet.ray(rays.index[r]).direction().normalized().dot(mean) < coherent_cosine) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * ray box intersection same as single ray traversal
+	 */
+	bool intersect_box(const UMBvhFlatNode& node, const PacketRays& rays, int r)
+	{
+		const float* bounds[] = { node.minimum, node.maximum };
+		double interval_min = rays.tmin[r];
+		double interval_max = rays.tmax[r];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const int negative = rays.dir_is_negative[axis][r];
+			const double tmin = (bounds[  negative][axis] - rays.origin[axis][r]) * rays.inv_dir[axis][r];
+			const double tmax = (bounds[1-negative][axis] - rays.origin[axis][r]) * rays.inv_dir[axis][r];
+			if (tmin > interval_min) interval_min = tmin;
+			if (tmax < interval_max) interval_max = tmax;
+			if (interval_min > interval_max) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * conservative test whether any ray of the packet may hit the box.
+	 * bounds of products are computed from the extreme rays with the same operations,
+	 * so rounding never culls a box hit by a ray.
+	 * @retval false no ray hits the box
+	 */
+	bool intersect_box_interval(const UMBvhFlatNode& node, const PacketRays& rays)
+	{
+		double interval_min = rays.tmin_min;
+		double interval_max = rays.tmax_max;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (!rays.is_interval_axis[axis]) continue;
+			const bool negative = rays.inv_dir_min[axis] < 0;
+			const double near_bound = negative ? node.maximum[axis] : node.minimum[axis];
+			const double far_bound = negative ? node.minimum[axis] : node.maximum[axis];
+			const double near0 = (near_bound - rays.origin_max[axis]) * rays.inv_dir_min[axis];
+			const double near1 = (near_bound - rays.origin_max[axis]) * rays.inv_dir_max[axis];
+			const double near2 = (near_bound - rays.origin_min[axis]) * rays.inv_dir_min[axis];
+			const double near3 = (near_bound - rays.origin_min[axis]) * rays.inv_dir_max[axis];
+			const double far0 = (far_bound - rays.origin_max[axis]) * rays.inv_dir_min[axis];
+			const double far1 = (far_bound - rays.origin_max[axis]) * rays.inv_dir_max[axis];
+			const double far2 = (far_bound - rays.origin_min[axis]) * rays.inv_dir_min[axis];
+			const double far3 = (far_bound - rays.origin_min[axis]) * rays.inv_dir_max[axis];
+			const double tmin = std::min(std::min(near0, near1), std::min(near2, near3));
+			const double tmax = std::max(std::max(far0, far1), std::max(far2, far3));
+			if (tmin > interval_min) interval_min = tmin;
+			if (tmax < interval_max) interval_max = tmax;
+			if (interval_min > interval_max) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * find first ray which hits the box
+	 * @param [in] node a node
+	 * @param [in] rays active rays
+	 * @param [in] first first ray to test
+	 * @retval index of the ray. rays.count if no ray hits
+	 */
+	int find_first_hit(const UMBvhFlatNode& node, const PacketRays& rays, int first)
+	{
+		// first ray hits, so the box is not culled
+		if (!rays.done[first] && intersect_box(node, rays, first)) return first;
+		// whole packet misses
+		if (!intersect_box_interval(node, rays)) return rays.count;
+		for (int r = first + 1; r < rays.count; ++r)
+		{
+			if (!rays.done[r] && intersect_box(node, rays, r)) return r;
+		}
+		return rays.count;
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * ray packet intersection.
+ * the packet traverses binary nodes together, starting from the first ray which hits each node.
+ */
+void UMBvh::intersects(UMRayPacket& packet) const
+{
+	if (node_list_.empty()) return;
+
+	PacketRays rays;
+	set_packet_rays(rays, packet);
+	if (rays.count == 0) return;
+
+	const bool is_shadow = packet.is_shadow();
+	if (!is_coherent(packet, rays))
+	{
+		for (int r = 0; r < rays.count; ++r)
+		{
+			const int index = rays.index[r];
+			UMRay& ray = packet.mutable_ray(index);
+			if (is_shadow)
+			{
+				if (intersects(ray)) packet.set_hit(index);
+				continue;
+			}
+			const double tmax = ray.tmax();
+			ray.set_tmax(rays.tmax[r]);
+			UMHit hit;
+			hit.distance = rays.tmax[r];
+			if (intersects(ray, hit))
+			{
+				packet.set_hit(index, hit);
+			}
+			ray.set_tmax(tmax);
+		}
+		return;
+	}
+
+	UMHit closest[max_packet_ray_count];
+	UMBvhLeafRay leaf_rays[max_packet_ray_count];
+	for (int r = 0; r < rays.count; ++r)
+	{
+		closest[r].distance = rays.tmax[r];
+		leaf_rays[r].init(packet.ray(rays.index[r]), leaves_.precision());
+	}
+	// other primitives than triangles are tested with the packet of rays which hit the leaf
+	bool is_active[max_packet_ray_count];
+	double ray_tmax[max_packet_ray_count];
+	for (int k = 0; k < packet.ray_count(); ++k)
+	{
+		is_active[k] = packet.is_active(k);
+		ray_tmax[k] = packet.ray(k).tmax();
+	}
+	int remaining_count = rays.count;
+
+	// child order follows the first ray
+	int dir_is_negative[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		dir_is_negative[axis] = rays.dir_is_negative[axis][0];
+	}
+
+	unsigned int branch_stack[1024];
+	int first_stack[1024];
+	unsigned int branch_stack_index = 0;
+	unsigned int i = 0;
+	int first = 0;
+	for (;;)
+	{
+		const UMBvhFlatNode& node = node_list_[i];
+		first = find_first_hit(node, rays, first);
+		if (first < rays.count)
+		{
+			if (node.is_leaf())
+			{
+				const int end = node.offset + node.primitive_count;
+				bool has_other = false;
+				bool leaf_mask[max_packet_ray_count];
+				for (int r = first; r < rays.count; ++r)
+				{
+					leaf_mask[r] = !rays.done[r] && (r == first || intersect_box(node, rays, r));
+					if (!leaf_mask[r]) continue;
+					const UMBvhLeafRay& leaf_ray = leaf_rays[r];
+					for (int k = node.offset; k < end; ++k)
+					{
+						if (!leaves_.is_triangle(k))
+						{
+							has_other = true;
+							continue;
+						}
+						if (is_shadow)
+						{
+							if (leaves_.intersects(leaf_ray, ordered_primitives_, k, k + 1))
+							{
+								packet.set_hit(rays.index[r]);
+								rays.done[r] = true;
+								--remaining_count;
+								break;
+							}
+						}
+						else if (leaves_.intersects(leaf_ray, ordered_primitives_, k, k + 1, closest[r]))
+						{
+							rays.tmax[r] = closest[r].distance;
+						}
+					}
+				}
+				if (has_other)
+				{
+					for (int r = 0; r < rays.count; ++r)
+					{
+						const int index = rays.index[r];
+						packet.set_active(index, r >= first && leaf_mask[r] && !rays.done[r]);
+						// hits farther than triangles found in this traversal are not needed
+						if (!is_shadow) packet.mutable_ray(index).set_tmax(rays.tmax[r]);
+					}
+					for (int k = node.offset; k < end; ++k)
+					{
+						if (leaves_.is_triangle(k)) continue;
+						ordered_primitives_[k]->intersects(packet);
+					}
+					for (int r = first; r < rays.count; ++r)
+					{
+						if (!leaf_mask[r] || rays.done[r]) continue;
+						const int index = rays.index[r];
+						if (is_shadow)
+						{
+							if (packet.is_hit(index))
+							{
+								rays.done[r] = true;
+								--remaining_count;
+							}
+							continue;
+						}
+						const double distance = packet.closest_distance(index);
+						if (packet.is_hit(index) && distance < closest[r].distance)
+						{
+							// set by the primitive itself
+							closest[r] = packet.hit(index);
+							rays.tmax[r] = distance;
+						}
+					}
+				}
+				if (remaining_count == 0) break;
+				// branch stack is empty.
+				if (branch_stack_index == 0) break;
+				// branch stack is exist. pop.
+				--branch_stack_index;
+				i = branch_stack[branch_stack_index];
+				first = first_stack[branch_stack_index];
+			}
+			// is branch
+			else
+			{
+				first_stack[branch_stack_index] = first;
+				if (dir_is_negative[node.axis])
+				{
+					// push left branch index
+					branch_stack[branch_stack_index++] = i + 1;
+					// go to right
+					i = node.offset;
+				}
+				else
+				{
+					// push right branch index
+					branch_stack[branch_stack_index++] = node.offset;
+					// go to left
+					++i;
+				}
+			}
+		}
+		else
+		{
+			// not hit. branch stack is empty.
+			if (branch_stack_index == 0) break;
+			// not hit. branch stack is exist. pop.
+			--branch_stack_index;
+			i = branch_stack[branch_stack_index];
+			first = first_stack[branch_stack_index];
+		}
+	}
+
+	// restore rays given by the caller
+	for (int k = 0; k < packet.ray_count(); ++k)
+	{
+		packet.set_active(k, is_active[k]);
+		packet.mutable_ray(k).set_tmax(ray_tmax[k]);
+	}
+	if (is_shadow) return;
+
+	// hits are shaded by the caller after all primitives are tested
+	for (int r = 0; r < rays.count; ++r)
+	{
+		UMHit& hit = closest[r];
+		if (!hit.primitive && hit.index < 0) continue;
+		// triangles of leaves are shaded by this
+		if (!hit.primitive) hit.primitive = this;
+		packet.set_hit(rays.index[r], hit);
+	}
+}
+
+} // burger
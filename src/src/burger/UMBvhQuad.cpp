@@ -0,0 +1,384 @@
+/**
+ * @file UMBvhQuad.cpp
+ * 4-wide bounding volume hierarchy
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMBvhQuad.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <xmmintrin.h>
+#include "UMRay.h"
+#include "UMShaderParameter.h"
+
+namespace
+{
+	using namespace burger;
+
+	/// max traversal stack size
+	const int max_stack_size = 512;
+
+	/// enlarges far distance of float slab test to cover rounding errors
+	const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+	/**
+	 * error bound of a float slab distance.
+	 * covers rounding of the ray origin and of the products.
+	 * @param [in] origin ray origin
+	 * @param [in] bounds_abs_max max absolute value of bounds
+	 * @param [in] inv_dir inverted ray direction
+	 */
+	float slab_error(double origin, double bounds_abs_max, float inv_dir)
+	{
+		const double origin_error = std::abs(static_cast<double>(static_cast<float>(origin)) - origin);
+		const double product_error = 4.0 * std::numeric_limits<float>::epsilon() * (std::abs(origin) + bounds_abs_max);
+		return static_cast<float>((origin_error + product_error) * std::abs(inv_dir));
+	}
+
+	/**
+	 * surface area of a binary node
+	 */
+	float node_area(const UMBvhFlatNode& node)
+	{
+		const float dx = node.maximum[0] - node.minimum[0];
+		const float dy = node.maximum[1] - node.minimum[1];
+		const float dz = node.maximum[2] - node.minimum[2];
+		return 2.0f * (dx * dy + dx * dz + dy * dz);
+	}
+
+	/**
+	 * set child slot of a quad node
+	 */
+	void set_child(UMBvhQuadNode& node, int slot, const UMBvhFlatNode& src, int child, int primitive_count)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			node.minimum[k][slot] = src.minimum[k];
+			node.maximum[k][slot] = src.maximum[k];
+		}
+		node.child[slot] = child;
+		node.primitive_count[slot] = primitive_count;
+	}
+
+	/**
+	 * set child slot of a quad node empty
+	 */
+	void set_empty_child(UMBvhQuadNode& node, int slot)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			node.minimum[k][slot] =  (std::numeric_limits<float>::infinity)();
+			node.maximum[k][slot] = -(std::numeric_limits<float>::infinity)();
+		}
+		node.child[slot] = -1;
+		node.primitive_count[slot] = 0;
+	}
+
+	/**
+	 * traversal stack entry
+	 */
+	struct StackEntry
+	{
+		int child;
+		int primitive_count;
+		float distance;
+	};
+
+	/**
+	 * ray data for SSE box tests
+	 */
+	struct QuadRay
+	{
+		QuadRay(const UMRay& ray, const UMVec3d& bounds_abs_max)
+		{
+			const UMVec3d& origin = ray.origin();
+			const UMVec3d& direction = ray.direction();
+			for (int k = 0; k < 3; ++k)
+			{
+				const float inv_dir = static_cast<float>(1.0 / direction[k]);
+				const float origin_x_inv_dir = static_cast<float>(origin[k]) * inv_dir;
+				const float pad = slab_error(origin[k], bounds_abs_max[k], inv_dir);
+				// near distance is decreased and far distance is increased by pad
+				origin_x_inv_dir_near[k] = _mm_set1_ps(origin_x_inv_dir + pad);
+				origin_x_inv_dir_far[k] = _mm_set1_ps(origin_x_inv_dir - pad);
+				this->inv_dir[k] = _mm_set1_ps(inv_dir);
+				is_negative[k] = inv_dir < 0.0f ? 1 : 0;
+			}
+			tmin = _mm_set1_ps(static_cast<float>(ray.tmin()));
+		}
+		__m128 origin_x_inv_dir_near[3];
+		__m128 origin_x_inv_dir_far[3];
+		__m128 inv_dir[3];
+		__m128 tmin;
+		int is_negative[3];
+	};
+
+	/**
+	 * test 4 child boxes
+	 * @param [out] distance near distance of each child
+	 * @retval hit mask
+	 */
+	int intersect_quad(
+		const UMBvhQuadNode& node,
+		const QuadRay& ray,
+		float closest_distance,
+		float distance[4])
+	{
+		__m128 interval_min = ray.tmin;
+		__m128 interval_max = _mm_set1_ps(closest_distance * far_scale);
+		for (int k = 0; k < 3; ++k)
+		{
+			const __m128 near_plane = _mm_load_ps(ray.is_negative[k] ? node.maximum[k] : node.minimum[k]);
+			const __m128 far_plane = _mm_load_ps(ray.is_negative[k] ? node.minimum[k] : node.maximum[k]);
+			const __m128 tnear = _mm_sub_ps(_mm_mul_ps(near_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_near[k]);
+			const __m128 tfar = _mm_sub_ps(_mm_mul_ps(far_plane, ray.inv_dir[k]), ray.origin_x_inv_dir_far[k]);
+			// NaN is ignored because max/min return the second operand
+			interval_min = _mm_max_ps(tnear, interval_min);
+			interval_max = _mm_min_ps(_mm_mul_ps(tfar, _mm_set1_ps(far_scale)), interval_max);
+		}
+		_mm_storeu_ps(distance, interval_min);
+		return _mm_movemask_ps(_mm_cmple_ps(interval_min, interval_max));
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * build from binary bvh nodes
+ */
+bool UMBvhQuad::build(const UMBvhFlatNodeList& binary_node_list)
+{
+	node_list_.clear();
+	source_list_.clear();
+	bounds_abs_max_ = UMVec3d(0.0);
+	if (binary_node_list.empty()) return false;
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	if (root.is_leaf())
+	{
+		UMBvhQuadNode node;
+		set_child(node, 0, root, root.offset, root.primitive_count);
+		for (int i = 1; i < 4; ++i)
+		{
+			set_empty_child(node, i);
+		}
+		node_list_.push_back(node);
+		source_list_.assign(4, -1);
+		source_list_[0] = 0;
+		return true;
+	}
+	node_list_.reserve(binary_node_list.size() / 2 + 1);
+	collapse(binary_node_list, 0);
+	return true;
+}
+
+/**
+ * collapse binary branch to a quad node
+ * @retval index of created node
+ */
+int UMBvhQuad::collapse(const UMBvhFlatNodeList& binary_node_list, int binary_index)
+{
+	const int index = static_cast<int>(node_list_.size());
+	node_list_.push_back(UMBvhQuadNode());
+	source_list_.resize(source_list_.size() + 4, -1);
+
+	// open the largest branch child until 4 children
+	int children[4];
+	int child_count = 2;
+	children[0] = binary_index + 1;
+	children[1] = binary_node_list[binary_index].offset;
+	while (child_count < 4)
+	{
+		int largest = -1;
+		float largest_area = -1.0f;
+		for (int i = 0; i < child_count; ++i)
+		{
+			const UMBvhFlatNode& child = binary_node_list[children[i]];
+			if (child.is_leaf()) continue;
+			const float area = node_area(child);
+			if (area > largest_area)
+			{
+				largest_area = area;
+				largest = i;
+			}
+		}
+		if (largest < 0) break;
+		const int opened = children[largest];
+		children[largest] = opened + 1;
+		children[child_count++] = binary_node_list[opened].offset;
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i >= child_count)
+		{
+			set_empty_child(node_list_[index], i);
+			continue;
+		}
+		const UMBvhFlatNode& child = binary_node_list[children[i]];
+		source_list_[index * 4 + i] = children[i];
+		if (child.is_leaf())
+		{
+			set_child(node_list_[index], i, child, child.offset, child.primitive_count);
+		}
+		else
+		{
+			// node_list_ may be reallocated in collapse
+			const int child_index = collapse(binary_node_list, children[i]);
+			set_child(node_list_[index], i, child, child_index, 0);
+		}
+	}
+	return index;
+}
+
+/**
+ * refit bounds to refitted binary bvh nodes
+ */
+void UMBvhQuad::refit(const UMBvhFlatNodeList& binary_node_list)
+{
+	if (node_list_.empty() || binary_node_list.empty()) return;
+
+	const UMBvhFlatNode& root = binary_node_list[0];
+	for (int k = 0; k < 3; ++k)
+	{
+		bounds_abs_max_[k] = std::max(std::abs(root.minimum[k]), std::abs(root.maximum[k]));
+	}
+	const int node_count = static_cast<int>(node_list_.size());
+#pragma omp parallel for if (node_count > 4096)
+	for (int i = 0; i < node_count; ++i)
+	{
+		UMBvhQuadNode& node = node_list_[i];
+		for (int slot = 0; slot < 4; ++slot)
+		{
+			const int source = source_list_[i * 4 + slot];
+			if (source < 0) continue;
+			const UMBvhFlatNode& src = binary_node_list[source];
+			for (int k = 0; k < 3; ++k)
+			{
+				node.minimum[k][slot] = src.minimum[k];
+				node.maximum[k][slot] = src.maximum[k];
+			}
+		}
+	}
+}
+
+/**
+ * ray intersection
+ */
+bool UMBvhQuad::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const
+{
+	if (node_list_.empty()) return false;
+
+	const QuadRay quad_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	float closest_distance_f = static_cast<float>(
+		std::min(hit.distance, static_cast<double>((std::numeric_limits<float>::max)())));
+	bool found = false;
+
+	StackEntry stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index].child = 0;
+	stack[stack_index].primitive_count = 0;
+	stack[stack_index].distance = 0.0f;
+	++stack_index;
+
+	while (stack_index > 0)
+	{
+		const StackEntry entry = stack[--stack_index];
+		if (entry.distance > closest_distance_f) continue;
+
+		// leaf
+		if (entry.primitive_count > 0)
+		{
+			const int end = entry.child + entry.primitive_count;
+			if (leaves.intersects(leaf_ray, ordered_primitives, entry.child, end, hit))
+			{
+				closest_distance_f = static_cast<float>(hit.distance);
+				found = true;
+			}
+			continue;
+		}
+
+		// branch
+		const UMBvhQuadNode& node = node_list_[entry.child];
+		float distance[4];
+		const int mask = intersect_quad(node, quad_ray, closest_distance_f, distance);
+		if (mask == 0) continue;
+
+		// sort hit children far to near, then push. near child is popped first.
+		int order[4];
+		int hit_count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			int k = hit_count++;
+			while (k > 0 && distance[order[k - 1]] < distance[i])
+			{
+				order[k] = order[k - 1];
+				--k;
+			}
+			order[k] = i;
+		}
+		for (int i = 0; i < hit_count; ++i)
+		{
+			StackEntry& pushed = stack[stack_index++];
+			pushed.child = node.child[order[i]];
+			pushed.primitive_count = node.primitive_count[order[i]];
+			pushed.distance = distance[order[i]];
+		}
+	}
+	return found;
+}
+
+/**
+ * ray intersection
+ */
+bool UMBvhQuad::intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const
+{
+	if (node_list_.empty()) return false;
+
+	const QuadRay quad_ray(ray, bounds_abs_max_);
+	const UMBvhLeafRay leaf_ray(ray, leaves.precision());
+	const float tmax = static_cast<float>(ray.tmax());
+
+	int stack[max_stack_size];
+	int stack_index = 0;
+	stack[stack_index++] = 0;
+
+	while (stack_index > 0)
+	{
+		const UMBvhQuadNode& node = node_list_[stack[--stack_index]];
+		float distance[4];
+		const int mask = intersect_quad(node, quad_ray, tmax, distance);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)) || node.child[i] < 0) continue;
+			if (node.primitive_count[i] > 0)
+			{
+				const int end = node.child[i] + node.primitive_count[i];
+				if (leaves.intersects(leaf_ray, ordered_primitives, node.child[i], end))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				stack[stack_index++] = node.child[i];
+			}
+		}
+	}
+	return false;
+}
+
+} // burger
@@ -0,0 +1,108 @@
+/**
+ * @file UMBvhQuad.h
+ * 4-wide bounding volume hierarchy
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "UMMacro.h"
+#include "UMPrimitive.h"
+#include "UMAlignedAllocator.h"
+#include "UMBvh.h"
+
+namespace burger
+{
+
+class UMBvhQuad;
+typedef std::shared_ptr<UMBvhQuad> UMBvhQuadPtr;
+
+class UMRay;
+class UMShaderParameter;
+
+/**
+ * 4-wide bvh node.
+ * bounds of 4 children are stored as SoA for SSE.
+ */
+struct UMBvhQuadNode
+{
+	/// minimum of child AABBs. [axis][child]
+	float minimum[3][4];
+	/// maximum of child AABBs. [axis][child]
+	float maximum[3][4];
+	/// leaf: first index of ordered primitives. branch: node index. -1: empty
+	int child[4];
+	/// primitive count of leaf child. 0 for branch child
+	int primitive_count[4];
+};
+typedef std::vector<UMBvhQuadNode, UMAlignedAllocator<UMBvhQuadNode, 64> > UMBvhQuadNodeList;
+
+/**
+ * 4-wide bvh collapsed from a binary bvh.
+ * shares ordered primitives with the binary bvh.
+ */
+class UMBvhQuad
+{
+	DISALLOW_COPY_AND_ASSIGN(UMBvhQuad);
+
+public:
+	UMBvhQuad() : bounds_abs_max_(0.0) {}
+
+	~UMBvhQuad() {}
+
+	/**
+	 * build from binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh
+	 * @retval success or fail
+	 */
+	bool build(const UMBvhFlatNodeList& binary_node_list);
+
+	/**
+	 * refit bounds to refitted binary bvh nodes
+	 * @param [in] binary_node_list flattened binary bvh which has the same topology as built
+	 */
+	void refit(const UMBvhFlatNodeList& binary_node_list);
+
+	/**
+	 * get node count
+	 */
+	unsigned int node_count() const { return static_cast<unsigned int>(node_list_.size()); }
+
+	/**
+	 * get node list
+	 */
+	const UMBvhQuadNodeList& node_list() const { return node_list_; }
+
+	/**
+	 * ray intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 * @param [in,out] hit the closest hit found so far. triangles of leaves are set without primitive
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves, UMHit& hit) const;
+
+	/**
+	 * ray intersection
+	 * @param [in] ray a ray
+	 * @param [in] ordered_primitives primitives referred by leaves
+	 * @param [in] leaves precomputed leaf primitives
+	 */
+	bool intersects(const UMRay& ray, const UMPrimitiveList& ordered_primitives, const UMBvhLeaves& leaves) const;
+
+private:
+	int collapse(const UMBvhFlatNodeList& binary_node_list, int binary_index);
+
+	UMBvhQuadNodeList node_list_;
+	// binary node index of each child slot. -1 for empty
+	std::vector<int> source_list_;
+	UMVec3d bounds_abs_max_;
+};
+
+} // burger
@@ -12,6 +12,7 @@
 
 #include "UMMath.h"
 #include "UMRay.h"
+#include "UMTileScheduler.h"
 
 namespace burger
 {
@@ -50,26 +51,31 @@ void UMCamera::init(int width, int height)
 }
 
 /**
- * generate a camera ray
+ * refresh camera matrix and the basis of camera rays
  */
-void UMCamera::generate_ray(UMRay& dst, const UMVec2d& sample_point, bool is_initial)
+void UMCamera::refresh()
 {
-	if (is_initial)
-	{
-		const UMMat44d& view_projection = view_projection_matrix();
-		UMVec3d right (view_projection.m[0][0], view_projection.m[1][0], view_projection.m[2][0]);
-		UMVec3d up (view_projection.m[0][1], view_projection.m[1][1], view_projection.m[2][1]);
-		UMVec3d direction (view_projection.m[0][2], view_projection.m[1][2], view_projection.m[2][2]);
-	
-		double inv_yscale = tan(um_to_radian(fov_y() * 0.5));
-		double inv_xscale = aspect() * inv_yscale;
-		right *= inv_xscale;
-		up *= inv_yscale;
-		generate_ray_x_scale_ = right * aspect();
-		generate_ray_y_scale_ = up;
-		generate_ray_adder_ = direction / inv_yscale;
-	}
+	view_projection_matrix_ = view_matrix() * projection_matrix();
+
+	const UMMat44d& view_projection = view_projection_matrix();
+	UMVec3d right (view_projection.m[0][0], view_projection.m[1][0], view_projection.m[2][0]);
+	UMVec3d up (view_projection.m[0][1], view_projection.m[1][1], view_projection.m[2][1]);
+	UMVec3d direction (view_projection.m[0][2], view_projection.m[1][2], view_projection.m[2][2]);
+
+	double inv_yscale = tan(um_to_radian(fov_y() * 0.5));
+	double inv_xscale = aspect() * inv_yscale;
+	right *= inv_xscale;
+	up *= inv_yscale;
+	generate_ray_x_scale_ = right * aspect();
+	generate_ray_y_scale_ = up;
+	generate_ray_adder_ = direction / inv_yscale;
+}
 
+/**
+ * generate a camera ray
+ */
+void UMCamera::generate_ray(UMRay& dst, const UMVec2d& sample_point) const
+{
 	double xx = sample_point.x * inverted_width_ * 2 - 1;
 	double yy = sample_point.y * inverted_height_ * 2 - 1;
 	UMVec3d dir = generate_ray_x_scale_ * xx + generate_ray_y_scale_ * yy + generate_ray_adder_;
@@ -78,6 +84,47 @@ void UMCamera::generate_ray(UMRay& dst, const UMVec2d& sample_point, bool is_ini
 	dst.set_direction(dir.normalized());
 }
 
+/**
+ * generate camera rays of all pixels in a tile
+ */
+void UMCamera::generate_rays(const UMTile& tile, const UMVec2d* samples, int sample_count, UMCameraRays& rays) const
+{
+	const int count = tile.width * tile.height * sample_count;
+	rays.resize(count);
+	rays.origin = position();
+	if (count == 0) return;
+
+	const UMVec3d& xs = generate_ray_x_scale_;
+	const UMVec3d& ys = generate_ray_y_scale_;
+	const UMVec3d& adder = generate_ray_adder_;
+	double* direction_x = &rays.direction_x[0];
+	double* direction_y = &rays.direction_y[0];
+	double* direction_z = &rays.direction_z[0];
+	int* pixel = &rays.pixel[0];
+	for (int y = 0, i = 0; y < tile.height; ++y)
+	{
+		const int py = tile.y + y;
+		for (int x = 0; x < tile.width; ++x)
+		{
+			const int px = tile.x + x;
+			const int tile_pixel = tile.width * y + x;
+			for (int s = 0; s < sample_count; ++s, ++i)
+			{
+				const double xx = (px + samples[i].x) * inverted_width_ * 2 - 1;
+				const double yy = (py + samples[i].y) * inverted_height_ * 2 - 1;
+				const double dx = xs.x * xx + ys.x * yy + adder.x;
+				const double dy = xs.y * xx + ys.y * yy + adder.y;
+				const double dz = xs.z * xx + ys.z * yy + adder.z;
+				const double inv_length = 1.0 / std::sqrt(dx * dx + dy * dy + dz * dz);
+				direction_x[i] = dx * inv_length;
+				direction_y[i] = dy * inv_length;
+				direction_z[i] = dz * inv_length;
+				pixel[i] = tile_pixel;
+			}
+		}
+	}
+}
+
 /**
  * rotate camera
  */
@@ -100,6 +147,7 @@ void UMCamera::rotate(double mx, double my)
 
 	//view_matrix_.identity();
 	um_matrix_look_at_rh(view_matrix_, position_, target_, up_);
+	refresh();
 }
 
 /**
@@ -119,6 +167,7 @@ void UMCamera::zoom(double mx, double my)
 	}
 
 	um_matrix_perspective_fov_rh(projection_matrix_, um_to_radian(fov_y_), aspect_, near_, far_);
+	refresh();
 
 	UMAny fovy(fov_y_);
 	zoom_event_->set_parameter(fovy);
@@ -146,6 +195,7 @@ void UMCamera::dolly(double mx, double my)
 
 	//view_matrix_.identity();
 	um_matrix_look_at_rh(view_matrix_, position_, target_, up_);
+	refresh();
 		
 	double position_length = position_.length();
 	UMAny length(position_length);
@@ -24,6 +24,39 @@ typedef std::shared_ptr<UMCamera> UMCameraPtr;
 typedef std::weak_ptr<UMCamera> UMCameraWeakPtr;
 
 class UMRay;
+struct UMTile;
+
+/**
+ * camera rays of a tile in structure of arrays.
+ * all rays start from the camera position.
+ */
+struct UMCameraRays
+{
+	/**
+	 * get ray count
+	 */
+	int count() const { return static_cast<int>(pixel.size()); }
+
+	/**
+	 * set ray count
+	 */
+	void resize(int count)
+	{
+		direction_x.resize(count);
+		direction_y.resize(count);
+		direction_z.resize(count);
+		pixel.resize(count);
+	}
+
+	/// origin of all rays
+	UMVec3d origin;
+	/// normalized directions
+	std::vector<double> direction_x;
+	std::vector<double> direction_y;
+	std::vector<double> direction_z;
+	/// pixel index in the tile of each ray. row major
+	std::vector<int> pixel;
+};
 
 /**
  * a camera
@@ -44,11 +77,9 @@ public:
 	void init(int width, int height);
 	
 	/**
-	 * refresh camera matrix
+	 * refresh camera matrix and the basis of camera rays
 	 */
-	void refresh() {
-		view_projection_matrix_ = view_matrix() * projection_matrix();
-	}
+	void refresh();
 
 	/** 
 	 * get view matrix
@@ -58,7 +89,7 @@ public:
 	/** 
 	 * set view matrix
 	 */
-	void set_view_matrix(const UMMat44d& mat) { view_matrix_ = mat; }
+	void set_view_matrix(const UMMat44d& mat) { view_matrix_ = mat; refresh(); }
 	
 	/** 
 	 * get projection matrix
@@ -68,7 +99,7 @@ public:
 	/** 
 	 * set projection matrix
 	 */
-	void set_projection_matrix(const UMMat44d& mat) { projection_matrix_ = mat; }
+	void set_projection_matrix(const UMMat44d& mat) { projection_matrix_ = mat; refresh(); }
 	
 	/**
 	 * get view projection matrix
@@ -76,12 +107,21 @@ public:
 	const UMMat44d& view_projection_matrix() const { return view_projection_matrix_; }
 	
 	/** 
-	 * generate a camera ray
+	 * generate a camera ray.
+	 * uses the basis computed at refresh, so threads can share the camera.
 	 * @param [out] ray generated ray
 	 * @param [in] sample_point a sample point on pixel in imageplane
-	 * @param [in] is_initial initialize generate values
 	 */
-	void generate_ray(UMRay& ray, const UMVec2d& sample_point, bool is_initial);
+	void generate_ray(UMRay& ray, const UMVec2d& sample_point) const;
+
+	/**
+	 * generate camera rays of all pixels in a tile
+	 * @param [in] tile target tile
+	 * @param [in] samples sample points in pixels. sample_count points for each pixel of the tile in row major order
+	 * @param [in] sample_count sample count of a pixel
+	 * @param [out] rays generated rays. same order as samples
+	 */
+	void generate_rays(const UMTile& tile, const UMVec2d* samples, int sample_count, UMCameraRays& rays) const;
 
 	/** 
 	 * get aspect
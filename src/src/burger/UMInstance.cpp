@@ -0,0 +1,192 @@
+/**
+ * @file UMInstance.cpp
+ * an instance of bottom level bvh with a transform
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMInstance.h"
+#include "UMBvh.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMShaderParameter.h"
+
+namespace
+{
+	using namespace burger;
+
+	/**
+	 * transform point. the matrix is row vector style.
+	 */
+	UMVec3d transform_point(const UMMat44d& m, const UMVec3d& p)
+	{
+		return UMVec3d(
+			p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0],
+			p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1],
+			p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2]);
+	}
+
+	/**
+	 * transform direction without translation
+	 */
+	UMVec3d transform_vector(const UMMat44d& m, const UMVec3d& v)
+	{
+		return UMVec3d(
+			v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0],
+			v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1],
+			v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2]);
+	}
+
+	/**
+	 * transform normal by transposed inverse matrix
+	 * @param [in] inverse inverted transform
+	 */
+	UMVec3d transform_normal(const UMMat44d& inverse, const UMVec3d& n)
+	{
+		return UMVec3d(
+			n.x * inverse.m[0][0] + n.y * inverse.m[0][1] + n.z * inverse.m[0][2],
+			n.x * inverse.m[1][0] + n.y * inverse.m[1][1] + n.z * inverse.m[1][2],
+			n.x * inverse.m[2][0] + n.y * inverse.m[2][1] + n.z * inverse.m[2][2]);
+	}
+
+	/**
+	 * transform ray to object space.
+	 * direction is not normalized, so distances are same in both spaces.
+	 */
+	void transform_ray(const UMMat44d& inverse, const UMRay& ray, UMRay& object_ray)
+	{
+		object_ray.set_origin(transform_point(inverse, ray.origin()));
+		object_ray.set_direction(transform_vector(inverse, ray.direction()));
+		object_ray.set_tmin(ray.tmin());
+		object_ray.set_tmax(ray.tmax());
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * set object to world transform
+ */
+void UMInstance::set_transform(const UMMat44d& transform)
+{
+	transform_ = transform;
+	inverse_transform_ = transform.inverted();
+	update_box();
+}
+
+/**
+ * ray intersection
+ */
+bool UMInstance::intersects(const UMRay& ray, UMShaderParameter& param) const
+{
+	UMHit hit;
+	if (!intersects(ray, hit)) return false;
+	shade_hit(ray, hit, param);
+	return true;
+}
+
+/**
+ * ray intersection without shading
+ */
+bool UMInstance::intersects(const UMRay& ray, UMHit& hit) const
+{
+	if (!bvh_) return false;
+	UMRay object_ray;
+	transform_ray(inverse_transform_, ray, object_ray);
+	if (!bvh_->intersects(object_ray, hit)) return false;
+	hit.instance = this;
+	return true;
+}
+
+/**
+ * set shading parameters of a hit in this instance
+ */
+void UMInstance::shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const
+{
+	UMRay object_ray;
+	transform_ray(inverse_transform_, ray, object_ray);
+	UMHit object_hit(hit);
+	object_hit.instance = NULL;
+	object_hit.shade(object_ray, param);
+
+	param.intersect_point = ray.origin() + ray.direction() * param.distance;
+	param.normal = transform_normal(inverse_transform_, param.normal).normalized();
+}
+
+/**
+ * ray intersection
+ */
+bool UMInstance::intersects(const UMRay& ray) const
+{
+	if (!bvh_) return false;
+	UMRay object_ray;
+	transform_ray(inverse_transform_, ray, object_ray);
+	return bvh_->intersects(object_ray);
+}
+
+/**
+ * ray packet intersection
+ */
+void UMInstance::intersects(UMRayPacket& packet) const
+{
+	if (!bvh_) return;
+	UMRayPacket object_packet(packet.is_shadow());
+	int source_index[UMRayPacket::max_ray_count];
+	for (int i = 0; i < packet.ray_count(); ++i)
+	{
+		if (!packet.is_active(i)) continue;
+		if (packet.is_shadow() && packet.is_hit(i)) continue;
+		const UMRay& ray = packet.ray(i);
+		const int index = object_packet.add_ray(
+			transform_point(inverse_transform_, ray.origin()),
+			transform_vector(inverse_transform_, ray.direction()));
+		UMRay& object_ray = object_packet.mutable_ray(index);
+		object_ray.set_tmin(ray.tmin());
+		object_ray.set_tmax(packet.closest_distance(i));
+		source_index[index] = i;
+	}
+	if (object_packet.ray_count() == 0) return;
+	bvh_->intersects(object_packet);
+
+	for (int k = 0; k < object_packet.ray_count(); ++k)
+	{
+		if (!object_packet.is_hit(k)) continue;
+		const int i = source_index[k];
+		if (packet.is_shadow())
+		{
+			packet.set_hit(i);
+			continue;
+		}
+		// distances of object rays are same as world rays. shaded by shade_hit() later
+		UMHit hit(object_packet.hit(k));
+		if (hit.distance >= packet.closest_distance(i)) continue;
+		hit.instance = this;
+		packet.set_hit(i, hit);
+	}
+}
+
+/**
+ * update AABB
+ */
+void UMInstance::update_box()
+{
+	box_.init();
+	if (!bvh_) return;
+	const UMBox& box = bvh_->box();
+	if (box.minimum().x > box.maximum().x) return;
+	for (int i = 0; i < 8; ++i)
+	{
+		const UMVec3d corner(
+			box[i & 1].x,
+			box[(i >> 1) & 1].y,
+			box[(i >> 2) & 1].z);
+		box_.extend(transform_point(transform_, corner));
+	}
+}
+
+} // burger
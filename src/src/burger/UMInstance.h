@@ -0,0 +1,128 @@
+/**
+ * @file UMInstance.h
+ * an instance of bottom level bvh with a transform
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "UMMacro.h"
+#include "UMMath.h"
+#include "UMPrimitive.h"
+#include "UMBox.h"
+
+namespace burger
+{
+
+class UMInstance;
+typedef std::shared_ptr<UMInstance> UMInstancePtr;
+typedef std::vector<UMInstancePtr> UMInstanceList;
+
+class UMBvh;
+typedef std::shared_ptr<UMBvh> UMBvhPtr;
+
+class UMRay;
+class UMShaderParameter;
+
+/**
+ * an instance of bottom level bvh.
+ * rays are transformed to the object space of the bvh,
+ * so a bvh can be shared by many instances.
+ */
+class UMInstance : public UMPrimitive
+{
+	DISALLOW_COPY_AND_ASSIGN(UMInstance);
+public:
+	/**
+	 * @param [in] bvh bottom level bvh
+	 * @param [in] transform object to world transform
+	 */
+	UMInstance(UMBvhPtr bvh, const UMMat44d& transform) :
+		bvh_(bvh)
+	{
+		set_transform(transform);
+	}
+
+	~UMInstance() {}
+
+	/**
+	 * get bottom level bvh
+	 */
+	UMBvhPtr bvh() const { return bvh_; }
+
+	/**
+	 * get object to world transform
+	 */
+	const UMMat44d& transform() const { return transform_; }
+
+	/**
+	 * get world to object transform
+	 */
+	const UMMat44d& inverse_transform() const { return inverse_transform_; }
+
+	/**
+	 * set object to world transform. updates box.
+	 * the top level bvh needs refit or rebuild after this.
+	 * @param [in] transform object to world transform
+	 */
+	void set_transform(const UMMat44d& transform);
+
+	/**
+	 * ray intersection
+	 * @param [in] ray a ray
+	 * @param [in,out] param shading parameters
+	 */
+	virtual bool intersects(const UMRay& ray, UMShaderParameter& param) const;
+
+	/**
+	 * ray intersection
+	 * @param [in] ray a ray
+	 */
+	virtual bool intersects(const UMRay& ray) const;
+
+	/**
+	 * ray intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const;
+
+	/**
+	 * set shading parameters of a hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const;
+
+	/**
+	 * ray packet intersection
+	 * @param [in,out] packet rays and the closest hits found so far
+	 */
+	virtual void intersects(UMRayPacket& packet) const;
+
+	/**
+	 * get box
+	 */
+	virtual const UMBox& box() const { return box_; }
+
+	/**
+	 * update AABB from the box of bottom level bvh.
+	 * the bottom level bvh is not refitted because it may be shared.
+	 */
+	virtual void update_box();
+
+private:
+	UMBvhPtr bvh_;
+	UMMat44d transform_;
+	UMMat44d inverse_transform_;
+	UMBox box_;
+};
+
+} // burger
@@ -10,7 +10,9 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "UMMacro.h"
 #include "UMMatrix.h"
@@ -58,5 +60,67 @@ T um_clip(T val) {
 	return val;
 }
 
+/**
+ * offset a point on a surface to the origin of a ray leaving the surface.
+ * the offset grows with float ulps of the point, so that the ray does not hit
+ * the surface again even if the point has an error of float precision.
+ * [Wachter and Binder 2019, A Fast and Robust Method for Avoiding Self-Intersection]
+ * rays from the returned origin can use 0 as tmin.
+ * @param [in] point point on the surface
+ * @param [in] normal geometric normal of the surface
+ * @param [in] direction direction of the ray
+ */
+inline UMVec3d um_offset_ray_origin(const UMVec3d& point, const UMVec3d& normal, const UMVec3d& direction)
+{
+	const float origin_threshold = 1.0f / 32.0f;
+	const float float_scale = 1.0f / 65536.0f;
+	const float int_scale = 256.0f;
+	const UMVec3d n = normal.dot(direction) < 0 ? -normal : normal;
+
+	UMVec3d offset_point(point);
+	for (int i = 0; i < 3; ++i)
+	{
+		const float p = static_cast<float>(point[i]);
+		if (std::fabs(p) < origin_threshold)
+		{
+			// ulps are too small near the origin
+			offset_point[i] += float_scale * n[i];
+			continue;
+		}
+		int bits = 0;
+		std::memcpy(&bits, &p, sizeof(float));
+		const int offset = static_cast<int>(int_scale * n[i]);
+		bits += (p < 0) ? -offset : offset;
+		float offset_p = 0.0f;
+		std::memcpy(&offset_p, &bits, sizeof(float));
+		offset_point[i] += static_cast<double>(offset_p) - static_cast<double>(p);
+	}
+	return offset_point;
+}
+
+/**
+ * russian roulette by the throughput of a diffuse path.
+ * the path survives with probability of the max component of the throughput,
+ * so dark paths end early and bright paths are not cut.
+ * @param [in] albedo color of the hit
+ * @param [in] roulette_depth the roulette runs while the remaining depth is less than this
+ * @param [in] random uniform random number in [0, 1)
+ * @param [in,out] depth remaining depth. decremented if the path continues
+ * @param [in,out] throughput weight of the path. multiplied by the albedo and divided by the survival probability
+ * @retval false the path is terminated
+ */
+inline bool um_russian_roulette(const UMVec3d& albedo, int roulette_depth, double random, int& depth, UMVec3d& throughput)
+{
+	if (depth <= 0) return false;
+	throughput = throughput.multiply(albedo);
+	if (depth < roulette_depth)
+	{
+		const double probability = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 1.0);
+		if (random >= probability) return false;
+		throughput *= 1.0 / probability;
+	}
+	--depth;
+	return true;
+}
 
 } // burger
@@ -32,6 +32,90 @@ namespace
 
 namespace burger
 {
+/**
+ * convert storage of positions, normals and uvs
+ */
+void UMMesh::set_float_storage(bool is_float)
+{
+	if (is_float == is_float_storage_) return;
+	if (is_float)
+	{
+		const int vertex_size = static_cast<int>(vertex_list_.size());
+		const int normal_size = static_cast<int>(normal_list_.size());
+		const int uv_size = static_cast<int>(uv_list_.size());
+		for (int k = 0; k < 3; ++k)
+		{
+			float_storage_.position[k].resize(vertex_size);
+			float_storage_.normal[k].resize(normal_size);
+		}
+		for (int k = 0; k < 2; ++k)
+		{
+			float_storage_.uv[k].resize(uv_size);
+		}
+		for (int i = 0; i < vertex_size; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				float_storage_.position[k][i] = static_cast<float>(vertex_list_[i][k]);
+			}
+		}
+		for (int i = 0; i < normal_size; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				float_storage_.normal[k][i] = static_cast<float>(normal_list_[i][k]);
+			}
+		}
+		for (int i = 0; i < uv_size; ++i)
+		{
+			float_storage_.uv[0][i] = static_cast<float>(uv_list_[i].x);
+			float_storage_.uv[1][i] = static_cast<float>(uv_list_[i].y);
+		}
+		Vec3dList().swap(vertex_list_);
+		Vec3dList().swap(normal_list_);
+		Vec2dList().swap(uv_list_);
+	}
+	else
+	{
+		vertex_list_.resize(vertex_count());
+		normal_list_.resize(normal_count());
+		uv_list_.resize(uv_count());
+		for (int i = 0, size = vertex_count(); i < size; ++i)
+		{
+			vertex_list_[i] = vertex(i);
+		}
+		for (int i = 0, size = normal_count(); i < size; ++i)
+		{
+			normal_list_[i] = normal(i);
+		}
+		for (int i = 0, size = uv_count(); i < size; ++i)
+		{
+			uv_list_[i] = uv(i);
+		}
+		float_storage_ = FloatStorage();
+	}
+	is_float_storage_ = is_float;
+}
+
+/**
+ * resize normals to vertex count
+ */
+void UMMesh::resize_normals()
+{
+	const int vertex_size = vertex_count();
+	if (is_float_storage_)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			float_storage_.normal[k].resize(vertex_size);
+		}
+	}
+	else
+	{
+		normal_list_.resize(vertex_size);
+	}
+}
+
 /** 
  * create normals
  * @param [in] is_smooth smooth or flat
@@ -39,33 +123,30 @@ namespace burger
 bool UMMesh::create_normals(bool is_smooth)
 {
 	if (face_list().empty()) return false;
-	if (vertex_list().empty()) return false;
+	if (vertex_count() == 0) return false;
 	
 	const int face_size = static_cast<int>(face_list().size());
-	const int vertex_size = static_cast<int>(vertex_list().size());
-	mutable_normal_list().resize(vertex_size);
-	
-	for (int i = 0; i < vertex_size; ++i)
-	{
-		mutable_normal_list().at(i) = UMVec3d(0);
-	}
+	const int vertex_size = vertex_count();
+	// accumulate in double for both storages
+	Vec3dList normal_list(vertex_size, UMVec3d(0));
 
 	for (int i = 0; i < face_size; ++i)
 	{
 		UMVec3i face = face_list().at(i);
-		const UMVec3d& v0 = vertex_list().at(face.x);
-		const UMVec3d& v1 = vertex_list().at(face.y);
-		const UMVec3d& v2 = vertex_list().at(face.z);
+		const UMVec3d v0 = vertex(face.x);
+		const UMVec3d v1 = vertex(face.y);
+		const UMVec3d v2 = vertex(face.z);
 		UMVec3d normal = (v0-v1).cross(v1-v2);
 
-		mutable_normal_list().at(face.x) += normal;
-		mutable_normal_list().at(face.y) += normal;
-		mutable_normal_list().at(face.z) += normal;
+		normal_list.at(face.x) += normal;
+		normal_list.at(face.y) += normal;
+		normal_list.at(face.z) += normal;
 	}
 	
+	resize_normals();
 	for (int i = 0; i < vertex_size; ++i)
 	{
-		mutable_normal_list().at(i) = normal_list().at(i).normalized();
+		set_normal(i, normal_list.at(i).normalized());
 	}
 	return false;
 }
@@ -78,10 +159,10 @@ void UMMesh::update_box()
 	box_.set_minimum(UMVec3d(std::numeric_limits<double>::infinity()));
 	box_.set_maximum(UMVec3d(-std::numeric_limits<double>::infinity()));
 	
-	const int vertex_size = static_cast<int>(vertex_list().size());
+	const int vertex_size = vertex_count();
 	for (int i = 0; i < vertex_size; ++i)
 	{
-		box_.extend(vertex_list().at(i));
+		box_.extend(vertex(i));
 	}
 }
 
@@ -90,17 +171,57 @@ void UMMesh::update_box()
  */
 UMMaterialPtr UMMesh::material_from_face_index(int face_index) const
 {
+	const int index = material_index_from_face_index(face_index);
+	if (index < 0) return UMMaterialPtr();
+	return material_list_[index];
+}
+
+/** 
+ * get index of material list from face index
+ */
+int UMMesh::material_index_from_face_index(int face_index) const
+{
+	if (face_index >= 0 && face_index < static_cast<int>(material_index_list_.size()))
+	{
+		const unsigned int index = material_index_list_[face_index];
+		if (index < material_list_.size()) return static_cast<int>(index);
+		return -1;
+	}
+
 	int pos = 0;
-	UMMaterialList::const_iterator it = material_list_.begin();
-	for (; it != material_list_.end(); ++it)
+	const int material_count = static_cast<int>(material_list_.size());
+	for (int i = 0; i < material_count; ++i)
 	{
-		const int polygon_count = (*it)->polygon_count();
+		const int polygon_count = material_list_[i]->polygon_count();
 		if (face_index >= pos && face_index < (pos+polygon_count)) {
-			return *it;
+			return i;
 		}
 		pos += polygon_count;
 	}
-	return UMMaterialPtr();
+	return -1;
+}
+
+/**
+ * create material index of each face
+ */
+bool UMMesh::create_material_index_list()
+{
+	material_index_list_.clear();
+	const int material_count = static_cast<int>(material_list_.size());
+	if (material_count >= eNoMaterial) return false;
+	for (int i = 0; i < material_count; ++i)
+	{
+		const int polygon_count = material_list_[i]->polygon_count();
+		if (polygon_count <= 0) continue;
+		material_index_list_.insert(material_index_list_.end(), polygon_count, static_cast<unsigned short>(i));
+	}
+	// faces after all polygon counts have no material
+	const size_t face_count = face_list_.size();
+	if (material_index_list_.size() < face_count)
+	{
+		material_index_list_.resize(face_count, static_cast<unsigned short>(eNoMaterial));
+	}
+	return true;
 }
 
 /**
@@ -118,9 +239,9 @@ bool UMMesh::intersects(const UMRay& ray, UMShaderParameter& dst_parameter) cons
 	for (int i = 0; i < face_size; ++i)
 	{
 		const UMVec3i& face = face_list().at(i);
-		const UMVec3d& v0 = vertex_list().at(face.x);
-		const UMVec3d& v1 = vertex_list().at(face.y);
-		const UMVec3d& v2 = vertex_list().at(face.z);
+		const UMVec3d v0 = vertex(face.x);
+		const UMVec3d v1 = vertex(face.y);
+		const UMVec3d v2 = vertex(face.z);
 		if (UMTriangle::intersects(v0, v1, v2, ray, parameter))
 		{
 			if (parameter.distance < closest_distance)
@@ -128,9 +249,9 @@ bool UMMesh::intersects(const UMRay& ray, UMShaderParameter& dst_parameter) cons
 				result = true;
 				closest_distance = parameter.distance;
 				// normal
-				const UMVec3d& n0 = normal_list().at(face.x);
-				const UMVec3d& n1 = normal_list().at(face.y);
-				const UMVec3d& n2 = normal_list().at(face.z);
+				const UMVec3d n0 = normal(face.x);
+				const UMVec3d n1 = normal(face.y);
+				const UMVec3d n2 = normal(face.z);
 				parameter.normal = (
 					n0 * parameter.uvw.x + 
 					n1 * parameter.uvw.y + 
@@ -142,11 +263,11 @@ bool UMMesh::intersects(const UMRay& ray, UMShaderParameter& dst_parameter) cons
 					parameter.color.x = diffuse.x;
 					parameter.color.y = diffuse.y;
 					parameter.color.z = diffuse.z;
-					if (!uv_list().empty() && !material->texture_list().empty()) {
+					if (uv_count() > 0 && !material->texture_list().empty()) {
 						// uv
-						const UMVec2d& uv0 = uv_list().at(i * 3 + 0);
-						const UMVec2d& uv1 = uv_list().at(i * 3 + 1);
-						const UMVec2d& uv2 = uv_list().at(i * 3 + 2);
+						const UMVec2d uv0 = uv(i * 3 + 0);
+						const UMVec2d uv1 = uv(i * 3 + 1);
+						const UMVec2d uv2 = uv(i * 3 + 2);
 						UMVec2d uv = UMVec2d(
 							uv0 * parameter.uvw.x +
 							uv1 * parameter.uvw.y +
@@ -181,9 +302,9 @@ bool UMMesh::intersects(const UMRay& ray) const
 	for (int i = 0; i < face_size; ++i)
 	{
 		const UMVec3i& face = face_list().at(i);
-		const UMVec3d& v0 = vertex_list().at(face.x);
-		const UMVec3d& v1 = vertex_list().at(face.y);
-		const UMVec3d& v2 = vertex_list().at(face.z);
+		const UMVec3d v0 = vertex(face.x);
+		const UMVec3d v1 = vertex(face.y);
+		const UMVec3d v2 = vertex(face.z);
 		if (UMTriangle::intersects(v0, v1, v2, ray))
 		{
 			return true;
@@ -14,6 +14,7 @@
 #include "UMMaterial.h"
 #include "UMPrimitive.h"
 #include "UMBox.h"
+#include "UMAlignedAllocator.h"
 
 #include <vector>
 
@@ -33,14 +34,30 @@ class UMMesh
 {
 	DISALLOW_COPY_AND_ASSIGN(UMMesh);
 public:
-	UMMesh() {}
+	UMMesh() : is_float_storage_(false) {}
 	~UMMesh() {}
 	
-	typedef std::vector<UMVec3d> Vec4dList;
+	typedef std::vector<UMVec4d> Vec4dList;
 	typedef std::vector<UMVec3d> Vec3dList;
 	typedef std::vector<UMVec2d> Vec2dList;
 	typedef std::vector<UMVec3i> Vec3iList;
 	typedef std::vector<int> IndexList;
+	typedef std::vector<unsigned short> MaterialIndexList;
+	typedef std::vector<float, UMAlignedAllocator<float, 32> > FloatList;
+
+	/**
+	 * vertex attributes stored as structure of arrays in float.
+	 * positions and normals are per vertex. uvs are per face corner same as uv_list.
+	 */
+	struct FloatStorage
+	{
+		/// x, y, z of positions
+		FloatList position[3];
+		/// x, y, z of normals
+		FloatList normal[3];
+		/// u, v of uvs
+		FloatList uv[2];
+	};
 
 	/**
 	 * get face list
@@ -52,8 +69,133 @@ public:
 	 */
 	Vec3iList& mutable_face_list() { return face_list_; }
 
+	/**
+	 * is float storage or not
+	 */
+	bool is_float_storage() const { return is_float_storage_; }
+
+	/**
+	 * convert storage of positions, normals and uvs.
+	 * float storage releases vertex_list, normal_list and uv_list.
+	 * use the accessors below to read and write vertex attributes of both storages.
+	 * @param [in] is_float float storage or double lists
+	 */
+	void set_float_storage(bool is_float);
+
+	/**
+	 * get float storage. empty if not float storage
+	 */
+	const FloatStorage& float_storage() const { return float_storage_; }
+
+	/**
+	 * get vertex count
+	 */
+	int vertex_count() const
+	{
+		if (is_float_storage_) return static_cast<int>(float_storage_.position[0].size());
+		return static_cast<int>(vertex_list_.size());
+	}
+
+	/**
+	 * get normal count
+	 */
+	int normal_count() const
+	{
+		if (is_float_storage_) return static_cast<int>(float_storage_.normal[0].size());
+		return static_cast<int>(normal_list_.size());
+	}
+
+	/**
+	 * get uv count
+	 */
+	int uv_count() const
+	{
+		if (is_float_storage_) return static_cast<int>(float_storage_.uv[0].size());
+		return static_cast<int>(uv_list_.size());
+	}
+
+	/**
+	 * get vertex position
+	 */
+	UMVec3d vertex(int index) const
+	{
+		if (is_float_storage_)
+		{
+			return UMVec3d(
+				float_storage_.position[0][index],
+				float_storage_.position[1][index],
+				float_storage_.position[2][index]);
+		}
+		return vertex_list_[index];
+	}
+
+	/**
+	 * set vertex position
+	 */
+	void set_vertex(int index, const UMVec3d& vertex)
+	{
+		if (is_float_storage_)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				float_storage_.position[i][index] = static_cast<float>(vertex[i]);
+			}
+			return;
+		}
+		vertex_list_[index] = vertex;
+	}
+
+	/**
+	 * get vertex normal
+	 */
+	UMVec3d normal(int index) const
+	{
+		if (is_float_storage_)
+		{
+			return UMVec3d(
+				float_storage_.normal[0][index],
+				float_storage_.normal[1][index],
+				float_storage_.normal[2][index]);
+		}
+		return normal_list_[index];
+	}
+
+	/**
+	 * set vertex normal
+	 */
+	void set_normal(int index, const UMVec3d& normal)
+	{
+		if (is_float_storage_)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				float_storage_.normal[i][index] = static_cast<float>(normal[i]);
+			}
+			return;
+		}
+		normal_list_[index] = normal;
+	}
+
+	/**
+	 * resize normals to vertex count
+	 */
+	void resize_normals();
+
+	/**
+	 * get uv of a face corner
+	 * @param [in] index face index * 3 + corner
+	 */
+	UMVec2d uv(int index) const
+	{
+		if (is_float_storage_)
+		{
+			return UMVec2d(float_storage_.uv[0][index], float_storage_.uv[1][index]);
+		}
+		return uv_list_[index];
+	}
+
 	/** 
-	 * get vertex list
+	 * get vertex list. empty if float storage
 	 */
 	const Vec3dList& vertex_list() const { return vertex_list_; }
 
@@ -63,7 +205,7 @@ public:
 	Vec3dList& mutable_vertex_list() { return vertex_list_; }
 
 	/**
-	 * get normal list
+	 * get normal list. empty if float storage
 	 */
 	const Vec3dList& normal_list() const { return normal_list_; }
 
@@ -83,7 +225,7 @@ public:
 	Vec4dList& mutable_vertex_color_list() { return vertex_color_list_; }
 
 	/**
-	 * get uv list
+	 * get uv list. empty if float storage
 	 */
 	const Vec2dList& uv_list() const { return uv_list_; }
 
@@ -112,6 +254,28 @@ public:
 	 */
 	UMMaterialList& mutable_material_list() { return material_list_; }
 
+	/**
+	 * material index of faces which have no material
+	 */
+	enum { eNoMaterial = 0xFFFF };
+
+	/**
+	 * get material index of each face. empty if not created
+	 */
+	const MaterialIndexList& material_index_list() const { return material_index_list_; }
+
+	/**
+	 * get material index of each face
+	 */
+	MaterialIndexList& mutable_material_index_list() { return material_index_list_; }
+
+	/**
+	 * create material index of each face from polygon counts of materials.
+	 * call this again when the material list or polygon counts are changed.
+	 * @retval success or fail. fails if the mesh has eNoMaterial materials or more
+	 */
+	bool create_material_index_list();
+
 	/** 
 	 * create normals
 	 * @param [in] is_smooth smooth or flat
@@ -148,21 +312,32 @@ public:
 	
 
 	/**
-	 * get material from face index
+	 * get material from face index.
+	 * looks up material index list if created, else scans polygon counts of materials.
 	 */ 
 	UMMaterialPtr material_from_face_index(int face_index) const;
 
+	/**
+	 * get index of material list from face index.
+	 * used while shading, so as not to copy the material pointer.
+	 * @retval -1 the face has no material
+	 */
+	int material_index_from_face_index(int face_index) const;
+
 private:
 
 	Vec3iList face_list_;
-	Vec4dList vertex_list_;
-	Vec4dList normal_list_;
+	Vec3dList vertex_list_;
+	Vec3dList normal_list_;
 	Vec4dList vertex_color_list_;
 	Vec2dList uv_list_;
 	IndexList uv_index_list_;
+	FloatStorage float_storage_;
+	bool is_float_storage_;
 
 	UMBox box_;
 	UMMaterialList material_list_;
+	MaterialIndexList material_index_list_;
 };
 
 } //burger
\ No newline at end of file
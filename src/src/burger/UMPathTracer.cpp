@@ -12,8 +12,11 @@
 #include "UMRenderParameter.h"
 #include "UMShaderParameter.h"
 #include "UMRay.h"
+#include "UMRayPacket.h"
 #include "UMScene.h"
 #include "UMVector.h"
+#include "UMMath.h"
+#include "UMTileScheduler.h"
 
 #include <limits>
 #include <algorithm>
@@ -27,6 +30,9 @@ namespace
 	using namespace burger;
 
 	const int minimum_path_depth = 2;
+
+	/// dark pixels are not refined forever
+	const double adaptive_min_luminance = 0.01;
 	
 	std::uniform_real_distribution<> random_range(0.0, 1.0);
 
@@ -39,6 +45,25 @@ namespace
 		return src;
 	}
 
+	double luminance(const UMVec3d& color)
+	{
+		return 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+	}
+
+	/**
+	 * relative standard error of the mean luminance of a pixel
+	 * @param [in] sum sum of luminance of samples
+	 * @param [in] square_sum sum of squared luminance of samples
+	 * @param [in] count sample count
+	 */
+	double relative_error(double sum, double square_sum, double count)
+	{
+		if (count < 2.0) return std::numeric_limits<double>::max();
+		const double mean = sum / count;
+		const double variance = std::max(square_sum / count - mean * mean, 0.0) * count / (count - 1.0);
+		return std::sqrt(variance / count) / std::max(mean, adaptive_min_luminance);
+	}
+
 	UMVec3d hemisphere(const UMVec3d& normal, std::mt19937& mt)
 	{
 		UMVec3d u, v, w;
@@ -56,7 +81,36 @@ namespace
 		return dir;
 	}
 
-}
+	/**
+	 * russian roulette by the throughput and the next ray of a diffuse path
+	 * @param [in] parameter shading parameter of the hit
+	 * @param [in] max_depth max depth of the path
+	 * @param [in,out] depth remaining depth
+	 * @param [in,out] throughput weight of the path
+	 * @param [out] ray next ray
+	 * @param [in,out] mt random number generator
+	 * @retval false the path is terminated
+	 */
+	bool next_path_ray(
+		const UMShaderParameter& parameter,
+		int max_depth,
+		int& depth,
+		UMVec3d& throughput,
+		UMRay& ray,
+		std::mt19937& mt)
+	{
+		if (!um_russian_roulette(parameter.color, max_depth - minimum_path_depth, random_range(mt), depth, throughput))
+		{
+			return false;
+		}
+		const UMVec3d dir = hemisphere(parameter.normal, mt);
+		ray.set_origin(um_offset_ray_origin(parameter.intersect_point, parameter.normal, dir));
+		ray.set_direction(dir);
+		ray.set_tmin(0.0);
+		return true;
+	}
+
+} // anonymouse namespace
 
 namespace burger
 {
@@ -66,12 +120,21 @@ class UMIntersection
 	DISALLOW_COPY_AND_ASSIGN(UMIntersection);
 	public:
 		UMIntersection() : 
-			closest_distance(std::numeric_limits<double>::max())
+			closest_distance(std::numeric_limits<double>::max()),
+			closest_primitive(NULL)
 		{}
 
+		/**
+		 * forget the hit for the next ray
+		 */
+		void clear()
+		{
+			closest_distance = std::numeric_limits<double>::max();
+			closest_primitive = NULL;
+		}
+
 		double closest_distance;
-		UMPrimitivePtr closest_primitive;
-		UMShaderParameter closest_parameter;
+		const UMPrimitive* closest_primitive;
 
 	static bool intersect(
 		const UMRay& ray, 
@@ -79,39 +142,64 @@ class UMIntersection
 		UMShaderParameter& parameter, 
 		UMIntersection& intersection)
 	{
-		UMPrimitiveList::const_iterator it = scene.primitive_list().begin();
-		for (int i = 0; it != scene.primitive_list().end(); ++it, ++i)
+		// bvh and unbounded primitives
+		UMHit hit;
+		const UMPrimitiveList* lists[] = { &scene.primitive_list(), &scene.unbounded_primitive_list() };
+		for (int k = 0; k < 2; ++k)
 		{
-			UMPrimitivePtr primitive = *it;
-			if (primitive->intersects(ray, parameter))
+			UMPrimitiveList::const_iterator it = lists[k]->begin();
+			for (; it != lists[k]->end(); ++it)
 			{
-				if (parameter.distance < intersection.closest_distance) 
+				// primitives accept only hits closer than the current one
+				const UMPrimitivePtr& primitive = *it;
+				if (primitive->intersects(ray, hit))
 				{
-					intersection.closest_distance = parameter.distance;
-					intersection.closest_primitive = primitive;
-					intersection.closest_parameter = parameter;
+					intersection.closest_primitive = primitive.get();
 				}
 			}
 		}
-		return intersection.closest_primitive;
+		if (!intersection.closest_primitive) return false;
+		// shade the closest hit only
+		hit.shade(ray, parameter);
+		intersection.closest_distance = hit.distance;
+		return true;
 	}
 
 	static bool intersect(
 		const UMRay& ray, 
 		const UMScene& scene)
 	{
-		UMPrimitiveList::const_iterator it = scene.primitive_list().begin();
-		for (int i = 0; it != scene.primitive_list().end(); ++it, ++i)
+		const UMPrimitiveList* lists[] = { &scene.primitive_list(), &scene.unbounded_primitive_list() };
+		for (int k = 0; k < 2; ++k)
 		{
-			UMPrimitivePtr primitive = *it;
-			if (primitive->intersects(ray))
+			UMPrimitiveList::const_iterator it = lists[k]->begin();
+			for (; it != lists[k]->end(); ++it)
 			{
-				return true;
+				const UMPrimitivePtr& primitive = *it;
+				if (primitive->intersects(ray))
+				{
+					return true;
+				}
 			}
 		}
 		return false;
 	}
 
+	static void intersect(
+		UMRayPacket& packet,
+		const UMScene& scene)
+	{
+		const UMPrimitiveList* lists[] = { &scene.primitive_list(), &scene.unbounded_primitive_list() };
+		for (int k = 0; k < 2; ++k)
+		{
+			UMPrimitiveList::const_iterator it = lists[k]->begin();
+			for (; it != lists[k]->end(); ++it)
+			{
+				(*it)->intersects(packet);
+			}
+		}
+	}
+
 };
 
 UMPathTracer::UMPathTracer() : 
@@ -119,110 +207,160 @@ UMPathTracer::UMPathTracer() :
 	current_subpixel_x_(0),
 	current_subpixel_y_(0),
 	max_sample_count_(0),
-	sample_event_(std::make_shared<UMEvent>(eEventTypeRenderProgressSample))
+	sample_event_(std::make_shared<UMEvent>(eEventTypeRenderProgressSample)),
+	unconverged_pixel_count_(0),
+	traced_sample_count_(0),
+	sample_budget_(0)
 {
 	mutable_event_list().push_back(sample_event_);
 }
 
 /**
- * trace and return color of the hit point
+ * trace a path and return color of it
  */
-UMVec3d UMPathTracer::trace(const UMRay& ray, const UMScene& scene, UMShaderParameter& parameter, std::mt19937& mt)
+UMVec3d UMPathTracer::trace(
+	const UMRay& ray, 
+	const UMVec3d& throughput,
+	const UMScene& scene, 
+	UMShaderParameter& parameter, 
+	std::mt19937& mt)
 {
+	UMVec3d color(0);
+	UMVec3d path_throughput(throughput);
+	UMRay path_ray(ray.origin(), ray.direction());
+	path_ray.set_tmin(ray.tmin());
+	path_ray.set_tmax(ray.tmax());
+	// shading overwrites the parameter, so the depth is kept here
+	int depth = parameter.depth;
+	const int max_depth = parameter.max_depth;
 	UMIntersection intersection;
-	if (!UMIntersection::intersect(ray, scene, parameter, intersection)){
-		return scene.background_color();
-	}
-
-	UMVec3d normal = intersection.closest_parameter.normal;
-	if (normal.dot(ray.direction()) >= 0.0)
+	for (;;)
 	{
-		normal = -normal;
-	}
-	
-	UMVec3d point_color(intersection.closest_parameter.color);
-	double russian_roulette_probability = std::max(point_color.x, std::max(point_color.y, point_color.z));
-	
-	if (parameter.depth < 16) {
-		russian_roulette_probability *= pow(0.5, 16 - parameter.depth);
+		intersection.clear();
+		if (!UMIntersection::intersect(path_ray, scene, parameter, intersection))
+		{
+			color += path_throughput.multiply(scene.background_color());
+			break;
+		}
+		color += path_throughput.multiply(parameter.emissive);
+		// diffuse direct
+		color += path_throughput.multiply(illuminate_direct(scene, parameter, mt));
+		// diffuse indirect
+		if (!next_path_ray(parameter, max_depth, depth, path_throughput, path_ray, mt)) break;
 	}
+	parameter.depth = depth;
+	return color;
+}
 
-	UMVec3d color = intersection.closest_parameter.emissive;
+/**
+ * trace camera rays and return colors of the hit points
+ */
+void UMPathTracer::trace(
+	UMRayPacket& packet,
+	const UMScene& scene,
+	UMVec3d* colors,
+	std::mt19937& mt)
+{
+	UMIntersection::intersect(packet, scene);
 
-	if (parameter.depth < (parameter.max_depth - minimum_path_depth)) {
-		if (random_range(mt) >= russian_roulette_probability)
+	// shade the closest hits only
+	const int ray_count = packet.ray_count();
+	UMShaderParameter parameter_list[UMRayPacket::max_ray_count];
+	for (int i = 0; i < ray_count; ++i)
+	{
+		if (!packet.is_hit(i))
 		{
-			return color;
+			colors[i] = scene.background_color();
+			continue;
 		}
-	} else {
-		russian_roulette_probability = 1.0;
+		packet.shade(i, parameter_list[i]);
+		colors[i] = parameter_list[i].emissive;
 	}
-	--parameter.depth;
 
-	// diffuse direct
-	color += illuminate_direct(ray, scene, intersection, parameter, mt);
-	// diffuse indirect
-	color += illuminate_indirect(ray, scene, intersection, parameter, mt) / russian_roulette_probability;
+	// diffuse direct. shadow rays toward a light are traced together
+	UMRayPacket shadow_packet(true);
+	int source_index[UMRayPacket::max_ray_count];
+	UMVec3d intensity_list[UMRayPacket::max_ray_count];
+	UMLightList::const_iterator it = scene.light_list().begin();
+	for (; it != scene.light_list().end(); ++it)
+	{
+		const UMLightPtr& light = *it;
+		shadow_packet.clear();
+		for (int i = 0; i < ray_count; ++i)
+		{
+			if (!packet.is_hit(i)) continue;
+			const UMShaderParameter& parameter = parameter_list[i];
+			UMVec3d intensity;
+			UMVec3d sample_point;
+			UMVec3d direction;
+			UMVec2d random_value(random_range(mt), random_range(mt));
+			if (light->sample(intensity, sample_point, direction, parameter, random_value))
+			{
+				const UMVec3d shadow_dir = direction.normalized();
+				const UMVec3d p = um_offset_ray_origin(parameter.intersect_point, parameter.normal, shadow_dir);
+				const int index = shadow_packet.add_ray(p, shadow_dir);
+				shadow_packet.mutable_ray(index).set_tmin(0.0);
+				shadow_packet.mutable_ray(index).set_tmax( (sample_point - p).length() );
+				source_index[index] = i;
+				intensity_list[index] = intensity;
+			}
+		}
+		UMIntersection::intersect(shadow_packet, scene);
+		for (int k = 0; k < shadow_packet.ray_count(); ++k)
+		{
+			if (shadow_packet.is_hit(k)) continue;
+			const int i = source_index[k];
+			colors[i] += (parameter_list[i].color * M_PI_INV).multiply(intensity_list[k]);
+		}
+	}
 
-	return color;
+	// diffuse indirect. each path continues in its own loop
+	for (int i = 0; i < ray_count; ++i)
+	{
+		if (!packet.is_hit(i)) continue;
+		UMShaderParameter& parameter = parameter_list[i];
+		UMVec3d throughput(1.0);
+		UMRay next_ray;
+		if (next_path_ray(parameter, parameter.max_depth, parameter.depth, throughput, next_ray, mt))
+		{
+			colors[i] += trace(next_ray, throughput, scene, parameter, mt);
+		}
+	}
 }
 
 /**
  * direct lighting
  */
 UMVec3d UMPathTracer::illuminate_direct(
-	const UMRay& ray, 
 	const UMScene& scene, 
-	const UMIntersection& intersection,
-	UMShaderParameter& parameter,
+	const UMShaderParameter& parameter,
 	std::mt19937& mt)
 {
 	UMVec3d color(0);
-	UMMaterialPtr mat = intersection.closest_parameter.material;
-
 	UMLightList::const_iterator it = scene.light_list().begin();
 	for (; it != scene.light_list().end(); ++it)
 	{
-		UMLightPtr light = *it;
+		const UMLightPtr& light = *it;
 		UMVec3d intensity;
 		UMVec3d sample_point;
 		UMVec3d direction;
 		UMVec2d random_value(random_range(mt), random_range(mt));
-		if (light->sample(intensity, sample_point, direction, intersection.closest_parameter, random_value))
+		if (light->sample(intensity, sample_point, direction, parameter, random_value))
 		{
-			UMVec3d p(intersection.closest_parameter.intersect_point);
-			UMRay shadow_ray(p, direction.normalized());
+			const UMVec3d shadow_dir = direction.normalized();
+			UMVec3d p = um_offset_ray_origin(parameter.intersect_point, parameter.normal, shadow_dir);
+			UMRay shadow_ray(p, shadow_dir);
+			shadow_ray.set_tmin(0.0);
 			shadow_ray.set_tmax( (sample_point - p).length() );
 			if (!UMIntersection::intersect(shadow_ray, scene))
 			{
-				color += (intersection.closest_parameter.color * M_PI_INV).multiply(intensity);
+				color += (parameter.color * M_PI_INV).multiply(intensity);
 			}
 		}
 	}
 	return color;
 }
 
-/**
- * indirect lighting
- */
-UMVec3d UMPathTracer::illuminate_indirect(
-	const UMRay& ray, 
-	const UMScene& scene, 
-	const UMIntersection& intersection,
-	UMShaderParameter& parameter,
-	std::mt19937& mt)
-{
-	UMVec3d color;
-	UMMaterialPtr mat = intersection.closest_parameter.material;
-
-	UMVec3d dir = hemisphere(parameter.normal, mt);
-	UMRay next_ray(intersection.closest_parameter.intersect_point, dir);
-	UMVec3d traced_color = trace(next_ray, scene, parameter, mt);
-	// importance sampling
-	color = traced_color.multiply(intersection.closest_parameter.color);
-	return color;
-}
-
 /**
  * render
  */
@@ -232,26 +370,100 @@ bool UMPathTracer::render(const UMScene& scene, UMRenderParameter& parameter)
 	if (!scene.camera()) return false;
 
 	const int sample_count = parameter.sample_count();
-	sampler_.generate_samples(sample_count);
-
-	for (int y = 0; y < height_; ++y)
+	const double adaptive_error = parameter.adaptive_error();
+	const int min_sample_count = std::max(parameter.adaptive_min_sample_count(), 2);
+	const bool is_adaptive = adaptive_error > 0.0;
+	// noisy pixels may take the samples left by converged pixels
+	const int max_pixel_sample_count = is_adaptive ? sample_count * std::max(parameter.adaptive_max_sample_scale(), 1) : sample_count;
+	sampler_.generate_samples(max_pixel_sample_count);
+	const UMRandomSampler::SampleList& sample_list = sampler_.sample_list();
+
+	UMCameraPtr camera = scene.camera();
+	UMImage::ImageBuffer& out_buffer = parameter.mutable_output_image().mutable_list();
+	const int width = width_;
+	const int pixel_count = width_ * height_;
+	if (is_adaptive)
 	{
-		std::mt19937 mt;
-
-		for (int x = 0; x < width_; ++x)
-		{
-			const int pos = width_ * y + x;
-			for (int s = 0; s < sample_count; ++s)
+		parameter.mutable_convergence_image().init(width_, height_);
+	}
+	UMImage::ImageBuffer& convergence_buffer = parameter.mutable_convergence_image().mutable_list();
+
+	// adaptive sampling spends the samples of uniform sampling
+	std::vector<int> pixel_sample_count_list(pixel_count, 0);
+	luminance_sum_list_.assign(pixel_count, 0.0);
+	luminance_square_sum_list_.assign(pixel_count, 0.0);
+	converged_list_.assign(pixel_count, 0);
+	unconverged_pixel_count_ = pixel_count;
+	traced_sample_count_ = 0;
+	sample_budget_ = static_cast<long long>(pixel_count) * sample_count;
+
+	const UMTileScheduler scheduler(parameter.thread_count(), parameter.tile_size());
+	const int tile_count = scheduler.tile_count(width_, height_);
+	std::vector<int> traced_count_list(tile_count);
+	std::vector<int> converged_count_list(tile_count);
+
+	// uniform sampling takes all samples in a pass.
+	// adaptive sampling takes a few samples of each unconverged pixel per pass until the budget is used.
+	const int pass_sample_count = is_adaptive ? min_sample_count : sample_count;
+	for (int pass = 0; unconverged_pixel_count_ > 0; ++pass)
+	{
+		const long long remaining_count = sample_budget_ - traced_sample_count_;
+		const int batch_count = static_cast<int>(
+			std::min(static_cast<long long>(pass_sample_count), remaining_count / unconverged_pixel_count_));
+		if (batch_count <= 0) break;
+
+		std::fill(traced_count_list.begin(), traced_count_list.end(), 0);
+		std::fill(converged_count_list.begin(), converged_count_list.end(), 0);
+		scheduler.run_tiles(width_, height_, [&](const UMTile& tile, int /*thread*/) {
+			std::mt19937 mt(tile.index + pass * tile_count);
+			for (int y = tile.y; y < tile.y + tile.height; ++y)
 			{
-				UMVec2d sample_point(sampler_.sample(s));
-				sample_point.x += x;
-				sample_point.y += y;
-				UMRay ray;
-				scene.camera()->generate_ray(ray, sample_point, (y == 0 && x == 0 && s== 0));
-				UMShaderParameter shader_parameter;
-				UMVec3d color = trace(ray, scene, shader_parameter, mt);
-				parameter.mutable_output_image().mutable_list()[pos] += UMVec4d(color, 1.0);
+				for (int x = tile.x; x < tile.x + tile.width; ++x)
+				{
+					const int pos = width * y + x;
+					if (converged_list_[pos]) continue;
+					const int first = pixel_sample_count_list[pos];
+					const int last = std::min(first + batch_count, max_pixel_sample_count);
+					for (int s = first; s < last; ++s)
+					{
+						UMVec2d sample_point(sample_list[s]);
+						sample_point.x += x;
+						sample_point.y += y;
+						UMRay ray;
+						camera->generate_ray(ray, sample_point);
+						UMShaderParameter shader_parameter;
+						UMVec3d color = trace(ray, UMVec3d(1.0), scene, shader_parameter, mt);
+						out_buffer[pos] += UMVec4d(color, 1.0);
+						const double value = luminance(color);
+						luminance_sum_list_[pos] += value;
+						luminance_square_sum_list_[pos] += value * value;
+					}
+					pixel_sample_count_list[pos] = last;
+					traced_count_list[tile.index] += last - first;
+
+					// stop sampling the pixel if converged or all samples are taken
+					const double error = relative_error(luminance_sum_list_[pos], luminance_square_sum_list_[pos], last);
+					const bool is_converged = is_adaptive && last >= min_sample_count && error < adaptive_error;
+					if (is_converged || last >= max_pixel_sample_count || !is_adaptive)
+					{
+						converged_list_[pos] = 1;
+						++converged_count_list[tile.index];
+					}
+					if (is_adaptive)
+					{
+						convergence_buffer[pos] = UMVec4d(
+							error,
+							last / static_cast<double>(max_pixel_sample_count),
+							is_converged ? 1.0 : 0.0,
+							1.0);
+					}
+				}
 			}
+		});
+		for (int i = 0; i < tile_count; ++i)
+		{
+			traced_sample_count_ += traced_count_list[i];
+			unconverged_pixel_count_ -= converged_count_list[i];
 		}
 	}
 	
@@ -267,11 +479,20 @@ bool UMPathTracer::progress_render(const UMScene& scene, UMRenderParameter& para
 	if (!scene.camera()) return false;
 	
 	const UMVec2i super_sampling = parameter.super_sampling_count();
+	const int pixel_count = width_ * height_;
+	const double adaptive_error = parameter.adaptive_error();
+	const bool is_adaptive = adaptive_error > 0.0;
 	
-	// end
-	if (current_sample_count_ == max_sample_count_ &&
-		current_subpixel_x_ == (super_sampling.x-1) &&
-		current_subpixel_y_ == (super_sampling.y-1)) 
+	// end. adaptive sampling stops before a pass exceeds the budget, even within subpixels
+	const bool is_last_subpixel =
+		(current_subpixel_x_ == (super_sampling.x-1) &&
+		 current_subpixel_y_ == (super_sampling.y-1));
+	const bool is_finished = is_adaptive ?
+		(current_sample_count_ > 0 && (
+			unconverged_pixel_count_ == 0 ||
+			(sample_budget_ - traced_sample_count_) < unconverged_pixel_count_))
+		: (is_last_subpixel && current_sample_count_ == max_sample_count_);
+	if (is_finished) 
 	{
 		current_subpixel_x_ = 0;
 		current_subpixel_y_ = 0;
@@ -286,6 +507,17 @@ bool UMPathTracer::progress_render(const UMScene& scene, UMRenderParameter& para
 		current_subpixel_y_ = 0;
 		temporary_image_.init(width_, height_);
 		max_sample_count_ = parameter.sample_count() / (super_sampling.x * super_sampling.y);
+		// adaptive sampling spends the samples of uniform sampling
+		luminance_sum_list_.assign(pixel_count, 0.0);
+		luminance_square_sum_list_.assign(pixel_count, 0.0);
+		converged_list_.assign(pixel_count, 0);
+		unconverged_pixel_count_ = pixel_count;
+		traced_sample_count_ = 0;
+		sample_budget_ = static_cast<long long>(pixel_count) * parameter.sample_count();
+		if (is_adaptive)
+		{
+			parameter.mutable_convergence_image().init(width_, height_);
+		}
 	}
 	
 	bool is_end_subpixel = 
@@ -309,54 +541,111 @@ bool UMPathTracer::progress_render(const UMScene& scene, UMRenderParameter& para
 			++current_subpixel_x_;
 		}
 	}
-	const double inv_current_sample_count = 1.0 / current_sample_count_;
 	const double inv_current_subpixel_sample_count 
 		= 1.0 / (current_subpixel_x_ + 1)
 		* 1.0 / (current_subpixel_y_ + 1);
 	const double inv_super_sampling_x = 1.0 / (double)super_sampling.x;
 	const double inv_super_sampling_y = 1.0 / (double)super_sampling.y;
 	
+	UMCameraPtr camera = scene.camera();
+	const UMVec2d subpixel(
+		current_subpixel_x_ * inv_super_sampling_x,
+		current_subpixel_y_ * inv_super_sampling_y);
+
+	const UMTileScheduler scheduler(parameter.thread_count(), parameter.tile_size());
+	const int tile_count = scheduler.tile_count(width_, height_);
 	std::random_device random_device;
-	std::vector<unsigned int> seed(2 * height_);
+	std::vector<unsigned int> seed(2 * tile_count);
 	std::generate(seed.begin(), seed.end(), std::ref(random_device));
-
-#pragma omp parallel for schedule(dynamic, 1) num_threads(8)
-	for (int y = 0; y < height_; ++y)
-	{
-		std::mt19937 mt(std::seed_seq(seed.begin() + 2 * y, seed.begin() +  2 * (y + 1)));
-		for (int x = 0; x < width_; ++x)
+	// counted by each tile, so threads share nothing
+	std::vector<int> traced_count_list(tile_count, 0);
+	std::vector<int> converged_count_list(tile_count, 0);
+
+	UMImage::ImageBuffer& current_buffer = temporary_image_.mutable_list();
+	UMImage::ImageBuffer& out_buffer = parameter.mutable_output_image().mutable_list();
+	UMImage::ImageBuffer& convergence_buffer = parameter.mutable_convergence_image().mutable_list();
+	const int width = width_;
+	const int min_sample_count = std::max(parameter.adaptive_min_sample_count(), 2);
+	const double max_pixel_sample_count = 
+		static_cast<double>(max_sample_count_) * std::max(parameter.adaptive_max_sample_scale(), 1) * super_sampling.x * super_sampling.y;
+	scheduler.run_tiles(width_, height_, [&](const UMTile& tile, int /*thread*/) {
+		std::seed_seq seed_sequence(seed.begin() + 2 * tile.index, seed.begin() + 2 * (tile.index + 1));
+		std::mt19937 mt(seed_sequence);
+		UMRayPacket packet;
+		UMVec3d colors[UMRayPacket::max_ray_count];
+		int positions[UMRayPacket::max_ray_count];
+		// camera rays of all pixels in the tile
+		const int tile_pixel_count = tile.width * tile.height;
+		const std::vector<UMVec2d> samples(tile_pixel_count, subpixel);
+		UMCameraRays rays;
+		camera->generate_rays(tile, &samples[0], 1, rays);
+		for (int i = 0; i < tile_pixel_count; )
 		{
-			// target pixel
-			const int pos = width_ * y + x;
-			UMVec4d& current_color = temporary_image_.mutable_list()[pos];
-			UMVec4d& out_color = parameter.mutable_output_image().mutable_list()[pos];
-			
-			// sample point
-			UMVec2d sample_point(x, y);
-			sample_point.x += current_subpixel_x_ * inv_super_sampling_x;
-			sample_point.y += current_subpixel_y_ * inv_super_sampling_y;
-			// generate camera ray
-			bool is_initial = (
-				y == 0 
-				&& x == 0 
-				&& current_subpixel_y_ == 0 
-				&& current_subpixel_x_ == 0);
-			UMRay ray;
-			scene.camera()->generate_ray(ray, sample_point, is_initial);
+			// camera rays of neighbor pixels in the tile
+			packet.clear();
+			for (; i < tile_pixel_count && !packet.is_full(); ++i)
+			{
+				const int tile_pixel = rays.pixel[i];
+				const int x = tile.x + tile_pixel % tile.width;
+				const int y = tile.y + tile_pixel / tile.width;
+				const int pos = width * y + x;
+				// converged pixels leave the samples to noisy pixels
+				if (converged_list_[pos]) continue;
+				const UMVec3d direction(rays.direction_x[i], rays.direction_y[i], rays.direction_z[i]);
+				positions[packet.add_ray(rays.origin, direction)] = pos;
+			}
+			if (packet.ray_count() == 0) continue;
 			// trace
-			UMShaderParameter shader_param;
-			UMVec3d color = trace(ray, scene, shader_param, mt);
-			// output
-			current_color += UMVec4d(color, 1.0);
+			trace(packet, scene, colors, mt);
+			traced_count_list[tile.index] += packet.ray_count();
 
-			if (is_end_subpixel)
+			for (int k = 0; k < packet.ray_count(); ++k)
 			{
-				out_color = map_one(current_color 
-					* inv_current_sample_count
-					* inv_super_sampling_x
-					* inv_super_sampling_y);
+				// target pixel
+				const int pos = positions[k];
+				UMVec4d& current_color = current_buffer[pos];
+				// output
+				current_color += UMVec4d(colors[k], 1.0);
+				const double value = luminance(colors[k]);
+				luminance_sum_list_[pos] += value;
+				luminance_square_sum_list_[pos] += value * value;
+
+				if (!is_adaptive)
+				{
+					if (is_end_subpixel)
+					{
+						out_buffer[pos] = map_one(current_color / current_color.w);
+					}
+					continue;
+				}
+				// rendering may stop within subpixels, so adaptive sampling outputs every pass
+				out_buffer[pos] = map_one(current_color / current_color.w);
+				const double error = relative_error(
+					luminance_sum_list_[pos], luminance_square_sum_list_[pos], current_color.w);
+				const bool is_last_sample = current_color.w >= max_pixel_sample_count;
+				if ((is_end_subpixel || is_last_sample) && current_color.w >= min_sample_count && error < adaptive_error)
+				{
+					converged_list_[pos] = 1;
+					++converged_count_list[tile.index];
+				}
+				else if (is_last_sample)
+				{
+					// noisy, but no samples are left
+					converged_list_[pos] = 2;
+					++converged_count_list[tile.index];
+				}
+				convergence_buffer[pos] = UMVec4d(
+					error,
+					current_color.w / max_pixel_sample_count,
+					converged_list_[pos] == 1 ? 1.0 : 0.0,
+					1.0);
 			}
 		}
+	});
+	for (int i = 0; i < tile_count; ++i)
+	{
+		traced_sample_count_ += traced_count_list[i];
+		unconverged_pixel_count_ -= converged_count_list[i];
 	}
 
 	UMAny sample_count(current_sample_count_);
@@ -30,7 +30,7 @@ typedef std::shared_ptr<UMPathTracer> UMPathTracerPtr;
 
 class UMScene;
 class UMRenderParameter;
-class UMIntersection;
+class UMRayPacket;
 
 /**
  * a raytracer
@@ -76,34 +76,45 @@ public:
 
 private:
 	/**
-	 * trace
+	 * trace a path and return color of it.
+	 * the path is traced in a loop carrying its throughput, not by recursion.
+	 * @param [in] ray first ray of the path
+	 * @param [in] throughput weight of the path before the ray
+	 * @param [in] scene target scene
+	 * @param [in,out] parameter hit record reused for all bounces. depth is the remaining depth
+	 * @param [in,out] mt random number generator
 	 */
 	UMVec3d trace(
 		const UMRay& ray, 
+		const UMVec3d& throughput,
 		const UMScene& scene, 
 		UMShaderParameter& parameter, 
 		std::mt19937& mt);
 
 	/**
-	 * direct lighting
+	 * trace camera rays and return colors of the hit points.
+	 * camera rays and shadow rays toward each light are traced as packets.
+	 * @param [in,out] packet camera rays
+	 * @param [in] scene target scene
+	 * @param [out] colors color of each ray
+	 * @param [in,out] mt random number generator
 	 */
-	UMVec3d illuminate_direct(
-		const UMRay& ray, 
-		const UMScene& scene, 
-		const UMIntersection& intersection, 
-		UMShaderParameter& parameter,
+	void trace(
+		UMRayPacket& packet,
+		const UMScene& scene,
+		UMVec3d* colors,
 		std::mt19937& mt);
 
 	/**
-	 * indirect lighting
+	 * direct lighting
+	 * @param [in] scene target scene
+	 * @param [in] parameter shading parameter of the hit
+	 * @param [in,out] mt random number generator
 	 */
-	UMVec3d illuminate_indirect(
-		const UMRay& ray, 
+	UMVec3d illuminate_direct(
 		const UMScene& scene, 
-		const UMIntersection& intersection, 
-		UMShaderParameter& parameter, 
+		const UMShaderParameter& parameter,
 		std::mt19937& mt);
-	
 
 	// for progress render
 	int current_sample_count_;
@@ -113,6 +124,14 @@ private:
 	UMRandomSampler sampler_;
 	UMImage temporary_image_;
 	UMEventPtr sample_event_;
+
+	// for adaptive sampling. converged_list_ is 1 for converged pixels, 2 for pixels which took all samples
+	std::vector<double> luminance_sum_list_;
+	std::vector<double> luminance_square_sum_list_;
+	std::vector<char> converged_list_;
+	int unconverged_pixel_count_;
+	long long traced_sample_count_;
+	long long sample_budget_;
 };
 
 } // burger
@@ -26,7 +26,17 @@ namespace burger
  */
 bool UMPlane::intersects(const UMRay& ray, UMShaderParameter& parameter) const
 {
-	const UMVec3d& ray_dir = ray.direction();
+	UMHit hit;
+	if (!intersects(ray, hit)) return false;
+	shade_hit(ray, hit, parameter);
+	return true;
+}
+
+/**
+ * ray plane intersection without shading
+ */
+bool UMPlane::intersects(const UMRay& ray, UMHit& hit) const
+{
 	const UMVec3d& ray_orig = ray.origin();
 
 	double angle = normal_.dot(ray.direction());
@@ -36,18 +46,32 @@ bool UMPlane::intersects(const UMRay& ray, UMShaderParameter& parameter) const
 	}
 
 	double distance = normal_.dot(point_ - ray_orig) / angle;
-	if (distance < FLT_EPSILON) {
+	if (distance < ray.tmin()) {
 		// ray is back of plane
 		return false;
 	}
-	
+	if (distance > ray.tmax()) {
+		// no reach
+		return false;
+	}
+	if (distance >= hit.distance) {
+		// not closer
+		return false;
+	}
+	hit.set(this, 0, distance, 0.0, 0.0);
+	return true;
+}
+
+/**
+ * set shading parameters of a hit
+ */
+void UMPlane::shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& parameter) const
+{
 	parameter.color = material_->diffuse().xyz();
-	parameter.material = material_;
-	parameter.distance = distance;
-	parameter.intersect_point = ray_orig + ray_dir * distance;
+	parameter.material = material_.get();
+	parameter.distance = hit.distance;
+	parameter.intersect_point = ray.origin() + ray.direction() * hit.distance;
 	parameter.normal = normal_;
-
-	return true;
 }
 
 /**
@@ -65,10 +89,14 @@ bool UMPlane::intersects(const UMRay& ray) const
 	}
 
 	double distance = normal_.dot(point_ - ray.origin()) / angle;
-	if (distance < FLT_EPSILON) {
+	if (distance < ray.tmin()) {
 		// ray is back of plane
 		return false;
 	}
+	if (distance > ray.tmax()) {
+		// no reach
+		return false;
+	}
 	return true;
 }
 
@@ -103,6 +131,7 @@ UMMeshPtr UMPlane::convert_to_mesh(double width, double height) const
 
 	material_->set_polygon_count(static_cast<int>(mesh->face_list().size()));
 	mesh->mutable_material_list().push_back(material_);
+	mesh->create_material_index_list();
 	mesh->create_normals(true);
 	mesh->update_box();
 	return mesh;
@@ -90,11 +90,31 @@ public:
 	 * @param [in] ray a ray
 	 */
 	virtual bool intersects(const UMRay& ray) const;
+
+	/**
+	 * ray plane intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const;
+
+	/**
+	 * set shading parameters of a hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const;
 	
 	/**
 	 * get box
 	 */
 	virtual const UMBox& box() const { return box_; }
+
+	/**
+	 * a plane is infinite
+	 */
+	virtual bool is_bounded() const { return false; }
 	
 	/**
 	 * update AABB
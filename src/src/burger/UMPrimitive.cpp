@@ -0,0 +1,46 @@
+/**
+ * @file UMPrimitive.cpp
+ * interface of primitive
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMPrimitive.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMShaderParameter.h"
+
+namespace burger
+{
+
+/**
+ * ray packet intersection
+ */
+void UMPrimitive::intersects(UMRayPacket& packet) const
+{
+	const int ray_count = packet.ray_count();
+	for (int i = 0; i < ray_count; ++i)
+	{
+		if (!packet.is_active(i)) continue;
+		if (packet.is_shadow())
+		{
+			if (!packet.is_hit(i) && intersects(packet.ray(i)))
+			{
+				packet.set_hit(i);
+			}
+			continue;
+		}
+		// keep only the hit closer than the current one. shaded by the caller
+		UMHit hit;
+		hit.distance = packet.closest_distance(i);
+		if (intersects(packet.ray(i), hit))
+		{
+			packet.set_hit(i, hit);
+		}
+	}
+}
+
+} // burger
@@ -12,6 +12,8 @@
 
 #include <memory>
 #include <vector>
+#include <limits>
+#include <cstddef>
 
 #include "UMMacro.h"
 #include "UMVector.h"
@@ -26,6 +28,8 @@ typedef std::vector<UMPrimitivePtr> UMPrimitiveList;
 class UMRay;
 class UMShaderParameter;
 class UMBox;
+class UMRayPacket;
+struct UMHit;
 
 /**
  * interface of primitive
@@ -50,11 +54,40 @@ public:
 	 * @param [in] ray a ray
 	 */
 	virtual bool intersects(const UMRay& ray) const = 0;
+
+	/**
+	 * ray intersection without shading.
+	 * overwrites the hit only if a closer hit is found. shading is deferred to shade_hit().
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 * @retval closer hit is found or not
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const = 0;
+
+	/**
+	 * set shading parameters of a hit found by this primitive
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const = 0;
+
+	/**
+	 * ray packet intersection. tests each active ray by default.
+	 * @param [in,out] packet rays and the closest hits found so far
+	 */
+	virtual void intersects(UMRayPacket& packet) const;
 	
 	/**
 	 * get box
 	 */
 	virtual const UMBox& box() const = 0;
+
+	/**
+	 * has a finite box or not.
+	 * unbounded primitives are not put into bvh.
+	 */
+	virtual bool is_bounded() const { return true; }
 	
 	/**
 	 * update AABB
@@ -62,4 +95,70 @@ public:
 	virtual void update_box() = 0;
 };
 
+/**
+ * minimal record of a hit found without shading
+ */
+struct UMHit
+{
+	UMHit() :
+		primitive(NULL),
+		instance(NULL),
+		index(-1),
+		distance((std::numeric_limits<double>::max)()),
+		u(0.0),
+		v(0.0) {}
+
+	/**
+	 * set a closer hit found by a primitive
+	 * @param [in] hit_primitive primitive which shades the hit
+	 * @param [in] hit_index index of the hit element in the primitive
+	 * @param [in] hit_distance distance to the hit
+	 * @param [in] hit_u first surface coordinate
+	 * @param [in] hit_v second surface coordinate
+	 */
+	void set(const UMPrimitive* hit_primitive, int hit_index, double hit_distance, double hit_u, double hit_v)
+	{
+		primitive = hit_primitive;
+		instance = NULL;
+		index = hit_index;
+		distance = hit_distance;
+		u = hit_u;
+		v = hit_v;
+	}
+
+	/**
+	 * is hit or not
+	 */
+	bool is_hit() const { return primitive != NULL; }
+
+	/**
+	 * set shading parameters of the hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [out] param shading parameters
+	 */
+	void shade(const UMRay& ray, UMShaderParameter& param) const
+	{
+		if (instance)
+		{
+			instance->shade_hit(ray, *this, param);
+		}
+		else if (primitive)
+		{
+			primitive->shade_hit(ray, *this, param);
+		}
+	}
+
+	/// primitive which found the hit and shades it
+	const UMPrimitive* primitive;
+	/// instance which transformed the ray to the primitive. instances are not nested
+	const UMPrimitive* instance;
+	/// index of the hit element in the primitive, such as a leaf of bvh
+	int index;
+	/// distance to the hit
+	double distance;
+	/// surface coordinates. barycentric coordinates of second and third vertices for triangles
+	double u;
+	double v;
+};
+
 } // burger
@@ -0,0 +1,164 @@
+/**
+ * @file UMRayPacket.h
+ * coherent rays traced together
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include "UMMacro.h"
+#include "UMVector.h"
+#include "UMRay.h"
+#include "UMShaderParameter.h"
+#include "UMPrimitive.h"
+
+namespace burger
+{
+
+class UMRayPacket;
+typedef std::shared_ptr<UMRayPacket> UMRayPacketPtr;
+
+/**
+ * coherent rays traced together, such as camera rays of neighbor pixels
+ * or shadow rays toward a light. holds the result of each ray.
+ * primitives update the result only if they find a closer hit.
+ * hits are not shaded until the caller shades the closest one by shade().
+ */
+class UMRayPacket
+{
+	DISALLOW_COPY_AND_ASSIGN(UMRayPacket);
+
+public:
+	/// maximum ray count of a packet
+	enum { max_ray_count = 64 };
+
+	/**
+	 * @param [in] is_shadow find any hit without shading, or the closest hit
+	 */
+	explicit UMRayPacket(bool is_shadow = false) :
+		ray_count_(0),
+		is_shadow_(is_shadow) {}
+
+	~UMRayPacket() {}
+
+	/**
+	 * remove all rays
+	 */
+	void clear() { ray_count_ = 0; }
+
+	/**
+	 * add a ray
+	 * @param [in] origin origin
+	 * @param [in] direction direction
+	 * @retval index of added ray. -1 if the packet is full
+	 */
+	int add_ray(const UMVec3d& origin, const UMVec3d& direction)
+	{
+		if (is_full()) return -1;
+		const int index = ray_count_++;
+		UMRay& ray = rays_[index];
+		ray.set_origin(origin);
+		ray.set_direction(direction);
+		ray.set_tmin(FLT_EPSILON);
+		ray.set_tmax(FLT_MAX);
+		active_[index] = true;
+		hit_[index] = false;
+		return index;
+	}
+
+	/**
+	 * get ray count
+	 */
+	int ray_count() const { return ray_count_; }
+
+	/**
+	 * is full or not
+	 */
+	bool is_full() const { return ray_count_ == max_ray_count; }
+
+	/**
+	 * is shadow packet or not
+	 */
+	bool is_shadow() const { return is_shadow_; }
+
+	/**
+	 * get ray
+	 */
+	const UMRay& ray(int index) const { return rays_[index]; }
+
+	/**
+	 * get ray
+	 */
+	UMRay& mutable_ray(int index) { return rays_[index]; }
+
+	/**
+	 * is the ray tested or not
+	 */
+	bool is_active(int index) const { return active_[index]; }
+
+	/**
+	 * set the ray tested or not
+	 */
+	void set_active(int index, bool active) { active_[index] = active; }
+
+	/**
+	 * is hit or not
+	 */
+	bool is_hit(int index) const { return hit_[index]; }
+
+	/**
+	 * get distance of the closest hit found so far.
+	 * tmax of the ray if not hit.
+	 */
+	double closest_distance(int index) const
+	{
+		if (hit_[index] && !is_shadow_) return hit_list_[index].distance;
+		return rays_[index].tmax();
+	}
+
+	/**
+	 * get the closest hit found so far
+	 */
+	const UMHit& hit(int index) const { return hit_list_[index]; }
+
+	/**
+	 * set shading parameters of the closest hit
+	 * @param [in] index index of a hit ray
+	 * @param [out] parameter shading parameters
+	 */
+	void shade(int index, UMShaderParameter& parameter) const
+	{
+		hit_list_[index].shade(rays_[index], parameter);
+	}
+
+	/**
+	 * set a hit of a shadow ray
+	 */
+	void set_hit(int index) { hit_[index] = true; }
+
+	/**
+	 * set a closer hit
+	 * @param [in] index index of the ray
+	 * @param [in] hit the hit. shaded later by shade()
+	 */
+	void set_hit(int index, const UMHit& hit)
+	{
+		hit_[index] = true;
+		hit_list_[index] = hit;
+	}
+
+private:
+	UMRay rays_[max_ray_count];
+	UMHit hit_list_[max_ray_count];
+	bool active_[max_ray_count];
+	bool hit_[max_ray_count];
+	int ray_count_;
+	bool is_shadow_;
+};
+
+} // burger
@@ -12,19 +12,23 @@
 #include "UMRenderParameter.h"
 #include "UMShaderParameter.h"
 #include "UMRay.h"
+#include "UMRayPacket.h"
 #include "UMScene.h"
 #include "UMVector.h"
+#include "UMTileScheduler.h"
 
-#include <limits>
 #include <algorithm>
+#include <memory>
+#include <random>
+#include <ctime>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace
 {
 	using namespace burger;
 
-	// definition
-	UMVec3d trace(const UMRay& ray, const UMScene& scene, UMShaderParameter& parameter);
-
 	UMVec3d map_one(UMVec3d src) {
 		double max = std::max(src.x, std::max(src.y, src.z));
 		if (max > 1.0) {
@@ -33,101 +37,165 @@ namespace
 		return src;
 	}
 
-	UMVec3d reflect(const UMRay& ray, const UMVec3d& normal)
+	/**
+	 * shading function
+	 */
+	UMVec3d shade(const UMScene& scene, const UMShaderParameter& parameter)
 	{
-		UMVec3d in_dir(-ray.direction());
-		return -in_dir + normal * in_dir.dot(normal) * 2.0;
+		UMVec3d light_position = scene.light_list().at(0)->position();
+		UMVec3d shadow_dir = -(parameter.intersect_point - light_position ).normalized();
+		UMVec3d normal(parameter.normal);
+		return map_one(parameter.color * (normal.dot(shadow_dir)) * 0.5);
 	}
-	
-	class UMIntersection
-	{
-		DISALLOW_COPY_AND_ASSIGN(UMIntersection);
-		public:
-			UMIntersection() : 
-				closest_distance(std::numeric_limits<double>::max())
-			{}
-
-			double closest_distance;
-			UMPrimitivePtr closest_primitive;
-			UMShaderParameter closest_parameter;
-	};
 
-	bool intersect(
-		const UMRay& ray, 
-		const UMScene& scene, 
-		UMShaderParameter& parameter, 
-		UMIntersection& intersection)
+	/**
+	 * trace a packet and add colors of the hit points to the pixels.
+	 * clears the packet.
+	 * @param [in,out] packet rays
+	 * @param [in] scene target scene
+	 * @param [in] positions pixel position of each ray
+	 * @param [in,out] dst_buffer target image
+	 */
+	void trace(UMRayPacket& packet, const UMScene& scene, const int* positions, UMImage::ImageBuffer& dst_buffer)
 	{
-		UMPrimitiveList::const_iterator it = scene.primitive_list().begin();
-		for (int i = 0; it != scene.primitive_list().end(); ++it, ++i)
+		const UMPrimitiveList* lists[] = { &scene.primitive_list(), &scene.unbounded_primitive_list() };
+		for (int k = 0; k < 2; ++k)
 		{
-			UMPrimitivePtr primitive = *it;
-			if (primitive->intersects(ray, parameter))
+			UMPrimitiveList::const_iterator it = lists[k]->begin();
+			for (; it != lists[k]->end(); ++it)
 			{
-				if (parameter.distance < intersection.closest_distance) 
-				{
-					intersection.closest_distance = parameter.distance;
-					intersection.closest_primitive = primitive;
-					intersection.closest_parameter = parameter;
-				}
+				(*it)->intersects(packet);
+			}
+		}
+		for (int i = 0; i < packet.ray_count(); ++i)
+		{
+			UMVec3d color = scene.background_color();
+			if (packet.is_hit(i))
+			{
+				// shade the closest hit only
+				UMShaderParameter parameter;
+				packet.shade(i, parameter);
+				color = shade(scene, parameter);
 			}
+			dst_buffer[positions[i]] += UMVec4d(color, 1.0);
 		}
-		return intersection.closest_primitive;
+		packet.clear();
 	}
 
 	/**
-	 * shading function
+	 * add a ray to the packet. traces the packet if full.
 	 */
-	UMVec3d shade(const UMPrimitivePtr current, const UMRay& ray, const UMScene& scene, UMShaderParameter& parameter)
+	void add_ray(
+		UMRayPacket& packet,
+		const UMVec3d& origin,
+		const UMVec3d& direction,
+		int pos,
+		int* positions,
+		const UMScene& scene,
+		UMImage::ImageBuffer& dst_buffer)
 	{
-		UMVec3d light_position = scene.light_list().at(0)->position();
-		UMVec3d shadow_dir = -(parameter.intersect_point - light_position ).normalized();
-		UMVec3d normal(parameter.normal);
-
-		//// reflection ray
-		//if (parameter.bounce > 0)
-		//{
-		//	--parameter.bounce;
-		//	UMVec3d refrection_dir = reflect(ray, normal);
-		//	UMRay reflection_ray(parameter.intersect_point, refrection_dir);
-		//	UMVec3d original_color(parameter.color);
-		//	UMVec3d color = trace(reflection_ray, scene, parameter);
-		//	UMVec3d nl = parameter.normal.dot(refrection_dir);
-		//	return UMVec3d(
-		//		original_color.x * color.x * nl.x,
-		//		original_color.y * color.y * nl.y,
-		//		original_color.z * color.z * nl.z);
-		//}
-
-		//// shadow ray
-		//UMRay shadow_ray(parameter.intersect_point, shadow_dir);
-		//UMIntersection intersection;
-		//UMShaderParameter shadow_parameter;
-		//if (intersect(shadow_ray, scene, shadow_parameter, intersection))
-		//{
-		//	return UMVec3d(0);
-		//}
+		positions[packet.add_ray(origin, direction)] = pos;
+		if (packet.is_full())
+		{
+			trace(packet, scene, positions, dst_buffer);
+		}
+	}
 
-		return map_one(parameter.color * (normal.dot(shadow_dir)) * 0.5);
+	/**
+	 * wall clock seconds
+	 */
+	double current_seconds()
+	{
+#ifdef _OPENMP
+		return omp_get_wtime();
+#else
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
 	}
 
 	/**
-	 * trace and return color of the hit point
+	 * state of a rendering thread
 	 */
-	UMVec3d trace(const UMRay& ray, const UMScene& scene, UMShaderParameter& parameter)
+	struct RenderState
 	{
-		UMIntersection intersection;
-		if (!intersect(ray, scene, parameter, intersection)){
-			return scene.background_color();
+		UMRayPacket packet;
+		int positions[UMRayPacket::max_ray_count];
+		std::vector<UMVec2d> samples;
+		UMCameraRays rays;
+		std::mt19937 mt;
+	};
+
+	std::uniform_real_distribution<> random_range(0.0, 1.0);
+
+	/**
+	 * render a tile.
+	 * jitter of sub samples is seeded by the tile, so images do not depend on threads.
+	 * @param [in,out] state state of the thread
+	 * @param [in] scene target scene
+	 * @param [in] camera camera
+	 * @param [in] tile target tile
+	 * @param [in] width image width
+	 * @param [in] sample_count sample count of a pixel
+	 * @param [in,out] dst_buffer target image
+	 */
+	void render_tile(
+		RenderState& state,
+		const UMScene& scene,
+		const UMCamera& camera,
+		const UMTile& tile,
+		int width,
+		int sample_count,
+		UMImage::ImageBuffer& dst_buffer)
+	{
+		// camera rays of all pixels in the tile
+		const int ray_count = tile.width * tile.height * sample_count;
+		state.samples.resize(ray_count);
+		if (sample_count > 1)
+		{
+			state.mt.seed(tile.index);
+			for (int i = 0; i < ray_count; ++i)
+			{
+				state.samples[i].x = random_range(state.mt);
+				state.samples[i].y = random_range(state.mt);
+			}
+		}
+		else
+		{
+			std::fill(state.samples.begin(), state.samples.end(), UMVec2d(0));
 		}
+		camera.generate_rays(tile, state.samples.empty() ? NULL : &state.samples[0], sample_count, state.rays);
 
-		if (intersection.closest_primitive)
+		for (int y = tile.y; y < tile.y + tile.height; ++y)
+		{
+			for (int x = tile.x; x < tile.x + tile.width; ++x)
+			{
+				dst_buffer[width * y + x] = UMVec4d(0);
+			}
+		}
+		state.packet.clear();
+		const UMCameraRays& rays = state.rays;
+		for (int i = 0; i < ray_count; ++i)
 		{
-			return shade(intersection.closest_primitive, ray, scene, intersection.closest_parameter);
+			const int tile_pixel = rays.pixel[i];
+			const int pos = width * (tile.y + tile_pixel / tile.width) + tile.x + tile_pixel % tile.width;
+			const UMVec3d direction(rays.direction_x[i], rays.direction_y[i], rays.direction_z[i]);
+			add_ray(state.packet, rays.origin, direction, pos, state.positions, scene, dst_buffer);
+		}
+		trace(state.packet, scene, state.positions, dst_buffer);
+		if (sample_count > 1)
+		{
+			const double inv_sample_count = 1.0 / sample_count;
+			for (int y = tile.y; y < tile.y + tile.height; ++y)
+			{
+				for (int x = tile.x; x < tile.x + tile.width; ++x)
+				{
+					dst_buffer[width * y + x] *= inv_sample_count;
+				}
+			}
 		}
-		return scene.background_color();
 	}
-}
+
+} // anonymouse namespace
 
 namespace burger
 {
@@ -141,42 +209,16 @@ bool UMRayTracer::render(const UMScene& scene, UMRenderParameter& parameter)
 	if (!scene.camera()) return false;
 	
 	const int sample_count = parameter.super_sampling_count().x * parameter.super_sampling_count().y;
-	const double inv_sample_count = 1.0 / sample_count;
-
 	UMImage::ImageBuffer& dst_buffer = parameter.mutable_output_image().mutable_list();
 
-	for (int y = 0; y < height_; ++y)
-	{
-		if (sample_count > 1)
-		{
-			sampler_.generate_samples(sample_count * width_);
+	UMCameraPtr camera = scene.camera();
 
-			for (int x = 0; x < width_; ++x)
-			{
-				const int pos = width_ * y + x;
-				for (int s = 0; s < sample_count; ++s)
-				{
-					UMVec2d sample_point(sampler_.sample(s));
-					sample_point.x += x;
-					sample_point.y += y;
-					scene.camera()->generate_ray(ray_, sample_point, (y == 0 && x == 0 && s == 0));
-					UMVec3d color = trace(ray_, scene, shader_param_);
-					dst_buffer[pos] += UMVec4d(color, 1.0);
-				}
-				dst_buffer[pos] *= inv_sample_count;
-			}
-		}
-		else
-		{
-			for (int x = 0; x < width_; ++x)
-			{
-				const int pos = width_ * y + x;
-				scene.camera()->generate_ray(ray_, UMVec2d(x, y), (y == 0 && x == 0));
-				UMVec3d color = trace(ray_, scene, shader_param_);
-				dst_buffer[pos] = UMVec4d(color, 1.0);
-			}
-		}
-	}
+	const int width = width_;
+	const UMTileScheduler scheduler(parameter.thread_count(), parameter.tile_size());
+	std::unique_ptr<RenderState[]> state_list(new RenderState[scheduler.active_thread_count()]);
+	scheduler.run_tiles(width_, height_, [&](const UMTile& tile, int thread) {
+		render_tile(state_list[thread], scene, *camera, tile, width, sample_count, dst_buffer);
+	});
 	
 	return true;
 }
@@ -188,34 +230,33 @@ bool UMRayTracer::progress_render(const UMScene& scene, UMRenderParameter& param
 {
 	if (width_ == 0 || height_ == 0) return false;
 	if (!scene.camera()) return false;
-	
-	const int ystep = 10;
-	
+
+	const UMTileScheduler scheduler(parameter.thread_count(), parameter.tile_size());
+	const int tile_count = scheduler.tile_count(width_, height_);
+	// end
+	if (current_tile_ >= tile_count) { return false; }
+
 	const int sample_count = parameter.super_sampling_count().x * parameter.super_sampling_count().y;
-	const double inv_sample_count = 1.0 / sample_count;
+	UMImage::ImageBuffer& dst_buffer = parameter.mutable_output_image().mutable_list();
 
-	for (int& y = current_y_, rows = (y + ystep); y < rows; ++y)
-	{
-		// end
-		if (y == height_) { return false; }
-		
-		sampler_.generate_samples(sample_count * width_);
+	UMCameraPtr camera = scene.camera();
 
-		for (int x = 0; x < width_; ++x)
-		{
-			const int pos = width_ * y + x;
-			for (int s = 0; s < sample_count; ++s)
-			{
-				UMVec2d sample_point(sampler_.sample(s));
-				sample_point.x += x;
-				sample_point.y += y;
-				scene.camera()->generate_ray(ray_, sample_point, (y == 0 && x == 0 && s == 0));
-				UMVec3d color = trace(ray_, scene, shader_param_);
-				parameter.mutable_output_image().mutable_list()[pos] += UMVec4d(color, 1.0);
-			}
-			parameter.mutable_output_image().mutable_list()[pos] *= inv_sample_count;
-		}
-	}
+	// render batches of tiles on all threads until the time slice is used
+	const double start_time = current_seconds();
+	const int batch_size = 4 * scheduler.active_thread_count();
+	const int width = width_;
+	const int height = height_;
+	std::unique_ptr<RenderState[]> state_list(new RenderState[scheduler.active_thread_count()]);
+	do
+	{
+		const int first_tile = current_tile_;
+		const int count = std::min(batch_size, tile_count - first_tile);
+		scheduler.run(count, [&](int task, int thread) {
+			const UMTile tile = scheduler.tile(width, height, first_tile + task);
+			render_tile(state_list[thread], scene, *camera, tile, width, sample_count, dst_buffer);
+		});
+		current_tile_ += count;
+	} while (current_tile_ < tile_count && (current_seconds() - start_time) < time_slice_);
 	
 	return true;
 }
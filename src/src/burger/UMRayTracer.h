@@ -18,7 +18,6 @@
 #include "UMRay.h"
 #include "UMBvh.h"
 #include "UMShaderParameter.h"
-#include "UMRandomSampler.h"
 
 namespace burger
 {
@@ -37,9 +36,8 @@ class UMRayTracer : public UMRenderer
 	DISALLOW_COPY_AND_ASSIGN(UMRayTracer);
 public:
 	UMRayTracer() : 
-		current_x_(0),
-		current_y_(0),
-		ray_(UMVec3d(0, 0, 500), UMVec3d(0))
+		current_tile_(0),
+		time_slice_(0.05)
 	{}
 
 	~UMRayTracer() {}
@@ -49,10 +47,7 @@ public:
 	 * @note needs a context
 	 */
 	virtual bool init() {
-		current_x_ = 0;
-		current_y_ = 0;
-		ray_.set_origin( UMVec3d(0, 0, 500) );
-		ray_.set_direction( UMVec3d(0) );
+		current_tile_ = 0;
 		return true;
 	}
 
@@ -78,13 +73,21 @@ public:
 	 */
 	virtual bool progress_render(const UMScene& scene, UMRenderParameter& parameter);
 
+	/**
+	 * get seconds of a progress_render call.
+	 * a call returns after the batch of tiles which uses up this
+	 */
+	double time_slice() const { return time_slice_; }
+
+	/**
+	 * set seconds of a progress_render call
+	 */
+	void set_time_slice(double seconds) { time_slice_ = seconds; }
+
 private:
 	// for progress render
-	int current_x_;
-	int current_y_;
-	UMRay ray_;
-	UMShaderParameter shader_param_;
-	UMRandomSampler sampler_;
+	int current_tile_;
+	double time_slice_;
 };
 
 } // burger
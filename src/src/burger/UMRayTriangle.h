@@ -0,0 +1,145 @@
+/**
+ * @file UMRayTriangle.h
+ * watertight ray triangle intersection
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <cmath>
+#include "UMMacro.h"
+#include "UMVector.h"
+#include "UMRay.h"
+
+namespace burger
+{
+
+/**
+ * a ray transformed for watertight ray triangle intersection.
+ * the dominant axis of the direction becomes z and the direction is sheared to (0, 0, 1).
+ * [Woop et al. 2013, Watertight Ray/Triangle Intersection]
+ * @param T float or double. precision of the triangle vertices
+ */
+template <class T>
+struct UMWatertightRay
+{
+	UMWatertightRay() : kx(0), ky(1), kz(2), sx(0), sy(0), sz(1) {}
+
+	explicit UMWatertightRay(const UMRay& ray) { init(ray); }
+
+	/**
+	 * precompute shear constants of the ray
+	 */
+	void init(const UMRay& ray)
+	{
+		const UMVec3d& dir = ray.direction();
+		kz = 0;
+		if (std::fabs(dir.y) > std::fabs(dir[kz])) kz = 1;
+		if (std::fabs(dir.z) > std::fabs(dir[kz])) kz = 2;
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		// keep winding of triangles
+		if (dir[kz] < 0)
+		{
+			const int k = kx;
+			kx = ky;
+			ky = k;
+		}
+		sx = static_cast<T>(dir[kx] / dir[kz]);
+		sy = static_cast<T>(dir[ky] / dir[kz]);
+		sz = static_cast<T>(1.0 / dir[kz]);
+		origin = UMVector3<T>(
+			static_cast<T>(ray.origin().x),
+			static_cast<T>(ray.origin().y),
+			static_cast<T>(ray.origin().z));
+	}
+
+	/// origin in the precision of the vertices
+	UMVector3<T> origin;
+	/// axes of the sheared space
+	int kx;
+	int ky;
+	int kz;
+	/// shear constants
+	T sx;
+	T sy;
+	T sz;
+};
+
+/**
+ * watertight ray triangle intersection.
+ * rays through shared edges and vertices hit one of the neighbor triangles at least.
+ * only front faces (counterclockwise seen from the ray) are hit, same as UMTriangle.
+ * edge functions on the border are recomputed in double precision.
+ * @param [in] ray precomputed ray
+ * @param [in] a first vertex
+ * @param [in] b second vertex
+ * @param [in] c third vertex
+ * @param [in] tmin minimum distance
+ * @param [in] tmax maximum distance
+ * @param [out] distance distance to the hit
+ * @param [out] v barycentric coordinate of the second vertex
+ * @param [out] w barycentric coordinate of the third vertex
+ * @retval hit or not
+ */
+template <class T>
+inline bool um_intersect_triangle(
+	const UMWatertightRay<T>& ray,
+	const UMVector3<T>& a,
+	const UMVector3<T>& b,
+	const UMVector3<T>& c,
+	double tmin,
+	double tmax,
+	double& distance,
+	double& v,
+	double& w)
+{
+	const UMVector3<T> oa = a - ray.origin;
+	const UMVector3<T> ob = b - ray.origin;
+	const UMVector3<T> oc = c - ray.origin;
+
+	// shear and scale vertices
+	const T ax = oa[ray.kx] - ray.sx * oa[ray.kz];
+	const T ay = oa[ray.ky] - ray.sy * oa[ray.kz];
+	const T bx = ob[ray.kx] - ray.sx * ob[ray.kz];
+	const T by = ob[ray.ky] - ray.sy * ob[ray.kz];
+	const T cx = oc[ray.kx] - ray.sx * oc[ray.kz];
+	const T cy = oc[ray.ky] - ray.sy * oc[ray.kz];
+
+	// edge functions
+	T eu = cx * by - cy * bx;
+	T ev = ax * cy - ay * cx;
+	T ew = bx * ay - by * ax;
+	if (eu == 0 || ev == 0 || ew == 0)
+	{
+		eu = static_cast<T>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+		ev = static_cast<T>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+		ew = static_cast<T>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+	}
+	// outside or back face
+	if (eu < 0 || ev < 0 || ew < 0) return false;
+	const T det = eu + ev + ew;
+	if (det == 0) return false;
+
+	const T az = ray.sz * oa[ray.kz];
+	const T bz = ray.sz * ob[ray.kz];
+	const T cz = ray.sz * oc[ray.kz];
+	const T t = eu * az + ev * bz + ew * cz;
+	if (t < 0) return false;
+
+	const double inv_det = 1.0 / static_cast<double>(det);
+	const double hit_distance = static_cast<double>(t) * inv_det;
+	if (hit_distance < tmin) return false;
+	if (hit_distance > tmax) return false;
+
+	distance = hit_distance;
+	v = static_cast<double>(ev) * inv_det;
+	w = static_cast<double>(ew) * inv_det;
+	return true;
+}
+
+} // burger
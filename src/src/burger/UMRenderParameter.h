@@ -27,7 +27,12 @@ class UMRenderParameter
 public:
 	UMRenderParameter() 
 		: super_sampling_count_(2, 2),
-		sample_count_(1024)
+		sample_count_(1024),
+		thread_count_(0),
+		tile_size_(16),
+		adaptive_error_(0.0),
+		adaptive_min_sample_count_(16),
+		adaptive_max_sample_scale_(4)
 	{}
 
 	~UMRenderParameter() {}
@@ -42,21 +47,96 @@ public:
 	 */
 	UMImage&  mutable_output_image() { return output_image_; } 
 
+	/**
+	 * get convergence map written by adaptive sampling.
+	 * x: relative error, y: sample count / max sample count, z: 1 if converged
+	 */
+	const UMImage& convergence_image() const { return convergence_image_; }
+
+	/**
+	 * get convergence map written by adaptive sampling
+	 */
+	UMImage& mutable_convergence_image() { return convergence_image_; }
+
 	/** 
 	 * get sample count par pixel
 	 */
 	int sample_count() const { return sample_count_; }
 
+	/**
+	 * set sample count par pixel
+	 */
+	void set_sample_count(int count) { sample_count_ = count; }
+
 	/**
 	 * get super sampling
 	 */
 	UMVec2i super_sampling_count() const { return super_sampling_count_; }
+
+	/**
+	 * get rendering thread count. 0 means all hardware threads
+	 */
+	int thread_count() const { return thread_count_; }
+
+	/**
+	 * set rendering thread count. 0 means all hardware threads
+	 */
+	void set_thread_count(int count) { thread_count_ = count; }
+
+	/**
+	 * get width and height of tiles rendered by a thread at once
+	 */
+	int tile_size() const { return tile_size_; }
+
+	/**
+	 * set width and height of tiles rendered by a thread at once
+	 */
+	void set_tile_size(int size) { tile_size_ = size; }
+
+	/**
+	 * get target relative error of adaptive sampling.
+	 * pixels of which standard error of the mean is less than this stop sampling.
+	 * 0 means sampling all pixels uniformly
+	 */
+	double adaptive_error() const { return adaptive_error_; }
+
+	/**
+	 * set target relative error of adaptive sampling. 0 means sampling all pixels uniformly
+	 */
+	void set_adaptive_error(double error) { adaptive_error_ = error; }
+
+	/**
+	 * get sample count of a pixel before its error is tested
+	 */
+	int adaptive_min_sample_count() const { return adaptive_min_sample_count_; }
+
+	/**
+	 * set sample count of a pixel before its error is tested
+	 */
+	void set_adaptive_min_sample_count(int count) { adaptive_min_sample_count_ = count; }
+
+	/**
+	 * get max sample count of a noisy pixel as a multiple of sample_count.
+	 * noisy pixels take the samples left by converged pixels up to this
+	 */
+	int adaptive_max_sample_scale() const { return adaptive_max_sample_scale_; }
+
+	/**
+	 * set max sample count of a noisy pixel as a multiple of sample_count
+	 */
+	void set_adaptive_max_sample_scale(int scale) { adaptive_max_sample_scale_ = scale; }
 	
 private:
 	UMImage output_image_;
 	UMImage temporary_image_;
+	UMImage convergence_image_;
 	int sample_count_;
 	UMVec2i super_sampling_count_;
+	int thread_count_;
+	int tile_size_;
+	double adaptive_error_;
+	int adaptive_min_sample_count_;
+	int adaptive_max_sample_scale_;
 };
 
 } // burger
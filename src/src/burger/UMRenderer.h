@@ -37,6 +37,7 @@ public:
 	enum RendererType {
 		eSimpleRayTracer,
 		ePathTracer,
+		eWavefrontPathTracer,
 		eDirectX11Renderer
 	};
 	
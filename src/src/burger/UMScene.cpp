@@ -17,6 +17,67 @@
 #include "UMSphere.h"
 #include "UMPlane.h"
 #include "UMBvh.h"
+#include "UMInstance.h"
+#include <sstream>
+#include <iomanip>
+
+namespace
+{
+	using namespace burger;
+
+	/// eBvhAuto selects eBvhFastBuild for scenes and meshes which have primitives more than this
+	const size_t fast_build_primitive_count = 1024 * 1024;
+
+	/**
+	 * count primitives. faces under instances are counted instead of instances
+	 */
+	size_t leaf_primitive_count(const UMPrimitiveList& primitive_list)
+	{
+		size_t count = 0;
+		UMPrimitiveList::const_iterator it = primitive_list.begin();
+		for (; it != primitive_list.end(); ++it)
+		{
+			const UMInstance* instance = dynamic_cast<const UMInstance*>(it->get());
+			if (!instance || !instance->bvh())
+			{
+				++count;
+			}
+			else if (UMMeshPtr mesh = instance->bvh()->mesh())
+			{
+				count += mesh->face_list().size();
+			}
+			else
+			{
+				count += instance->bvh()->ordered_primitives().size();
+			}
+		}
+		return count;
+	}
+
+	/**
+	 * set build method of a build mode
+	 * @param [in,out] bvh target bvh
+	 * @param [in] quality build mode. eBvhCustom keeps the method
+	 * @param [in] primitive_count primitive count by which eBvhAuto selects the mode
+	 */
+	void set_build_method(UMBvh& bvh, UMScene::BvhQuality quality, size_t primitive_count)
+	{
+		if (quality == UMScene::eBvhAuto)
+		{
+			quality = primitive_count >= fast_build_primitive_count ? UMScene::eBvhFastBuild : UMScene::eBvhHighQuality;
+		}
+		if (quality == UMScene::eBvhFastBuild)
+		{
+			bvh.set_build_method(UMBvh::eLinear);
+			bvh.set_treelet_optimization(true);
+		}
+		else if (quality == UMScene::eBvhHighQuality)
+		{
+			bvh.set_build_method(UMBvh::eBinnedSAH);
+		}
+	}
+
+} // anonymouse namespace
 
 namespace burger
 {
@@ -74,12 +135,15 @@ void UMScene::create_sample_scene_2()
 void UMScene::init(int width, int height)
 {
 	bvh_ = UMBvh::create();
+	bvh_quality_ = eBvhCustom;
 
 	width_ = width;
 	height_ = height;
 
 	primitive_list_.clear();
+	unbounded_primitive_list_.clear();
 	light_list_.clear();
+	mesh_bvh_map_.clear();
 	camera_ = UMCameraPtr(new UMCamera(width, height));
 }
 
@@ -92,6 +156,104 @@ bool UMScene::update_bvh()
 	return bvh_->build(*this);
 }
 
+/** 
+ * update bvh by a build mode
+ */
+bool UMScene::update_bvh(BvhQuality quality)
+{
+	if (!bvh_) return false;
+	bvh_quality_ = quality;
+	set_build_method(*bvh_, quality, leaf_primitive_count(primitive_list_));
+
+	// bottom level bvhs hold most of faces. rebuild ones built by another mode
+	MeshBvhMap::iterator it = mesh_bvh_map_.begin();
+	for (; it != mesh_bvh_map_.end(); ++it)
+	{
+		UMBvh& mesh_bvh = *it->second;
+		const UMBvh::BuildMethod method = mesh_bvh.build_method();
+		const bool treelet_optimization = mesh_bvh.treelet_optimization();
+		set_build_method(mesh_bvh, quality, it->first->face_list().size());
+		if (mesh_bvh.build_method() != method || mesh_bvh.treelet_optimization() != treelet_optimization)
+		{
+			if (!build_mesh_bvh(it->first, mesh_bvh)) return false;
+		}
+	}
+	return update_bvh();
+}
+
+/** 
+ * refit bvh
+ */
+bool UMScene::refit_bvh()
+{
+	if (!bvh_) return false;
+	return bvh_->refit();
+}
+
+/**
+ * get bottom level bvh of a mesh
+ */
+UMBvhPtr UMScene::mesh_bvh(UMMeshPtr mesh)
+{
+	if (!mesh) return UMBvhPtr();
+	MeshBvhMap::iterator it = mesh_bvh_map_.find(mesh);
+	if (it != mesh_bvh_map_.end()) return it->second;
+
+	UMBvhPtr bvh = UMBvh::create();
+	if (!build_mesh_bvh(mesh, *bvh)) return UMBvhPtr();
+	mesh_bvh_map_[mesh] = bvh;
+	return bvh;
+}
+
+/**
+ * build bottom level bvh of a mesh
+ */
+bool UMScene::build_mesh_bvh(UMMeshPtr mesh, UMBvh& bvh) const
+{
+	// faces are referred by index. no triangle is created per face.
+	const int face_count = static_cast<int>(mesh->face_list().size());
+	if (bvh_)
+	{
+		bvh.set_build_settings(*bvh_);
+	}
+	set_build_method(bvh, bvh_quality_, mesh->face_list().size());
+	if (bvh_cache_directory_.empty())
+	{
+		return bvh.build(mesh);
+	}
+	unsigned long long key = UMBvh::hash(&face_count, sizeof(face_count));
+	if (mesh->is_float_storage())
+	{
+		for (int k = 0; k < 3 && mesh->vertex_count() > 0; ++k)
+		{
+			key = UMBvh::hash(&mesh->float_storage().position[k][0], sizeof(float) * mesh->vertex_count(), key);
+		}
+	}
+	else if (!mesh->vertex_list().empty())
+	{
+		key = UMBvh::hash(&mesh->vertex_list()[0], sizeof(UMVec3d) * mesh->vertex_list().size(), key);
+	}
+	if (face_count > 0)
+	{
+		key = UMBvh::hash(&mesh->face_list()[0], sizeof(UMVec3i) * face_count, key);
+	}
+	std::stringstream path;
+	path << bvh_cache_directory_ << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+	return bvh.build(mesh, path.str(), key);
+}
+
+/**
+ * add an instance of a mesh
+ */
+UMInstancePtr UMScene::add_mesh_instance(UMMeshPtr mesh, const UMMat44d& transform)
+{
+	UMBvhPtr bvh = mesh_bvh(mesh);
+	if (!bvh) return UMInstancePtr();
+	UMInstancePtr instance(std::make_shared<UMInstance>(bvh, transform));
+	primitive_list_.push_back(instance);
+	return instance;
+}
+
 /**
  * connect listener to all event on scene
  */
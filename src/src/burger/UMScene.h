@@ -12,7 +12,10 @@
 
 #include <memory>
 #include <vector>
+#include <map>
+#include <string>
 #include "UMVector.h"
+#include "UMMath.h"
 #include "UMPrimitive.h"
 #include "UMCamera.h"
 #include "UMLight.h"
@@ -29,6 +32,9 @@ typedef std::weak_ptr<UMScene> UMSceneWeakPtr;
 class UMBvh;
 typedef std::shared_ptr<UMBvh> UMBvhPtr;
 
+class UMInstance;
+typedef std::shared_ptr<UMInstance> UMInstancePtr;
+
 /**
  * 3D scene including many objects, lights, cameras, ...
  */
@@ -37,6 +43,16 @@ class UMScene
 	DISALLOW_COPY_AND_ASSIGN(UMScene);
 
 public:
+	/**
+	 * bvh build modes of update_bvh
+	 */
+	enum BvhQuality {
+		eBvhAuto, // eBvhFastBuild for large scenes and meshes, else eBvhHighQuality
+		eBvhFastBuild, // linear bvh with treelet optimization
+		eBvhHighQuality, // binned SAH
+		eBvhCustom // build settings of bvh() as they are
+	};
+
 	UMScene() { init(1280, 720); }
 	UMScene(int width, int height) { init(width, height); }
 	~UMScene() {}
@@ -79,6 +95,18 @@ public:
 	 */
 	UMPrimitiveList& mutable_primitive_list() { return primitive_list_; }
 	
+	/**
+	 * get unbounded primitive list.
+	 * primitives which have no finite box, such as planes, are moved here by update_bvh
+	 * and tested alongside the bvh.
+	 */
+	const UMPrimitiveList& unbounded_primitive_list() const { return unbounded_primitive_list_; }
+
+	/**
+	 * get unbounded primitive list
+	 */
+	UMPrimitiveList& mutable_unbounded_primitive_list() { return unbounded_primitive_list_; }
+	
 	/**
 	 * get mesh group list
 	 */
@@ -114,22 +142,86 @@ public:
 	 */
 	bool update_bvh();
 
+	/**
+	 * update bvh by a build mode.
+	 * eBvhAuto counts faces under instances. bottom level bvhs built by another mode are rebuilt,
+	 * and bvhs of meshes created after this use the same mode.
+	 * @param [in] quality build mode
+	 */
+	bool update_bvh(BvhQuality quality);
+
+	/**
+	 * get build mode of bottom level bvhs
+	 */
+	BvhQuality bvh_quality() const { return bvh_quality_; }
+
+	/**
+	 * set build mode of bottom level bvhs created after this.
+	 * eBvhAuto selects the mode of each mesh by its face count.
+	 * @param [in] quality build mode
+	 */
+	void set_bvh_quality(BvhQuality quality) { bvh_quality_ = quality; }
+
+	/**
+	 * refit bvh to moved primitives
+	 */
+	bool refit_bvh();
+
+	/**
+	 * get bottom level bvh of a mesh.
+	 * it is built once by the settings of bvh() and bvh_quality(), and shared by all instances of the mesh.
+	 * @param [in] mesh a mesh
+	 * @retval bvh of faces of the mesh referred by index. empty if failed
+	 */
+	UMBvhPtr mesh_bvh(UMMeshPtr mesh);
+
+	/**
+	 * get bvh cache directory
+	 */
+	const std::string& bvh_cache_directory() const { return bvh_cache_directory_; }
+
+	/**
+	 * set bvh cache directory.
+	 * bottom level bvhs of meshes are loaded from or saved to this directory
+	 * keyed by the hash of mesh geometry and build settings.
+	 * @param [in] directory existing directory. empty disables the cache
+	 */
+	void set_bvh_cache_directory(const std::string& directory) { bvh_cache_directory_ = directory; }
+
+	/**
+	 * add an instance of a mesh to primitive list
+	 * @param [in] mesh a mesh
+	 * @param [in] transform object to world transform
+	 * @retval added instance. empty if failed
+	 */
+	UMInstancePtr add_mesh_instance(UMMeshPtr mesh, const UMMat44d& transform);
+
 	/**
 	 * connect listener to all event on scene
 	 */
 	void connect_to_all_events(UMListenerPtr listener);
 
 private:
+	/**
+	 * build bottom level bvh of a mesh by the settings of the scene bvh and bvh_quality_
+	 */
+	bool build_mesh_bvh(UMMeshPtr mesh, UMBvh& bvh) const;
 
 	int width_;
 	int height_;
 
 	UMCameraPtr camera_;
 	UMPrimitiveList primitive_list_;
+	UMPrimitiveList unbounded_primitive_list_;
 	UMLightList light_list_;
 
 	UMMeshGroupList mesh_group_list_;
 	UMBvhPtr bvh_;
+	BvhQuality bvh_quality_;
+
+	typedef std::map<UMMeshPtr, UMBvhPtr> MeshBvhMap;
+	MeshBvhMap mesh_bvh_map_;
+	std::string bvh_cache_directory_;
 };
 
 } // burger
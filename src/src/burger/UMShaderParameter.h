@@ -17,18 +17,19 @@ namespace burger
 {
 
 /**
- * shading parameters
+ * shading parameters.
+ * holds no reference counted pointers, so copying this costs no atomic operations.
  */
 class UMShaderParameter
 {
 public:
-	UMShaderParameter() : emissive(0), bounce(-1), depth(32), max_depth(32) {}
+	UMShaderParameter() : material(NULL), emissive(0), bounce(-1), depth(32), max_depth(32) {}
 	~UMShaderParameter() {}
 	
 	/**
-	 * material
+	 * material. owned by the mesh or the primitive which is hit.
 	 */
-	UMMaterialPtr material;
+	const UMMaterial* material;
 
 	/**
 	 * color
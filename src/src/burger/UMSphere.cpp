@@ -24,6 +24,17 @@ namespace burger
  * ray sphere intersection
  */
 bool UMSphere::intersects(const UMRay& ray, UMShaderParameter& parameter) const
+{
+	UMHit hit;
+	if (!intersects(ray, hit)) return false;
+	shade_hit(ray, hit, parameter);
+	return true;
+}
+
+/**
+ * ray sphere intersection without shading
+ */
+bool UMSphere::intersects(const UMRay& ray, UMHit& hit) const
 {
 	const UMVec3d& ray_dir = ray.direction();
 	const UMVec3d& ray_orig = ray.origin();
@@ -41,28 +52,34 @@ bool UMSphere::intersects(const UMRay& ray, UMShaderParameter& parameter) const
 
 	double e = sqrt(d);
 	double distance = (-b - e) / (2 * a);
-	if (distance > FLT_EPSILON) {
-		// hit
-		parameter.color = material_->diffuse().xyz();
-		parameter.emissive = material_->emissive().xyz() * material_->emissive_factor();
-		parameter.distance = distance;
-		parameter.intersect_point = ray_orig + ray_dir * distance;
-		parameter.normal = (parameter.intersect_point - center_) / radius_;
-		return true;
+	if (distance > ray.tmax()) {
+		// no reach
+		return false;
 	}
-
-	distance = (-b + e) / (2 * a);
-	if (distance > FLT_EPSILON) {
-		// hit
-		parameter.color = material_->diffuse().xyz();
-		parameter.emissive = material_->emissive().xyz() * material_->emissive_factor();
-		parameter.distance = distance;
-		parameter.intersect_point = ray_orig + ray_dir * distance;
-		parameter.normal = (parameter.intersect_point - center_) / radius_;
-		return true;
+	if (distance <= ray.tmin()) {
+		distance = (-b + e) / (2 * a);
+		if (distance <= ray.tmin() || distance > ray.tmax()) {
+			return false;
+		}
+	}
+	if (distance >= hit.distance) {
+		// not closer
+		return false;
 	}
+	hit.set(this, 0, distance, 0.0, 0.0);
+	return true;
+}
 
-	return false;
+/**
+ * set shading parameters of a hit
+ */
+void UMSphere::shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& parameter) const
+{
+	parameter.color = material_->diffuse().xyz();
+	parameter.emissive = material_->emissive().xyz() * material_->emissive_factor();
+	parameter.distance = hit.distance;
+	parameter.intersect_point = ray.origin() + ray.direction() * hit.distance;
+	parameter.normal = (parameter.intersect_point - center_) / radius_;
 }
 
 /**
@@ -86,13 +103,17 @@ bool UMSphere::intersects(const UMRay& ray) const
 
 	double e = sqrt(d);
 	double distance = (-b - e) / (2 * a);
-	if (distance > FLT_EPSILON) {
+	if (distance > ray.tmax()) {
+		// no reach
+		return false;
+	}
+	if (distance > ray.tmin()) {
 		// hit
 		return true;
 	}
 
 	distance = (-b + e) / (2 * a);
-	if (distance > FLT_EPSILON) {
+	if (distance > ray.tmin() && distance <= ray.tmax()) {
 		// hit
 		return true;
 	}
@@ -187,6 +208,7 @@ UMMeshPtr UMSphere::convert_to_mesh(int stacks, int slices) const
 	}
 	material_->set_polygon_count(static_cast<int>(mesh->face_list().size()));
 	mesh->mutable_material_list().push_back(material_);
+	mesh->create_material_index_list();
 	mesh->create_normals(true);
 	mesh->update_box();
 	return mesh;
@@ -94,6 +94,21 @@ public:
 	 * @retval bool intersected or not
 	 */
 	virtual bool intersects(const UMRay& ray) const;
+
+	/**
+	 * ray sphere intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const;
+
+	/**
+	 * set shading parameters of a hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const;
 	
 	/**
 	 * get box
@@ -0,0 +1,201 @@
+/**
+ * @file UMTileScheduler.cpp
+ * parallel scheduler of image tiles
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMTileScheduler.h"
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+	using namespace burger;
+
+#ifdef _OPENMP
+	/**
+	 * tasks [head, tail) owned by a thread.
+	 * the owner takes the head, thieves take the back half.
+	 */
+	struct TaskQueue
+	{
+		omp_lock_t lock;
+		int head;
+		int tail;
+		// keep queues of threads on separate cache lines
+		char padding[64];
+	};
+
+	/**
+	 * take a task from the head of own queue
+	 */
+	bool pop_task(TaskQueue& queue, int& task)
+	{
+		bool found = false;
+		omp_set_lock(&queue.lock);
+		if (queue.head < queue.tail)
+		{
+			task = queue.head++;
+			found = true;
+		}
+		omp_unset_lock(&queue.lock);
+		return found;
+	}
+
+	/**
+	 * move the back half of another queue to own queue
+	 * @retval false all queues are empty
+	 */
+	bool steal_tasks(std::vector<TaskQueue>& queue_list, int thread)
+	{
+		const int queue_count = static_cast<int>(queue_list.size());
+		for (int i = 1; i < queue_count; ++i)
+		{
+			TaskQueue& victim = queue_list[(thread + i) % queue_count];
+			omp_set_lock(&victim.lock);
+			const int remain = victim.tail - victim.head;
+			if (remain <= 0)
+			{
+				omp_unset_lock(&victim.lock);
+				continue;
+			}
+			const int count = (remain + 1) / 2;
+			const int start = victim.tail - count;
+			victim.tail = start;
+			omp_unset_lock(&victim.lock);
+
+			TaskQueue& queue = queue_list[thread];
+			omp_set_lock(&queue.lock);
+			queue.head = start;
+			queue.tail = start + count;
+			omp_unset_lock(&queue.lock);
+			return true;
+		}
+		return false;
+	}
+#endif // _OPENMP
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+/**
+ * get thread count used by run
+ */
+int UMTileScheduler::active_thread_count() const
+{
+	if (thread_count_ > 0) return thread_count_;
+	return hardware_thread_count();
+}
+
+/**
+ * get hardware thread count
+ */
+int UMTileScheduler::hardware_thread_count()
+{
+#ifdef _OPENMP
+	return omp_get_num_procs();
+#else
+	return 1;
+#endif
+}
+
+/**
+ * get tile count of an image
+ */
+int UMTileScheduler::tile_count(int width, int height) const
+{
+	if (width <= 0 || height <= 0) return 0;
+	const int size = std::max(tile_size_, 1);
+	const int x_count = (width + size - 1) / size;
+	const int y_count = (height + size - 1) / size;
+	return x_count * y_count;
+}
+
+/**
+ * get a tile of an image
+ */
+UMTile UMTileScheduler::tile(int width, int height, int index) const
+{
+	const int size = std::max(tile_size_, 1);
+	const int x_count = (width + size - 1) / size;
+	UMTile tile;
+	tile.index = index;
+	tile.x = (index % x_count) * size;
+	tile.y = (index / x_count) * size;
+	tile.width = std::min(size, width - tile.x);
+	tile.height = std::min(size, height - tile.y);
+	return tile;
+}
+
+/**
+ * run tasks and wait for all of them
+ */
+void UMTileScheduler::run(int task_count, const TaskFunction& function) const
+{
+	if (task_count <= 0) return;
+	const int thread_count = std::min(active_thread_count(), task_count);
+#ifdef _OPENMP
+	if (thread_count > 1)
+	{
+		// contiguous ranges keep neighbor tiles on the same thread
+		std::vector<TaskQueue> queue_list(thread_count);
+		for (int i = 0; i < thread_count; ++i)
+		{
+			TaskQueue& queue = queue_list[i];
+			omp_init_lock(&queue.lock);
+			queue.head = static_cast<int>(static_cast<long long>(task_count) * i / thread_count);
+			queue.tail = static_cast<int>(static_cast<long long>(task_count) * (i + 1) / thread_count);
+		}
+
+		// the runtime may give fewer threads. their queues are stolen.
+#pragma omp parallel num_threads(thread_count)
+		{
+			const int thread = omp_get_thread_num();
+			for (;;)
+			{
+				int task = 0;
+				if (pop_task(queue_list[thread], task))
+				{
+					function(task, thread);
+				}
+				else if (!steal_tasks(queue_list, thread))
+				{
+					break;
+				}
+			}
+		}
+
+		for (int i = 0; i < thread_count; ++i)
+		{
+			omp_destroy_lock(&queue_list[i].lock);
+		}
+		return;
+	}
+#endif // _OPENMP
+	for (int task = 0; task < task_count; ++task)
+	{
+		function(task, 0);
+	}
+}
+
+/**
+ * run all tiles of an image and wait for all of them
+ */
+void UMTileScheduler::run_tiles(int width, int height, const TileFunction& function) const
+{
+	const UMTileScheduler& scheduler = *this;
+	run(tile_count(width, height), [&](int task, int thread) {
+		function(scheduler.tile(width, height, task), thread);
+	});
+}
+
+} // burger
@@ -0,0 +1,128 @@
+/**
+ * @file UMTileScheduler.h
+ * parallel scheduler of image tiles
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <functional>
+#include "UMMacro.h"
+
+namespace burger
+{
+
+/**
+ * a rectangle of pixels
+ */
+struct UMTile
+{
+	/// index in the tile list
+	int index;
+	/// left top pixel
+	int x;
+	int y;
+	/// size in pixels. tiles on the right and bottom edges may be smaller.
+	int width;
+	int height;
+};
+
+/**
+ * runs tasks on all threads with work stealing.
+ * each thread owns a contiguous range of tasks and runs it from the front.
+ * a thread which runs out of tasks steals the back half of another range,
+ * so expensive tiles do not leave the other threads idle.
+ * threads are the OpenMP team, which the runtime keeps alive between runs.
+ */
+class UMTileScheduler
+{
+public:
+	/**
+	 * a task. called with the task index and the index of the thread running it.
+	 */
+	typedef std::function<void (int task, int thread)> TaskFunction;
+
+	/**
+	 * a tile task. called with the tile and the index of the thread running it.
+	 */
+	typedef std::function<void (const UMTile& tile, int thread)> TileFunction;
+
+	UMTileScheduler() :
+		thread_count_(0),
+		tile_size_(16)
+	{}
+
+	/**
+	 * @param [in] thread_count thread count. 0 means all hardware threads
+	 * @param [in] tile_size width and height of tiles in pixels
+	 */
+	UMTileScheduler(int thread_count, int tile_size) :
+		thread_count_(thread_count),
+		tile_size_(tile_size)
+	{}
+
+	~UMTileScheduler() {}
+
+	/**
+	 * get thread count. 0 means all hardware threads
+	 */
+	int thread_count() const { return thread_count_; }
+
+	/**
+	 * set thread count. 0 means all hardware threads
+	 */
+	void set_thread_count(int count) { thread_count_ = count; }
+
+	/**
+	 * get width and height of tiles in pixels
+	 */
+	int tile_size() const { return tile_size_; }
+
+	/**
+	 * set width and height of tiles in pixels
+	 */
+	void set_tile_size(int size) { tile_size_ = size; }
+
+	/**
+	 * get thread count used by run
+	 */
+	int active_thread_count() const;
+
+	/**
+	 * get hardware thread count
+	 */
+	static int hardware_thread_count();
+
+	/**
+	 * get tile count of an image
+	 */
+	int tile_count(int width, int height) const;
+
+	/**
+	 * get a tile of an image
+	 * @param [in] width image width
+	 * @param [in] height image height
+	 * @param [in] index tile index. tiles are in row major order
+	 */
+	UMTile tile(int width, int height, int index) const;
+
+	/**
+	 * run tasks [0, task_count) and wait for all of them
+	 */
+	void run(int task_count, const TaskFunction& function) const;
+
+	/**
+	 * run all tiles of an image and wait for all of them
+	 */
+	void run_tiles(int width, int height, const TileFunction& function) const;
+
+private:
+	int thread_count_;
+	int tile_size_;
+};
+
+} // burger
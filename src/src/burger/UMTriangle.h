@@ -81,6 +81,11 @@ public:
 		const UMVec3d& v3,
 		const UMRay& ray);
 
+	/**
+	 * get mesh
+	 */
+	UMMeshPtr mesh() const { return mesh_; }
+
 	/**
 	 * get index
 	 */
@@ -125,6 +130,40 @@ public:
 	 * @param [in] ray a ray
 	 */
 	virtual bool intersects(const UMRay& ray) const;
+
+	/**
+	 * ray triangle intersection without shading
+	 * @param [in] ray a ray
+	 * @param [in,out] hit the closest hit found so far
+	 */
+	virtual bool intersects(const UMRay& ray, UMHit& hit) const;
+
+	/**
+	 * set shading parameters of a hit
+	 * @param [in] ray the ray which found the hit
+	 * @param [in] hit the hit
+	 * @param [out] param shading parameters
+	 */
+	virtual void shade_hit(const UMRay& ray, const UMHit& hit, UMShaderParameter& param) const;
+
+	/**
+	 * set normal, material and color at barycentric coordinate
+	 * @param [in,out] parameter shading parameters which have uvw
+	 */
+	void interpolate(UMShaderParameter& parameter) const;
+
+	/**
+	 * set normal, material and color at barycentric coordinate of a mesh face
+	 * @param [in] mesh mesh
+	 * @param [in] vertex_index vertex indices of the face
+	 * @param [in] face_index face index
+	 * @param [in,out] parameter shading parameters which have uvw
+	 */
+	static void interpolate(
+		const UMMesh& mesh,
+		const UMVec3i& vertex_index,
+		int face_index,
+		UMShaderParameter& parameter);
 	
 	/**
 	 * get box
@@ -0,0 +1,466 @@
+/**
+ * @file UMWavefrontPathTracer.cpp
+ * a pathtracer which traces paths as streams of rays
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include "UMWavefrontPathTracer.h"
+#include "UMRenderParameter.h"
+#include "UMShaderParameter.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMScene.h"
+#include "UMVector.h"
+#include "UMMath.h"
+#include "UMTileScheduler.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+	using namespace burger;
+
+	const int minimum_path_depth = 2;
+
+	/// paths traced together by default
+	const int default_wavefront_size = 1 << 16;
+
+	/// paths of a packet in stages
+	const int packet_size = UMRayPacket::max_ray_count;
+
+	/// cells of origins per axis in sort key
+	const int origin_cell_bits = 4;
+
+	std::uniform_real_distribution<> random_range(0.0, 1.0);
+
+	UMVec4d map_one(UMVec4d src) {
+		double max = std::max(src.x, std::max(src.y, src.z));
+		if (max > 1.0) {
+			return src / max;
+		}
+		src.w = 1.0;
+		return src;
+	}
+
+	UMVec3d hemisphere(const UMVec3d& normal, std::mt19937& mt)
+	{
+		UMVec3d u, v, w;
+		w = normal;
+		if (fabs(w.x) > FLT_EPSILON) {
+			u = UMVec3d(0, 1, 0).cross(w).normalized();
+		} else {
+			u = UMVec3d(1, 0, 0).cross(w).normalized();
+		}
+		v = w.cross(u);
+		const double r1 = 2 * M_PI * random_range(mt);
+		const double r2 = random_range(mt);
+		const double r2s = sqrt(r2);
+		UMVec3d dir = (u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1.0 - r2)).normalized();
+		return dir;
+	}
+
+	/**
+	 * spread lower 4 bits to every third bit
+	 */
+	int expand_bits(int v)
+	{
+		int result = 0;
+		for (int i = 0; i < origin_cell_bits; ++i)
+		{
+			result |= ((v >> i) & 1) << (3 * i);
+		}
+		return result;
+	}
+
+	void intersect(UMRayPacket& packet, const UMScene& scene)
+	{
+		const UMPrimitiveList* lists[] = { &scene.primitive_list(), &scene.unbounded_primitive_list() };
+		for (int k = 0; k < 2; ++k)
+		{
+			UMPrimitiveList::const_iterator it = lists[k]->begin();
+			for (; it != lists[k]->end(); ++it)
+			{
+				(*it)->intersects(packet);
+			}
+		}
+	}
+
+} // anonymouse namespace
+
+namespace burger
+{
+
+UMWavefrontPathTracer::UMWavefrontPathTracer() :
+	wavefront_size_(default_wavefront_size),
+	current_sample_count_(0),
+	current_subpixel_x_(0),
+	current_subpixel_y_(0),
+	max_sample_count_(0),
+	sample_event_(std::make_shared<UMEvent>(eEventTypeRenderProgressSample))
+{
+	mutable_event_list().push_back(sample_event_);
+}
+
+/**
+ * render all samples
+ */
+bool UMWavefrontPathTracer::render(const UMScene& scene, UMRenderParameter& parameter)
+{
+	if (width_ == 0 || height_ == 0) return false;
+	if (!scene.camera()) return false;
+	init();
+	current_subpixel_x_ = 0;
+	current_subpixel_y_ = 0;
+	while (progress_render(scene, parameter)) {}
+	return true;
+}
+
+/**
+ * progressive render
+ */
+bool UMWavefrontPathTracer::progress_render(const UMScene& scene, UMRenderParameter& parameter)
+{
+	if (width_ == 0 || height_ == 0) return false;
+	if (!scene.camera()) return false;
+
+	const UMVec2i super_sampling = parameter.super_sampling_count();
+
+	// end
+	if (current_sample_count_ == max_sample_count_ &&
+		current_subpixel_x_ == (super_sampling.x-1) &&
+		current_subpixel_y_ == (super_sampling.y-1))
+	{
+		current_subpixel_x_ = 0;
+		current_subpixel_y_ = 0;
+		return false;
+	}
+	// start
+	if (current_sample_count_ == 0 &&
+		current_subpixel_x_ == 0 &&
+		current_subpixel_y_ == 0) {
+		// init temporary image
+		current_subpixel_x_ = 0;
+		current_subpixel_y_ = 0;
+		temporary_image_.init(width_, height_);
+		max_sample_count_ = parameter.sample_count() / (super_sampling.x * super_sampling.y);
+	}
+
+	bool is_end_subpixel =
+		(current_subpixel_x_ == (super_sampling.x-1) &&
+		 current_subpixel_y_ == (super_sampling.y-1));
+	if (is_end_subpixel)
+	{
+		++current_sample_count_;
+		current_subpixel_x_ = 0;
+		current_subpixel_y_ = 0;
+	}
+	else
+	{
+		if (current_subpixel_x_ == (super_sampling.x-1))
+		{
+			++current_subpixel_y_;
+			current_subpixel_x_ = 0;
+		}
+		else
+		{
+			++current_subpixel_x_;
+		}
+	}
+	const double inv_current_sample_count = 1.0 / current_sample_count_;
+	const double inv_super_sampling_x = 1.0 / (double)super_sampling.x;
+	const double inv_super_sampling_y = 1.0 / (double)super_sampling.y;
+	const UMVec2d subpixel(
+		current_subpixel_x_ * inv_super_sampling_x,
+		current_subpixel_y_ * inv_super_sampling_y);
+
+	std::random_device random_device;
+	seed_generator_.seed(random_device());
+	scheduler_.set_thread_count(parameter.thread_count());
+	scheduler_.set_tile_size(parameter.tile_size());
+
+	const int pixel_count = width_ * height_;
+	const int wavefront_size = std::max(wavefront_size_, packet_size);
+	for (int start = 0; start < pixel_count; start += wavefront_size)
+	{
+		trace_wavefront(scene, start, std::min(start + wavefront_size, pixel_count), subpixel);
+	}
+
+	if (is_end_subpixel)
+	{
+		UMImage::ImageBuffer& out_buffer = parameter.mutable_output_image().mutable_list();
+		const UMImage::ImageBuffer& current_buffer = temporary_image_.list();
+		for (int pos = 0; pos < pixel_count; ++pos)
+		{
+			out_buffer[pos] = map_one(current_buffer[pos]
+				* inv_current_sample_count
+				* inv_super_sampling_x
+				* inv_super_sampling_y);
+		}
+	}
+
+	UMAny sample_count(current_sample_count_);
+	sample_event_->set_parameter(sample_count);
+	sample_event_->notify();
+
+	return true;
+}
+
+/**
+ * trace camera rays of pixels until all paths end
+ */
+void UMWavefrontPathTracer::trace_wavefront(const UMScene& scene, int start_pixel, int end_pixel, const UMVec2d& subpixel)
+{
+	const int path_count = end_pixel - start_pixel;
+	const int max_depth = UMShaderParameter().max_depth;
+	path_list_.resize(path_count);
+	hit_list_.resize(path_count);
+	is_hit_list_.resize(path_count);
+	shadow_ray_list_.resize(path_count * scene.light_list().size());
+
+	// generate camera rays
+	const UMCameraPtr camera = scene.camera();
+	UMRay ray;
+	for (int i = 0; i < path_count; ++i)
+	{
+		Path& path = path_list_[i];
+		path.pixel = start_pixel + i;
+		path.depth = max_depth;
+		path.radiance = UMVec3d(0);
+		path.throughput = UMVec3d(1);
+		UMVec2d sample_point(path.pixel % width_, path.pixel / width_);
+		sample_point.x += subpixel.x;
+		sample_point.y += subpixel.y;
+		camera->generate_ray(ray, sample_point);
+		path.origin = ray.origin();
+		path.direction = ray.direction();
+	}
+
+	while (!path_list_.empty())
+	{
+		sort_paths();
+		extend_paths(scene);
+		shade_paths(scene);
+		connect_paths(scene);
+		compact_paths();
+	}
+}
+
+/**
+ * sort alive paths by direction octant and origin
+ */
+void UMWavefrontPathTracer::sort_paths()
+{
+	const int path_count = static_cast<int>(path_list_.size());
+	order_list_.resize(path_count);
+	key_list_.resize(path_count);
+
+	UMVec3d minimum(path_list_[0].origin);
+	UMVec3d maximum(path_list_[0].origin);
+	for (int i = 1; i < path_count; ++i)
+	{
+		const UMVec3d& origin = path_list_[i].origin;
+		minimum = UMVec3d(std::min(minimum.x, origin.x), std::min(minimum.y, origin.y), std::min(minimum.z, origin.z));
+		maximum = UMVec3d(std::max(maximum.x, origin.x), std::max(maximum.y, origin.y), std::max(maximum.z, origin.z));
+	}
+	const int cell_count = 1 << origin_cell_bits;
+	const UMVec3d extent = maximum - minimum;
+	const UMVec3d scale(
+		extent.x > 0 ? (cell_count - 1) / extent.x : 0,
+		extent.y > 0 ? (cell_count - 1) / extent.y : 0,
+		extent.z > 0 ? (cell_count - 1) / extent.z : 0);
+
+	// key is direction octant then morton code of origin cell
+	for (int i = 0; i < path_count; ++i)
+	{
+		const Path& path = path_list_[i];
+		const int octant =
+			(path.direction.x < 0 ? 1 : 0) |
+			(path.direction.y < 0 ? 2 : 0) |
+			(path.direction.z < 0 ? 4 : 0);
+		const UMVec3d cell = (path.origin - minimum).multiply(scale);
+		const int morton =
+			expand_bits(static_cast<int>(cell.x)) |
+			(expand_bits(static_cast<int>(cell.y)) << 1) |
+			(expand_bits(static_cast<int>(cell.z)) << 2);
+		key_list_[i] = (octant << (3 * origin_cell_bits)) | morton;
+	}
+
+	// counting sort
+	bucket_list_.assign((8 << (3 * origin_cell_bits)) + 1, 0);
+	for (int i = 0; i < path_count; ++i)
+	{
+		++bucket_list_[key_list_[i] + 1];
+	}
+	for (size_t i = 1; i < bucket_list_.size(); ++i)
+	{
+		bucket_list_[i] += bucket_list_[i - 1];
+	}
+	for (int i = 0; i < path_count; ++i)
+	{
+		order_list_[bucket_list_[key_list_[i]]++] = i;
+	}
+}
+
+/**
+ * trace next rays of sorted paths as packets
+ */
+void UMWavefrontPathTracer::extend_paths(const UMScene& scene)
+{
+	const int path_count = static_cast<int>(path_list_.size());
+	const int chunk_count = (path_count + packet_size - 1) / packet_size;
+
+	scheduler_.run(chunk_count, [&](int chunk, int /*thread*/) {
+		const int start = chunk * packet_size;
+		const int end = std::min(start + packet_size, path_count);
+		UMRayPacket packet;
+		for (int i = start; i < end; ++i)
+		{
+			const Path& path = path_list_[order_list_[i]];
+			// origins of bounce rays are offset from surfaces
+			const int ray_index = packet.add_ray(path.origin, path.direction);
+			packet.mutable_ray(ray_index).set_tmin(0.0);
+		}
+		intersect(packet, scene);
+		for (int i = start; i < end; ++i)
+		{
+			const int index = order_list_[i];
+			const int k = i - start;
+			is_hit_list_[index] = packet.is_hit(k) ? 1 : 0;
+			if (packet.is_hit(k))
+			{
+				packet.shade(k, hit_list_[index]);
+			}
+		}
+	});
+}
+
+/**
+ * add emission and create shadow rays and next rays from hits
+ */
+void UMWavefrontPathTracer::shade_paths(const UMScene& scene)
+{
+	const int path_count = static_cast<int>(path_list_.size());
+	const int chunk_count = (path_count + packet_size - 1) / packet_size;
+	const int light_count = static_cast<int>(scene.light_list().size());
+	const int max_depth = UMShaderParameter().max_depth;
+	seed_list_.resize(chunk_count);
+	std::generate(seed_list_.begin(), seed_list_.end(), std::ref(seed_generator_));
+
+	scheduler_.run(chunk_count, [&](int chunk, int /*thread*/) {
+		std::mt19937 mt(seed_list_[chunk]);
+		const int start = chunk * packet_size;
+		const int end = std::min(start + packet_size, path_count);
+		for (int i = start; i < end; ++i)
+		{
+			const int index = order_list_[i];
+			Path& path = path_list_[index];
+			for (int k = 0; k < light_count; ++k)
+			{
+				shadow_ray_list_[index * light_count + k].is_valid = false;
+			}
+			if (!is_hit_list_[index])
+			{
+				path.radiance += path.throughput.multiply(scene.background_color());
+				path.depth = -1;
+				continue;
+			}
+
+			const UMShaderParameter& parameter = hit_list_[index];
+			path.radiance += path.throughput.multiply(parameter.emissive);
+
+			// diffuse direct
+			const UMVec3d diffuse = path.throughput.multiply(parameter.color * M_PI_INV);
+			for (int k = 0; k < light_count; ++k)
+			{
+				const UMLightPtr& light = scene.light_list()[k];
+				UMVec3d intensity;
+				UMVec3d sample_point;
+				UMVec3d direction;
+				UMVec2d random_value(random_range(mt), random_range(mt));
+				if (light->sample(intensity, sample_point, direction, parameter, random_value))
+				{
+					ShadowRay& shadow_ray = shadow_ray_list_[index * light_count + k];
+					shadow_ray.direction = direction.normalized();
+					shadow_ray.origin = um_offset_ray_origin(parameter.intersect_point, parameter.normal, shadow_ray.direction);
+					shadow_ray.distance = (sample_point - shadow_ray.origin).length();
+					shadow_ray.contribution = diffuse.multiply(intensity);
+					shadow_ray.is_valid = true;
+				}
+			}
+
+			// diffuse indirect. the same roulette as UMPathTracer
+			if (!um_russian_roulette(parameter.color, max_depth - minimum_path_depth, random_range(mt), path.depth, path.throughput))
+			{
+				path.depth = -1;
+				continue;
+			}
+			path.direction = hemisphere(parameter.normal, mt);
+			path.origin = um_offset_ray_origin(parameter.intersect_point, parameter.normal, path.direction);
+		}
+	});
+}
+
+/**
+ * trace shadow rays toward each light as packets and add direct lighting
+ */
+void UMWavefrontPathTracer::connect_paths(const UMScene& scene)
+{
+	const int path_count = static_cast<int>(path_list_.size());
+	const int chunk_count = (path_count + packet_size - 1) / packet_size;
+	const int light_count = static_cast<int>(scene.light_list().size());
+
+	scheduler_.run(chunk_count, [&](int chunk, int /*thread*/) {
+		const int start = chunk * packet_size;
+		const int end = std::min(start + packet_size, path_count);
+		UMRayPacket packet(true);
+		int source_index[packet_size];
+		for (int k = 0; k < light_count; ++k)
+		{
+			packet.clear();
+			for (int i = start; i < end; ++i)
+			{
+				const int index = order_list_[i];
+				const ShadowRay& shadow_ray = shadow_ray_list_[index * light_count + k];
+				if (!shadow_ray.is_valid) continue;
+				const int ray_index = packet.add_ray(shadow_ray.origin, shadow_ray.direction);
+				packet.mutable_ray(ray_index).set_tmin(0.0);
+				packet.mutable_ray(ray_index).set_tmax(shadow_ray.distance);
+				source_index[ray_index] = index;
+			}
+			intersect(packet, scene);
+			for (int i = 0; i < packet.ray_count(); ++i)
+			{
+				if (packet.is_hit(i)) continue;
+				const int index = source_index[i];
+				path_list_[index].radiance += shadow_ray_list_[index * light_count + k].contribution;
+			}
+		}
+	});
+}
+
+/**
+ * add radiance of ended paths to pixels and remove them
+ */
+void UMWavefrontPathTracer::compact_paths()
+{
+	UMImage::ImageBuffer& buffer = temporary_image_.mutable_list();
+	size_t alive_count = 0;
+	for (size_t i = 0; i < path_list_.size(); ++i)
+	{
+		const Path& path = path_list_[i];
+		if (path.depth < 0)
+		{
+			buffer[path.pixel] += UMVec4d(path.radiance, 1.0);
+			continue;
+		}
+		path_list_[alive_count++] = path;
+	}
+	path_list_.resize(alive_count);
+}
+
+} // burger
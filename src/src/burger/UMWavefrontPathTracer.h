@@ -0,0 +1,178 @@
+/**
+ * @file UMWavefrontPathTracer.h
+ * a pathtracer which traces paths as streams of rays
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <random>
+#include "UMMacro.h"
+#include "UMRenderer.h"
+#include "UMVector.h"
+#include "UMShaderParameter.h"
+#include "UMImage.h"
+#include "UMEvent.h"
+#include "UMTileScheduler.h"
+
+namespace burger
+{
+
+class UMWavefrontPathTracer;
+typedef std::shared_ptr<UMWavefrontPathTracer> UMWavefrontPathTracerPtr;
+
+class UMScene;
+class UMRenderParameter;
+
+/**
+ * a pathtracer which traces paths of many pixels together.
+ * each bounce runs as separate stages over all paths of a wavefront:
+ * sort rays by direction octant and origin, trace them as packets,
+ * shade hits and sample lights, trace shadow rays as packets.
+ * shares the throughput based russian roulette of UMPathTracer (um_russian_roulette),
+ * so both produce the same estimate.
+ */
+class UMWavefrontPathTracer : public UMRenderer
+{
+	DISALLOW_COPY_AND_ASSIGN(UMWavefrontPathTracer);
+public:
+	UMWavefrontPathTracer();
+
+	~UMWavefrontPathTracer() {}
+
+	/**
+	 * initialize
+	 */
+	virtual bool init() {
+		current_sample_count_ = 0;
+		return true;
+	}
+
+	/**
+	 * get renderer type
+	 */
+	virtual RendererType type() const { return eWavefrontPathTracer; }
+
+	/**
+	 * render all samples
+	 * @param [in] scene target scene
+	 * @param [in,out] parameter parameters for rendering
+	 * @retval success or failed
+	 */
+	virtual bool render(const UMScene& scene, UMRenderParameter& parameter);
+
+	/**
+	 * progressive render
+	 * @param [in] scene target scene
+	 * @param [in,out] parameter parameters for rendering
+	 * @retval true still render
+	 * @retval false render finished or failed
+	 */
+	virtual bool progress_render(const UMScene& scene, UMRenderParameter& parameter);
+
+	/**
+	 * get max path count traced together
+	 */
+	int wavefront_size() const { return wavefront_size_; }
+
+	/**
+	 * set max path count traced together. memory is proportional to this.
+	 */
+	void set_wavefront_size(int size) { wavefront_size_ = size; }
+
+private:
+	/**
+	 * state of a path
+	 */
+	struct Path
+	{
+		/// target pixel
+		int pixel;
+		/// remaining depth
+		int depth;
+		/// radiance gathered so far
+		UMVec3d radiance;
+		/// weight of the next hit
+		UMVec3d throughput;
+		/// next ray
+		UMVec3d origin;
+		UMVec3d direction;
+	};
+
+	/**
+	 * a shadow ray toward a light sample
+	 */
+	struct ShadowRay
+	{
+		UMVec3d origin;
+		UMVec3d direction;
+		double distance;
+		/// radiance added to the path if not occluded
+		UMVec3d contribution;
+		bool is_valid;
+	};
+
+	/**
+	 * trace camera rays of pixels [start_pixel, end_pixel) until all paths end
+	 * @param [in] scene target scene
+	 * @param [in] start_pixel first pixel
+	 * @param [in] end_pixel last pixel + 1
+	 * @param [in] subpixel position of camera rays in pixels
+	 */
+	void trace_wavefront(const UMScene& scene, int start_pixel, int end_pixel, const UMVec2d& subpixel);
+
+	/**
+	 * sort alive paths by direction octant and origin
+	 */
+	void sort_paths();
+
+	/**
+	 * trace next rays of sorted paths
+	 */
+	void extend_paths(const UMScene& scene);
+
+	/**
+	 * add emission and create shadow rays and next rays from hits
+	 */
+	void shade_paths(const UMScene& scene);
+
+	/**
+	 * trace shadow rays and add direct lighting
+	 */
+	void connect_paths(const UMScene& scene);
+
+	/**
+	 * remove ended paths
+	 */
+	void compact_paths();
+
+	int wavefront_size_;
+	UMTileScheduler scheduler_;
+
+	// for progress render
+	int current_sample_count_;
+	int current_subpixel_x_;
+	int current_subpixel_y_;
+	int max_sample_count_;
+	UMImage temporary_image_;
+	UMEventPtr sample_event_;
+
+	// wavefront
+	std::vector<Path> path_list_;
+	std::vector<int> order_list_;
+	std::vector<int> key_list_;
+	std::vector<int> bucket_list_;
+	std::vector<UMShaderParameter> hit_list_;
+	std::vector<char> is_hit_list_;
+	std::vector<ShadowRay> shadow_ray_list_;
+	std::vector<unsigned int> seed_list_;
+	std::mt19937 seed_generator_;
+};
+
+} // burger
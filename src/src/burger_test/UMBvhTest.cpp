@@ -0,0 +1,889 @@
+/**
+ * @file UMBvhTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <ctime>
+#include <sstream>
+#include <limits>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMBvhQuad.h"
+#include "UMBvhOct.h"
+#include "UMBvhCompressed.h"
+#include "UMMesh.h"
+#include "UMMaterial.h"
+#include "UMTriangle.h"
+#include "UMSphere.h"
+#include "UMPlane.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMShaderParameter.h"
+#include "UMTestScene.h"
+
+#define TEST_EPSILON 0.0001
+
+BOOST_AUTO_TEST_SUITE(UMBvhTest)
+
+using namespace burger;
+using namespace burger::test;
+
+namespace
+{
+	/**
+	 * long thin triangles like walls of architectural scenes, and small ones
+	 */
+	UMMeshPtr create_thin_mesh(int triangle_count)
+	{
+		std::mt19937 mt(3);
+		std::uniform_real_distribution<double> position(-100.0, 100.0);
+		std::uniform_real_distribution<double> offset(-0.5, 0.5);
+
+		UMMeshPtr mesh(std::make_shared<UMMesh>());
+		for (int i = 0; i < triangle_count; ++i)
+		{
+			const UMVec3d a(position(mt), position(mt), position(mt));
+			UMVec3d b(position(mt), position(mt), position(mt));
+			if (i % 2)
+			{
+				b = a + (b - a) * 0.05;
+			}
+			mesh->mutable_vertex_list().push_back(a);
+			mesh->mutable_vertex_list().push_back(b);
+			mesh->mutable_vertex_list().push_back(b + UMVec3d(offset(mt), offset(mt), offset(mt)));
+			mesh->mutable_face_list().push_back(UMVec3i(3 * i, 3 * i + 1, 3 * i + 2));
+		}
+		UMMaterialPtr material = UMMaterial::default_material();
+		material->set_polygon_count(triangle_count);
+		mesh->mutable_material_list().push_back(material);
+		mesh->create_normals(true);
+		mesh->update_box();
+		return mesh;
+	}
+
+	/**
+	 * random ray
+	 */
+	void create_random_ray(UMRay& ray, std::mt19937& mt)
+	{
+		std::uniform_real_distribution<double> position(-150.0, 150.0);
+		std::uniform_real_distribution<double> direction(-1.0, 1.0);
+		ray.set_origin(UMVec3d(position(mt), position(mt), position(mt)));
+		ray.set_direction(UMVec3d(direction(mt), direction(mt), direction(mt)).normalized());
+	}
+
+	/**
+	 * closest hit by testing all primitives
+	 */
+	bool intersects_all(const UMPrimitiveList& primitives, const UMRay& ray, double& distance)
+	{
+		bool hit = false;
+		distance = (std::numeric_limits<double>::max)();
+		UMShaderParameter parameter;
+		for (size_t i = 0; i < primitives.size(); ++i)
+		{
+			if (primitives[i]->intersects(ray, parameter) && parameter.distance < distance)
+			{
+				distance = parameter.distance;
+				hit = true;
+			}
+		}
+		return hit;
+	}
+
+	/**
+	 * check bvh against testing all primitives
+	 */
+	void check_intersection(const UMBvh& bvh, const UMPrimitiveList& primitives)
+	{
+		std::mt19937 mt(5);
+		for (int i = 0; i < 500; ++i)
+		{
+			UMRay ray;
+			create_random_ray(ray, mt);
+			double distance = 0.0;
+			const bool hit = intersects_all(primitives, ray, distance);
+
+			UMShaderParameter parameter;
+			BOOST_CHECK_EQUAL(hit, bvh.intersects(ray, parameter));
+			if (hit)
+			{
+				BOOST_CHECK_CLOSE(distance, parameter.distance, TEST_EPSILON);
+			}
+			BOOST_CHECK_EQUAL(hit, bvh.intersects(ray));
+		}
+	}
+
+	/**
+	 * 8x8 rays from an origin toward a small region, like camera rays of a tile
+	 */
+	void create_coherent_packet(UMRayPacket& packet, std::mt19937& mt)
+	{
+		std::uniform_real_distribution<double> position(-150.0, 150.0);
+		std::uniform_real_distribution<double> target(-100.0, 100.0);
+		const UMVec3d origin(position(mt), position(mt), position(mt));
+		const UMVec3d center(target(mt), target(mt), target(mt));
+		packet.clear();
+		for (int y = 0; y < 8; ++y)
+		{
+			for (int x = 0; x < 8; ++x)
+			{
+				const UMVec3d point = center + UMVec3d(x - 3.5, y - 3.5, 0.0) * 0.5;
+				packet.add_ray(origin, (point - origin).normalized());
+			}
+		}
+	}
+
+	/**
+	 * check packet intersection against single rays
+	 */
+	void check_packet(const UMBvh& bvh, UMRayPacket& packet)
+	{
+		bvh.intersects(packet);
+		for (int i = 0; i < packet.ray_count(); ++i)
+		{
+			const UMRay& ray = packet.ray(i);
+			if (packet.is_shadow())
+			{
+				BOOST_CHECK_EQUAL(bvh.intersects(ray), packet.is_hit(i));
+				continue;
+			}
+			UMShaderParameter parameter;
+			const bool hit = bvh.intersects(ray, parameter);
+			BOOST_CHECK_EQUAL(hit, packet.is_hit(i));
+			if (hit && packet.is_hit(i))
+			{
+				UMShaderParameter packet_parameter;
+				packet.shade(i, packet_parameter);
+				BOOST_CHECK_CLOSE(parameter.distance, packet.hit(i).distance, TEST_EPSILON);
+				BOOST_CHECK_CLOSE(parameter.distance, packet_parameter.distance, TEST_EPSILON);
+				BOOST_CHECK_SMALL((parameter.normal - packet_parameter.normal).length(), TEST_EPSILON);
+				BOOST_CHECK_SMALL((parameter.intersect_point - packet_parameter.intersect_point).length(), TEST_EPSILON);
+			}
+		}
+	}
+
+	/**
+	 * check bvh of a node layout
+	 */
+	void check_layout(UMBvh::BuildMethod method, UMBvh::NodeLayout layout)
+	{
+		UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+		UMScene scene;
+		fill_scene(scene, mesh);
+		const UMPrimitiveList primitives = scene.primitive_list();
+
+		UMBvhPtr bvh = scene.bvh();
+		bvh->set_build_method(method);
+		bvh->set_node_layout(layout);
+		BOOST_REQUIRE(scene.update_bvh());
+		BOOST_CHECK_EQUAL(1u, scene.primitive_list().size());
+		if (layout == UMBvh::eOctNode)
+		{
+			// falls back to 4-wide without AVX
+			BOOST_CHECK_EQUAL(UMBvhOct::is_supported(), static_cast<bool>(bvh->oct()));
+			BOOST_CHECK_EQUAL(!UMBvhOct::is_supported(), static_cast<bool>(bvh->quad()));
+		}
+		else
+		{
+			BOOST_CHECK_EQUAL(layout == UMBvh::eQuadNode, static_cast<bool>(bvh->quad()));
+			BOOST_CHECK(!bvh->oct());
+		}
+		BOOST_CHECK_EQUAL(layout == UMBvh::eCompressedNode, static_cast<bool>(bvh->compressed8()));
+		BOOST_CHECK_EQUAL(layout == UMBvh::eCompressedNode16, static_cast<bool>(bvh->compressed16()));
+		check_intersection(*bvh, primitives);
+	}
+
+	/**
+	 * move all vertices of the mesh
+	 */
+	void move_vertices(UMMeshPtr mesh, double amount, unsigned int seed)
+	{
+		std::mt19937 mt(seed);
+		std::uniform_real_distribution<double> offset(-amount, amount);
+		const int vertex_count = static_cast<int>(mesh->vertex_list().size());
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			mesh->mutable_vertex_list().at(i) += UMVec3d(offset(mt), offset(mt), offset(mt));
+		}
+	}
+
+	/**
+	 * traversal steps of random rays
+	 */
+	UMBvhTraversalCount count_traversal(const UMBvh& bvh, int ray_count)
+	{
+		std::mt19937 mt(7);
+		UMBvhTraversalCount count;
+		for (int i = 0; i < ray_count; ++i)
+		{
+			UMRay ray;
+			create_random_ray(ray, mt);
+			UMShaderParameter parameter;
+			bvh.intersects(ray, parameter, count);
+		}
+		return count;
+	}
+
+	/**
+	 * seconds for tracing rays
+	 */
+	double trace_seconds(const UMBvh& bvh, int ray_count)
+	{
+		std::mt19937 mt(7);
+		const std::clock_t start = std::clock();
+		for (int i = 0; i < ray_count; ++i)
+		{
+			UMRay ray;
+			create_random_ray(ray, mt);
+			UMShaderParameter parameter;
+			bvh.intersects(ray, parameter);
+		}
+		return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+	}
+
+} // anonymouse namespace
+
+BOOST_AUTO_TEST_CASE(BinnedSAHTest)
+{
+	check_layout(UMBvh::eBinnedSAH, UMBvh::eBinaryNode);
+}
+
+BOOST_AUTO_TEST_CASE(MiddleSplitTest)
+{
+	check_layout(UMBvh::eMiddleSplit, UMBvh::eBinaryNode);
+}
+
+BOOST_AUTO_TEST_CASE(QuadNodeTest)
+{
+	check_layout(UMBvh::eBinnedSAH, UMBvh::eQuadNode);
+	check_layout(UMBvh::eMiddleSplit, UMBvh::eQuadNode);
+}
+
+BOOST_AUTO_TEST_CASE(OctNodeTest)
+{
+	check_layout(UMBvh::eBinnedSAH, UMBvh::eOctNode);
+	check_layout(UMBvh::eMiddleSplit, UMBvh::eOctNode);
+
+	// lane test of float leaves gives the same hits as binary float leaves
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMScene binary_scene;
+	fill_scene(binary_scene, mesh);
+	binary_scene.bvh()->set_leaf_precision(eFloatLeaf);
+	BOOST_REQUIRE(binary_scene.update_bvh());
+	UMScene oct_scene;
+	fill_scene(oct_scene, mesh);
+	oct_scene.bvh()->set_node_layout(UMBvh::eOctNode);
+	oct_scene.bvh()->set_leaf_precision(eFloatLeaf);
+	BOOST_REQUIRE(oct_scene.update_bvh());
+	if (oct_scene.bvh()->oct())
+	{
+		BOOST_CHECK(oct_scene.bvh()->oct()->triangles_list().empty());
+		BOOST_CHECK(!oct_scene.bvh()->oct()->float_triangles_list().empty());
+	}
+	std::mt19937 mt(23);
+	for (int i = 0; i < 2000; ++i)
+	{
+		UMRay ray;
+		create_random_ray(ray, mt);
+		UMShaderParameter parameter;
+		UMShaderParameter oct_parameter;
+		const bool hit = binary_scene.bvh()->intersects(ray, parameter);
+		BOOST_CHECK_EQUAL(hit, oct_scene.bvh()->intersects(ray, oct_parameter));
+		BOOST_CHECK_EQUAL(hit, oct_scene.bvh()->intersects(ray));
+		if (!hit) continue;
+		BOOST_CHECK_EQUAL(parameter.distance, oct_parameter.distance);
+		BOOST_CHECK_EQUAL(parameter.uvw.x, oct_parameter.uvw.x);
+		BOOST_CHECK_EQUAL(parameter.uvw.y, oct_parameter.uvw.y);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CompressedNodeTest)
+{
+	check_layout(UMBvh::eBinnedSAH, UMBvh::eCompressedNode);
+	check_layout(UMBvh::eBinnedSAH, UMBvh::eCompressedNode16);
+
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	UMBvhPtr bvh = scene.bvh();
+	bvh->set_node_layout(UMBvh::eCompressedNode);
+	BOOST_REQUIRE(scene.update_bvh());
+	UMBvhCompressed8Ptr compressed = bvh->compressed8();
+	BOOST_REQUIRE(compressed);
+	BOOST_CHECK_EQUAL(64u, sizeof(UMBvhCompressed8::Node));
+	BOOST_CHECK_EQUAL(96u, sizeof(UMBvhCompressed16::Node));
+	BOOST_CHECK(bvh->node_memory_size() < bvh->node_count() * sizeof(UMBvhFlatNode));
+
+	// decoded boxes contain the primitives of leaf children
+	const UMPrimitiveList& ordered_primitives = bvh->ordered_primitives();
+	for (unsigned int i = 0; i < compressed->node_count(); ++i)
+	{
+		const UMBvhCompressed8::Node& node = compressed->node_list()[i];
+		for (int slot = 0; slot < 4; ++slot)
+		{
+			if (node.child[slot] < 0 || node.primitive_count[slot] == 0) continue;
+			UMVec3d minimum, maximum;
+			UMBvhCompressed8::decode(node, slot, minimum, maximum);
+			for (int k = node.child[slot]; k < node.child[slot] + node.primitive_count[slot]; ++k)
+			{
+				const UMBox& box = ordered_primitives[k]->box();
+				BOOST_CHECK(minimum.x <= box.minimum().x && box.maximum().x <= maximum.x);
+				BOOST_CHECK(minimum.y <= box.minimum().y && box.maximum().y <= maximum.y);
+				BOOST_CHECK(minimum.z <= box.minimum().z && box.maximum().z <= maximum.z);
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(SpatialSplitTest)
+{
+	check_layout(UMBvh::eSpatialSplit, UMBvh::eBinaryNode);
+	check_layout(UMBvh::eSpatialSplit, UMBvh::eQuadNode);
+	check_layout(UMBvh::eSpatialSplit, UMBvh::eOctNode);
+}
+
+BOOST_AUTO_TEST_CASE(SpatialSplitThinTriangleTest)
+{
+	UMMeshPtr mesh = create_thin_mesh(5000);
+
+	UMScene sah_scene;
+	fill_scene(sah_scene, mesh);
+	UMBvhPtr sah_bvh = sah_scene.bvh();
+	sah_bvh->set_build_method(UMBvh::eBinnedSAH);
+	BOOST_REQUIRE(sah_scene.update_bvh());
+
+	UMScene scene;
+	fill_scene(scene, mesh);
+	const UMPrimitiveList primitives = scene.primitive_list();
+	UMBvhPtr bvh = scene.bvh();
+	bvh->set_build_method(UMBvh::eSpatialSplit);
+	BOOST_REQUIRE(scene.update_bvh());
+
+	// references are duplicated within the budget
+	const size_t reference_count = bvh->ordered_primitives().size();
+	BOOST_CHECK(reference_count > primitives.size());
+	BOOST_CHECK(reference_count <= primitives.size() * (1.0 + bvh->spatial_split_budget()));
+
+	// fewer tests per ray
+	BOOST_CHECK(bvh->sah_cost() < sah_bvh->sah_cost());
+	const UMBvhTraversalCount sah_count = count_traversal(*sah_bvh, 1000);
+	const UMBvhTraversalCount count = count_traversal(*bvh, 1000);
+	BOOST_CHECK(count.node_test_count < sah_count.node_test_count);
+	BOOST_CHECK(count.primitive_test_count < sah_count.primitive_test_count);
+	check_intersection(*bvh, primitives);
+
+	std::stringstream message;
+	message << "spatial split (1000 rays)"
+		<< " sah cost: " << sah_bvh->sah_cost() << " -> " << bvh->sah_cost()
+		<< " node tests: " << sah_count.node_test_count << " -> " << count.node_test_count
+		<< " primitive tests: " << sah_count.primitive_test_count << " -> " << count.primitive_test_count;
+	BOOST_TEST_MESSAGE(message.str());
+
+	// refit updates duplicated references
+	move_vertices(mesh, 1.0, 2);
+	BOOST_REQUIRE(scene.refit_bvh());
+	check_intersection(*bvh, primitives);
+}
+
+BOOST_AUTO_TEST_CASE(LinearTest)
+{
+	check_layout(UMBvh::eLinear, UMBvh::eBinaryNode);
+	check_layout(UMBvh::eLinear, UMBvh::eQuadNode);
+	check_layout(UMBvh::eLinear, UMBvh::eOctNode);
+}
+
+BOOST_AUTO_TEST_CASE(TreeletOptimizationTest)
+{
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+
+	UMScene linear_scene;
+	fill_scene(linear_scene, mesh);
+	UMBvhPtr linear_bvh = linear_scene.bvh();
+	linear_bvh->set_build_method(UMBvh::eLinear);
+	linear_bvh->set_treelet_optimization(false);
+	BOOST_REQUIRE(linear_scene.update_bvh());
+
+	UMScene scene;
+	fill_scene(scene, mesh);
+	const UMPrimitiveList primitives = scene.primitive_list();
+	UMBvhPtr bvh = scene.bvh();
+	BOOST_REQUIRE(scene.update_bvh(UMScene::eBvhFastBuild));
+	BOOST_CHECK_EQUAL(UMBvh::eLinear, bvh->build_method());
+	BOOST_CHECK(bvh->treelet_optimization());
+
+	// treelets restore quality
+	BOOST_CHECK(bvh->sah_cost() < linear_bvh->sah_cost());
+	check_intersection(*bvh, primitives);
+
+	std::stringstream message;
+	message << "linear bvh"
+		<< " build: " << linear_bvh->build_time() << "s sah cost: " << linear_bvh->sah_cost()
+		<< " treelet optimized build: " << bvh->build_time() << "s sah cost: " << bvh->sah_cost();
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_CASE(LeafTrianglesTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	const UMPrimitiveList primitives = scene.primitive_list();
+
+	UMBvhPtr bvh = scene.bvh();
+	BOOST_REQUIRE(scene.update_bvh());
+
+	// triangles are precomputed in leaf order. spheres are not.
+	const UMBvhTriangleList& triangle_list = bvh->leaves().triangle_list();
+	BOOST_REQUIRE_EQUAL(bvh->ordered_primitives().size(), triangle_list.size());
+	int triangle_count = 0;
+	for (size_t i = 0; i < triangle_list.size(); ++i)
+	{
+		const bool is_triangle = dynamic_cast<const UMTriangle*>(bvh->ordered_primitives()[i].get()) != NULL;
+		BOOST_CHECK_EQUAL(is_triangle, triangle_list[i].is_triangle != 0);
+		if (is_triangle) ++triangle_count;
+	}
+	BOOST_CHECK_EQUAL(static_cast<int>(mesh->face_list().size()), triangle_count);
+
+	// shading parameters are same as the triangle sets
+	std::mt19937 mt(9);
+	for (int i = 0; i < 500; ++i)
+	{
+		UMRay ray;
+		create_random_ray(ray, mt);
+		UMShaderParameter bvh_parameter;
+		if (!bvh->intersects(ray, bvh_parameter)) continue;
+
+		UMShaderParameter parameter;
+		double distance = (std::numeric_limits<double>::max)();
+		for (size_t k = 0; k < primitives.size(); ++k)
+		{
+			UMShaderParameter primitive_parameter;
+			if (primitives[k]->intersects(ray, primitive_parameter) && primitive_parameter.distance < distance)
+			{
+				distance = primitive_parameter.distance;
+				parameter = primitive_parameter;
+			}
+		}
+		BOOST_CHECK_EQUAL(parameter.distance, bvh_parameter.distance);
+		BOOST_CHECK_SMALL((parameter.normal - bvh_parameter.normal).length(), TEST_EPSILON);
+		BOOST_CHECK_SMALL((parameter.uvw - bvh_parameter.uvw).length(), TEST_EPSILON);
+		BOOST_CHECK_SMALL((parameter.color - bvh_parameter.color).length(), TEST_EPSILON);
+		BOOST_CHECK_EQUAL(parameter.material, bvh_parameter.material);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(FloatLeafTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	for (int layout = UMBvh::eBinaryNode; layout <= UMBvh::eQuadNode; ++layout)
+	{
+		UMScene scene;
+		fill_scene(scene, mesh);
+		scene.bvh()->set_node_layout(static_cast<UMBvh::NodeLayout>(layout));
+		BOOST_REQUIRE(scene.update_bvh());
+		const UMBvh& bvh = *scene.bvh();
+
+		UMScene float_scene;
+		fill_scene(float_scene, mesh);
+		float_scene.bvh()->set_node_layout(static_cast<UMBvh::NodeLayout>(layout));
+		float_scene.bvh()->set_leaf_precision(eFloatLeaf);
+		BOOST_REQUIRE(float_scene.update_bvh());
+		const UMBvh& float_bvh = *float_scene.bvh();
+		BOOST_CHECK_EQUAL(eFloatLeaf, float_bvh.leaves().precision());
+		BOOST_CHECK(float_bvh.leaves().triangle_list().empty());
+		BOOST_CHECK(float_bvh.leaves().memory_size() * 2 <= bvh.leaves().memory_size() + bvh.leaves().memory_size() / 10);
+
+		// hits are same within float precision
+		std::mt19937 mt(17);
+		int different_count = 0;
+		for (int i = 0; i < 2000; ++i)
+		{
+			UMRay ray;
+			create_random_ray(ray, mt);
+			UMShaderParameter parameter;
+			UMShaderParameter float_parameter;
+			const bool hit = bvh.intersects(ray, parameter);
+			const bool float_hit = float_bvh.intersects(ray, float_parameter);
+			if (hit != float_hit || hit != float_bvh.intersects(ray))
+			{
+				++different_count;
+				continue;
+			}
+			if (!hit) continue;
+			BOOST_CHECK_CLOSE(parameter.distance, float_parameter.distance, 0.01);
+			BOOST_CHECK_SMALL((parameter.uvw - float_parameter.uvw).length(), 0.001);
+		}
+		BOOST_CHECK(different_count <= 2);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(PacketTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	for (int layout = UMBvh::eBinaryNode; layout <= UMBvh::eQuadNode; ++layout)
+	{
+		UMScene scene;
+		fill_scene(scene, mesh);
+		scene.bvh()->set_node_layout(static_cast<UMBvh::NodeLayout>(layout));
+		BOOST_REQUIRE(scene.update_bvh());
+		const UMBvh& bvh = *scene.bvh();
+
+		std::mt19937 mt(11);
+		std::uniform_real_distribution<double> length(0.0, 300.0);
+		UMRayPacket packet;
+		UMRayPacket shadow_packet(true);
+		for (int i = 0; i < 50; ++i)
+		{
+			// coherent rays
+			create_coherent_packet(packet, mt);
+			check_packet(bvh, packet);
+
+			// shadow rays toward points
+			shadow_packet.clear();
+			for (int k = 0; k < packet.ray_count(); ++k)
+			{
+				const int index = shadow_packet.add_ray(packet.ray(k).origin(), packet.ray(k).direction());
+				shadow_packet.mutable_ray(index).set_tmax(length(mt));
+			}
+			check_packet(bvh, shadow_packet);
+
+			// incoherent rays
+			packet.clear();
+			while (!packet.is_full())
+			{
+				UMRay ray;
+				create_random_ray(ray, mt);
+				packet.add_ray(ray.origin(), ray.direction());
+			}
+			check_packet(bvh, packet);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(PacketBenchmark)
+{
+	UMMeshPtr mesh = create_random_mesh(100000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	scene.bvh()->set_node_layout(UMBvh::eBinaryNode);
+	BOOST_REQUIRE(scene.update_bvh());
+	const UMBvh& bvh = *scene.bvh();
+	const int packet_count = 2000;
+
+	std::mt19937 mt(13);
+	UMRayPacket packet;
+	UMShaderParameter parameter;
+	int single_hit_count = 0;
+	const std::clock_t single_start = std::clock();
+	for (int i = 0; i < packet_count; ++i)
+	{
+		create_coherent_packet(packet, mt);
+		for (int k = 0; k < packet.ray_count(); ++k)
+		{
+			if (bvh.intersects(packet.ray(k), parameter)) ++single_hit_count;
+		}
+	}
+	const double single_seconds = static_cast<double>(std::clock() - single_start) / CLOCKS_PER_SEC;
+
+	mt.seed(13);
+	int packet_hit_count = 0;
+	const std::clock_t packet_start = std::clock();
+	for (int i = 0; i < packet_count; ++i)
+	{
+		create_coherent_packet(packet, mt);
+		bvh.intersects(packet);
+		for (int k = 0; k < packet.ray_count(); ++k)
+		{
+			if (packet.is_hit(k)) ++packet_hit_count;
+		}
+	}
+	const double packet_seconds = static_cast<double>(std::clock() - packet_start) / CLOCKS_PER_SEC;
+	BOOST_CHECK_EQUAL(single_hit_count, packet_hit_count);
+
+	std::stringstream message;
+	message << "bvh packet benchmark (" << packet_count * static_cast<int>(UMRayPacket::max_ray_count) << " coherent rays)"
+		<< " single: " << single_seconds << "s"
+		<< " packet: " << packet_seconds << "s";
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_CASE(UnboundedPrimitiveTest)
+{
+	UMMeshPtr mesh = create_random_mesh(2000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	UMPlanePtr plane(std::make_shared<UMPlane>(UMVec3d(0, -120, 0), UMVec3d(0, 1, 0)));
+	scene.mutable_primitive_list().push_back(plane);
+	const UMPrimitiveList primitives = scene.primitive_list();
+	BOOST_CHECK(!plane->is_bounded());
+
+	// the plane is tested by the scene, not by the bvh
+	BOOST_REQUIRE(scene.update_bvh());
+	BOOST_REQUIRE_EQUAL(1u, scene.primitive_list().size());
+	BOOST_CHECK_EQUAL(scene.bvh(), scene.primitive_list()[0]);
+	BOOST_REQUIRE_EQUAL(1u, scene.unbounded_primitive_list().size());
+	BOOST_CHECK_EQUAL(plane, scene.unbounded_primitive_list()[0]);
+	BOOST_CHECK_EQUAL(primitives.size() - 1, scene.bvh()->ordered_primitives().size());
+
+	// root box covers bounded primitives only
+	const UMBox& box = scene.bvh()->box();
+	BOOST_CHECK(box.minimum().y > -110.0);
+	BOOST_CHECK(box.maximum().y < 110.0);
+
+	std::mt19937 mt(15);
+	for (int i = 0; i < 500; ++i)
+	{
+		UMRay ray;
+		create_random_ray(ray, mt);
+		double distance = 0.0;
+		const bool hit = intersects_all(primitives, ray, distance);
+
+		double scene_distance = (std::numeric_limits<double>::max)();
+		UMShaderParameter parameter;
+		if (scene.bvh()->intersects(ray, parameter)) scene_distance = parameter.distance;
+		if (plane->intersects(ray, parameter)) scene_distance = std::min(scene_distance, parameter.distance);
+		BOOST_CHECK_EQUAL(hit, scene_distance < (std::numeric_limits<double>::max)());
+		if (hit)
+		{
+			BOOST_CHECK_CLOSE(distance, scene_distance, TEST_EPSILON);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CacheTest)
+{
+	const std::string path("UMBvhTest_cache.bvh");
+	std::remove(path.c_str());
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	const UMPrimitiveList primitives = scene.primitive_list();
+	const unsigned long long key = UMBvh::hash(&mesh->vertex_list()[0], sizeof(UMVec3d) * mesh->vertex_list().size());
+
+	// first build writes the cache
+	UMBvhPtr bvh = UMBvh::create();
+	BOOST_REQUIRE(bvh->build(primitives, path, key));
+	BOOST_CHECK(!bvh->is_cache_loaded());
+
+	// same key loads the same tree
+	UMBvhPtr cached_bvh = UMBvh::create();
+	cached_bvh->set_node_layout(UMBvh::eQuadNode);
+	BOOST_REQUIRE(cached_bvh->build(primitives, path, key));
+	BOOST_CHECK(cached_bvh->is_cache_loaded());
+	BOOST_CHECK_EQUAL(bvh->node_count(), cached_bvh->node_count());
+	BOOST_CHECK_EQUAL(bvh->depth(), cached_bvh->depth());
+	BOOST_CHECK_CLOSE(bvh->sah_cost(), cached_bvh->sah_cost(), TEST_EPSILON);
+	BOOST_CHECK(cached_bvh->quad());
+	BOOST_CHECK(bvh->ordered_primitives() == cached_bvh->ordered_primitives());
+	check_intersection(*cached_bvh, primitives);
+
+	// other key or other build settings do not load
+	UMBvhPtr other_bvh = UMBvh::create();
+	BOOST_CHECK(!other_bvh->load_cache(primitives, path, key + 1));
+	other_bvh->set_build_method(UMBvh::eLinear);
+	BOOST_CHECK(!other_bvh->load_cache(primitives, path, key));
+	other_bvh->set_build_method(UMBvh::eBinnedSAH);
+	other_bvh->set_leaf_precision(eFloatLeaf);
+	BOOST_CHECK(!other_bvh->load_cache(primitives, path, key));
+	other_bvh->set_leaf_precision(eDoubleLeaf);
+	UMPrimitiveList fewer_primitives(primitives.begin(), primitives.end() - 1);
+	BOOST_CHECK(!other_bvh->load_cache(fewer_primitives, path, key));
+	std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(RefitTest)
+{
+	for (int layout = UMBvh::eBinaryNode; layout <= UMBvh::eCompressedNode16; ++layout)
+	{
+		UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+		UMScene scene;
+		fill_scene(scene, mesh);
+		const UMPrimitiveList primitives = scene.primitive_list();
+
+		UMBvhPtr bvh = scene.bvh();
+		bvh->set_node_layout(static_cast<UMBvh::NodeLayout>(layout));
+		BOOST_REQUIRE(scene.update_bvh());
+		const unsigned int node_count = bvh->node_count();
+
+		// small deformation keeps the topology
+		move_vertices(mesh, 1.0, 2);
+		BOOST_REQUIRE(scene.refit_bvh());
+		BOOST_CHECK_EQUAL(node_count, bvh->node_count());
+		BOOST_CHECK(bvh->sah_cost() <= bvh->built_sah_cost() * bvh->rebuild_threshold());
+		check_intersection(*bvh, primitives);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(RefitRebuildTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMScene scene;
+	fill_scene(scene, mesh);
+	const UMPrimitiveList primitives = scene.primitive_list();
+
+	UMBvhPtr bvh = scene.bvh();
+	BOOST_REQUIRE(scene.update_bvh());
+	const double built_sah_cost = bvh->built_sah_cost();
+
+	// scatter vertices. refit degrades the tree and rebuilds it.
+	move_vertices(mesh, 100.0, 3);
+	BOOST_REQUIRE(scene.refit_bvh());
+	BOOST_CHECK(bvh->built_sah_cost() != built_sah_cost);
+	BOOST_CHECK_CLOSE(bvh->built_sah_cost(), bvh->sah_cost(), TEST_EPSILON);
+	check_intersection(*bvh, primitives);
+}
+
+BOOST_AUTO_TEST_CASE(MeshTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	UMPrimitiveList triangles;
+	const int face_count = static_cast<int>(mesh->face_list().size());
+	for (int i = 0; i < face_count; ++i)
+	{
+		triangles.push_back(std::make_shared<UMTriangle>(mesh, mesh->face_list().at(i), i));
+	}
+
+	for (int method = UMBvh::eMiddleSplit; method <= UMBvh::eLinear; ++method)
+	{
+		for (int layout = UMBvh::eBinaryNode; layout <= UMBvh::eCompressedNode16; ++layout)
+		{
+			if (method != UMBvh::eBinnedSAH && layout != UMBvh::eBinaryNode) continue;
+			UMBvhPtr bvh = UMBvh::create();
+			bvh->set_build_method(static_cast<UMBvh::BuildMethod>(method));
+			bvh->set_node_layout(static_cast<UMBvh::NodeLayout>(layout));
+			BOOST_REQUIRE(bvh->build(mesh));
+			BOOST_CHECK(bvh->mesh() == mesh);
+			BOOST_CHECK(bvh->ordered_primitives().empty());
+			BOOST_CHECK(bvh->primitive_order().size() >= triangles.size());
+			check_intersection(*bvh, triangles);
+		}
+	}
+
+	// faces are shaded same as triangles
+	UMBvhPtr bvh = UMBvh::create();
+	BOOST_REQUIRE(bvh->build(mesh));
+	std::mt19937 mt(7);
+	for (int i = 0; i < 500; ++i)
+	{
+		UMRay ray;
+		create_random_ray(ray, mt);
+		UMShaderParameter expected;
+		UMShaderParameter parameter;
+		double distance = 0.0;
+		if (!intersects_all(triangles, ray, distance)) continue;
+		for (int k = 0; k < face_count; ++k)
+		{
+			UMShaderParameter p;
+			if (triangles[k]->intersects(ray, p) && p.distance == distance) expected = p;
+		}
+		BOOST_REQUIRE(bvh->intersects(ray, parameter));
+		BOOST_CHECK_CLOSE(expected.distance, parameter.distance, TEST_EPSILON);
+		BOOST_CHECK_SMALL((expected.normal - parameter.normal).length(), TEST_EPSILON);
+		BOOST_CHECK(expected.material == parameter.material);
+	}
+
+	// cache of faces is compatible with cache of triangles in face order
+	const std::string path("UMBvhTest_mesh_cache.bvh");
+	std::remove(path.c_str());
+	const unsigned long long key = UMBvh::hash(&mesh->vertex_list()[0], sizeof(UMVec3d) * mesh->vertex_list().size());
+	UMBvhPtr triangle_bvh = UMBvh::create();
+	BOOST_REQUIRE(triangle_bvh->build(triangles, path, key));
+	UMBvhPtr cached_bvh = UMBvh::create();
+	BOOST_REQUIRE(cached_bvh->build(mesh, path, key));
+	BOOST_CHECK(cached_bvh->is_cache_loaded());
+	BOOST_CHECK(cached_bvh->primitive_order() == triangle_bvh->primitive_order());
+	check_intersection(*cached_bvh, triangles);
+	std::remove(path.c_str());
+
+	// refit reads the updated vertices
+	move_vertices(mesh, 1.0, 2);
+	for (int i = 0; i < face_count; ++i)
+	{
+		triangles[i]->update_box();
+	}
+	BOOST_REQUIRE(bvh->refit());
+	check_intersection(*bvh, triangles);
+
+	// scene shares one bvh per mesh
+	UMScene scene;
+	scene.init(16, 16);
+	BOOST_REQUIRE(scene.add_mesh_instance(mesh, UMMat44d()));
+	BOOST_REQUIRE(scene.add_mesh_instance(mesh, UMMat44d()));
+	BOOST_CHECK(scene.mesh_bvh(mesh)->mesh() == mesh);
+	BOOST_CHECK_EQUAL(2u, scene.primitive_list().size());
+}
+
+BOOST_AUTO_TEST_CASE(NodeLayoutBenchmark)
+{
+	UMMeshPtr mesh = create_random_mesh(100000, 100.0);
+	const int ray_count = 100000;
+
+	UMScene binary_scene;
+	fill_scene(binary_scene, mesh);
+	binary_scene.bvh()->set_node_layout(UMBvh::eBinaryNode);
+	BOOST_REQUIRE(binary_scene.update_bvh());
+
+	UMScene quad_scene;
+	fill_scene(quad_scene, mesh);
+	quad_scene.bvh()->set_node_layout(UMBvh::eQuadNode);
+	BOOST_REQUIRE(quad_scene.update_bvh());
+
+	UMScene oct_scene;
+	fill_scene(oct_scene, mesh);
+	oct_scene.bvh()->set_node_layout(UMBvh::eOctNode);
+	BOOST_REQUIRE(oct_scene.update_bvh());
+
+	UMScene float_quad_scene;
+	fill_scene(float_quad_scene, mesh);
+	float_quad_scene.bvh()->set_node_layout(UMBvh::eQuadNode);
+	float_quad_scene.bvh()->set_leaf_precision(eFloatLeaf);
+	BOOST_REQUIRE(float_quad_scene.update_bvh());
+
+	UMScene float_oct_scene;
+	fill_scene(float_oct_scene, mesh);
+	float_oct_scene.bvh()->set_node_layout(UMBvh::eOctNode);
+	float_oct_scene.bvh()->set_leaf_precision(eFloatLeaf);
+	BOOST_REQUIRE(float_oct_scene.update_bvh());
+
+	UMScene compressed_scene;
+	fill_scene(compressed_scene, mesh);
+	compressed_scene.bvh()->set_node_layout(UMBvh::eCompressedNode);
+	BOOST_REQUIRE(compressed_scene.update_bvh());
+
+	UMScene compressed16_scene;
+	fill_scene(compressed16_scene, mesh);
+	compressed16_scene.bvh()->set_node_layout(UMBvh::eCompressedNode16);
+	BOOST_REQUIRE(compressed16_scene.update_bvh());
+
+	const double binary_seconds = trace_seconds(*binary_scene.bvh(), ray_count);
+	const double quad_seconds = trace_seconds(*quad_scene.bvh(), ray_count);
+	const double oct_seconds = trace_seconds(*oct_scene.bvh(), ray_count);
+	const double float_quad_seconds = trace_seconds(*float_quad_scene.bvh(), ray_count);
+	const double float_oct_seconds = trace_seconds(*float_oct_scene.bvh(), ray_count);
+	const double compressed_seconds = trace_seconds(*compressed_scene.bvh(), ray_count);
+	const double compressed16_seconds = trace_seconds(*compressed16_scene.bvh(), ray_count);
+
+	std::stringstream message;
+	message << "bvh layout benchmark (" << ray_count << " rays)"
+		<< " binary: " << binary_seconds << "s " << binary_scene.bvh()->node_memory_size() << "bytes"
+		<< " quad: " << quad_seconds << "s " << quad_scene.bvh()->node_memory_size() << "bytes"
+		<< " oct: " << oct_seconds << "s " << oct_scene.bvh()->node_memory_size() << "bytes"
+		<< (UMBvhOct::is_supported() ? "" : " (no AVX)")
+		<< " float leaf quad: " << float_quad_seconds << "s"
+		<< " float leaf oct: " << float_oct_seconds << "s"
+		<< " compressed 8bit: " << compressed_seconds << "s " << compressed_scene.bvh()->node_memory_size() << "bytes"
+		<< " 16bit: " << compressed16_seconds << "s " << compressed16_scene.bvh()->node_memory_size() << "bytes";
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
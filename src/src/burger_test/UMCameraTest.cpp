@@ -16,6 +16,9 @@
 #include "UMMatrix.h"
 #include "UMVector.h"
 #include "UMMath.h"
+#include "UMCamera.h"
+#include "UMRay.h"
+#include "UMTileScheduler.h"
 
 #define N 10
 #define TEST_EPSILON 0.0005f
@@ -87,4 +90,38 @@ BOOST_AUTO_TEST_CASE(CameraInit)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(GenerateRaysTest)
+{
+	UMCamera camera(160, 120);
+	camera.rotate(-20, -45);
+	camera.zoom(0, -10);
+
+	// batched rays are same as single rays
+	const UMTileScheduler scheduler(1, 16);
+	const UMTile tile = scheduler.tile(160, 120, scheduler.tile_count(160, 120) - 1);
+	const int sample_count = 3;
+	std::vector<UMVec2d> samples(tile.width * tile.height * sample_count);
+	std::uniform_real_distribution<> sample_range(0.0, 1.0);
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		samples[i] = UMVec2d(sample_range(mt), sample_range(mt));
+	}
+	UMCameraRays rays;
+	camera.generate_rays(tile, &samples[0], sample_count, rays);
+	BOOST_REQUIRE_EQUAL(static_cast<int>(samples.size()), rays.count());
+	for (int i = 0; i < rays.count(); ++i)
+	{
+		const int tile_pixel = i / sample_count;
+		BOOST_CHECK_EQUAL(tile_pixel, rays.pixel[i]);
+		UMVec2d sample_point(samples[i]);
+		sample_point.x += tile.x + tile_pixel % tile.width;
+		sample_point.y += tile.y + tile_pixel / tile.width;
+		UMRay ray;
+		camera.generate_ray(ray, sample_point);
+		const UMVec3d direction(rays.direction_x[i], rays.direction_y[i], rays.direction_z[i]);
+		BOOST_CHECK_SMALL((ray.direction() - direction).length(), 1.0e-12);
+		BOOST_CHECK_SMALL((ray.origin() - rays.origin).length(), 1.0e-12);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,344 @@
+/**
+ * @file UMInstanceTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <limits>
+#include <cmath>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMInstance.h"
+#include "UMMesh.h"
+#include "UMMaterial.h"
+#include "UMTriangle.h"
+#include "UMSphere.h"
+#include "UMRay.h"
+#include "UMRayPacket.h"
+#include "UMShaderParameter.h"
+#include "UMTestScene.h"
+
+#define TEST_EPSILON 0.0001
+
+BOOST_AUTO_TEST_SUITE(UMInstanceTest)
+
+using namespace burger;
+using namespace burger::test;
+
+namespace
+{
+	/**
+	 * rotation around y, uniform scale and translation
+	 */
+	UMMat44d create_transform(double angle, double scale, const UMVec3d& translation)
+	{
+		UMMat44d transform;
+		transform.m[0][0] = scale * std::cos(angle);
+		transform.m[0][2] = -scale * std::sin(angle);
+		transform.m[1][1] = scale;
+		transform.m[2][0] = scale * std::sin(angle);
+		transform.m[2][2] = scale * std::cos(angle);
+		transform.m[3][0] = translation.x;
+		transform.m[3][1] = translation.y;
+		transform.m[3][2] = translation.z;
+		return transform;
+	}
+
+	/**
+	 * append triangles of the mesh transformed to world
+	 */
+	void append_world_triangles(UMPrimitiveList& dst, UMMeshPtr mesh, const UMMat44d& transform)
+	{
+		UMMeshPtr world_mesh(std::make_shared<UMMesh>());
+		const int vertex_count = static_cast<int>(mesh->vertex_list().size());
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			const UMVec3d& p = mesh->vertex_list()[i];
+			world_mesh->mutable_vertex_list().push_back(UMVec3d(
+				p.x * transform.m[0][0] + p.y * transform.m[1][0] + p.z * transform.m[2][0] + transform.m[3][0],
+				p.x * transform.m[0][1] + p.y * transform.m[1][1] + p.z * transform.m[2][1] + transform.m[3][1],
+				p.x * transform.m[0][2] + p.y * transform.m[1][2] + p.z * transform.m[2][2] + transform.m[3][2]));
+		}
+		world_mesh->mutable_face_list() = mesh->face_list();
+		world_mesh->mutable_material_list() = mesh->material_list();
+		world_mesh->create_normals(true);
+		const int face_count = static_cast<int>(mesh->face_list().size());
+		for (int i = 0; i < face_count; ++i)
+		{
+			dst.push_back(std::make_shared<UMTriangle>(world_mesh, world_mesh->face_list().at(i), i));
+		}
+	}
+
+	/**
+	 * check scene bvh against testing all world triangles
+	 */
+	void check_intersection(const UMBvh& bvh, const UMPrimitiveList& primitives)
+	{
+		std::mt19937 mt(5);
+		std::uniform_real_distribution<double> position(-150.0, 150.0);
+		std::uniform_real_distribution<double> direction(-1.0, 1.0);
+		int hit_count = 0;
+		for (int i = 0; i < 500; ++i)
+		{
+			UMRay ray;
+			ray.set_origin(UMVec3d(position(mt), position(mt), position(mt)));
+			ray.set_direction(UMVec3d(direction(mt), direction(mt), direction(mt)).normalized());
+
+			bool hit = false;
+			double distance = (std::numeric_limits<double>::max)();
+			UMVec3d normal;
+			UMShaderParameter parameter;
+			for (size_t k = 0; k < primitives.size(); ++k)
+			{
+				if (primitives[k]->intersects(ray, parameter) && parameter.distance < distance)
+				{
+					distance = parameter.distance;
+					normal = parameter.normal;
+					hit = true;
+				}
+			}
+
+			UMShaderParameter instance_parameter;
+			BOOST_CHECK_EQUAL(hit, bvh.intersects(ray, instance_parameter));
+			BOOST_CHECK_EQUAL(hit, bvh.intersects(ray));
+			if (hit)
+			{
+				++hit_count;
+				BOOST_CHECK_CLOSE(distance, instance_parameter.distance, TEST_EPSILON);
+				BOOST_CHECK_SMALL((normal - instance_parameter.normal).length(), TEST_EPSILON);
+				const UMVec3d point = ray.origin() + ray.direction() * distance;
+				BOOST_CHECK_SMALL((point - instance_parameter.intersect_point).length(), TEST_EPSILON);
+			}
+		}
+		BOOST_CHECK(hit_count > 0);
+	}
+
+	/**
+	 * check packets of coherent rays against single rays through instances
+	 */
+	void check_packet(const UMBvh& bvh)
+	{
+		std::mt19937 mt(7);
+		std::uniform_real_distribution<double> position(-150.0, 150.0);
+		std::uniform_real_distribution<double> target(-80.0, 80.0);
+		UMRayPacket packet;
+		UMRayPacket shadow_packet(true);
+		for (int i = 0; i < 50; ++i)
+		{
+			const UMVec3d origin(position(mt), position(mt), position(mt));
+			const UMVec3d center(target(mt), target(mt), target(mt));
+			packet.clear();
+			shadow_packet.clear();
+			for (int k = 0; k < UMRayPacket::max_ray_count; ++k)
+			{
+				const UMVec3d point = center + UMVec3d(k % 8 - 3.5, k / 8 - 3.5, 0.0);
+				const UMVec3d direction = (point - origin).normalized();
+				packet.add_ray(origin, direction);
+				shadow_packet.add_ray(origin, direction);
+			}
+			bvh.intersects(packet);
+			bvh.intersects(shadow_packet);
+			for (int k = 0; k < packet.ray_count(); ++k)
+			{
+				UMShaderParameter parameter;
+				const bool hit = bvh.intersects(packet.ray(k), parameter);
+				BOOST_CHECK_EQUAL(hit, packet.is_hit(k));
+				BOOST_CHECK_EQUAL(bvh.intersects(packet.ray(k)), shadow_packet.is_hit(k));
+				if (hit && packet.is_hit(k))
+				{
+					// packets keep hits and shade the closest one only
+					UMHit single_hit;
+					bvh.intersects(packet.ray(k), single_hit);
+					BOOST_CHECK_EQUAL(single_hit.primitive, packet.hit(k).primitive);
+					BOOST_CHECK_EQUAL(single_hit.instance, packet.hit(k).instance);
+					UMShaderParameter packet_parameter;
+					packet.shade(k, packet_parameter);
+					BOOST_CHECK_CLOSE(parameter.distance, packet_parameter.distance, TEST_EPSILON);
+					BOOST_CHECK_SMALL((parameter.normal - packet_parameter.normal).length(), TEST_EPSILON);
+				}
+			}
+		}
+	}
+
+} // anonymouse namespace
+
+BOOST_AUTO_TEST_CASE(SharedMeshBvhTest)
+{
+	UMMeshPtr mesh = create_random_mesh(2000, 50.0);
+	UMScene scene;
+	const UMMat44d transform1 = create_transform(0.0, 1.0, UMVec3d(-60.0, 0.0, 0.0));
+	const UMMat44d transform2 = create_transform(0.7, 1.5, UMVec3d(60.0, 10.0, -20.0));
+	UMInstancePtr instance1 = scene.add_mesh_instance(mesh, transform1);
+	UMInstancePtr instance2 = scene.add_mesh_instance(mesh, transform2);
+	BOOST_REQUIRE(instance1);
+	BOOST_REQUIRE(instance2);
+
+	// geometry is shared
+	BOOST_CHECK_EQUAL(instance1->bvh(), instance2->bvh());
+	BOOST_CHECK_EQUAL(instance1->bvh(), scene.mesh_bvh(mesh));
+	BOOST_CHECK_EQUAL(2u, scene.primitive_list().size());
+
+	UMPrimitiveList world_triangles;
+	append_world_triangles(world_triangles, mesh, transform1);
+	append_world_triangles(world_triangles, mesh, transform2);
+
+	BOOST_REQUIRE(scene.update_bvh());
+	check_intersection(*scene.bvh(), world_triangles);
+	check_packet(*scene.bvh());
+}
+
+BOOST_AUTO_TEST_CASE(MeshBvhSettingsTest)
+{
+	UMMeshPtr mesh = create_random_mesh(2000, 50.0);
+	UMScene scene;
+	UMBvhPtr scene_bvh = scene.bvh();
+	scene_bvh->set_build_method(UMBvh::eLinear);
+	scene_bvh->set_node_layout(UMBvh::eQuadNode);
+	scene_bvh->set_leaf_precision(eFloatLeaf);
+	scene_bvh->set_spatial_split_budget(0.1);
+	scene_bvh->set_treelet_optimization(false);
+	scene_bvh->set_rebuild_threshold(2.0);
+	UMInstancePtr instance = scene.add_mesh_instance(mesh, create_transform(0.4, 1.0, UMVec3d(10.0, 0.0, 0.0)));
+	BOOST_REQUIRE(instance);
+
+	// bottom level bvhs are built by the settings of the scene bvh
+	const UMBvh& mesh_bvh = *instance->bvh();
+	BOOST_CHECK_EQUAL(UMBvh::eLinear, mesh_bvh.build_method());
+	BOOST_CHECK_EQUAL(UMBvh::eQuadNode, mesh_bvh.node_layout());
+	BOOST_CHECK_EQUAL(eFloatLeaf, mesh_bvh.leaf_precision());
+	BOOST_CHECK_CLOSE(0.1, mesh_bvh.spatial_split_budget(), TEST_EPSILON);
+	BOOST_CHECK(!mesh_bvh.treelet_optimization());
+	BOOST_CHECK_CLOSE(2.0, mesh_bvh.rebuild_threshold(), TEST_EPSILON);
+	BOOST_CHECK(mesh_bvh.quad());
+
+	BOOST_REQUIRE(scene.update_bvh());
+	check_packet(*scene.bvh());
+}
+
+BOOST_AUTO_TEST_CASE(BvhQualityTest)
+{
+	// faces under instances are counted, not instances
+	UMMeshPtr mesh = create_random_mesh(20000, 50.0);
+	UMScene scene;
+	for (int i = 0; i < 60; ++i)
+	{
+		BOOST_REQUIRE(scene.add_mesh_instance(mesh, create_transform(0.1 * i, 1.0, UMVec3d(i * 120.0, 0.0, 0.0))));
+	}
+	BOOST_REQUIRE(scene.update_bvh(UMScene::eBvhAuto));
+	BOOST_CHECK_EQUAL(UMScene::eBvhAuto, scene.bvh_quality());
+	BOOST_CHECK_EQUAL(UMBvh::eLinear, scene.bvh()->build_method());
+	// a mesh is selected by its own face count
+	UMBvhPtr mesh_bvh = scene.mesh_bvh(mesh);
+	BOOST_CHECK_EQUAL(UMBvh::eBinnedSAH, mesh_bvh->build_method());
+
+	// bottom level bvhs are rebuilt by another mode
+	const double sah_cost = mesh_bvh->sah_cost();
+	BOOST_REQUIRE(scene.update_bvh(UMScene::eBvhFastBuild));
+	BOOST_CHECK_EQUAL(mesh_bvh, scene.mesh_bvh(mesh));
+	BOOST_CHECK_EQUAL(UMBvh::eLinear, mesh_bvh->build_method());
+	BOOST_CHECK(mesh_bvh->treelet_optimization());
+	BOOST_CHECK(mesh_bvh->sah_cost() != sah_cost);
+	check_packet(*scene.bvh());
+
+	// meshes added later are built by the same mode
+	UMMeshPtr other_mesh = create_random_mesh(1000, 50.0);
+	UMInstancePtr other_instance = scene.add_mesh_instance(other_mesh, UMMat44d());
+	BOOST_REQUIRE(other_instance);
+	BOOST_CHECK_EQUAL(UMBvh::eLinear, other_instance->bvh()->build_method());
+
+	// small scenes are built by binned SAH
+	UMScene small_scene;
+	small_scene.set_bvh_quality(UMScene::eBvhAuto);
+	UMInstancePtr small_instance = small_scene.add_mesh_instance(other_mesh, UMMat44d());
+	BOOST_REQUIRE(small_instance);
+	BOOST_CHECK_EQUAL(UMBvh::eBinnedSAH, small_instance->bvh()->build_method());
+	BOOST_REQUIRE(small_scene.update_bvh(UMScene::eBvhAuto));
+	BOOST_CHECK_EQUAL(UMBvh::eBinnedSAH, small_scene.bvh()->build_method());
+}
+
+BOOST_AUTO_TEST_CASE(MoveInstanceTest)
+{
+	UMMeshPtr mesh = create_random_mesh(2000, 50.0);
+	UMScene scene;
+	const UMMat44d transform1 = create_transform(0.0, 1.0, UMVec3d(-60.0, 0.0, 0.0));
+	const UMMat44d transform2 = create_transform(0.3, 1.0, UMVec3d(60.0, 0.0, 0.0));
+	UMInstancePtr instance1 = scene.add_mesh_instance(mesh, transform1);
+	UMInstancePtr instance2 = scene.add_mesh_instance(mesh, transform2);
+	BOOST_REQUIRE(scene.update_bvh());
+	const unsigned int bottom_node_count = instance1->bvh()->node_count();
+
+	// moving an object refits only the top level
+	const UMMat44d moved = create_transform(-1.2, 0.8, UMVec3d(0.0, 40.0, 30.0));
+	instance2->set_transform(moved);
+	BOOST_REQUIRE(scene.refit_bvh());
+	BOOST_CHECK_EQUAL(bottom_node_count, instance1->bvh()->node_count());
+
+	UMPrimitiveList world_triangles;
+	append_world_triangles(world_triangles, mesh, transform1);
+	append_world_triangles(world_triangles, mesh, moved);
+	check_intersection(*scene.bvh(), world_triangles);
+}
+
+BOOST_AUTO_TEST_CASE(DeferredHitTest)
+{
+	UMMeshPtr mesh = create_random_mesh(2000, 50.0);
+	UMScene scene;
+	UMInstancePtr instance = scene.add_mesh_instance(mesh, create_transform(0.5, 1.2, UMVec3d(20.0, 0.0, 0.0)));
+	std::mt19937 sphere_mt(3);
+	std::uniform_real_distribution<double> sphere_position(-80.0, 80.0);
+	for (int i = 0; i < 50; ++i)
+	{
+		UMVec3d center(sphere_position(sphere_mt), sphere_position(sphere_mt), sphere_position(sphere_mt));
+		scene.mutable_primitive_list().push_back(std::make_shared<UMSphere>(center, 4.0));
+	}
+	BOOST_REQUIRE(scene.update_bvh());
+	const UMBvh& bvh = *scene.bvh();
+
+	std::mt19937 mt(9);
+	std::uniform_real_distribution<double> position(-150.0, 150.0);
+	std::uniform_real_distribution<double> direction(-1.0, 1.0);
+	int instance_hit_count = 0;
+	int sphere_hit_count = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		UMRay ray;
+		ray.set_origin(UMVec3d(position(mt), position(mt), position(mt)));
+		ray.set_direction(UMVec3d(direction(mt), direction(mt), direction(mt)).normalized());
+
+		// traversal finds the hit only, shading runs once after it
+		UMHit hit;
+		UMShaderParameter parameter;
+		const bool is_hit = bvh.intersects(ray, hit);
+		BOOST_CHECK_EQUAL(is_hit, bvh.intersects(ray, parameter));
+		BOOST_CHECK_EQUAL(is_hit, hit.is_hit());
+		if (!is_hit) continue;
+
+		if (hit.instance)
+		{
+			++instance_hit_count;
+			BOOST_CHECK_EQUAL(instance.get(), hit.instance);
+			BOOST_CHECK_EQUAL(instance->bvh().get(), hit.primitive);
+			BOOST_CHECK(hit.index >= 0);
+		}
+		else
+		{
+			++sphere_hit_count;
+			BOOST_CHECK(dynamic_cast<const UMSphere*>(hit.primitive));
+		}
+		UMShaderParameter deferred_parameter;
+		hit.shade(ray, deferred_parameter);
+		BOOST_CHECK_CLOSE(parameter.distance, hit.distance, TEST_EPSILON);
+		BOOST_CHECK_CLOSE(parameter.distance, deferred_parameter.distance, TEST_EPSILON);
+		BOOST_CHECK_SMALL((parameter.normal - deferred_parameter.normal).length(), TEST_EPSILON);
+		BOOST_CHECK_SMALL((parameter.intersect_point - deferred_parameter.intersect_point).length(), TEST_EPSILON);
+	}
+	BOOST_CHECK(instance_hit_count > 0);
+	BOOST_CHECK(sphere_hit_count > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
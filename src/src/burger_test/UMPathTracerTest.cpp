@@ -0,0 +1,204 @@
+/**
+ * @file UMPathTracerTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMPathTracer.h"
+#include "UMRenderParameter.h"
+#include "UMTestScene.h"
+
+BOOST_AUTO_TEST_SUITE(UMPathTracerTest)
+
+using namespace burger;
+using namespace burger::test;
+
+namespace
+{
+	/**
+	 * render the scene with a sample count
+	 * @param [in] is_progressive use progress_render or render
+	 * @param [in] adaptive_error target error of adaptive sampling. 0 for uniform sampling
+	 * @param [in] max_sample_scale noisy pixels take up to this times samples of uniform sampling
+	 * @param [out] image rendered image
+	 * @param [out] convergence_image convergence map
+	 * @retval pass count of progress_render
+	 */
+	int render_samples(
+		const UMScene& scene,
+		int sample_count,
+		bool is_progressive,
+		double adaptive_error,
+		int max_sample_scale,
+		UMImage& image,
+		UMImage& convergence_image)
+	{
+		const int width = scene.width();
+		const int height = scene.height();
+		UMPathTracer path_tracer;
+		path_tracer.set_width(width);
+		path_tracer.set_height(height);
+		path_tracer.init();
+		UMRenderParameter parameter;
+		parameter.set_sample_count(sample_count);
+		parameter.set_adaptive_error(adaptive_error);
+		parameter.set_adaptive_max_sample_scale(max_sample_scale);
+		parameter.mutable_output_image().init(width, height);
+		int pass_count = 0;
+		if (is_progressive)
+		{
+			while (path_tracer.progress_render(scene, parameter))
+			{
+				++pass_count;
+			}
+		}
+		else
+		{
+			BOOST_REQUIRE(path_tracer.render(scene, parameter));
+		}
+		image.init(width, height);
+		image.mutable_list() = parameter.output_image().list();
+		if (!is_progressive)
+		{
+			// render accumulates samples
+			for (size_t i = 0; i < image.list().size(); ++i)
+			{
+				UMVec4d& color = image.mutable_list()[i];
+				color = color / color.w;
+			}
+		}
+		convergence_image.mutable_list() = parameter.convergence_image().list();
+		return pass_count;
+	}
+
+	/**
+	 * check samples are moved from converged pixels to noisy pixels within the budget
+	 */
+	void check_convergence(
+		const UMImage& convergence_image,
+		int pixel_count,
+		int sample_count,
+		double adaptive_error,
+		int max_sample_scale)
+	{
+		BOOST_REQUIRE_EQUAL(static_cast<size_t>(pixel_count), convergence_image.list().size());
+		const double max_pixel_sample_count = static_cast<double>(sample_count) * max_sample_scale;
+		double traced_count = 0.0;
+		int converged_count = 0;
+		int refined_count = 0;
+		for (int i = 0; i < pixel_count; ++i)
+		{
+			const UMVec4d& pixel = convergence_image.list()[i];
+			BOOST_CHECK(pixel.y > 0.0);
+			BOOST_CHECK(pixel.y <= 1.0);
+			traced_count += pixel.y * max_pixel_sample_count;
+			if (pixel.z > 0.0)
+			{
+				++converged_count;
+				BOOST_CHECK(pixel.x < adaptive_error);
+			}
+			else if (pixel.y > 1.0 / max_sample_scale)
+			{
+				// more samples than uniform sampling
+				++refined_count;
+			}
+		}
+		BOOST_CHECK(converged_count > 0);
+		BOOST_CHECK(refined_count > 0);
+		BOOST_CHECK(traced_count <= static_cast<double>(pixel_count) * sample_count + 0.5);
+
+		std::stringstream message;
+		message << "adaptive sampling converged: " << converged_count
+			<< " refined: " << refined_count
+			<< " samples: " << traced_count << " / " << static_cast<double>(pixel_count) * sample_count;
+		BOOST_TEST_MESSAGE(message.str());
+	}
+
+} // anonymouse namespace
+
+BOOST_AUTO_TEST_CASE(FloatLeafImageTest)
+{
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+
+	// shadow and bounce rays start from offset origins.
+	// float leaves differ from double leaves no more than noise of two double renders.
+	UMPathTracer path_tracer;
+	UMImage image;
+	render_scene(mesh, eDoubleLeaf, path_tracer, 4, image);
+	UMPathTracer other_path_tracer;
+	UMImage other_image;
+	render_scene(mesh, eDoubleLeaf, other_path_tracer, 4, other_image);
+	UMPathTracer float_path_tracer;
+	UMImage float_image;
+	render_scene(mesh, eFloatLeaf, float_path_tracer, 4, float_image);
+	const double noise = mean_difference(image, other_image);
+	const double difference = mean_difference(image, float_image);
+	BOOST_CHECK(difference < noise * 1.1);
+	BOOST_CHECK_CLOSE(mean_color(image), mean_color(float_image), 3.0);
+
+	std::stringstream message;
+	message << "float leaf image difference of path tracer: " << difference << " (noise " << noise << ")";
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_CASE(MeanColorTest)
+{
+	// reference mean color of 64 passes of the recursive path tracer
+	// which was replaced by the iterative one. both estimate the same image.
+	const double reference_mean = 0.2003;
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+	UMPathTracer path_tracer;
+	UMImage image;
+	render_scene(mesh, eDoubleLeaf, path_tracer, 64, image);
+	const double mean = mean_color(image);
+	BOOST_CHECK_CLOSE(mean, reference_mean, 1.0);
+
+	std::stringstream message;
+	message << "mean color of path tracer: " << mean << " (reference " << reference_mean << ")";
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_CASE(AdaptiveSamplingTest)
+{
+	UMMeshPtr mesh = create_random_mesh(5000, 100.0);
+	const int width = 80;
+	const int height = 60;
+	const int sample_count = 64;
+	const double adaptive_error = 0.05;
+	const int max_sample_scale = UMRenderParameter().adaptive_max_sample_scale();
+	UMScene scene(width, height);
+	fill_scene(scene, mesh);
+	add_area_light(scene);
+	BOOST_REQUIRE(scene.update_bvh());
+
+	for (int k = 0; k < 2; ++k)
+	{
+		const bool is_progressive = (k == 0);
+		UMImage image;
+		UMImage adaptive_image;
+		UMImage convergence_image;
+		const int pass_count = render_samples(
+			scene, sample_count, is_progressive, 0.0, max_sample_scale, image, convergence_image);
+		const int adaptive_pass_count = render_samples(
+			scene, sample_count, is_progressive, adaptive_error, max_sample_scale, adaptive_image, convergence_image);
+		if (is_progressive)
+		{
+			BOOST_CHECK(pass_count > 0);
+			BOOST_CHECK(adaptive_pass_count > 0);
+		}
+		check_convergence(convergence_image, width * height, sample_count, adaptive_error, max_sample_scale);
+
+		// same image within noise
+		BOOST_CHECK(mean_color(image) > 0.0);
+		BOOST_CHECK_CLOSE(mean_color(image), mean_color(adaptive_image), 5.0);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
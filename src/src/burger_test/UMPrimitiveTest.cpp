@@ -14,6 +14,7 @@
 #include "UMMesh.h"
 #include "UMTriangle.h"
 #include "UMRay.h"
+#include "UMShaderParameter.h"
 
 #define TEST_EPSILON 0.0001
 
@@ -97,4 +98,118 @@ BOOST_AUTO_TEST_CASE(TriangleIntersectTest)
 	BOOST_CHECK_EQUAL(false, triangle.intersects(ray7));
 }
 
+BOOST_AUTO_TEST_CASE(MeshFloatStorageTest)
+{
+	UMMeshPtr mesh( std::make_shared<UMMesh>() );
+	mesh->mutable_vertex_list().push_back(UMVec3d(-100, -100, 0));
+	mesh->mutable_vertex_list().push_back(UMVec3d( 100, -100, 0));
+	mesh->mutable_vertex_list().push_back(UMVec3d(   0,  100, 0));
+	mesh->mutable_vertex_list().push_back(UMVec3d(   0,    0, 100));
+	mesh->mutable_face_list().push_back(UMVec3i(0, 1, 2));
+	mesh->mutable_face_list().push_back(UMVec3i(0, 1, 3));
+	for (int i = 0; i < 6; ++i)
+	{
+		mesh->mutable_uv_list().push_back(UMVec2d(i / 6.0, 1.0 - i / 6.0));
+	}
+	mesh->create_normals(true);
+	mesh->update_box();
+	const UMMesh::Vec3dList vertex_list = mesh->vertex_list();
+	const UMMesh::Vec3dList normal_list = mesh->normal_list();
+	const UMMesh::Vec2dList uv_list = mesh->uv_list();
+	UMTriangle triangle(mesh, UMVec3i(0, 1, 2), 0);
+	UMRay ray(UMVec3d(-20, -30, 200), UMVec3d(0, 0, -1));
+	UMShaderParameter parameter;
+	BOOST_REQUIRE(triangle.intersects(ray, parameter));
+
+	// double lists are moved to float storage
+	mesh->set_float_storage(true);
+	BOOST_CHECK(mesh->is_float_storage());
+	BOOST_CHECK(mesh->vertex_list().empty());
+	BOOST_CHECK(mesh->normal_list().empty());
+	BOOST_CHECK(mesh->uv_list().empty());
+	BOOST_REQUIRE_EQUAL(4, mesh->vertex_count());
+	BOOST_REQUIRE_EQUAL(4, mesh->normal_count());
+	BOOST_REQUIRE_EQUAL(6, mesh->uv_count());
+	for (int i = 0; i < 4; ++i)
+	{
+		BOOST_CHECK_SMALL((vertex_list[i] - mesh->vertex(i)).length(), TEST_EPSILON);
+		BOOST_CHECK_SMALL((normal_list[i] - mesh->normal(i)).length(), TEST_EPSILON);
+		BOOST_CHECK_EQUAL(mesh->vertex(i).x, mesh->float_storage().position[0][i]);
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		BOOST_CHECK_SMALL((uv_list[i] - mesh->uv(i)).length(), TEST_EPSILON);
+	}
+
+	// triangles and normals read the float storage
+	UMShaderParameter float_parameter;
+	BOOST_REQUIRE(triangle.intersects(ray, float_parameter));
+	BOOST_CHECK_CLOSE(parameter.distance, float_parameter.distance, TEST_EPSILON);
+	BOOST_CHECK_SMALL((parameter.normal - float_parameter.normal).length(), TEST_EPSILON);
+	mesh->create_normals(true);
+	for (int i = 0; i < 4; ++i)
+	{
+		BOOST_CHECK_SMALL((normal_list[i] - mesh->normal(i)).length(), TEST_EPSILON);
+	}
+	mesh->set_vertex(3, UMVec3d(0, 0, 50));
+	mesh->update_box();
+	BOOST_CHECK_CLOSE(50.0, mesh->box().maximum().z, TEST_EPSILON);
+
+	// and back to double lists
+	mesh->set_float_storage(false);
+	BOOST_CHECK(!mesh->is_float_storage());
+	BOOST_REQUIRE_EQUAL(4u, mesh->vertex_list().size());
+	BOOST_CHECK_EQUAL(6u, mesh->uv_list().size());
+	BOOST_CHECK_CLOSE(50.0, mesh->vertex_list()[3].z, TEST_EPSILON);
+	BOOST_CHECK(mesh->float_storage().position[0].empty());
+}
+
+BOOST_AUTO_TEST_CASE(MeshMaterialIndexTest)
+{
+	UMMeshPtr mesh( std::make_shared<UMMesh>() );
+	const int polygon_counts[] = { 3, 0, 5, 2 };
+	int face_count = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		UMMaterialPtr material = UMMaterial::default_material();
+		material->set_polygon_count(polygon_counts[i]);
+		mesh->mutable_material_list().push_back(material);
+		face_count += polygon_counts[i];
+	}
+	// a face without material
+	++face_count;
+	for (int i = 0; i < face_count; ++i)
+	{
+		mesh->mutable_face_list().push_back(UMVec3i(0, 1, 2));
+	}
+
+	std::vector<UMMaterialPtr> scanned;
+	for (int i = 0; i < face_count; ++i)
+	{
+		scanned.push_back(mesh->material_from_face_index(i));
+	}
+	BOOST_CHECK(!scanned.back());
+
+	BOOST_REQUIRE(mesh->create_material_index_list());
+	BOOST_CHECK_EQUAL(static_cast<size_t>(face_count), mesh->material_index_list().size());
+	BOOST_CHECK_EQUAL(2, mesh->material_index_list()[3]);
+	BOOST_CHECK_EQUAL(static_cast<int>(UMMesh::eNoMaterial), mesh->material_index_list().back());
+	for (int i = 0; i < face_count; ++i)
+	{
+		BOOST_CHECK(scanned[i] == mesh->material_from_face_index(i));
+	}
+
+	// shading refers materials by index without copying pointers
+	BOOST_CHECK_EQUAL(2, mesh->material_index_from_face_index(3));
+	BOOST_CHECK_EQUAL(-1, mesh->material_index_from_face_index(face_count - 1));
+	mesh->mutable_vertex_list().push_back(UMVec3d(0, 0, 0));
+	mesh->mutable_vertex_list().push_back(UMVec3d(1, 0, 0));
+	mesh->mutable_vertex_list().push_back(UMVec3d(0, 1, 0));
+	mesh->create_normals(true);
+	UMShaderParameter parameter;
+	parameter.uvw = UMVec3d(1.0 / 3.0);
+	UMTriangle::interpolate(*mesh, mesh->face_list()[3], 3, parameter);
+	BOOST_CHECK_EQUAL(mesh->material_list()[2].get(), parameter.material);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
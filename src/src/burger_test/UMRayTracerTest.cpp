@@ -0,0 +1,84 @@
+/**
+ * @file UMRayTracerTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMRayTracer.h"
+#include "UMRenderParameter.h"
+#include "UMTestScene.h"
+
+BOOST_AUTO_TEST_SUITE(UMRayTracerTest)
+
+using namespace burger;
+using namespace burger::test;
+
+BOOST_AUTO_TEST_CASE(FloatLeafImageTest)
+{
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+
+	// camera rays. subpixel samples are same for new renderers
+	UMRayTracer ray_tracer;
+	UMImage image;
+	render_scene(mesh, eDoubleLeaf, ray_tracer, 1000, image);
+	UMRayTracer float_ray_tracer;
+	UMImage float_image;
+	render_scene(mesh, eFloatLeaf, float_ray_tracer, 1000, float_image);
+	const double difference = mean_difference(image, float_image);
+	BOOST_CHECK(mean_color(image) > 0.0);
+	BOOST_CHECK(difference < 1.0 / 255.0);
+
+	std::stringstream message;
+	message << "float leaf image difference of ray tracer: " << difference;
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_CASE(ParallelRayTracerTest)
+{
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+	const int width = 160;
+	const int height = 120;
+	UMScene scene(width, height);
+	fill_scene(scene, mesh);
+	add_area_light(scene);
+	BOOST_REQUIRE(scene.update_bvh());
+
+	// a single thread
+	UMRayTracer serial_ray_tracer;
+	serial_ray_tracer.set_width(width);
+	serial_ray_tracer.set_height(height);
+	serial_ray_tracer.init();
+	UMRenderParameter serial_parameter;
+	serial_parameter.set_thread_count(1);
+	serial_parameter.set_tile_size(8);
+	serial_parameter.mutable_output_image().init(width, height);
+	BOOST_REQUIRE(serial_ray_tracer.render(scene, serial_parameter));
+
+	// time sliced on all threads. images do not depend on threads.
+	UMRayTracer ray_tracer;
+	ray_tracer.set_width(width);
+	ray_tracer.set_height(height);
+	ray_tracer.init();
+	ray_tracer.set_time_slice(0.0);
+	UMRenderParameter parameter;
+	parameter.set_tile_size(8);
+	parameter.mutable_output_image().init(width, height);
+	int pass_count = 0;
+	while (ray_tracer.progress_render(scene, parameter))
+	{
+		++pass_count;
+	}
+	BOOST_CHECK(pass_count > 0);
+	BOOST_CHECK(pass_count <= (width / 8) * (height / 8));
+	BOOST_CHECK(mean_color(serial_parameter.output_image()) > 0.0);
+	BOOST_CHECK_EQUAL(0.0, mean_difference(serial_parameter.output_image(), parameter.output_image()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,150 @@
+/**
+ * @file UMTestScene.h
+ * meshes and scenes shared by tests
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#pragma once
+
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <cmath>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMMesh.h"
+#include "UMMaterial.h"
+#include "UMTriangle.h"
+#include "UMSphere.h"
+#include "UMAreaLight.h"
+#include "UMRenderer.h"
+#include "UMRenderParameter.h"
+
+namespace burger
+{
+namespace test
+{
+
+/**
+ * random triangle soup
+ * @param [in] triangle_count triangle count
+ * @param [in] range triangles are centered in [-range, range] on each axis
+ */
+inline UMMeshPtr create_random_mesh(int triangle_count, double range)
+{
+	std::mt19937 mt(1);
+	std::uniform_real_distribution<double> position(-range, range);
+	std::uniform_real_distribution<double> offset(-3.0, 3.0);
+
+	UMMeshPtr mesh(std::make_shared<UMMesh>());
+	for (int i = 0; i < triangle_count; ++i)
+	{
+		UMVec3d center(position(mt), position(mt), position(mt));
+		for (int k = 0; k < 3; ++k)
+		{
+			mesh->mutable_vertex_list().push_back(center + UMVec3d(offset(mt), offset(mt), offset(mt)));
+		}
+		mesh->mutable_face_list().push_back(UMVec3i(3 * i, 3 * i + 1, 3 * i + 2));
+	}
+	UMMaterialPtr material = UMMaterial::default_material();
+	material->set_polygon_count(triangle_count);
+	mesh->mutable_material_list().push_back(material);
+	mesh->create_normals(true);
+	mesh->update_box();
+	return mesh;
+}
+
+/**
+ * fill scene by triangles of the mesh and some spheres
+ */
+inline void fill_scene(UMScene& scene, UMMeshPtr mesh)
+{
+	const int face_count = static_cast<int>(mesh->face_list().size());
+	for (int i = 0; i < face_count; ++i)
+	{
+		scene.mutable_primitive_list().push_back(
+			std::make_shared<UMTriangle>(mesh, mesh->face_list().at(i), i));
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		scene.mutable_primitive_list().push_back(
+			std::make_shared<UMSphere>(UMVec3d(i * 20.0 - 100.0, 0, 0), 3.0));
+	}
+}
+
+/**
+ * add an area light above the scene of fill_scene
+ */
+inline void add_area_light(UMScene& scene)
+{
+	scene.mutable_light_list().push_back(std::make_shared<UMAreaLight>(
+		UMVec3d(-50, 150, -50), UMVec3d(100, 0, 0), UMVec3d(0, 0, 100), UMVec3d(0, -1, 0), 1.0, 0.0, 0.0));
+}
+
+/**
+ * render a scene of the mesh and spheres lit by an area light
+ * @param [in] mesh mesh
+ * @param [in] precision precision of bvh leaves
+ * @param [in] renderer renderer
+ * @param [in] max_pass_count max progressive render count
+ * @param [out] image rendered image
+ */
+inline void render_scene(UMMeshPtr mesh, UMBvhLeafPrecision precision, UMRenderer& renderer, int max_pass_count, UMImage& image)
+{
+	const int width = 160;
+	const int height = 120;
+	UMScene scene(width, height);
+	fill_scene(scene, mesh);
+	add_area_light(scene);
+	scene.bvh()->set_leaf_precision(precision);
+	BOOST_REQUIRE(scene.update_bvh());
+	renderer.set_width(width);
+	renderer.set_height(height);
+	renderer.init();
+	UMRenderParameter parameter;
+	parameter.mutable_output_image().init(width, height);
+	for (int i = 0; i < max_pass_count; ++i)
+	{
+		if (!renderer.progress_render(scene, parameter)) break;
+	}
+	image.init(width, height);
+	image.mutable_list() = parameter.output_image().list();
+}
+
+/**
+ * mean absolute difference of color channels
+ */
+inline double mean_difference(const UMImage& image, const UMImage& other)
+{
+	BOOST_REQUIRE_EQUAL(image.list().size(), other.list().size());
+	const int pixel_count = static_cast<int>(image.list().size());
+	double difference = 0.0;
+	for (int i = 0; i < pixel_count; ++i)
+	{
+		const UMVec4d& a = image.list()[i];
+		const UMVec4d& b = other.list()[i];
+		difference += std::fabs(a.x - b.x) + std::fabs(a.y - b.y) + std::fabs(a.z - b.z);
+	}
+	return difference / (3.0 * pixel_count);
+}
+
+/**
+ * mean of color channels
+ */
+inline double mean_color(const UMImage& image)
+{
+	const int pixel_count = static_cast<int>(image.list().size());
+	double sum = 0.0;
+	for (int i = 0; i < pixel_count; ++i)
+	{
+		const UMVec4d& a = image.list()[i];
+		sum += a.x + a.y + a.z;
+	}
+	return sum / (3.0 * pixel_count);
+}
+
+} // test
+} // burger
@@ -0,0 +1,101 @@
+/**
+ * @file UMTileSchedulerTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include "UMTileScheduler.h"
+
+BOOST_AUTO_TEST_SUITE(UMTileSchedulerTest)
+
+using namespace burger;
+
+BOOST_AUTO_TEST_CASE(TileTest)
+{
+	const UMTileScheduler scheduler(4, 16);
+	const int width = 100;
+	const int height = 37;
+	BOOST_CHECK_EQUAL(7 * 3, scheduler.tile_count(width, height));
+
+	// tiles cover all pixels once
+	std::vector<int> covered(width * height, 0);
+	for (int i = 0; i < scheduler.tile_count(width, height); ++i)
+	{
+		const UMTile tile = scheduler.tile(width, height, i);
+		BOOST_CHECK_EQUAL(i, tile.index);
+		for (int y = tile.y; y < tile.y + tile.height; ++y)
+		{
+			for (int x = tile.x; x < tile.x + tile.width; ++x)
+			{
+				++covered[width * y + x];
+			}
+		}
+	}
+	for (size_t i = 0; i < covered.size(); ++i)
+	{
+		BOOST_CHECK_EQUAL(1, covered[i]);
+	}
+
+	const UMTile last = scheduler.tile(width, height, scheduler.tile_count(width, height) - 1);
+	BOOST_CHECK_EQUAL(96, last.x);
+	BOOST_CHECK_EQUAL(32, last.y);
+	BOOST_CHECK_EQUAL(4, last.width);
+	BOOST_CHECK_EQUAL(5, last.height);
+}
+
+BOOST_AUTO_TEST_CASE(RunTest)
+{
+	const int thread_counts[] = { 1, 3, 8, 0 };
+	for (int k = 0; k < 4; ++k)
+	{
+		const UMTileScheduler scheduler(thread_counts[k], 8);
+		BOOST_CHECK(scheduler.active_thread_count() >= 1);
+
+		// each task runs once even if tasks are uneven and stolen
+		const int task_count = 1000;
+		std::vector<int> run_count(task_count, 0);
+		std::vector<int> thread_list(task_count, -1);
+		std::vector<double> result(task_count, 0.0);
+		scheduler.run(task_count, [&](int task, int thread) {
+			double sum = 0.0;
+			const int work = (task % 97 == 0) ? 200000 : 100;
+			for (int i = 0; i < work; ++i)
+			{
+				sum += i * 0.5;
+			}
+			result[task] = sum;
+			++run_count[task];
+			thread_list[task] = thread;
+		});
+		for (int i = 0; i < task_count; ++i)
+		{
+			BOOST_CHECK_EQUAL(1, run_count[i]);
+			BOOST_CHECK(thread_list[i] >= 0);
+			BOOST_CHECK(thread_list[i] < scheduler.active_thread_count());
+			BOOST_CHECK(result[i] > 0.0);
+		}
+
+		// tiles
+		std::vector<int> pixels(64 * 48, 0);
+		scheduler.run_tiles(64, 48, [&](const UMTile& tile, int thread) {
+			for (int y = tile.y; y < tile.y + tile.height; ++y)
+			{
+				for (int x = tile.x; x < tile.x + tile.width; ++x)
+				{
+					++pixels[64 * y + x];
+				}
+			}
+		});
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			BOOST_CHECK_EQUAL(1, pixels[i]);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
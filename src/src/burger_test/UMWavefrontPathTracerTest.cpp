@@ -0,0 +1,50 @@
+/**
+ * @file UMWavefrontPathTracerTest.cpp
+ *
+ * @author tori31001 at gmail.com
+ *
+ * Copyright (C) 2013 Kazuma Hatta
+ * Licensed  under the MIT license.
+ *
+ */
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include "UMScene.h"
+#include "UMBvh.h"
+#include "UMPathTracer.h"
+#include "UMWavefrontPathTracer.h"
+#include "UMTestScene.h"
+
+BOOST_AUTO_TEST_SUITE(UMWavefrontPathTracerTest)
+
+using namespace burger;
+using namespace burger::test;
+
+BOOST_AUTO_TEST_CASE(MeanColorTest)
+{
+	UMMeshPtr mesh = create_random_mesh(20000, 100.0);
+
+	// both tracers estimate the same image, so means agree within noise
+	UMPathTracer path_tracer;
+	UMImage image;
+	render_scene(mesh, eDoubleLeaf, path_tracer, 64, image);
+	UMWavefrontPathTracer wavefront_path_tracer;
+	UMImage wavefront_image;
+	render_scene(mesh, eDoubleLeaf, wavefront_path_tracer, 64, wavefront_image);
+	BOOST_CHECK_CLOSE(mean_color(image), mean_color(wavefront_image), 1.0);
+
+	// a wavefront smaller than the pixel count is traced in several rounds
+	UMWavefrontPathTracer small_path_tracer;
+	small_path_tracer.set_wavefront_size(1000);
+	UMImage small_image;
+	render_scene(mesh, eDoubleLeaf, small_path_tracer, 64, small_image);
+	BOOST_CHECK_CLOSE(mean_color(image), mean_color(small_image), 1.0);
+
+	std::stringstream message;
+	message << "mean color of path tracer: " << mean_color(image)
+		<< " wavefront: " << mean_color(wavefront_image)
+		<< " small wavefront: " << mean_color(small_image);
+	BOOST_TEST_MESSAGE(message.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
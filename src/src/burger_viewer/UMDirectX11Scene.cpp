@@ -262,6 +262,14 @@ bool UMDirectX11Scene::load(
 	umio::UMObjectPtr obj;
 	obj = io.load(utf16path, umio::UMIOSetting());
 	if (!obj) return false;
+
+	// bottom level bvhs are cached next to the bos file
+	const std::wstring::size_type separator = utf16path.find_last_of(L"\\/");
+	if (separator != std::wstring::npos)
+	{
+		render_scene_->set_bvh_cache_directory(UMStringUtil::utf16_to_utf8(
+			UMStringUtil::wstring_to_utf16(utf16path.substr(0, separator))));
+	}
 	
 	// import to burger
 	UMMeshGroupPtr mesh_group(std::make_shared<UMMeshGroup>());
@@ -281,15 +289,8 @@ bool UMDirectX11Scene::load(
 			
 			//render_scene_->mutable_primitive_list().push_back(mesh);
 
-			const int face_count = static_cast<int>(mesh->face_list().size());
-			const int start_index = static_cast<int>(render_scene_->primitive_list().size());
-			render_scene_->mutable_primitive_list().resize(start_index + face_count);
-			for (int i = 0; i < face_count; ++i)
-			{
-				const UMVec3i& face = mesh->face_list().at(i);
-				UMTrianglePtr triangle(std::make_shared<UMTriangle>(mesh, face, i));
-				render_scene_->mutable_primitive_list().at(start_index + i) = triangle;
-			}
+			// bottom level bvh per mesh. the scene bvh is built over instances.
+			render_scene_->add_mesh_instance(mesh, UMMat44d());
 		}
 	}
 
@@ -386,6 +386,18 @@ bool UMDirectX11Viewer::init_devices(HWND hWnd, int width, int height)
 		UMTime buildtime("buildtime", true);
 #endif
 		scene_->mutable_render_scene()->update_bvh();
+#ifndef HONBAN
+		if (UMBvhPtr bvh = scene_->render_scene()->bvh())
+		{
+			std::string message = "bvh build time:" + UMStringUtil::number_to_string(bvh->build_time())
+				+ " sah cost:" + UMStringUtil::number_to_string(bvh->sah_cost())
+				+ " nodes:" + UMStringUtil::number_to_string(bvh->node_count())
+				+ " references:" + UMStringUtil::number_to_string(bvh->ordered_primitives().size())
+				+ " depth:" + UMStringUtil::number_to_string(bvh->depth())
+				+ "\n";
+			::OutputDebugStringA(message.c_str());
+		}
+#endif
 	}
 
 	// for rendering1h
@@ -79,13 +79,12 @@ namespace
 
 		UMVec3f* dx_vertex = (UMVec3f*)resource.pData;
 		const UMMesh::Vec3iList& face_list = src_mesh->face_list();
-		const UMMesh::Vec3dList& vertex_list = src_mesh->vertex_list();
 
 		for (size_t i = 0, i_size = face_list.size(); i < i_size; ++i) {
 			const UMVec3i& face = face_list.at(i);
 			for (int k = 0; k < 3; ++k)
 			{
-				const UMVec3d& vertex = vertex_list.at(face[k]);
+				const UMVec3d vertex = src_mesh->vertex(face[k]);
 				dx_vertex[i * 3 + k].x = static_cast<float>(vertex.x);
 				dx_vertex[i * 3 + k].y = static_cast<float>(vertex.y);
 				dx_vertex[i * 3 + k].z = static_cast<float>(vertex.z);
@@ -108,13 +107,12 @@ namespace
 
 		UMVec3f* dx_normal = (UMVec3f*)resource.pData;
 		const UMMesh::Vec3iList& face_list = src_mesh->face_list();
-		const UMMesh::Vec3dList& normal_list = src_mesh->normal_list();
 		
 		for (size_t i = 0, i_size = face_list.size(); i < i_size; ++i) {
 			const UMVec3i& face = face_list.at(i);
 			for (int k = 0; k < 3; ++k)
 			{
-				const UMVec3d& normal = normal_list.at(face[k]);
+				const UMVec3d normal = src_mesh->normal(face[k]);
 				dx_normal[i * 3 + k].x = static_cast<float>(normal.x);
 				dx_normal[i * 3 + k].y = static_cast<float>(normal.y);
 				dx_normal[i * 3 + k].z = static_cast<float>(normal.z);
@@ -136,10 +134,9 @@ namespace
 		device_context->Map(dst_mesh->uv_buffer_pointer(), 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
 
 		UMVec2f* dx_uv = (UMVec2f*) resource.pData;
-		const UMMesh::Vec2dList& uv_list = src_mesh->uv_list();
 		
-		for (size_t i = 0, i_size = uv_list.size(); i < i_size; ++i) {
-			const UMVec2d& uv = uv_list.at(i);
+		for (int i = 0, i_size = src_mesh->uv_count(); i < i_size; ++i) {
+			const UMVec2d uv = src_mesh->uv(i);
 			dx_uv[i].x = static_cast<float>(uv.x);
 			dx_uv[i].y = static_cast<float>(uv.y);
 		}
@@ -264,6 +261,9 @@ namespace
 			ummaterial->set_polygon_count(polygon_count);
 			mesh->mutable_material_list().at(0) = ummaterial;
 		}
+
+		// faces are sorted by material. shading looks up materials by this.
+		mesh->create_material_index_list();
 	}
 
 	//----------------------------------------------------------------------------
@@ -412,7 +412,7 @@ UMDirectX11MeshPtr UMModelIO::convert_mesh_to_dx11_mesh(
 	}
 
 	// create vertex buffer
-	if (src->vertex_list().size() > 0) {
+	if (src->vertex_count() > 0) {
 		// create full triangle verts for uv
 		size_t size = src->face_list().size() * 3;
 
@@ -433,7 +433,7 @@ UMDirectX11MeshPtr UMModelIO::convert_mesh_to_dx11_mesh(
 	}
 
 	// create normal buffer
-	if (src->normal_list().size() > 0) {
+	if (src->normal_count() > 0) {
 		// create full triangle normals for uv
 		size_t size = src->face_list().size() * 3;
 
@@ -454,8 +454,8 @@ UMDirectX11MeshPtr UMModelIO::convert_mesh_to_dx11_mesh(
 	}
 		
 	// create uv buffer
-	if (src->uv_list().size() > 0) {
-		size_t size = src->uv_list().size();
+	if (src->uv_count() > 0) {
+		size_t size = src->uv_count();
 
 		D3D11_BUFFER_DESC desc;
 		ZeroMemory(&desc, sizeof(desc));